@@ -21,6 +21,12 @@
 #include <cstdint>
 #include <map>
 
-std::map<int32_t, sorted_vector<int32_t>> readACX(const char* file);
+/**
+ * Equivalence classes of input characters: each character and those the
+ * input may have where it is expected
+ */
+typedef std::map<int32_t, sorted_vector<int32_t>> ACXMap;
+
+ACXMap readACX(const char* file);
 
 #endif
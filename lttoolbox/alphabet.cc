@@ -29,10 +29,56 @@
 
 using namespace icu;
 
+namespace {
+
+size_t
+hashPair(int32_t c1, int32_t c2)
+{
+  uint64_t k = (static_cast<uint64_t>(static_cast<uint32_t>(c1)) << 32) |
+               static_cast<uint32_t>(c2);
+  k *= 0x9E3779B97F4A7C15ULL;
+  return static_cast<size_t>(k ^ (k >> 29));
+}
+
+/**
+ * Uppercase of every character of the BMP, for getSymbol
+ */
+UChar const *
+upperTable()
+{
+  static std::vector<UChar> const table = [] {
+    std::vector<UChar> t(0x10000);
+    for(UChar32 c = 0; c < 0x10000; c++)
+    {
+      UChar32 u = u_toupper(c);
+      t[c] = static_cast<UChar>(u <= 0xFFFF ? u : c);
+    }
+    return t;
+  }();
+  return table.data();
+}
+
+/**
+ * Smallest power of two table with room for n keys at half load
+ */
+size_t
+tableSize(size_t n)
+{
+  size_t size = 16;
+  while(size < 2 * n)
+  {
+    size *= 2;
+  }
+  return size;
+}
+
+}
+
 Alphabet::Alphabet()
 {
-  spair[std::pair<int32_t, int32_t>(0,0)] = 0;
+  symbol_offsets.push_back(0);
   spairinv.push_back(std::pair<int32_t, int32_t>(0,0));
+  reindex();
 }
 
 Alphabet::~Alphabet()
@@ -66,67 +112,196 @@ Alphabet::copy(Alphabet const &a)
 {
   slexic = a.slexic;
   slexicinv = a.slexicinv;
+  symbol_text = a.symbol_text;
+  symbol_offsets = a.symbol_offsets;
   spair = a.spair;
   spairinv = a.spairinv;
 }
 
+int32_t
+Alphabet::findTag(UStringView s) const
+{
+  size_t mask = slexic.size() - 1;
+  for(size_t i = std::hash<UStringView>()(s) & mask; slexic[i] != 0;
+      i = (i + 1) & mask)
+  {
+    if(slexicinv[slexic[i] - 1] == s)
+    {
+      return slexic[i] - 1;
+    }
+  }
+  return -1;
+}
+
+int32_t
+Alphabet::findPair(int32_t c1, int32_t c2) const
+{
+  size_t mask = spair.size() - 1;
+  for(size_t i = hashPair(c1, c2) & mask; spair[i] != 0; i = (i + 1) & mask)
+  {
+    auto const &p = spairinv[spair[i] - 1];
+    if(p.first == c1 && p.second == c2)
+    {
+      return spair[i] - 1;
+    }
+  }
+  return -1;
+}
+
+void
+Alphabet::indexTag()
+{
+  if(2 * slexicinv.size() > slexic.size())
+  {
+    reindex();
+    return;
+  }
+  int32_t pos = slexicinv.size() - 1;
+  size_t mask = slexic.size() - 1;
+  size_t i = std::hash<UStringView>()(slexicinv[pos]) & mask;
+  while(slexic[i] != 0)
+  {
+    i = (i + 1) & mask;
+  }
+  slexic[i] = pos + 1;
+  symbol_text.append(slexicinv[pos]);
+  symbol_offsets.push_back(symbol_text.size());
+}
+
+void
+Alphabet::indexPair()
+{
+  if(2 * spairinv.size() > spair.size())
+  {
+    reindex();
+    return;
+  }
+  int32_t code = spairinv.size() - 1;
+  size_t mask = spair.size() - 1;
+  size_t i = hashPair(spairinv[code].first, spairinv[code].second) & mask;
+  while(spair[i] != 0)
+  {
+    i = (i + 1) & mask;
+  }
+  spair[i] = code + 1;
+}
+
+void
+Alphabet::reindex()
+{
+  // the output forms changed by setSymbol are kept
+  for(size_t i = symbol_offsets.size() - 1; i < slexicinv.size(); i++)
+  {
+    symbol_text.append(slexicinv[i]);
+    symbol_offsets.push_back(symbol_text.size());
+  }
+
+  slexic.assign(tableSize(slexicinv.size()), 0);
+  size_t mask = slexic.size() - 1;
+  for(size_t pos = 0; pos < slexicinv.size(); pos++)
+  {
+    size_t i = std::hash<UStringView>()(slexicinv[pos]) & mask;
+    while(slexic[i] != 0)
+    {
+      i = (i + 1) & mask;
+    }
+    slexic[i] = pos + 1;
+  }
+
+  spair.assign(tableSize(spairinv.size()), 0);
+  mask = spair.size() - 1;
+  for(size_t code = 0; code < spairinv.size(); code++)
+  {
+    size_t i = hashPair(spairinv[code].first, spairinv[code].second) & mask;
+    while(spair[i] != 0)
+    {
+      i = (i + 1) & mask;
+    }
+    spair[i] = code + 1;
+  }
+}
+
+UStringView
+Alphabet::tagText(int32_t symbol) const
+{
+  uint32_t start = symbol_offsets[-symbol-1];
+  return UStringView(symbol_text.data() + start,
+                     symbol_offsets[-symbol] - start);
+}
+
 void
 Alphabet::includeSymbol(UStringView s)
 {
-  if(slexic.find(s) == slexic.end())
+  if(findTag(s) == -1)
   {
-    int32_t slexic_size = slexic.size();
-    UString st{s};
-    slexic[st] = -(slexic_size+1);
-    slexicinv.push_back(st);
+    slexicinv.push_back(UString{s});
+    indexTag();
   }
 }
 
 int32_t
 Alphabet::operator()(int32_t const c1, int32_t const c2)
 {
-  auto tmp = std::make_pair(c1, c2);
-  if(spair.find(tmp) == spair.end())
+  int32_t code = findPair(c1, c2);
+  if(code == -1)
   {
-    int32_t spair_size = spair.size();
-    spair[tmp] = spair_size;
-    spairinv.push_back(tmp);
+    code = spairinv.size();
+    spairinv.push_back(std::make_pair(c1, c2));
+    indexPair();
   }
-
-  return spair[tmp];
+  return code;
 }
 
 int32_t
 Alphabet::operator()(UStringView s)
 {
   // While the documentation says this assumes existence, there are clearly code paths that call it with an unknown symbol and thus get 0 back AND create an entry for that 0. Changing it to just return 0 still passes all tests.
-  auto it = slexic.find(s);
-  if (it == slexic.end()) {
+  int32_t pos = findTag(s);
+  if (pos == -1) {
     return 0;
   }
-  return it->second;
+  return -(pos+1);
 }
 
 int32_t
 Alphabet::operator()(UStringView s) const
 {
-  auto it = slexic.find(s);
-  if (it == slexic.end()) {
+  int32_t pos = findTag(s);
+  if (pos == -1) {
     return -1;
   }
-  return it->second;
+  return -(pos+1);
 }
 
 bool
 Alphabet::isSymbolDefined(UStringView s) const
 {
-  return slexic.find(s) != slexic.end();
+  return findTag(s) != -1;
 }
 
 int32_t
 Alphabet::size() const
 {
-  return slexic.size();
+  return slexicinv.size();
+}
+
+size_t
+Alphabet::memoryUsage() const
+{
+  size_t bytes = slexicinv.capacity() * sizeof(UString) +
+                 slexic.capacity() * sizeof(int32_t) +
+                 symbol_text.capacity() * sizeof(UChar) +
+                 symbol_offsets.capacity() * sizeof(uint32_t) +
+                 spair.capacity() * sizeof(int32_t) +
+                 spairinv.capacity() * sizeof(spairinv[0]);
+  // short tags are stored in the string itself
+  size_t const local = UString().capacity();
+  for (auto& tag : slexicinv) {
+    if (tag.capacity() > local) {
+      bytes += (tag.capacity() + 1) * sizeof(UChar);
+    }
+  }
+  return bytes;
 }
 
 void
@@ -136,7 +311,8 @@ Alphabet::write(FILE *output) const
   Compression::multibyte_write(slexicinv.size(), output);  // taglist size
   for(size_t i = 0, limit = slexicinv.size(); i < limit; i++)
   {
-    Compression::string_write(slexicinv[i].substr(1, slexicinv[i].size()-2), output);
+    UStringView tag = tagText(-static_cast<int32_t>(i)-1);
+    Compression::string_write(tag.substr(1, tag.size()-2), output);
   }
 
   // Then we write the list of pairs
@@ -155,34 +331,33 @@ Alphabet::read(FILE *input)
 {
   Alphabet a_new;
   a_new.spairinv.clear();
-  a_new.spair.clear();
+
+  MultibyteReader in(input);
 
   // Reading of taglist
-  int32_t tam = Compression::multibyte_read(input);
+  int32_t tam = in.read();
   std::map<int32_t, std::string> tmp;
   while(tam > 0)
   {
     tam--;
     UString mytag = "<"_u;
-    mytag += Compression::string_read(input);
+    mytag += in.readString();
     mytag += ">"_u;
     a_new.slexicinv.push_back(mytag);
-    a_new.slexic[mytag]= -a_new.slexicinv.size(); // ToDo: This does not turn the result negative due to unsigned semantics
   }
 
   // Reading of pairlist
   size_t bias = a_new.slexicinv.size();
-  tam = Compression::multibyte_read(input);
+  tam = in.read();
   while(tam > 0)
   {
     tam--;
-    int32_t first = Compression::multibyte_read(input);
-    int32_t second = Compression::multibyte_read(input);
-    std::pair<int32_t, int32_t> tmp(first - bias, second - bias);
-    int32_t spair_size = a_new.spair.size();
-    a_new.spair[tmp] = spair_size;
-    a_new.spairinv.push_back(tmp);
+    int32_t first = in.read();
+    int32_t second = in.read();
+    a_new.spairinv.push_back(std::make_pair(first - bias, second - bias));
   }
+  in.finish();
+  a_new.reindex();
 
   *this = a_new;
 }
@@ -190,25 +365,23 @@ Alphabet::read(FILE *input)
 void
 Alphabet::serialise(std::ostream &serialised) const
 {
-  Serialiser<const std::vector<UString> >::serialise(slexicinv, serialised);
+  std::vector<UString> tags;
+  for(size_t i = 0; i < slexicinv.size(); i++)
+  {
+    tags.push_back(UString{tagText(-static_cast<int32_t>(i)-1)});
+  }
+  Serialiser<const std::vector<UString> >::serialise(tags, serialised);
   Serialiser<std::vector<std::pair<int32_t, int32_t> > >::serialise(spairinv, serialised);
 }
 
 void
 Alphabet::deserialise(std::istream &serialised)
 {
-  slexicinv.clear();
-  slexic.clear();
-  spairinv.clear();
-  spair.clear();
   slexicinv = Deserialiser<std::vector<UString> >::deserialise(serialised);
-  for (size_t i = 0; i < slexicinv.size(); i++) {
-    slexic[slexicinv[i]] = -i - 1; // ToDo: This does not turn the result negative due to unsigned semantics
-  }
   spairinv = Deserialiser<std::vector<std::pair<int32_t, int32_t> > >::deserialise(serialised);
-  for (size_t i = 0; i < slexicinv.size(); i++) {
-    spair[spairinv[i]] = i;
-  }
+  symbol_text.clear();
+  symbol_offsets.assign(1, 0);
+  reindex();
 }
 
 void
@@ -217,7 +390,7 @@ Alphabet::writeSymbol(int32_t const symbol, UFILE *output) const
   if(symbol < 0)
   {
     // write() has a name conflict
-    u_fprintf(output, "%S", slexicinv[-symbol-1].c_str());
+    ::write(tagText(symbol), output);
   }
   else
   {
@@ -231,7 +404,9 @@ Alphabet::getSymbol(UString &result, int32_t symbol, bool uppercase) const
   if (symbol == 0) {
     return;
   } else if (symbol < 0) {
-    result.append(slexicinv[-symbol-1]);
+    result.append(tagText(symbol));
+  } else if (symbol <= 0xFFFF) {
+    result += uppercase ? upperTable()[symbol] : static_cast<UChar>(symbol);
   } else if (uppercase) {
     result += u_toupper(static_cast<UChar32>(symbol));
   } else {
@@ -254,9 +429,9 @@ Alphabet::decode(int32_t code) const
 std::set<int32_t>
 Alphabet::symbolsWhereLeftIs(UChar32 l) const {
   std::set<int32_t> eps;
-  for(const auto& sp: spair) {  // [(l, r) : tag]
-    if(sp.first.first == l) {
-      eps.insert(sp.second);
+  for(size_t i = 0; i < spairinv.size(); i++) {
+    if(spairinv[i].first == l) {
+      eps.insert(i);
     }
   }
   return eps;
@@ -264,7 +439,21 @@ Alphabet::symbolsWhereLeftIs(UChar32 l) const {
 
 void Alphabet::setSymbol(int32_t symbol, UStringView newSymbolString) {
   //Should be a special character!
-  if (symbol < 0) slexicinv[-symbol-1] = newSymbolString;
+  // Only the output form changes, the symbol is still found by its old
+  // name
+  if (symbol < 0) {
+    std::vector<UString> forms;
+    for (size_t i = 0; i < slexicinv.size(); i++) {
+      forms.push_back(UString{tagText(-static_cast<int32_t>(i)-1)});
+    }
+    forms[-symbol-1] = newSymbolString;
+    symbol_text.clear();
+    symbol_offsets.assign(1, 0);
+    for (auto &form : forms) {
+      symbol_text.append(form);
+      symbol_offsets.push_back(symbol_text.size());
+    }
+  }
 }
 
 void
@@ -296,7 +485,13 @@ Alphabet::createLoopbackSymbols(std::set<int32_t> &symbols, const Alphabet &basi
       }
     }
   }
-  for(auto& it : basis.slexic)
+  // Tags in the order of their names
+  std::map<UStringView, int32_t> names;
+  for(size_t i = 0; i < basis.slexicinv.size(); i++)
+  {
+    names.insert({basis.slexicinv[i], -static_cast<int32_t>(i)-1});
+  }
+  for(auto& it : names)
   {
     // Only include tags that were actually seen on the correct side
     if(tags.find(it.second) != tags.end())
@@ -312,11 +507,18 @@ std::vector<int32_t>
 Alphabet::tokenize(UStringView str) const
 {
   std::vector<int32_t> ret;
+  tokenize(str, ret);
+  return ret;
+}
+
+void
+Alphabet::tokenize(UStringView str, std::vector<int32_t>& result) const
+{
+  result.clear();
   for (auto sym : symbol_iter(str)) {
-    if (sym.size() > 1) ret.push_back(operator()(sym));
-    else ret.push_back(static_cast<int32_t>(sym[0]));
+    if (sym.size() > 1) result.push_back(operator()(sym));
+    else result.push_back(static_cast<int32_t>(sym[0]));
   }
-  return ret;
 }
 
 bool
@@ -326,14 +528,14 @@ Alphabet::sameSymbol(int32_t tsym, const Alphabet& other, int32_t osym,
   // if it's a letter, then it's equal across alphabets
   if (tsym >= 0 && tsym == osym) return true;
   if (tsym < 0 && osym < 0 &&
-      this->slexicinv[-tsym-1] == other.slexicinv[-osym-1]) {
+      this->tagText(tsym) == other.tagText(osym)) {
     return true;
   }
   if (allow_anys &&
-      ((tsym < 0 && this->slexicinv[-tsym-1] == u"<ANY_CHAR>"_uv && osym > 0) ||
-       (tsym < 0 && this->slexicinv[-tsym-1] == u"<ANY_TAG>"_uv && osym < 0) ||
-       (osym < 0 && other.slexicinv[-osym-1] == u"<ANY_CHAR>"_uv && tsym > 0) ||
-       (osym < 0 && other.slexicinv[-osym-1] == u"<ANY_TAG>"_uv && tsym < 0))) {
+      ((tsym < 0 && this->tagText(tsym) == u"<ANY_CHAR>"_uv && osym > 0) ||
+       (tsym < 0 && this->tagText(tsym) == u"<ANY_TAG>"_uv && osym < 0) ||
+       (osym < 0 && other.tagText(osym) == u"<ANY_CHAR>"_uv && tsym > 0) ||
+       (osym < 0 && other.tagText(osym) == u"<ANY_TAG>"_uv && tsym < 0))) {
     return true;
   }
   return false;
@@ -35,24 +35,39 @@ class Alphabet
 {
 private:
   /**
-   * Symbol-identifier relationship. Only contains <tags>.
+   * Identifier-symbol relationship. Only contains <tags>, as they were
+   * included; the tag with code -(i+1) is slexicinv[i].
+   * @see slexic
+   */
+  std::vector<UString> slexicinv;
+
+  /**
+   * Symbol-identifier relationship: open addressing table of the
+   * positions in slexicinv plus one, 0 marking an empty slot.
    * @see slexicinv
    */
-  std::map<UString, int32_t, std::less<>> slexic;
+  std::vector<int32_t> slexic;
 
   /**
-   * Identifier-symbol relationship. Only contains <tags>.
-   * @see slexic
+   * Output form of the tags, one after the other; the tag at position i
+   * of slexicinv is the text from symbol_offsets[i] to
+   * symbol_offsets[i+1].  It only differs from slexicinv after
+   * setSymbol.
    */
-  std::vector<UString> slexicinv;
+  UString symbol_text;
 
+  /**
+   * Start of every tag in symbol_text, plus the end of the last one
+   */
+  std::vector<uint32_t> symbol_offsets;
 
   /**
-   * Map from symbol-pairs to symbols; tags get negative numbers,
+   * Map from symbol-pairs to symbols: open addressing table of the codes
+   * plus one, 0 marking an empty slot.  Tags get negative numbers,
    * other characters are UChar32's casted to ints.
    * @see spairinv
    */
-  std::map<std::pair<int32_t, int32_t>, int32_t> spair;
+  std::vector<int32_t> spair;
 
   /**
    * All symbol-pairs (both <tags> and letters).
@@ -60,6 +75,35 @@ private:
    */
   std::vector<std::pair<int32_t, int32_t> > spairinv;
 
+  /**
+   * Position in slexicinv of a tag, or -1 if not defined
+   */
+  int32_t findTag(UStringView s) const;
+
+  /**
+   * Code of a symbol-pair, or -1 if not defined
+   */
+  int32_t findPair(int32_t c1, int32_t c2) const;
+
+  /**
+   * Add the last tag of slexicinv to slexic and symbol_text
+   */
+  void indexTag();
+
+  /**
+   * Add the last symbol-pair of spairinv to spair
+   */
+  void indexPair();
+
+  /**
+   * Rebuild slexic, spair and symbol_text from slexicinv and spairinv
+   */
+  void reindex();
+
+  /**
+   * Output form of the tag with code symbol
+   */
+  UStringView tagText(int32_t symbol) const;
 
   void copy(Alphabet const &a);
   void destroy();
@@ -122,6 +166,11 @@ public:
    */
   int32_t size() const;
 
+  /**
+   * Bytes taken by the tags, the symbol-pairs and their indices
+   */
+  size_t memoryUsage() const;
+
   /**
    * Write method.
    * @param output output stream.
@@ -199,6 +248,12 @@ public:
 
   std::vector<int32_t> tokenize(UStringView str) const;
 
+  /**
+   * tokenize(), but write the symbols into result, discarding what it
+   * held
+   */
+  void tokenize(UStringView str, std::vector<int32_t>& result) const;
+
   bool sameSymbol(int32_t tsym, const Alphabet& other, int32_t osym,
                   bool allow_anys=false) const;
 };
@@ -22,12 +22,25 @@
 #include <lttoolbox/string_utils.h>
 #include <lttoolbox/file_utils.h>
 #include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iterator>
 #include <stack>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <unicode/uchar.h>
 #include <unicode/ustring.h>
 #include <utf8.h>
 #include <unicode/utf16.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace icu;
 
 AttCompiler::AttCompiler()
@@ -39,12 +52,227 @@ AttCompiler::~AttCompiler()
 void
 AttCompiler::clear()
 {
-  for (auto& it : graph)
+  nodes.clear();
+  phantom_nodes.clear();
+  alphabet = Alphabet();
+}
+
+namespace {
+
+// bytes of the file tokenized before they are compiled, per thread
+constexpr size_t chunk_size = 1 << 22;
+
+/**
+ * The bytes of a file, mapped into memory if it is a regular file and
+ * read into a buffer otherwise
+ */
+class FileBytes
+{
+private:
+  std::vector<char> buffer;
+  void* region = nullptr;
+  size_t length = 0;
+
+public:
+  const char* data = nullptr;
+  size_t size = 0;
+
+  ~FileBytes()
   {
-    delete it.second;
+#ifndef _WIN32
+    if (region != nullptr) {
+      munmap(region, length);
+    }
+#endif
   }
-  graph.clear();
-  alphabet = Alphabet();
+
+  bool open(std::string const &file_name)
+  {
+#ifndef _WIN32
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      if (st.st_size == 0) {
+        ::close(fd);
+        return true;
+      }
+      void* r = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (r != MAP_FAILED) {
+        region = r;
+        length = st.st_size;
+        madvise(region, length, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(region);
+        size = length;
+        ::close(fd);
+        return true;
+      }
+    }
+    ::close(fd);
+#endif
+    FILE* file = fopen(file_name.c_str(), "rb");
+    if (file == nullptr) {
+      return false;
+    }
+    char block[1 << 16];
+    size_t got;
+    while ((got = fread(block, 1, sizeof(block), file)) > 0) {
+      buffer.insert(buffer.end(), block, block + got);
+    }
+    fclose(file);
+    data = buffer.data();
+    size = buffer.size();
+    return true;
+  }
+};
+
+/**
+ * A non-empty line of an AT&T file split into its columns, with the
+ * numbers in it parsed
+ */
+struct AttLine
+{
+  // line number within its chunk, from 0
+  size_t number;
+  size_t columns;
+  // the first column starts with '-', which separates transducers
+  bool separator;
+  // whether the first column, the second (a target state, or the weight
+  // of a final state) and the fifth (the weight of a transition) parse
+  bool from_ok, second_ok, weight_ok;
+  int from, to;
+  double weight;
+  std::string_view upper, lower;
+};
+
+/**
+ * Lines of the file from begin up to end, which end a line, tokenized
+ */
+struct AttChunk
+{
+  const char* begin;
+  const char* end;
+  // lines seen, empty ones included
+  size_t line_count = 0;
+  std::vector<AttLine> lines;
+};
+
+// Whether s is digits, with a minus sign and a fraction as allowed
+bool
+isPlainNumber(std::string_view s, bool fraction)
+{
+  size_t i = (!s.empty() && s[0] == '-' ? 1 : 0);
+  size_t digits = i;
+  while (i < s.size() && s[i] >= '0' && s[i] <= '9') {
+    i++;
+  }
+  if (i == digits) {
+    return false;
+  }
+  if (fraction && i < s.size() && s[i] == '.') {
+    size_t point = ++i;
+    while (i < s.size() && s[i] >= '0' && s[i] <= '9') {
+      i++;
+    }
+    if (i == point) {
+      return false;
+    }
+  }
+  return i == s.size();
+}
+
+UString
+fromBytes(std::string_view bytes)
+{
+  UString s;
+  utf8::utf8to16(bytes.begin(), bytes.end(), std::back_inserter(s));
+  return s;
+}
+
+// StringUtils::stoi() on bytes, skipping the conversion for plain numbers
+bool
+parseInt(std::string_view s, int& value)
+{
+  if (s.size() < 10 && isPlainNumber(s, false)) {
+    std::from_chars(s.data(), s.data() + s.size(), value);
+    return true;
+  }
+  try {
+    value = StringUtils::stoi(fromBytes(s));
+  } catch (const std::invalid_argument& e) {
+    return false;
+  }
+  return true;
+}
+
+// StringUtils::stod() on bytes, skipping the conversion for plain numbers
+bool
+parseDouble(std::string_view s, double& value)
+{
+  if (s.size() < 16 && isPlainNumber(s, true)) {
+    std::from_chars(s.data(), s.data() + s.size(), value);
+    return true;
+  }
+  try {
+    value = StringUtils::stod(fromBytes(s));
+  } catch (const std::invalid_argument& e) {
+    return false;
+  }
+  return true;
+}
+
+void
+tokenize(AttChunk& chunk)
+{
+  const char* p = chunk.begin;
+  while (p < chunk.end) {
+    const char* eol = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+    if (eol == nullptr) {
+      eol = chunk.end;
+    }
+    size_t number = chunk.line_count++;
+    if (eol != p) {
+      std::string_view column[5];
+      size_t columns = 0;
+      const char* c = p;
+      while (true) {
+        const char* tab = static_cast<const char*>(memchr(c, '\t', eol - c));
+        const char* stop = (tab == nullptr ? eol : tab);
+        if (columns < 5) {
+          column[columns] = std::string_view(c, stop - c);
+        }
+        columns++;
+        if (tab == nullptr) {
+          break;
+        }
+        c = tab + 1;
+      }
+      AttLine line;
+      line.number = number;
+      line.columns = columns;
+      line.separator = (column[0].size() > 0 && column[0][0] == '-');
+      line.from_ok = parseInt(column[0], line.from);
+      line.to = 0;
+      line.weight = 0;
+      line.second_ok = line.weight_ok = true;
+      if (columns == 2) {
+        line.second_ok = parseDouble(column[1], line.weight);
+      } else if (columns > 2) {
+        line.second_ok = parseInt(column[1], line.to);
+        line.upper = column[2];
+        line.lower = (columns > 3 ? column[3] : std::string_view());
+        if (columns > 4) {
+          line.weight_ok = parseDouble(column[4], line.weight);
+        }
+      }
+      chunk.lines.push_back(line);
+    }
+    p = eol + 1;
+  }
+}
+
 }
 
 /**
@@ -119,22 +347,17 @@ AttCompiler::symbol_code(UStringView symbol, std::vector<int32_t>& split)
 
 void
 AttCompiler::add_transition(int from, int to,
-                            UStringView upper, UStringView lower,
+                            std::vector<int32_t> const &lsplit,
+                            std::vector<int32_t> const &rsplit,
                             double weight)
 {
   AttNode* src = get_node(from);
-  std::vector<int32_t> lsplit, rsplit;
-  symbol_code(upper, lsplit);
-  symbol_code(lower, rsplit);
   for (size_t i = 0; i < lsplit.size() || i < rsplit.size(); i++) {
     int32_t l = (lsplit.size() > i ? lsplit[i] : 0);
     int32_t r = (rsplit.size() > i ? rsplit[i] : 0);
     bool last = (i+1 >= lsplit.size() && i+1 >= rsplit.size());
     int dest = (last ? to : -(++phantom_count));
-    UString ls, rs;
-    alphabet.getSymbol(ls, l);
-    alphabet.getSymbol(rs, r);
-    src->transductions.push_back(Transduction(dest, ls, rs, alphabet(l, r),
+    src->transductions.push_back(Transduction(dest, alphabet(l, r),
                                               (last ? weight : default_weight)));
     classify_single_transition(src->transductions.back());
     src = get_node(dest);
@@ -146,140 +369,139 @@ AttCompiler::parse(std::string const &file_name, bool read_rl)
 {
   clear();
 
-  UFILE* infile = u_fopen(file_name.c_str(), "r", NULL, NULL);
-  if (infile == NULL) {
+  FileBytes file;
+  if (!file.open(file_name)) {
     std::cerr << "Error: unable to open '" << file_name << "' for reading." << std::endl;
+    exit(EXIT_FAILURE);
   }
-  std::vector<UString> tokens;
   bool first_line_in_fst = true;       // First line -- see below
   bool multiple_transducers = false;
   int state_id_offset = 1;
   int largest_seen_state_id = 0;
   int line_number = 0;
 
-  while (!u_feof(infile))
-  {
-    line_number++;
-    tokens.clear();
-    tokens.push_back(""_u);
-    do {
-      UChar c = u_fgetc(infile);
-      if (c == '\n' || c == U_EOF) {
-        break;
-      } else if (c == '\t') {
-        tokens.push_back(""_u);
-      } else {
-        tokens.back() += c;
-      }
-    } while (!u_feof(infile));
-
-    int from, to;
-    UString upper, lower;
-    double weight;
-
-    /* Empty line. */
-    if (tokens.size() == 1 && tokens[0].length() == 0)
-    {
-      continue;
-    }
-
-    if (first_line_in_fst && tokens.size() == 1)
-    {
-      std::cerr << "Error: invalid format in file '" << file_name << "' on line " << line_number << "." << std::endl;
-      exit(EXIT_FAILURE);
+  // The codes of the symbols seen so far, by their bytes in the file
+  std::unordered_map<std::string_view, std::vector<int32_t>> symbols;
+  auto codes = [&](std::string_view bytes) -> std::vector<int32_t> const & {
+    auto it = symbols.find(bytes);
+    if (it == symbols.end()) {
+      UString symbol = fromBytes(bytes);
+      convert_hfst(symbol);
+      std::vector<int32_t> split;
+      symbol_code(symbol, split);
+      it = symbols.insert({bytes, split}).first;
     }
-
-    if (tokens[0].find('-') == 0)
-    {
-      if (state_id_offset == 1) {
-        // this is the first split we've seen
-        std::cerr << "Warning: Multiple fsts in '" << file_name << "' will be disjuncted." << std::endl;
-        multiple_transducers = true;
+    return it->second;
+  };
+
+  // The file is cut into chunks at line ends, which are tokenized (on
+  // threads, with jobs) a few at a time and then compiled in order
+  size_t threads = (jobs ? std::max(1u, std::thread::hardware_concurrency()) : 1);
+  std::vector<AttChunk> chunks;
+  const char* rest = file.data;
+  const char* file_end = file.data + file.size;
+  while (rest < file_end)
+  {
+    chunks.clear();
+    while (rest < file_end && chunks.size() < threads) {
+      const char* end = rest + std::min(chunk_size, size_t(file_end - rest));
+      if (end < file_end) {
+        const char* eol = static_cast<const char*>(memchr(end, '\n', file_end - end));
+        end = (eol == nullptr ? file_end : eol + 1);
       }
-      // Update the offset for the new FST
-      state_id_offset = largest_seen_state_id + 1;
-      first_line_in_fst = true;
-      continue;
+      chunks.push_back(AttChunk());
+      chunks.back().begin = rest;
+      chunks.back().end = end;
+      rest = end;
     }
-
-    if (tokens.size() == 3 || tokens.size() > 5) {
-      std::cerr << "Error: wrong number of columns in file '" << file_name << "' on line " << line_number << "." << std::endl;
-      exit(EXIT_FAILURE);
-    }
-
-    try {
-      from = StringUtils::stoi(tokens[0]) + state_id_offset;
-    } catch (const std::invalid_argument& e) {
-      std::cerr << "Error: invalid source state in file '" << file_name << "' on line " << line_number << "." << std::endl;
-      exit(EXIT_FAILURE);
-    }
-    largest_seen_state_id = std::max(largest_seen_state_id, from);
-
-    get_node(from);
-    /* First line: the initial state is of both types. */
-    if (first_line_in_fst)
-    {
-      AttNode * starting_node = get_node(starting_state);
-
-      // Add an Epsilon transition from the new starting state
-      starting_node->transductions.push_back(
-                     Transduction(from, ""_u, ""_u, 0, default_weight));
-      first_line_in_fst = false;
-    }
-
-    /* Final state. */
-    if (tokens.size() <= 2)
-    {
-      if (tokens.size() > 1)
-      {
-	try {
-	  weight = StringUtils::stod(tokens[1]);
-	} catch (const std::invalid_argument& e) {
-	  std::cerr << "Error: invalid weight in file '" << file_name << "' on line " << line_number << "." << std::endl;
-	  exit(EXIT_FAILURE);
-	}
+    if (chunks.size() > 1) {
+      std::vector<std::thread> tokenizers;
+      for (auto& chunk : chunks) {
+        tokenizers.emplace_back(tokenize, std::ref(chunk));
       }
-      else
-      {
-        weight = default_weight;
+      for (auto& tokenizer : tokenizers) {
+        tokenizer.join();
       }
-      finals.insert(std::pair <int, double>(from, weight));
+    } else {
+      tokenize(chunks[0]);
     }
-    else
-    {
-      try {
-	to = StringUtils::stoi(tokens[1]) + state_id_offset;
-      } catch (const std::invalid_argument& e) {
-	std::cerr << "Error: invalid target state in file '" << file_name << "' on line " << line_number << "." << std::endl;
-	exit(EXIT_FAILURE);
-      }
-      largest_seen_state_id = std::max(largest_seen_state_id, to);
-      if(read_rl)
-      {
-        upper = tokens[3];
-        lower = tokens[2];
-      }
-      else
-      {
-        upper = tokens[2];
-        lower = tokens[3];
-      }
-      convert_hfst(upper);
-      convert_hfst(lower);
-      if(tokens.size() > 4)
-      {
-	try {
-	  weight = StringUtils::stod(tokens[4]);
-	} catch (const std::invalid_argument& e) {
-	  std::cerr << "Error: invalid weight in file '" << file_name << "' on line " << line_number << "." << std::endl;
-	  exit(EXIT_FAILURE);
-	}
-      }
-      else
-      {
-        weight = default_weight;
+
+    for (auto& chunk : chunks) {
+      for (auto& line : chunk.lines) {
+        int line_no = line_number + static_cast<int>(line.number) + 1;
+
+        if (first_line_in_fst && line.columns == 1)
+        {
+          std::cerr << "Error: invalid format in file '" << file_name << "' on line " << line_no << "." << std::endl;
+          exit(EXIT_FAILURE);
+        }
+
+        if (line.separator)
+        {
+          if (state_id_offset == 1) {
+            // this is the first split we've seen
+            std::cerr << "Warning: Multiple fsts in '" << file_name << "' will be disjuncted." << std::endl;
+            multiple_transducers = true;
+          }
+          // Update the offset for the new FST
+          state_id_offset = largest_seen_state_id + 1;
+          first_line_in_fst = true;
+          continue;
+        }
+
+        if (line.columns == 3 || line.columns > 5) {
+          std::cerr << "Error: wrong number of columns in file '" << file_name << "' on line " << line_no << "." << std::endl;
+          exit(EXIT_FAILURE);
+        }
+
+        if (!line.from_ok) {
+          std::cerr << "Error: invalid source state in file '" << file_name << "' on line " << line_no << "." << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        int from = line.from + state_id_offset;
+        largest_seen_state_id = std::max(largest_seen_state_id, from);
+
+        get_node(from);
+        /* First line: the initial state is of both types. */
+        if (first_line_in_fst)
+        {
+          AttNode * starting_node = get_node(starting_state);
+
+          // Add an Epsilon transition from the new starting state
+          starting_node->transductions.push_back(
+                         Transduction(from, 0, default_weight));
+          first_line_in_fst = false;
+        }
+
+        /* Final state. */
+        if (line.columns <= 2)
+        {
+          if (!line.second_ok) {
+            std::cerr << "Error: invalid weight in file '" << file_name << "' on line " << line_no << "." << std::endl;
+            exit(EXIT_FAILURE);
+          }
+          double weight = (line.columns > 1 ? line.weight : default_weight);
+          finals.insert(std::pair <int, double>(from, weight));
+        }
+        else
+        {
+          if (!line.second_ok) {
+            std::cerr << "Error: invalid target state in file '" << file_name << "' on line " << line_no << "." << std::endl;
+            exit(EXIT_FAILURE);
+          }
+          int to = line.to + state_id_offset;
+          largest_seen_state_id = std::max(largest_seen_state_id, to);
+          std::vector<int32_t> const &upper = codes(read_rl ? line.lower : line.upper);
+          std::vector<int32_t> const &lower = codes(read_rl ? line.upper : line.lower);
+          if (!line.weight_ok) {
+            std::cerr << "Error: invalid weight in file '" << file_name << "' on line " << line_no << "." << std::endl;
+            exit(EXIT_FAILURE);
+          }
+          double weight = (line.columns > 4 ? line.weight : default_weight);
+          add_transition(from, to, upper, lower, weight);
+        }
       }
-      add_transition(from, to, upper, lower, weight);
+      line_number += static_cast<int>(chunk.line_count);
     }
   }
 
@@ -289,15 +511,14 @@ AttCompiler::parse(std::string const &file_name, bool read_rl)
     // then we have an extra epsilon transduction at the beginning
     // so skip it
   }
+  // an empty file has no states yet, but the walks below start there
+  get_node(starting_state);
 
   /* Classify the nodes of the graph. */
   if (splitting) {
     classify_forwards();
-    std::set<int> path;
-    classify_backwards(starting_state, path);
+    classify_backwards();
   }
-
-  u_fclose(infile);
 }
 
 /** Extracts the sub-transducer made of states of type @p type. */
@@ -305,94 +526,84 @@ Transducer
 AttCompiler::extract_transducer(TransducerType type)
 {
   Transducer transducer;
-  /* Correlation between the graph's state ids and those in the transducer. */
-  std::map<int, int> corr;
-  std::set<int> visited;
-
-  corr[starting_state] = transducer.getInitial();
-  _extract_transducer(type, starting_state, transducer, corr, visited);
-
-  /* The final states. */
-  //bool noFinals = true;
-  for (auto& f : finals)
+  /*
+   * Correlation between the graph's state ids and those in the
+   * transducer, by slot(), -1 where there is none yet.
+   */
+  std::vector<int> corr(slots(), -1);
+  std::vector<bool> visited(slots(), false);
+
+  corr[slot(starting_state)] = transducer.getInitial();
+
+  /*
+   * The states are walked depth-first, taking each transition of the
+   * right type in turn and going on from its target before the next,
+   * which is the order the states of the transducer get numbered in.
+   */
+  struct Visit
   {
-    if (corr.find(f.first) != corr.end())
-    {
-      transducer.setFinal(corr[f.first], f.second);
-      //noFinals = false;
+    int state;
+    size_t next;
+    /* The source state had no number yet when it was reached. */
+    bool new_from;
+  };
+  std::vector<Visit> todo;
+  auto visit = [&](int state) {
+    if (!visited[slot(state)]) {
+      visited[slot(state)] = true;
+      todo.push_back({state, 0, corr[slot(state)] == -1});
     }
-  }
+  };
+  visit(starting_state);
 
-/*
-  if(noFinals)
+  while (!todo.empty())
   {
-    std::cerr << "No final states (" << type << ")" << std::endl;
-    std::cerr << "  were:" << std::endl;
-    std::cerr << "\t" ;
-    for (auto& f : finals)
+    Visit& current = todo.back();
+    AttNode* source = get_node(current.state);
+    if (current.next == source->transductions.size())
     {
-      std::cerr << f.first << " ";
+      todo.pop_back();
+      continue;
     }
-    std::cerr << std::endl;
-  }
-*/
-  return transducer;
-}
-
-/**
- * Recursively fills @p transducer (and @p corr) -- helper method called by
- * extract_transducer().
- */
-void
-AttCompiler::_extract_transducer(TransducerType type, int from,
-                                 Transducer& transducer, std::map<int, int>& corr,
-                                 std::set<int>& visited)
-{
-  if (visited.find(from) != visited.end())
-  {
-    return;
-  }
-  else
-  {
-    visited.insert(from);
-  }
-
-  AttNode* source = get_node(from);
-
-  /* Is the source state new? */
-  bool new_from = corr.find(from) == corr.end();
-  int from_t, to_t;
-
-  for (auto& it : source->transductions)
-  {
+    Transduction& it = source->transductions[current.next++];
     if ((it.type & type) != type)
     {
       continue;  // Not the right type
     }
+    int& from_t = corr[slot(current.state)];
+    int& to_t = corr[slot(it.to)];
     /* Is the target state new? */
-    bool new_to = corr.find(it.to) == corr.end();
+    bool new_to = (to_t == -1);
 
-    if (new_from)
+    if (current.new_from)
     {
-      corr[from] = transducer.size() + (new_to ? 1 : 0);
+      from_t = transducer.size() + (new_to ? 1 : 0);
     }
-    from_t = corr[from];
 
     /* Now with the target state: */
     if (!new_to)
     {
       /* We already know it, possibly by a different name: link them! */
-      to_t = corr[it.to];
       transducer.linkStates(from_t, to_t, it.tag, it.weight);
     }
     else
     {
       /* We haven't seen it yet: add a new state! */
       to_t = transducer.insertNewSingleTransduction(it.tag, from_t, it.weight);
-      corr[it.to] = to_t;
     }
-    _extract_transducer(type, it.to, transducer, corr, visited);
-  }  // for
+    visit(it.to);
+  }
+
+  /* The final states. */
+  for (auto& f : finals)
+  {
+    if (slot(f.first) < corr.size() && corr[slot(f.first)] != -1)
+    {
+      transducer.setFinal(corr[slot(f.first)], f.second);
+    }
+  }
+
+  return transducer;
 }
 
 void
@@ -416,63 +627,94 @@ void
 AttCompiler::classify_forwards()
 {
   std::stack<int> todo;
-  std::set<int> done;
+  std::vector<bool> done(slots(), false);
   todo.push(starting_state);
   while(!todo.empty()) {
     int next = todo.top();
     todo.pop();
-    if(done.find(next) != done.end()) continue;
+    if(done[slot(next)]) continue;
     AttNode* n1 = get_node(next);
     for(auto& t1 : n1->transductions) {
       AttNode* n2 = get_node(t1.to);
       for(auto& t2 : n2->transductions) {
         t2.type |= t1.type;
       }
-      if(done.find(t1.to) == done.end()) {
+      if(!done[slot(t1.to)]) {
         todo.push(t1.to);
       }
     }
-    done.insert(next);
+    done[slot(next)] = true;
   }
 }
 
 /**
- * Recursively determine edge types of initial epsilon transitions
- * Also check for epsilon loops or epsilon transitions to final states
- * @param state the state to examine
- * @param path the path we took to get here
+ * Determine edge types of initial epsilon transitions: the type of an
+ * undecided transition is that of all the transitions of its target.
+ * The states are walked depth-first from the starting state, and the
+ * type of each is recorded once it is known.
  */
-TransducerType
-AttCompiler::classify_backwards(int state, std::set<int>& path)
+void
+AttCompiler::classify_backwards()
 {
-  if(finals.find(state) != finals.end()) {
-    std::cerr << "ERROR: Transducer contains epsilon transition to a final state. Aborting." << std::endl;
-    exit(EXIT_FAILURE);
-  }
-  AttNode* node = get_node(state);
-  TransducerType type = UNDECIDED;
-  for(auto& t1 : node->transductions) {
+  enum Mark : char { UNSEEN, ON_PATH, KNOWN };
+  std::vector<char> mark(slots(), UNSEEN);
+  std::vector<TransducerType> known(slots(), UNDECIDED);
+
+  struct Visit
+  {
+    int state;
+    size_t next;
+    TransducerType type;
+  };
+  std::vector<Visit> path;
+  auto enter = [&](int state) {
+    if(finals.find(state) != finals.end()) {
+      std::cerr << "ERROR: Transducer contains epsilon transition to a final state. Aborting." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    mark[slot(state)] = ON_PATH;
+    path.push_back({state, 0, UNDECIDED});
+  };
+  enter(starting_state);
+
+  while(!path.empty()) {
+    Visit& current = path.back();
+    AttNode* node = get_node(current.state);
+    if(current.next == node->transductions.size()) {
+      // Note: if type is still UNDECIDED at this point, then we have a dead-end
+      // path, which is fine since it will be discarded by extract_transducer()
+      mark[slot(current.state)] = KNOWN;
+      known[slot(current.state)] = current.type;
+      TransducerType type = current.type;
+      path.pop_back();
+      if(!path.empty()) {
+        Visit& parent = path.back();
+        auto& t1 = get_node(parent.state)->transductions[parent.next - 1];
+        t1.type = type;
+        parent.type |= type;
+      }
+      continue;
+    }
+    auto& t1 = node->transductions[current.next++];
     if(t1.type != UNDECIDED) {
-      type |= t1.type;
-    } else if(path.find(t1.to) != path.end()) {
+      current.type |= t1.type;
+    } else if(mark[slot(t1.to)] == ON_PATH) {
       std::cerr << "ERROR: Transducer contains initial epsilon loop. Aborting." << std::endl;
       exit(EXIT_FAILURE);
+    } else if(mark[slot(t1.to)] == KNOWN) {
+      t1.type = known[slot(t1.to)];
+      current.type |= t1.type;
     } else {
-      path.insert(t1.to);
-      t1.type = classify_backwards(t1.to, path);
-      type |= t1.type;
-      path.erase(t1.to);
+      enter(t1.to);
     }
   }
-  // Note: if type is still UNDECIDED at this point, then we have a dead-end
-  // path, which is fine since it will be discarded by _extract_transducer()
-  return type;
 }
 
 
 /** Writes the transducer to @p file_name in lt binary format. */
 void
-AttCompiler::write(FILE *output)
+AttCompiler::write(FILE *output, bool mmap, StateVisits const *visits,
+                   bool directory)
 {
   std::map<UString, Transducer> temp;
   if (splitting) {
@@ -485,7 +727,7 @@ AttCompiler::write(FILE *output)
     temp["main@standard"_u] = extract_transducer(UNDECIDED);
   }
   writeTransducerSet(output, UString(letters.begin(), letters.end()),
-                     alphabet, temp);
+                     alphabet, temp, mmap, visits, directory);
 }
 
 void
@@ -499,3 +741,9 @@ AttCompiler::setSplitting(bool b)
 {
   splitting = b;
 }
+
+void
+AttCompiler::setJobs(bool b)
+{
+  jobs = b;
+}
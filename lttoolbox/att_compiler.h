@@ -27,6 +27,7 @@
 #include <lttoolbox/alphabet.h>
 #include <lttoolbox/transducer.h>
 #include <lttoolbox/compression.h>
+#include <lttoolbox/file_utils.h>
 
 #include <cstdlib>
 
@@ -64,14 +65,6 @@ public:
   /** Extracts the sub-transducer made of states of type @p type. */
   Transducer extract_transducer(TransducerType type);
 
-  /**
-   * Recursively fills @p transducer (and @p corr) -- helper method called by
-   * extract_transducer().
-   */
-  void _extract_transducer(TransducerType type, int from,
-                           Transducer& transducer, std::map<int, int>& corr,
-                           std::set<int>& visited) ;
-
   /**
    * Reads the AT&T format file @p file_name. The transducer and the alphabet
    * are both cleared before reading the new file.
@@ -79,12 +72,18 @@ public:
    */
   void parse(std::string const &file_name, bool read_rl);
 
-  /** Writes the transducer to @p file_name in lt binary format. */
+  /**
+   * Writes the transducer to @p fd in lt binary format, renumbering the
+   * states with @p visits if given (see Transducer::renumber()), and
+   * with a directory of the sections if @p directory
+   */
 
-  void write(FILE *fd) ;
+  void write(FILE *fd, bool mmap = false, StateVisits const *visits = nullptr,
+             bool directory = false) ;
 
   void setHfstSymbols(bool b);
   void setSplitting(bool b);
+  void setJobs(bool b);
 
 private:
 
@@ -114,51 +113,49 @@ private:
   struct Transduction
   {
     int            to;
-    UString        upper;
-    UString        lower;
     int            tag;
     double         weight;
     TransducerType type;
 
-    Transduction(int to, UString upper, UString lower, int tag,
-                 double weight, TransducerType type=UNDECIDED) :
-      to(to), upper(upper), lower(lower), tag(tag), weight(weight), type(type) {}
+    Transduction(int to, int tag, double weight, TransducerType type=UNDECIDED) :
+      to(to), tag(tag), weight(weight), type(type) {}
   };
 
   /** A node in the transducer graph. */
   struct AttNode
   {
-    int                  id;
     std::vector<Transduction> transductions;
-
-    AttNode(int id) : id(id) {}
   };
 
-  /** Stores the transducer graph. */
-  std::map<int, AttNode*> graph;
+  /**
+   * Stores the transducer graph: the states of the file by their id,
+   * the phantom states made to split multichar symbols (numbered -1,
+   * -2, ...) by minus their id minus one.
+   */
+  std::vector<AttNode> nodes;
+  std::vector<AttNode> phantom_nodes;
+
+  /** Read the file on all the cpu cores. */
+  bool jobs = false;
 
   /** Clears the data associated with the current transducer. */
   void clear();
 
   /**
    * Returns the Node that represents the state @id. If it does not exist,
-   * creates it and inserts it into @c graph.
+   * creates it (the pointers to other nodes then become invalid).
    */
 
   AttNode* get_node(int id)
   {
-    AttNode* state;
-
-    if (graph.find(id) != graph.end())
-    {
-      state = graph[id];
-    }
-    else
+    std::vector<AttNode>& store = (id >= 0 ? nodes : phantom_nodes);
+    size_t index = (id >= 0 ? static_cast<size_t>(id)
+                            : static_cast<size_t>(-(id + 1)));
+    if (index >= store.size())
     {
-      state = new AttNode(id);
-      graph[id] = state;
+      store.resize(index + 1);
     }
-    return state;
+    return &store[index];
   }
 
   /**
@@ -174,7 +171,28 @@ private:
   void classify_single_transition(Transduction& t);
 
   void classify_forwards();
-  TransducerType classify_backwards(int state, std::set<int>& path);
+
+  /**
+   * Determine edge types of initial epsilon transitions, walking each
+   * state once. Also check for epsilon loops or epsilon transitions to
+   * final states.
+   */
+  void classify_backwards();
+
+  /**
+   * Position of the state @p id in vectors with a place per node of
+   * the graph, once it is complete
+   */
+  size_t slot(int id) const
+  {
+    return (id >= 0 ? static_cast<size_t>(id)
+                    : nodes.size() + static_cast<size_t>(-(id + 1)));
+  }
+
+  size_t slots() const
+  {
+    return nodes.size() + phantom_nodes.size();
+  }
 
   /**
    * Converts symbols like @0@ to epsilon, @_SPACE_@ to space, etc.
@@ -188,7 +206,8 @@ private:
   // convert a string to a symbol code, splitting non-tag multichars
   void symbol_code(UStringView symbol, std::vector<int32_t>& split);
   void add_transition(int from, int to,
-                      UStringView upper, UStringView lower,
+                      std::vector<int32_t> const &lsplit,
+                      std::vector<int32_t> const &rsplit,
                       double weight);
 };
 
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LT_BLANK_QUEUE_H_
+#define _LT_BLANK_QUEUE_H_
+
+#include <lttoolbox/ustring.h>
+
+#include <utility>
+#include <vector>
+
+/**
+ * Queue of blanks kept as slices of one buffer.  The buffer and the
+ * slices keep their capacity when the queue empties, so queueing and
+ * printing the blanks of a stream doesn't allocate once it has warmed
+ * up.  A view returned by front() or back() is valid until the next
+ * push.
+ */
+class BlankQueue
+{
+private:
+  UString buffer;
+  UString scratch;
+
+  /**
+   * Start and length in buffer of each blank, those still queued from
+   * head on
+   */
+  std::vector<std::pair<size_t, size_t>> slices;
+  size_t head = 0;
+
+  /**
+   * Move the queued blanks to the start of the buffer, dropping the
+   * popped ones
+   */
+  void compact()
+  {
+    scratch.clear();
+    for(size_t i = head; i < slices.size(); i++)
+    {
+      size_t const start = scratch.size();
+      scratch.append(buffer, slices[i].first, slices[i].second);
+      slices[i - head] = {start, slices[i].second};
+    }
+    slices.resize(slices.size() - head);
+    head = 0;
+    buffer.swap(scratch);
+  }
+
+public:
+  bool empty() const
+  {
+    return head == slices.size();
+  }
+
+  size_t size() const
+  {
+    return slices.size() - head;
+  }
+
+  UStringView front() const
+  {
+    return UStringView(buffer).substr(slices[head].first, slices[head].second);
+  }
+
+  UStringView back() const
+  {
+    return UStringView(buffer).substr(slices.back().first, slices.back().second);
+  }
+
+  void push(UStringView blank)
+  {
+    slices.push_back({buffer.size(), blank.size()});
+    buffer.append(blank);
+  }
+
+  /**
+   * Queue a blank to be the next one popped
+   */
+  void push_front(UStringView blank)
+  {
+    std::pair<size_t, size_t> const slice = {buffer.size(), blank.size()};
+    buffer.append(blank);
+    if(head > 0)
+    {
+      slices[--head] = slice;
+    }
+    else
+    {
+      slices.insert(slices.begin(), slice);
+    }
+  }
+
+  /**
+   * Bytes taken by the buffers, which keep the size of the longest run
+   * of blanks queued
+   */
+  size_t memoryUsage() const
+  {
+    return (buffer.capacity() + scratch.capacity()) * sizeof(UChar) +
+           slices.capacity() * sizeof(slices[0]);
+  }
+
+  void pop()
+  {
+    head++;
+    if(head == slices.size())
+    {
+      buffer.clear();
+      slices.clear();
+      head = 0;
+    }
+    else if(head >= 64 && head * 2 >= slices.size())
+    {
+      compact();
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _LT_BLOCK_QUEUE_H_
+#define _LT_BLOCK_QUEUE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/**
+ * Bounded queue handing blocks of data from one thread to another.  The
+ * blocks are large, so that taking a lock per block costs nothing next
+ * to the work on it; the blocks given back with recycle() are reused so
+ * that their storage is not allocated again.
+ */
+template <class T>
+class BlockQueue
+{
+private:
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<T> blocks;
+  std::vector<T> spare;
+  size_t capacity;
+  bool closed = false;
+
+public:
+  /**
+   * @param capacity most blocks queued before push() waits
+   */
+  explicit BlockQueue(size_t capacity) : capacity(capacity) {}
+
+  /**
+   * Queue a block, waiting while the queue is full
+   * @param block the block, left as an empty spare block to fill next
+   * @return false, leaving the block alone, if the queue was closed
+   */
+  bool push(T &block)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&]() { return closed || blocks.size() < capacity; });
+    if(closed)
+    {
+      return false;
+    }
+    blocks.push_back(std::move(block));
+    if(spare.empty())
+    {
+      block = T();
+    }
+    else
+    {
+      block = std::move(spare.back());
+      spare.pop_back();
+    }
+    lock.unlock();
+    changed.notify_all();
+    return true;
+  }
+
+  /**
+   * Take the next block, waiting while the queue is empty
+   * @return false once the queue is closed and empty
+   */
+  bool pop(T &block)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&]() { return closed || !blocks.empty(); });
+    if(blocks.empty())
+    {
+      return false;
+    }
+    block = std::move(blocks.front());
+    blocks.pop_front();
+    lock.unlock();
+    changed.notify_all();
+    return true;
+  }
+
+  /**
+   * Give a consumed block back for push() to hand out
+   */
+  void recycle(T &block)
+  {
+    block.clear();
+    std::lock_guard<std::mutex> lock(mutex);
+    if(spare.size() < capacity)
+    {
+      spare.push_back(std::move(block));
+    }
+  }
+
+  /**
+   * No more blocks will be pushed; pop() returns what is queued and then
+   * false, and push() fails
+   */
+  void close()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    changed.notify_all();
+  }
+};
+
+#endif
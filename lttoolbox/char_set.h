@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LT_CHAR_SET_H_
+#define _LT_CHAR_SET_H_
+
+#include <lttoolbox/ustring.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Set of Unicode code points as a two-level bitmap: blocks of 256
+ * characters, each one either the shared empty block or a 256-bit leaf.
+ * Membership tests are two array lookups whatever the size of the set.
+ */
+class CharSet
+{
+private:
+  static constexpr UChar32 max_char = 0x10FFFF;
+  static constexpr int block_bits = 8;
+  static constexpr size_t blocks = (max_char >> block_bits) + 1;
+
+  typedef std::array<uint64_t, 4> Leaf;
+
+  /**
+   * Leaf of every block, 0 being the empty leaf
+   */
+  std::vector<uint16_t> index;
+  std::vector<Leaf> leaves;
+  size_t count = 0;
+
+public:
+  CharSet()
+  {
+    clear();
+  }
+
+  void insert(UChar32 c)
+  {
+    if (c < 0 || c > max_char || contains(c)) {
+      return;
+    }
+    uint16_t &block = index[c >> block_bits];
+    if (block == 0) {
+      block = leaves.size();
+      leaves.push_back(Leaf());
+    }
+    leaves[block][(c >> 6) & 3] |= uint64_t(1) << (c & 63);
+    count++;
+  }
+
+  bool contains(UChar32 c) const
+  {
+    if (c < 0 || c > max_char) {
+      return false;
+    }
+    return (leaves[index[c >> block_bits]][(c >> 6) & 3] >> (c & 63)) & 1;
+  }
+
+  void clear()
+  {
+    index.assign(blocks, 0);
+    leaves.assign(1, Leaf());
+    count = 0;
+  }
+
+  size_t size() const
+  {
+    return count;
+  }
+
+  bool empty() const
+  {
+    return count == 0;
+  }
+
+  /**
+   * Bytes taken by the set
+   */
+  size_t memoryUsage() const
+  {
+    return index.capacity() * sizeof(uint16_t) +
+           leaves.capacity() * sizeof(Leaf);
+  }
+};
+
+#endif
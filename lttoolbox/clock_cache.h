@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LT_CLOCK_CACHE_H_
+#define _LT_CLOCK_CACHE_H_
+
+#include <lttoolbox/ustring.h>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Bounded map from strings to values with CLOCK (second chance)
+ * eviction.  The bound is a number of entries, an approximate number of
+ * bytes, or both; with neither the cache is disabled and stores nothing.
+ */
+template <class T>
+class ClockCache
+{
+private:
+  struct Slot
+  {
+    UString key;
+    T value;
+    size_t bytes;
+    bool used;
+    bool referenced;
+  };
+
+  /**
+   * Bookkeeping cost of an entry on top of its key and value
+   */
+  static constexpr size_t slot_overhead = sizeof(Slot) + 4 * sizeof(void *);
+
+  std::vector<Slot> slots;
+  std::vector<size_t> free_slots;
+  std::unordered_map<UString, size_t> index;
+
+  /**
+   * Position of the clock hand in slots
+   */
+  size_t hand = 0;
+
+  size_t max_entries = 0;
+  size_t max_bytes = 0;
+  size_t bytes = 0;
+
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+  bool full(size_t extra) const
+  {
+    return (max_entries > 0 && index.size() >= max_entries) ||
+           (max_bytes > 0 && bytes + extra > max_bytes);
+  }
+
+  /**
+   * Evict the first entry the hand finds not referenced since its last
+   * pass, and free its slot
+   */
+  void evict()
+  {
+    while(true)
+    {
+      if(hand >= slots.size())
+      {
+        hand = 0;
+      }
+      Slot &slot = slots[hand];
+      if(slot.used && !slot.referenced)
+      {
+        index.erase(slot.key);
+        bytes -= slot.bytes;
+        slot.used = false;
+        slot.key.clear();
+        slot.value = T();
+        free_slots.push_back(hand);
+        hand++;
+        return;
+      }
+      slot.referenced = false;
+      hand++;
+    }
+  }
+
+public:
+  /**
+   * Set the bounds of the cache, dropping its contents
+   * @param entries maximum number of entries, 0 for no limit
+   * @param size maximum approximate size in bytes, 0 for no limit
+   */
+  void setCapacity(size_t entries, size_t size)
+  {
+    clear();
+    max_entries = entries;
+    max_bytes = size;
+  }
+
+  bool enabled() const
+  {
+    return max_entries > 0 || max_bytes > 0;
+  }
+
+  /**
+   * Look up a key, counting a hit or a miss
+   * @return the cached value, or nullptr; the pointer is valid until
+   *         the next insertion
+   */
+  T const * find(UString const &key)
+  {
+    auto it = index.find(key);
+    if(it == index.end())
+    {
+      misses++;
+      return nullptr;
+    }
+    hits++;
+    slots[it->second].referenced = true;
+    return &slots[it->second].value;
+  }
+
+  /**
+   * Add an entry, evicting others if needed.  Existing keys are left
+   * as they are.
+   * @param key the key
+   * @param value the value
+   * @param value_bytes approximate dynamic size of value
+   */
+  void insert(UString const &key, T const &value, size_t value_bytes)
+  {
+    if(!enabled() || index.find(key) != index.end())
+    {
+      return;
+    }
+    size_t size = slot_overhead + key.size() * sizeof(UChar) + value_bytes;
+    if(max_bytes > 0 && size > max_bytes)
+    {
+      return;
+    }
+    while(!index.empty() && full(size))
+    {
+      evict();
+    }
+
+    size_t pos;
+    if(!free_slots.empty())
+    {
+      pos = free_slots.back();
+      free_slots.pop_back();
+    }
+    else
+    {
+      pos = slots.size();
+      slots.push_back(Slot());
+    }
+    slots[pos] = {key, value, size, true, false};
+    index.insert({key, pos});
+    bytes += size;
+  }
+
+  void clear()
+  {
+    slots.clear();
+    free_slots.clear();
+    index.clear();
+    hand = 0;
+    bytes = 0;
+  }
+
+  size_t size() const
+  {
+    return index.size();
+  }
+
+  /**
+   * Approximate size in bytes of the entries, as counted against the
+   * maximum size
+   */
+  size_t getBytes() const
+  {
+    return bytes;
+  }
+
+  uint64_t getHits() const
+  {
+    return hits;
+  }
+
+  uint64_t getMisses() const
+  {
+    return misses;
+  }
+};
+
+#endif
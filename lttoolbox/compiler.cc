@@ -21,8 +21,155 @@
 #include <lttoolbox/acx.h>
 #include <lttoolbox/regexp_compiler.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
 #include <iostream>
+#include <sstream>
 #include <thread>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  double
+  secondsSince(Clock::time_point start)
+  {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  /**
+   * The most memory the process has had resident so far, in bytes, or 0
+   * where that isn't known
+   */
+  uint64_t
+  peakMemory()
+  {
+#ifndef _WIN32
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+#ifdef __APPLE__
+      return usage.ru_maxrss;
+#else
+      return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+    }
+#endif
+    return 0;
+  }
+
+  /**
+   * Roughly the bytes a transducer takes: a map node for each state and
+   * a multimap node for each transition
+   */
+  size_t
+  transducerBytes(Transducer &t)
+  {
+    return static_cast<size_t>(t.size()) * 80 +
+           static_cast<size_t>(t.numberOfTransitions()) * 64;
+  }
+
+  std::string
+  reportName(UString const &name, bool json)
+  {
+    std::ostringstream out;
+    out << name;
+    if(!json)
+    {
+      return out.str();
+    }
+    std::string escaped;
+    for(char c : out.str())
+    {
+      if(c == '"' || c == '\\')
+      {
+        escaped += '\\';
+      }
+      escaped += c;
+    }
+    return escaped;
+  }
+
+  void
+  writeCosts(FILE *output, char const *kind,
+             std::map<UString, CompilerReport::Cost> const &costs, bool json)
+  {
+    if(json)
+    {
+      fprintf(output, ", \"%s\": [", kind);
+      bool first = true;
+      for(auto &it : costs)
+      {
+        auto &c = it.second;
+        fprintf(output, "%s{\"name\": \"%s\", \"entries\": %" PRIu64
+                ", \"references\": %" PRIu64 ", \"states_before\": %" PRIu64
+                ", \"arcs_before\": %" PRIu64 ", \"states\": %" PRIu64
+                ", \"arcs\": %" PRIu64 ", \"insertion_seconds\": %.6f"
+                ", \"minimisation_seconds\": %.6f, \"peak_bytes\": %" PRIu64 "}",
+                first ? "" : ", ", reportName(it.first, true).c_str(),
+                c.entries, c.references, c.states_before, c.arcs_before,
+                c.states, c.arcs, c.insertion, c.minimisation, c.peak_memory);
+        first = false;
+      }
+      fprintf(output, "]");
+      return;
+    }
+
+    std::vector<std::pair<UString, CompilerReport::Cost>> sorted(costs.begin(), costs.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [](auto const &a, auto const &b) {
+      return a.second.insertion + a.second.minimisation >
+             b.second.insertion + b.second.minimisation;
+    });
+    fprintf(output, "%s: %zu\n", kind, sorted.size());
+    for(auto &it : sorted)
+    {
+      auto &c = it.second;
+      fprintf(output, "  %s: %" PRIu64 " entries", reportName(it.first, false).c_str(),
+              c.entries);
+      if(c.references > 0)
+      {
+        fprintf(output, ", used %" PRIu64 " times", c.references);
+      }
+      fprintf(output, ", %" PRIu64 " states %" PRIu64 " arcs -> %" PRIu64
+              " states %" PRIu64 " arcs, insertion %.3f s, minimisation %.3f s, peak %" PRIu64 " kB\n",
+              c.states_before, c.arcs_before, c.states, c.arcs,
+              c.insertion, c.minimisation, c.peak_memory / 1024);
+    }
+  }
+}
+
+void
+CompilerReport::write(FILE *output, bool json) const
+{
+  if(json)
+  {
+    fprintf(output, "{\"parsing_seconds\": %.6f, \"parsing_peak_bytes\": %" PRIu64
+            ", \"minimisation_seconds\": %.6f, \"minimisation_peak_bytes\": %" PRIu64
+            ", \"regexps\": %" PRIu64 ", \"distinct_regexps\": %" PRIu64
+            ", \"regexp_seconds\": %.6f",
+            parsing, parsing_peak, minimisation, minimisation_peak,
+            regexps, distinct_regexps, regexp_time);
+    writeCosts(output, "paradigms", paradigms, true);
+    writeCosts(output, "sections", sections, true);
+    fprintf(output, "}\n");
+  }
+  else
+  {
+    fprintf(output, "parsing:      %.3f s, peak %" PRIu64 " kB\n",
+            parsing, parsing_peak / 1024);
+    fprintf(output, "minimisation: %.3f s, peak %" PRIu64 " kB\n",
+            minimisation, minimisation_peak / 1024);
+    fprintf(output, "regexps:      %" PRIu64 ", %" PRIu64 " different, %.3f s\n",
+            regexps, distinct_regexps, regexp_time);
+    writeCosts(output, "paradigms", paradigms, false);
+    writeCosts(output, "sections", sections, false);
+  }
+  fflush(output);
+}
 
 Compiler::Compiler()
 {
@@ -37,7 +184,7 @@ Compiler::parseACX(std::string const &file, UStringView dir)
 {
   if(dir == COMPILER_RESTRICTION_LR_VAL)
   {
-    acx_map = readACX(file.c_str());
+    (runtime_acx ? runtime_acx_map : acx_map) = readACX(file.c_str());
   }
 }
 
@@ -51,6 +198,7 @@ Compiler::parse(std::string const &file, UStringView dir)
     direction = dir;
   }
   reader = XMLParseUtil::open_or_exit(file.c_str());
+  Clock::time_point const start = Clock::now();
 
   int ret = xmlTextReaderRead(reader);
   while(ret == 1)
@@ -64,9 +212,28 @@ Compiler::parse(std::string const &file, UStringView dir)
     std::cerr << "Error: Parse error at the end of input." << std::endl;
   }
 
+  for(auto &it : open_parts)
+  {
+    closePart(it.first);
+  }
+  while(!part_jobs.empty())
+  {
+    finishPart();
+  }
+
   xmlFreeTextReader(reader);
-  xmlCleanupParser();
 
+  if(reporting)
+  {
+    report.parsing = secondsSince(start);
+    report.parsing_peak = peakMemory();
+    // the threads below only look their sections up
+    for(auto &it : sections)
+    {
+      report.sections[it.first];
+    }
+  }
+  Clock::time_point const minimisation_start = Clock::now();
 
   // Minimize transducers: For each section, call transducer.minimize() in
   // its own thread. This is the major bottleneck of lt-comp and sections
@@ -74,18 +241,25 @@ Compiler::parse(std::string const &file, UStringView dir)
   std::vector<std::thread> minimisations;
   for(auto& it : sections)
   {
-    if(jobs) {
+    auto &parts = section_parts[it.first];
+    // within a memory limit, one at a time
+    if(jobs && memory_limit == 0) {
       minimisations.push_back(
-        std::thread([](Transducer &t) { t.minimize(); },
-                    std::ref(it.second)));
+        std::thread(&Compiler::joinParts, this, std::cref(it.first),
+                    std::ref(it.second), std::ref(parts)));
     }
     else {
-      it.second.minimize();
+      joinParts(it.first, it.second, parts);
     }
   }
   for (auto &thr : minimisations) {
     thr.join();
   }
+  if(reporting)
+  {
+    report.minimisation = secondsSince(minimisation_start);
+    report.minimisation_peak = peakMemory();
+  }
 
   if (is_separable) {
     // ensure that all paths end in <$>, in case the user forgot to include
@@ -191,8 +365,24 @@ Compiler::procParDef()
   {
     if(!paradigms[current_paradigm].isEmpty())
     {
-      paradigms[current_paradigm].minimize();
-      paradigms[current_paradigm].joinFinals();
+      Transducer &t = paradigms[current_paradigm];
+      CompilerReport::Cost *cost = nullptr;
+      if(reporting)
+      {
+        cost = &report.paradigms[current_paradigm];
+        cost->states_before = t.size();
+        cost->arcs_before = t.numberOfTransitions();
+      }
+      Clock::time_point const start = Clock::now();
+      t.minimize(0, 1, push_weights, weight_quantum);
+      t.joinFinals();
+      if(cost != nullptr)
+      {
+        cost->minimisation += secondsSince(start);
+        cost->states = t.size();
+        cost->arcs = t.numberOfTransitions();
+        cost->peak_memory = peakMemory();
+      }
       current_paradigm.clear();
     }
   }
@@ -558,6 +748,10 @@ Compiler::procPar()
     XMLParseUtil::error_and_die(reader, "Undefined paradigm '%S'.", paradigm_name.c_str());
   }
   e.setParadigm(paradigm_name);
+  if(reporting)
+  {
+    report.paradigms[paradigm_name].references++;
+  }
   return e;
 }
 
@@ -567,14 +761,52 @@ Compiler::insertEntryTokens(std::vector<EntryToken> const &elements)
   if(!current_paradigm.empty())
   {
     // compilation of paradigms
+    Clock::time_point const start = (reporting ? Clock::now() : Clock::time_point());
     Transducer &t = paradigms[current_paradigm];
     int e = t.getInitial();
 
-    for(auto& element : elements)
+    for(size_t i = 0, limit = elements.size(); i < limit; i++)
     {
+      auto const &element = elements[i];
       if(element.isParadigm())
       {
-        e = t.insertTransducer(e, paradigms[element.paradigmName()]);
+        // as in the sections, the entries that start or end with the
+        // same paradigm share one copy of it
+        UString const &name = element.paradigmName();
+        if(i == limit - 1)
+        {
+          auto &suffixes = paradigm_suffixes[current_paradigm];
+          auto it = suffixes.find(name);
+          if(it != suffixes.end())
+          {
+            t.linkStates(e, it->second.first, alphabet(0, 0));
+            e = it->second.second;
+          }
+          else
+          {
+            int start = t.insertNewSingleTransduction(alphabet(0, 0), e);
+            e = t.insertTransducer(start, paradigms[name]);
+            suffixes[name] = {start, e};
+          }
+        }
+        else if(i == 0)
+        {
+          auto &prefixes = paradigm_prefixes[current_paradigm];
+          auto it = prefixes.find(name);
+          if(it != prefixes.end())
+          {
+            e = it->second;
+          }
+          else
+          {
+            e = t.insertTransducer(e, paradigms[name]);
+            prefixes[name] = e;
+          }
+        }
+        else
+        {
+          e = t.insertTransducer(e, paradigms[name]);
+        }
       }
       else if(element.isSingleTransduction())
       {
@@ -583,10 +815,8 @@ Compiler::insertEntryTokens(std::vector<EntryToken> const &elements)
       }
       else if(element.isRegexp())
       {
-        RegexpCompiler analyzer;
-        analyzer.initialize(&alphabet);
-        analyzer.compile(element.regExp());
-        e = t.insertTransducer(e, analyzer.getTransducer(), alphabet(0,0));
+        e = t.insertTransducer(e, regexpTransducer(element.regExp()),
+                               alphabet(0,0));
       }
       else
       {
@@ -594,66 +824,553 @@ Compiler::insertEntryTokens(std::vector<EntryToken> const &elements)
       }
     }
     t.setFinal(e, default_weight);
+    if(reporting)
+    {
+      auto &cost = report.paradigms[current_paradigm];
+      cost.entries++;
+      cost.insertion += secondsSince(start);
+    }
+    if(!cache_dir.empty())
+    {
+      uint64_t &hash = paradigm_hashes[current_paradigm];
+      hash = (hash ^ hashEntry(elements)) * 0x100000001b3ull;
+    }
+  }
+  else if(buildsPartsApart())
+  {
+    if(reporting)
+    {
+      report.sections[current_section].entries++;
+    }
+    auto &part = open_parts[current_section];
+    part.first.push_back(elements);
+    bool end;
+    if(!cache_dir.empty())
+    {
+      uint64_t const hash = hashEntry(elements);
+      part.second = (part.second ^ hash) * 0x100000001b3ull;
+      end = (hash % std::max<size_t>(part_entries, 1) == 0);
+    }
+    else
+    {
+      end = (part.first.size() == part_entries);
+    }
+    if(end)
+    {
+      closePart(current_section);
+    }
   }
   else
   {
-    // dictionary compilation
+    if(reporting)
+    {
+      report.sections[current_section].entries++;
+    }
+    // counted here rather than at <e>, as the restrictions drop some
+    if(part_entries > 0 && open_part_entries[current_section]++ == part_entries)
+    {
+      setAsidePart(current_section);
+    }
+    insertSectionEntry(elements);
+  }
+}
 
-    Transducer &t = sections[current_section];
-    int e = t.getInitial();
+void
+Compiler::insertSectionEntry(std::vector<EntryToken> const &elements)
+{
+  Clock::time_point const start = (reporting ? Clock::now() : Clock::time_point());
+  Transducer &t = sections[current_section];
+  int e = t.getInitial();
 
-    for(size_t i = 0, limit = elements.size(); i < limit; i++)
+  for(size_t i = 0, limit = elements.size(); i < limit; i++)
+  {
+    if(elements[i].isParadigm())
     {
-      if(elements[i].isParadigm())
+      if(i == elements.size()-1)
       {
-        if(i == elements.size()-1)
+        // suffix paradigm
+        if(suffix_paradigms[current_section].find(elements[i].paradigmName()) != suffix_paradigms[current_section].end())
         {
-          // suffix paradigm
-          if(suffix_paradigms[current_section].find(elements[i].paradigmName()) != suffix_paradigms[current_section].end())
-          {
-            t.linkStates(e, suffix_paradigms[current_section][elements[i].paradigmName()], 0, elements[i].entryWeight());
-            e = postsuffix_paradigms[current_section][elements[i].paradigmName()];
-          }
-          else
-          {
-            e = t.insertNewSingleTransduction(alphabet(0, 0), e, elements[i].entryWeight());
-            suffix_paradigms[current_section][elements[i].paradigmName()] = e;
-            e = t.insertTransducer(e, paradigms[elements[i].paradigmName()]);
-            postsuffix_paradigms[current_section][elements[i].paradigmName()] = e;
-          }
+          t.linkStates(e, suffix_paradigms[current_section][elements[i].paradigmName()], 0, elements[i].entryWeight());
+          e = postsuffix_paradigms[current_section][elements[i].paradigmName()];
         }
-        else if(i == 0)
+        else
         {
-          // prefix paradigm
-          if(prefix_paradigms[current_section].find(elements[i].paradigmName()) != prefix_paradigms[current_section].end())
-          {
-            e = prefix_paradigms[current_section][elements[i].paradigmName()];
-          }
-          else
-          {
-            e = t.insertTransducer(e, paradigms[elements[i].paradigmName()]);
-            prefix_paradigms[current_section][elements[i].paradigmName()] = e;
-          }
+          e = t.insertNewSingleTransduction(alphabet(0, 0), e, elements[i].entryWeight());
+          suffix_paradigms[current_section][elements[i].paradigmName()] = e;
+          e = t.insertTransducer(e, paradigms[elements[i].paradigmName()]);
+          postsuffix_paradigms[current_section][elements[i].paradigmName()] = e;
+        }
+      }
+      else if(i == 0)
+      {
+        // prefix paradigm
+        if(prefix_paradigms[current_section].find(elements[i].paradigmName()) != prefix_paradigms[current_section].end())
+        {
+          e = prefix_paradigms[current_section][elements[i].paradigmName()];
         }
         else
         {
-          // intermediate paradigm
           e = t.insertTransducer(e, paradigms[elements[i].paradigmName()]);
+          prefix_paradigms[current_section][elements[i].paradigmName()] = e;
         }
       }
-      else if(elements[i].isRegexp())
+      else
+      {
+        // intermediate paradigm
+        e = t.insertTransducer(e, paradigms[elements[i].paradigmName()]);
+      }
+    }
+    else if(elements[i].isRegexp())
+    {
+      e = t.insertTransducer(e, regexpTransducer(elements[i].regExp()),
+                             alphabet(0,0));
+    }
+    else
+    {
+      e = matchTransduction(elements[i].left(), elements[i].right(), e, t, elements[i].entryWeight());
+    }
+  }
+  t.setFinal(e, default_weight);
+  if(reporting)
+  {
+    report.sections[current_section].insertion += secondsSince(start);
+  }
+}
+
+Transducer &
+Compiler::regexpTransducer(std::vector<int32_t> const &re)
+{
+  auto it = regexps.find(re);
+  if(reporting)
+  {
+    report.regexps++;
+  }
+  if(it == regexps.end())
+  {
+    Clock::time_point const start = Clock::now();
+    RegexpCompiler analyzer;
+    analyzer.initialize(&alphabet);
+    analyzer.compile(re);
+    it = regexps.emplace(re, analyzer.getTransducer()).first;
+    it->second.minimize(alphabet(0,0));
+    if(reporting)
+    {
+      report.distinct_regexps++;
+      report.regexp_time += secondsSince(start);
+    }
+  }
+  return it->second;
+}
+
+namespace {
+  /**
+   * FNV-1a, stable from one run to the next, unlike std::hash
+   */
+  struct ContentHash
+  {
+    uint64_t value = 0xcbf29ce484222325ull;
+
+    void add(void const *data, size_t size)
+    {
+      auto const *bytes = static_cast<unsigned char const *>(data);
+      for(size_t i = 0; i < size; i++)
+      {
+        value = (value ^ bytes[i]) * 0x100000001b3ull;
+      }
+    }
+
+    template <class T>
+    void add(T const &n)
+    {
+      add(&n, sizeof(n));
+    }
+
+    /**
+     * The value with its bits mixed, as the low ones alone are weak
+     */
+    uint64_t mixed() const
+    {
+      uint64_t z = value;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+    }
+
+    void addString(UStringView str)
+    {
+      add(str.size());
+      add(str.data(), str.size() * sizeof(UChar));
+    }
+  };
+}
+
+bool
+Compiler::buildsPartsApart() const
+{
+  return !cache_dir.empty() || (jobs && part_entries > 0);
+}
+
+uint64_t
+Compiler::hashEntry(std::vector<EntryToken> const &elements) const
+{
+  ContentHash hash;
+  // tags are numbered as they are first seen, so they go in by name
+  auto const symbols = [&](std::vector<int> const &syms) {
+    hash.add(syms.size());
+    for(int sym : syms)
+    {
+      if(sym < 0)
       {
-        RegexpCompiler analyzer;
-        analyzer.initialize(&alphabet);
-        analyzer.compile(elements[i].regExp());
-        e = t.insertTransducer(e, analyzer.getTransducer(), alphabet(0,0));
+        UString tag;
+        alphabet.getSymbol(tag, sym);
+        hash.addString(tag);
       }
       else
       {
-        e = matchTransduction(elements[i].left(), elements[i].right(), e, t, elements[i].entryWeight());
+        hash.add(sym);
       }
     }
-    t.setFinal(e, default_weight);
+  };
+  for(auto const &element : elements)
+  {
+    if(element.isParadigm())
+    {
+      hash.add('p');
+      hash.addString(element.paradigmName());
+      auto it = paradigm_hashes.find(element.paradigmName());
+      hash.add(it == paradigm_hashes.end() ? uint64_t(0) : it->second);
+    }
+    else if(element.isRegexp())
+    {
+      hash.add('r');
+      symbols(element.regExp());
+    }
+    else
+    {
+      hash.add('t');
+      symbols(element.left());
+      symbols(element.right());
+      hash.add(element.entryWeight());
+    }
+  }
+  return hash.mixed();
+}
+
+void
+Compiler::closePart(UString const &section)
+{
+  auto &part = open_parts[section];
+  if(part.first.empty())
+  {
+    return;
+  }
+
+  std::string path;
+  if(!cache_dir.empty())
+  {
+    // what else the entries compile to depends on: matchTransduction()
+    // swaps their sides by direction and loops on <ANY_TAG> and
+    // <ANY_CHAR> if separable
+    ContentHash key;
+    key.add("lttoolbox part 2", 16);
+    key.add(part.second);
+    key.add(part.first.size());
+    key.addString(direction);
+    key.add(is_separable);
+    for(auto const &it : acx_map)
+    {
+      key.add(it.first);
+      for(auto c : it.second)
+      {
+        key.add(c);
+      }
+    }
+    char name[21];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key.value));
+    path = cache_dir + "/" + name + ".part";
+  }
+
+  // the part is built by a compiler of its own, with a copy of the
+  // alphabet so far and of the paradigms it uses, so that it can go on
+  // while this one parses the next part
+  part_jobs.emplace_back();
+  PartJob &job = part_jobs.back();
+  job.section = section;
+  job.entries.swap(part.first);
+  part.second = 0;
+  job.worker.reset(new Compiler());
+  Compiler &worker = *job.worker;
+  worker.direction = direction;
+  worker.alphabet = alphabet;
+  worker.acx_map = acx_map;
+  worker.is_separable = is_separable;
+  worker.any_tag = any_tag;
+  worker.any_char = any_char;
+  worker.word_boundary = word_boundary;
+  worker.word_boundary_s = word_boundary_s;
+  worker.word_boundary_ns = word_boundary_ns;
+  worker.reading_boundary = reading_boundary;
+  worker.current_section = section;
+  worker.reporting = reporting;
+  for(auto const &elements : job.entries)
+  {
+    for(auto const &element : elements)
+    {
+      if(element.isParadigm() && !worker.paradigms.count(element.paradigmName()))
+      {
+        worker.paradigms.insert(*paradigms.find(element.paradigmName()));
+      }
+    }
+  }
+  sections[section];
+
+  if(jobs)
+  {
+    job.thread = std::thread(&Compiler::buildPart, &worker,
+                             std::cref(job.entries), path);
+    size_t const threads = std::max(1u, std::thread::hardware_concurrency());
+    while(part_jobs.size() > threads)
+    {
+      finishPart();
+    }
+  }
+  else
+  {
+    worker.buildPart(job.entries, path);
+    finishPart();
+  }
+}
+
+void
+Compiler::buildPart(std::vector<std::vector<EntryToken>> const &entries,
+                    std::string const &path)
+{
+  Transducer &t = sections[current_section];
+  if(!path.empty())
+  {
+    if(FILE *cached = fopen(path.c_str(), "rb"))
+    {
+      bool ok = true;
+      try
+      {
+        alphabet.read(cached);
+        t.read(cached);
+      }
+      catch(std::exception const &)
+      {
+        ok = false;
+      }
+      ok = ok && !ferror(cached);
+      fclose(cached);
+      if(ok)
+      {
+        return;
+      }
+      t.clear();
+    }
+  }
+
+  for(auto const &elements : entries)
+  {
+    insertSectionEntry(elements);
+  }
+  Clock::time_point const start = Clock::now();
+  t.minimize();
+  if(reporting)
+  {
+    report.sections[current_section].minimisation += secondsSince(start);
+  }
+
+  if(!path.empty())
+  {
+    // written aside and renamed, so that no run reads half a part
+    std::string const temp = path + ".tmp";
+    if(FILE *output = fopen(temp.c_str(), "wb"))
+    {
+      alphabet.write(output);
+      t.write(output);
+      if(fclose(output) != 0 || rename(temp.c_str(), path.c_str()) != 0)
+      {
+        remove(temp.c_str());
+      }
+    }
+  }
+}
+
+void
+Compiler::finishPart()
+{
+  // in the order the parts were closed, so that the symbols are
+  // numbered the same however the threads run
+  PartJob &job = part_jobs.front();
+  if(job.thread.joinable())
+  {
+    job.thread.join();
+  }
+  Transducer &t = job.worker->sections[job.section];
+  t.updateAlphabet(job.worker->alphabet, alphabet);
+  if(reporting)
+  {
+    // the worker counted what it did, but the entries were counted here
+    CompilerReport const &done = job.worker->report;
+    auto &cost = report.sections[job.section];
+    auto it = done.sections.find(job.section);
+    if(it != done.sections.end())
+    {
+      cost.insertion += it->second.insertion;
+      cost.minimisation += it->second.minimisation;
+    }
+    report.regexps += done.regexps;
+    report.distinct_regexps += done.distinct_regexps;
+    report.regexp_time += done.regexp_time;
+  }
+  section_parts[job.section].emplace_back(t, job.entries.size());
+  part_jobs.pop_front();
+  spillParts();
+}
+
+void
+Compiler::setAsidePart(UString const &section)
+{
+  // The entries still to come go into a new transducer, so the states of
+  // this one will not change again and it can be minimized now.  Parts
+  // holding as many entries are merged like the digits of a binary
+  // counter, which minimizes each entry about log(n) times in all.
+  Transducer &t = sections[section];
+  Clock::time_point const start = Clock::now();
+  t.minimize();
+  if(reporting)
+  {
+    report.sections[section].minimisation += secondsSince(start);
+  }
+  auto &parts = section_parts[section];
+  parts.emplace_back(t, open_part_entries[section] - 1);
+  t.clear();
+  open_part_entries[section] = 1;
+  prefix_paradigms[section].clear();
+  suffix_paradigms[section].clear();
+  postsuffix_paradigms[section].clear();
+
+  while(parts.size() > 1 && parts[parts.size()-2].second <= parts.back().second)
+  {
+    auto &merged = parts[parts.size()-2];
+    merged.first.unionWith(alphabet, parts.back().first);
+    Clock::time_point const merge_start = Clock::now();
+    merged.first.minimize();
+    if(reporting)
+    {
+      report.sections[section].minimisation += secondsSince(merge_start);
+    }
+    merged.second += parts.back().second;
+    parts.pop_back();
+  }
+  spillParts();
+}
+
+void
+Compiler::spillParts()
+{
+  if(memory_limit == 0)
+  {
+    return;
+  }
+  size_t bytes = 0;
+  for(auto &it : section_parts)
+  {
+    for(auto &part : it.second)
+    {
+      bytes += transducerBytes(part.first);
+    }
+  }
+  if(bytes <= memory_limit)
+  {
+    return;
+  }
+  for(auto &it : section_parts)
+  {
+    if(it.second.empty())
+    {
+      continue;
+    }
+    // a file a section rather than a part, so that a large dictionary
+    // does not run out of file descriptors
+    auto &spill = spilled_parts[it.first];
+    if(spill.first == nullptr)
+    {
+      spill.first = tmpfile();
+      if(spill.first == nullptr)
+      {
+        std::cerr << "Error: Cannot create a temporary file to set parts of section '";
+        std::cerr << it.first << "' aside in." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+    for(auto &part : it.second)
+    {
+      part.first.write(spill.first);
+      spill.second++;
+    }
+    if(fflush(spill.first) != 0 || ferror(spill.first))
+    {
+      std::cerr << "Error: Cannot write parts of section '" << it.first;
+      std::cerr << "' to a temporary file." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    it.second.clear();
+  }
+}
+
+void
+Compiler::joinParts(UString const &section, Transducer &t,
+                    std::vector<std::pair<Transducer, size_t>> &parts)
+{
+  for(auto &part : parts)
+  {
+    t.unionWith(alphabet, part.first);
+  }
+  parts.clear();
+  auto spilled = spilled_parts.find(section);
+  if(spilled != spilled_parts.end())
+  {
+    // what was joined so far is minimized whenever it outgrows the limit,
+    // or twice its size when last minimized, so that the parts read back
+    // neither pile up unminimized nor get minimized over and over
+    size_t grown = memory_limit;
+    FILE *spill = spilled->second.first;
+    rewind(spill);
+    for(size_t i = 0; i < spilled->second.second; i++)
+    {
+      Transducer part;
+      part.read(spill);
+      t.unionWith(alphabet, part);
+      if(transducerBytes(t) > grown)
+      {
+        t.minimize();
+        grown = std::max(memory_limit, 2 * transducerBytes(t));
+      }
+    }
+    fclose(spill);
+    spilled_parts.erase(spilled);
+  }
+  CompilerReport::Cost *cost = nullptr;
+  if(reporting)
+  {
+    cost = &report.sections.find(section)->second;
+    cost->states_before = t.size();
+    cost->arcs_before = t.numberOfTransitions();
+  }
+  Clock::time_point const start = Clock::now();
+  // with jobs, the paths of a single big section starting with different
+  // symbols are minimized on separate threads as well
+  unsigned const threads = jobs ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+  t.minimize(0, threads, push_weights, weight_quantum);
+  if(cost != nullptr)
+  {
+    cost->minimisation += secondsSince(start);
+    cost->states = t.size();
+    cost->arcs = t.numberOfTransitions();
+    cost->peak_memory = peakMemory();
   }
 }
 
@@ -1009,9 +1726,11 @@ Compiler::procRegexp()
 }
 
 void
-Compiler::write(FILE *output)
+Compiler::write(FILE *output, bool mmap, StateVisits const *visits,
+                bool directory)
 {
-  writeTransducerSet(output, letters, alphabet, sections);
+  writeTransducerSet(output, letters, alphabet, sections, mmap, visits,
+                     directory, &runtime_acx_map);
 }
 
 void
@@ -1056,12 +1775,60 @@ Compiler::setMaxSectionEntries(size_t m)
   max_section_entries = m;
 }
 
+void
+Compiler::setPartEntries(size_t m)
+{
+  part_entries = m;
+}
+
+void
+Compiler::setCacheDir(std::string const &dir)
+{
+  cache_dir = dir;
+}
+
+void
+Compiler::setMemoryLimit(size_t bytes)
+{
+  memory_limit = bytes;
+}
+
+void
+Compiler::setPushWeights(bool value)
+{
+  push_weights = value;
+}
+
+void
+Compiler::setWeightQuantum(double quantum)
+{
+  weight_quantum = quantum;
+}
+
 void
 Compiler::setVerbose(bool verbosity)
 {
   verbose = verbosity;
 }
 
+void
+Compiler::setRuntimeACX(bool value)
+{
+  runtime_acx = value;
+}
+
+void
+Compiler::setReport(bool value)
+{
+  reporting = value;
+}
+
+CompilerReport const &
+Compiler::getReport() const
+{
+  return report;
+}
+
 void
 Compiler::setEntryDebugging(bool debug)
 {
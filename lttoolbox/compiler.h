@@ -19,14 +19,75 @@
 
 #include <lttoolbox/alphabet.h>
 #include <lttoolbox/entry_token.h>
+#include <lttoolbox/file_utils.h>
 #include <lttoolbox/transducer.h>
 #include <lttoolbox/ustring.h>
 #include <lttoolbox/sorted_vector.hpp>
 
+#include <cstdint>
+#include <cstdio>
+#include <deque>
 #include <map>
+#include <memory>
 #include <set>
+#include <string>
+#include <thread>
+#include <vector>
 #include <libxml/xmlreader.h>
 
+/**
+ * What compiling a dictionary cost, by paradigm and by section, for
+ * finding what makes a build slow or big, see Compiler::setReport()
+ */
+struct CompilerReport
+{
+  /**
+   * A paradigm or a section: how many entries it has and, for a
+   * paradigm, how many entries use it; its states and transitions
+   * before and after it was minimised; the seconds spent inserting its
+   * entries and minimising it; and the peak memory of the process, in
+   * bytes, once it was minimised
+   */
+  struct Cost
+  {
+    uint64_t entries = 0;
+    uint64_t references = 0;
+    uint64_t states_before = 0;
+    uint64_t arcs_before = 0;
+    uint64_t states = 0;
+    uint64_t arcs = 0;
+    double insertion = 0;
+    double minimisation = 0;
+    uint64_t peak_memory = 0;
+  };
+  std::map<UString, Cost> paradigms;
+  std::map<UString, Cost> sections;
+
+  /**
+   * How many regular expressions the entries have, how many of them are
+   * different and the seconds spent compiling those
+   */
+  uint64_t regexps = 0;
+  uint64_t distinct_regexps = 0;
+  double regexp_time = 0;
+
+  /**
+   * The seconds spent reading the dictionary, with the parts of the
+   * sections built along the way, and then minimising the sections, with
+   * the peak memory of the process at the end of each
+   */
+  double parsing = 0;
+  uint64_t parsing_peak = 0;
+  double minimisation = 0;
+  uint64_t minimisation_peak = 0;
+
+  /**
+   * Write the report as JSON, or as text with the paradigms and
+   * sections that took longest first
+   */
+  void write(FILE *output, bool json) const;
+};
+
 /**
  * A compiler of dictionaries to letter transducers
  */
@@ -74,6 +135,13 @@ private:
    */
   size_t max_section_entries = 0;
 
+  /**
+   * The number of top-level entries after which the part of a section
+   * built so far is minimized and set aside.
+   * If 0, each section is built whole and minimized at the end.
+   */
+  size_t part_entries = 0;
+
   /**
    * The dictionary section being compiled
    */
@@ -148,6 +216,12 @@ private:
    */
   std::map<UString, Transducer> sections;
 
+  /**
+   * Minimal transducers of the regular expressions compiled so far, by
+   * their symbols, see regexpTransducer()
+   */
+  std::map<std::vector<int32_t>, Transducer> regexps;
+
   /**
    * List of named prefix copy of a paradigm
    */
@@ -163,11 +237,107 @@ private:
    */
   std::map<UString, std::map<UString, int> > postsuffix_paradigms;
 
+  /**
+   * Copies of the paradigms used at the start of the entries of a
+   * paradigm, by the names of both, with where each copy ends
+   */
+  std::map<UString, std::map<UString, int>> paradigm_prefixes;
+
+  /**
+   * Copies of the paradigms used at the end of the entries of a
+   * paradigm, by the names of both, with where each copy starts and ends
+   */
+  std::map<UString, std::map<UString, std::pair<int, int>>> paradigm_suffixes;
+
+  /**
+   * Minimized parts of each section set aside while it is compiled, with
+   * the number of entries each holds, largest first
+   */
+  std::map<UString, std::vector<std::pair<Transducer, size_t>>> section_parts;
+
+  /**
+   * The bytes the parts set aside from the sections may take before they
+   * are written to temporary files; if 0, they are all kept in memory
+   */
+  size_t memory_limit = 0;
+
+  /**
+   * The temporary file of each section that its parts are written to, one
+   * after another in the order they were set aside, to stay within
+   * memory_limit, and how many parts it holds
+   */
+  std::map<UString, std::pair<FILE*, size_t>> spilled_parts;
+
+  /**
+   * Whether the paradigms and sections are minimized with their weights
+   * pushed towards their initial state, and the multiple of which the
+   * weights are rounded to when they are, if above 0
+   */
+  bool push_weights = false;
+  double weight_quantum = 0;
+
+  /**
+   * The number of top-level entries in the part of each section still
+   * being built
+   */
+  std::map<UString, size_t> open_part_entries;
+
+  /**
+   * Directory to keep the minimized parts of sections in, if not empty;
+   * the entries of a part are then only inserted when it is not there
+   */
+  std::string cache_dir;
+
+  /**
+   * The entries of the part of each section not yet closed, when parts
+   * are built apart, and the hash of their contents
+   */
+  std::map<UString, std::pair<std::vector<std::vector<EntryToken>>, uint64_t>> open_parts;
+
+  /**
+   * A closed part of a section, built by a compiler of its own
+   */
+  struct PartJob
+  {
+    UString section;
+    std::vector<std::vector<EntryToken>> entries;
+    std::unique_ptr<Compiler> worker;
+    std::thread thread;
+  };
+
+  /**
+   * The parts being built, in the order they were closed
+   */
+  std::deque<PartJob> part_jobs;
+
+  /**
+   * Hash of the entries of each paradigm, for the hashes of the entries
+   * using it
+   */
+  std::map<UString, uint64_t, std::less<>> paradigm_hashes;
+
   /**
    * Mapping of aliases of characters specified in ACX files
    */
   std::map<int32_t, sorted_vector<int32_t> > acx_map;
 
+  /**
+   * Mapping read from the ACX file to be written with the transducers
+   * rather than expanded into them, see setRuntimeACX()
+   */
+  ACXMap runtime_acx_map;
+
+  /**
+   * Whether parseACX() keeps the mapping for lt-proc to apply
+   */
+  bool runtime_acx = false;
+
+  /**
+   * Whether to fill in report, see setReport()
+   */
+  bool reporting = false;
+  CompilerReport report;
+
   /**
    * LSX symbols
    */
@@ -263,6 +433,78 @@ private:
    */
   void insertEntryTokens(std::vector<EntryToken> const &elements);
 
+  /**
+   * Minimize the part of a section built so far and set it aside, merging
+   * it with the parts before it while they hold as many entries
+   * @param section the name of the section
+   */
+  void setAsidePart(UString const &section);
+
+  /**
+   * Write all the parts set aside to temporary files if they take more
+   * than memory_limit
+   */
+  void spillParts();
+
+  /**
+   * Join a section with the parts set aside from it and minimize it
+   * @param section the name of the section
+   * @param t the part of the section still being built
+   * @param parts the parts set aside
+   */
+  void joinParts(UString const &section, Transducer &t,
+                 std::vector<std::pair<Transducer, size_t>> &parts);
+
+  /**
+   * Insert a list of tokens into the section being processed
+   * @param elements the list
+   */
+  void insertSectionEntry(std::vector<EntryToken> const &elements);
+
+  /**
+   * The transducer of a regular expression, compiled and minimised the
+   * first time it is met, so that one used by many entries is neither
+   * compiled again nor inserted with the epsilons of its construction
+   * @param re the symbols of the expression
+   */
+  Transducer & regexpTransducer(std::vector<int32_t> const &re);
+
+  /**
+   * Hash of what a list of tokens compiles to, the same in any run
+   * @param elements the list
+   */
+  uint64_t hashEntry(std::vector<EntryToken> const &elements) const;
+
+  /**
+   * Whether the entries of a part are held back and inserted by a
+   * compiler of its own once the part is closed, which they are with a
+   * cache_dir, or with jobs and a part size
+   */
+  bool buildsPartsApart() const;
+
+  /**
+   * Start building the part of a section whose entries are open, on a
+   * thread of its own with jobs
+   * @param section the name of the section
+   */
+  void closePart(UString const &section);
+
+  /**
+   * Build the part of current_section from its entries in this compiler,
+   * reading it from path instead if it is there, and otherwise saving it
+   * there
+   * @param entries the entries of the part
+   * @param path the file in cache_dir for the part, or empty
+   */
+  void buildPart(std::vector<std::vector<EntryToken>> const &entries,
+                 std::string const &path);
+
+  /**
+   * Wait for the first part being built and add it to the parts set
+   * aside from its section
+   */
+  void finishPart();
+
   /**
    * Skip all document #text nodes before "elem"
    * @param name the name of the node
@@ -385,8 +627,13 @@ public:
   /**
    * Write the result of compilation
    * @param fd the stream where write the result
+   * @param mmap write the transducers in the memory mapped format
+   * @param visits visits to renumber the states with, if any, see
+   *               Transducer::renumber()
+   * @param directory write a directory of the sections before them
    */
-  void write(FILE *fd);
+  void write(FILE *fd, bool mmap = false, StateVisits const *visits = nullptr,
+             bool directory = false);
 
   /**
    * Set keep morpheme boundaries
@@ -403,11 +650,67 @@ public:
    */
   void setMaxSectionEntries(size_t m);
 
+  /**
+   * Set how many top-level entries to add to a section before minimizing
+   * what was built so far, which keeps the transducers being built small
+   * on large dictionaries; 0 minimizes each section once, at the end
+   */
+  void setPartEntries(size_t m);
+
+  /**
+   * Keep the minimized parts of the sections in a directory and take
+   * them from there in later runs when their entries have not changed;
+   * the parts end after entries chosen by their contents, about one in
+   * every setPartEntries() entries, so that a change only makes its own
+   * part compile again
+   */
+  void setCacheDir(std::string const &dir);
+
+  /**
+   * Set how many bytes the parts set aside from the sections may take;
+   * past that they are written to temporary files, and read back one at
+   * a time when their section is joined, and the sections are minimized
+   * one after another.  0 keeps everything in memory
+   */
+  void setMemoryLimit(size_t bytes);
+
+  /**
+   * Set whether to push the weights of the paradigms and sections towards
+   * their initial state when minimizing them, so that entries which only
+   * differ in their weight can share their ends
+   */
+  void setPushWeights(bool value);
+
+  /**
+   * Set the multiple to round the weights of the paradigms and sections
+   * to when minimizing them, which lets more of them merge; 0 keeps them
+   * exact
+   */
+  void setWeightQuantum(double quantum);
+
   /**
    * Set verbose output
    */
   void setVerbose(bool verbosity = false);
 
+  /**
+   * Write the ACX mapping with the transducers for lt-proc to apply at
+   * lookup, instead of adding a transition for every equivalent
+   * character; set before parseACX()
+   */
+  void setRuntimeACX(bool value);
+
+  /**
+   * Keep count of what compiling each paradigm and section costs, at
+   * the price of reading the clock for every entry; set before parse()
+   */
+  void setReport(bool value);
+
+  /**
+   * What compiling the dictionary cost, if setReport() was set
+   */
+  CompilerReport const & getReport() const;
+
   /**
    * Set the alt value to use in compilation
    * @param a the value
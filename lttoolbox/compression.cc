@@ -17,12 +17,19 @@
 #include <lttoolbox/compression.h>
 
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
 #include <limits>
 #include <iostream>
 #include <utf8.h>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 void
 Compression::writeByte(unsigned char byte, FILE *output)
 {
@@ -253,6 +260,84 @@ Compression::multibyte_read(std::istream &input)
   return result;
 }
 
+unsigned int
+Compression::multibyte_decode(unsigned char const *&data,
+                              unsigned char const *end)
+{
+  if(end - data >= 4)
+  {
+    return multibyte_decode(data);
+  }
+  unsigned char bytes[4]{};
+  size_t length = (data < end ? (data[0] >> 6) + 1 : 1);
+  for(size_t i = 0; i < length && data + i < end; i++)
+  {
+    bytes[i] = data[i];
+  }
+  unsigned char const *in = bytes;
+  unsigned int value = multibyte_decode(in);
+  data = (static_cast<size_t>(end - data) >= length ? data + length : end);
+  return value;
+}
+
+size_t
+Compression::multibyte_decode(unsigned char const *&data,
+                              unsigned char const *end,
+                              unsigned int *values, size_t count)
+{
+  size_t done = 0;
+  while(done < count && end - data >= 4)
+  {
+#if defined(__SSE2__)
+    // sixteen integers of one byte each, the usual case for the symbols
+    // and targets of the transitions of small states
+    if(count - done >= 16 && end - data >= 16)
+    {
+      __m128i const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data));
+      __m128i const high = _mm_and_si128(bytes, _mm_set1_epi8(static_cast<char>(0xc0)));
+      if(_mm_movemask_epi8(_mm_cmpeq_epi8(high, _mm_setzero_si128())) == 0xffff)
+      {
+        __m128i const zero = _mm_setzero_si128();
+        __m128i const low = _mm_unpacklo_epi8(bytes, zero);
+        __m128i const up = _mm_unpackhi_epi8(bytes, zero);
+        __m128i *out = reinterpret_cast<__m128i *>(values + done);
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(low, zero));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(low, zero));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(up, zero));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(up, zero));
+        data += 16;
+        done += 16;
+        continue;
+      }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    if(count - done >= 16 && end - data >= 16)
+    {
+      uint8x16_t const bytes = vld1q_u8(data);
+      if(vmaxvq_u8(bytes) < 0x40)
+      {
+        uint16x8_t const low = vmovl_u8(vget_low_u8(bytes));
+        uint16x8_t const up = vmovl_u8(vget_high_u8(bytes));
+        vst1q_u32(values + done, vmovl_u16(vget_low_u16(low)));
+        vst1q_u32(values + done + 4, vmovl_u16(vget_high_u16(low)));
+        vst1q_u32(values + done + 8, vmovl_u16(vget_low_u16(up)));
+        vst1q_u32(values + done + 12, vmovl_u16(vget_high_u16(up)));
+        data += 16;
+        done += 16;
+        continue;
+      }
+    }
+#endif
+    values[done++] = multibyte_decode(data);
+  }
+  while(done < count && data < end &&
+        static_cast<size_t>(end - data) > static_cast<size_t>(data[0] >> 6))
+  {
+    values[done++] = multibyte_decode(data, end);
+  }
+  return done;
+}
+
 
 void
 Compression::string_write(UStringView str, FILE *output)
@@ -376,10 +461,28 @@ Compression::long_multibyte_write(const double& value, std::ostream &output)
 }
 
 double
-Compression::long_multibyte_read(FILE *input)
+Compression::long_multibyte_value(unsigned int mantissa, unsigned int exponent)
 {
   double result = 0.0;
+  double value = static_cast<double>(static_cast<int>(mantissa)) / 0x40000000;
+  if (mantissa == std::numeric_limits<unsigned int>::max() && exponent >= std::numeric_limits<unsigned int>::max() - 1) {
+    if (exponent == std::numeric_limits<unsigned int>::max() - 1) {
+      result = -1.0*std::numeric_limits<double>::infinity();
+    }
+    else {
+      result = std::numeric_limits<double>::infinity();
+    }
+  }
+  else {
+    result = ldexp(value, static_cast<int>(exponent));
+  }
 
+  return result;
+}
+
+double
+Compression::long_multibyte_read(FILE *input)
+{
   unsigned int mantissa = 0;
   unsigned int exponent = 0;
 
@@ -412,27 +515,12 @@ Compression::long_multibyte_read(FILE *input)
     exponent = exponent | aux;
   }
 
-  double value = static_cast<double>(static_cast<int>(mantissa)) / 0x40000000;
-  if (mantissa == std::numeric_limits<unsigned int>::max() && exponent >= std::numeric_limits<unsigned int>::max() - 1) {
-    if (exponent == std::numeric_limits<unsigned int>::max() - 1) {
-      result = -1.0*std::numeric_limits<double>::infinity();
-    }
-    else {
-      result = std::numeric_limits<double>::infinity();
-    }
-  }
-  else {
-    result = ldexp(value, static_cast<int>(exponent));
-  }
-
-  return result;
+  return long_multibyte_value(mantissa, exponent);
 }
 
 double
 Compression::long_multibyte_read(std::istream &input)
 {
-  double result = 0.0;
-
   unsigned int mantissa = 0;
   unsigned int exponent = 0;
 
@@ -465,18 +553,131 @@ Compression::long_multibyte_read(std::istream &input)
     exponent = exponent | aux;
   }
 
-  double value = static_cast<double>(static_cast<int>(mantissa)) / 0x40000000;
-  if (mantissa == std::numeric_limits<unsigned int>::max() && exponent >= std::numeric_limits<unsigned int>::max() - 1) {
-    if (exponent == std::numeric_limits<unsigned int>::max() - 1) {
-      result = -1.0*std::numeric_limits<double>::infinity();
+  return long_multibyte_value(mantissa, exponent);
+}
+
+MultibyteReader::MultibyteReader(FILE *input) :
+input(input),
+start(ftell(input)),
+origin(start)
+{
+  if(start >= 0)
+  {
+    buffer.resize(block_size + padding);
+    bytes = buffer.data();
+  }
+}
+
+MultibyteReader::MultibyteReader(unsigned char const *data, size_t length) :
+bytes(data),
+end(length),
+eof(true)
+{
+}
+
+MultibyteReader::~MultibyteReader()
+{
+  finish();
+}
+
+void
+MultibyteReader::fill()
+{
+  start += pos;
+  end -= pos;
+  memmove(buffer.data(), buffer.data() + pos, end);
+  pos = 0;
+  size_t wanted = buffer.size() - padding - end;
+  size_t got = fread_unlocked(buffer.data() + end, 1, wanted, input);
+  end += got;
+  if(got < wanted)
+  {
+    eof = true;
+  }
+  memset(buffer.data() + end, 0, padding);
+}
+
+void
+MultibyteReader::read(unsigned int *values, size_t count)
+{
+  if(start < 0)
+  {
+    for(size_t i = 0; i < count; i++)
+    {
+      values[i] = Compression::multibyte_read(input);
     }
-    else {
-      result = std::numeric_limits<double>::infinity();
+    return;
+  }
+  while(count > 0)
+  {
+    if(input == nullptr)
+    {
+      unsigned char const *data = bytes + pos;
+      size_t done = Compression::multibyte_decode(data, bytes + end, values, count);
+      // past the end, the read values are 0 as in a file
+      for(size_t i = done; i < count; i++)
+      {
+        values[i] = Compression::multibyte_decode(data, bytes + end);
+      }
+      pos = data - bytes;
+      return;
     }
+    ensure();
+    unsigned char const *data = bytes + pos;
+    // at the end of the file, the padding decodes as zeros
+    size_t done = Compression::multibyte_decode(data, bytes + (eof ? end + padding : end),
+                                                values, count);
+    pos = data - bytes;
+    values += done;
+    count -= done;
   }
-  else {
-    result = ldexp(value, static_cast<int>(exponent));
+}
+
+double
+MultibyteReader::readDouble()
+{
+  if(start < 0)
+  {
+    return Compression::long_multibyte_read(input);
+  }
+  unsigned int mantissa = read();
+  if(mantissa >= 0x04000000)
+  {
+    mantissa = ((mantissa & 0x03ffffff) << 26) | read();
   }
+  unsigned int exponent = read();
+  if(exponent >= 0x04000000)
+  {
+    exponent = ((exponent & 0x03ffffff) << 26) | read();
+  }
+  return Compression::long_multibyte_value(mantissa, exponent);
+}
 
+UString
+MultibyteReader::readString()
+{
+  UString result;
+  unsigned int limit = read();
+  result.reserve(limit);
+  for(unsigned int i = 0; i != limit; i++)
+  {
+    result += static_cast<UChar32>(read());
+  }
   return result;
 }
+
+void
+MultibyteReader::finish()
+{
+  if(start < 0 || input == nullptr)
+  {
+    return;
+  }
+  if(pos < end)
+  {
+    fseek(input, start + static_cast<long>(pos), SEEK_SET);
+  }
+  start += (pos < end ? pos : end);
+  pos = end = 0;
+  eof = false;
+}
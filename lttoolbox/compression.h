@@ -17,17 +17,22 @@
 #ifndef _COMPRESSION_
 #define _COMPRESSION_
 
+#include <cstddef>
 #include <cstdio>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 #include <lttoolbox/ustring.h>
 #include <lttoolbox/my_stdio.h>
+#include <vector>
 
 // Global lttoolbox features
 constexpr char HEADER_LTTOOLBOX[4]{'L', 'T', 'T', 'B'};
 enum LT_FEATURES : uint64_t {
-  LTF_UNKNOWN = (1ull << 0), // Features >= this are unknown, so throw an error; Inc this if more features are added
+  LTF_DIRECTORY = (1ull << 0), // A directory of the sections follows the features, see writeTransducerSet()
+  LTF_ACX = (1ull << 1), // Equivalence classes of input characters follow the alphabet, for lt-proc to apply, see writeTransducerSet()
+  LTF_UNKNOWN = (1ull << 2), // Features >= this are unknown, so throw an error; Inc this if more features are added
   LTF_RESERVED = (1ull << 63), // If we ever reach this many feature flags, we need a flag to know how to extend beyond 64 bits
 };
 
@@ -35,7 +40,9 @@ enum LT_FEATURES : uint64_t {
 constexpr char HEADER_TRANSDUCER[4]{'L', 'T', 'T', 'D'};
 enum TD_FEATURES : uint64_t {
   TDF_WEIGHTS = (1ull << 0),
-  TDF_UNKNOWN = (1ull << 1), // Features >= this are unknown, so throw an error; Inc this if more features are added
+  TDF_MMAP = (1ull << 1), // Flat native image that can be mapped into memory as is, see TransExe::write()
+  TDF_DETERMINISTIC = (1ull << 2), // Every node has at most one transition per input symbol and no epsilon transitions, see TransExe::isDeterministic()
+  TDF_UNKNOWN = (1ull << 3), // Features >= this are unknown, so throw an error; Inc this if more features are added
   TDF_RESERVED = (1ull << 63), // If we ever reach this many feature flags, we need a flag to know how to extend beyond 64 bits
 };
 
@@ -119,6 +126,22 @@ inline auto read_le(std::istream& in) {
   return read_le(in, Value{});
 }
 
+inline uint64_t read_le(unsigned char const *in) {
+  uint64_t v = 0;
+  memcpy(&v, in, sizeof(v));
+  v =
+    ((v & 0xFF00000000000000) >> 56) |
+    ((v & 0xFF000000000000) >> 40) |
+    ((v & 0xFF0000000000) >> 24) |
+    ((v & 0xFF00000000) >> 8) |
+    ((v & 0xFF000000) << 8) |
+    ((v & 0xFF0000) << 24) |
+    ((v & 0xFF00) << 40) |
+    ((v & 0xFF) << 56)
+  ;
+  return v;
+}
+
 /**
  * Clase "Compression".
  * Class methods to access compressed data by the byte-aligned method
@@ -126,6 +149,8 @@ inline auto read_le(std::istream& in) {
 class Compression
 {
 private:
+  friend class MultibyteReader;
+
   /**
    * Writing a byte
    * @param byte char to write.
@@ -140,6 +165,12 @@ private:
    */
   static unsigned char readByte(FILE *input);
 
+  /**
+   * The double that long_multibyte_write() split into these parts
+   */
+  static double long_multibyte_value(unsigned int mantissa,
+                                     unsigned int exponent);
+
 public:
   /**
    * Encodes an integer value and writes it into the output stream
@@ -173,6 +204,46 @@ public:
    */
   static unsigned int multibyte_read(std::istream &is);
 
+  /**
+   * Decode an integer written by multibyte_write() from a buffer that
+   * has at least four bytes from data readable
+   * @param data the first byte, moved past the integer
+   * @return the integer value read
+   */
+  static unsigned int multibyte_decode(unsigned char const *&data)
+  {
+    unsigned int extra = data[0] >> 6;
+    uint32_t word = (static_cast<uint32_t>(data[0]) << 24) |
+                    (static_cast<uint32_t>(data[1]) << 16) |
+                    (static_cast<uint32_t>(data[2]) << 8) |
+                    static_cast<uint32_t>(data[3]);
+    data += extra + 1;
+    return (word >> (8 * (3 - extra))) & ((0x40u << (8 * extra)) - 1);
+  }
+
+  /**
+   * Decode an integer written by multibyte_write() from the buffer
+   * [data, end), with the bytes missing at its end read as 0 like
+   * multibyte_read() does at the end of a file
+   * @param data the first byte, moved past the integer
+   * @return the integer value read
+   */
+  static unsigned int multibyte_decode(unsigned char const *&data,
+                                       unsigned char const *end);
+
+  /**
+   * Decode integers written by multibyte_write() from the buffer
+   * [data, end), several at a time where the integers are short
+   * @param data the first byte, moved past the integers decoded
+   * @param values where to write the integers
+   * @param count most integers to decode
+   * @return how many integers were decoded: count, or fewer if the next
+   *         one doesn't fit in the buffer
+   */
+  static size_t multibyte_decode(unsigned char const *&data,
+                                 unsigned char const *end,
+                                 unsigned int *values, size_t count);
+
   /**
    * This method allows to write a plain string to an output stream
    * using its UCSencoding as integer.
@@ -223,4 +294,124 @@ public:
   static double long_multibyte_read(std::istream &is);
 };
 
+/**
+ * Reads what Compression writes from a file a block at a time instead
+ * of a byte at a time, for the readers of transducers.  If the file can
+ * seek, the bytes read ahead are given back by finish(), so that the
+ * file is left just after the last value read, as if it had been read
+ * with Compression; if it can't, the values are read with Compression.
+ * It can also read from bytes already in memory.
+ */
+class MultibyteReader
+{
+private:
+  static constexpr size_t block_size = 1 << 16;
+
+  /**
+   * Zeros kept after the bytes read, so that values can be decoded
+   * without checking for the end of the buffer, and past the end of
+   * the file as 0 like Compression does
+   */
+  static constexpr size_t padding = 16;
+
+  FILE *input = nullptr;
+  std::vector<unsigned char> buffer;
+  unsigned char const *bytes = nullptr;
+  size_t pos = 0;
+  size_t end = 0;
+  long start = 0;
+  long origin = 0;
+  bool eof = false;
+
+  /**
+   * Read more of the input after the bytes not decoded yet
+   */
+  void fill();
+
+  /**
+   * Make sure the next four bytes can be decoded
+   */
+  void ensure()
+  {
+    if(pos + 4 > end)
+    {
+      if(!eof)
+      {
+        fill();
+      }
+      if(eof && pos > end)
+      {
+        pos = end;
+      }
+    }
+  }
+
+public:
+  explicit MultibyteReader(FILE *input);
+
+  /**
+   * Read from the length bytes at data, which must outlive the reader
+   */
+  MultibyteReader(unsigned char const *data, size_t length);
+  ~MultibyteReader();
+
+  MultibyteReader(MultibyteReader const &) = delete;
+  MultibyteReader &operator=(MultibyteReader const &) = delete;
+
+  /**
+   * @see Compression::multibyte_read()
+   */
+  unsigned int read()
+  {
+    if(start < 0)
+    {
+      return Compression::multibyte_read(input);
+    }
+    unsigned char const *data;
+    unsigned int value;
+    if(input == nullptr)
+    {
+      data = bytes + pos;
+      value = Compression::multibyte_decode(data, bytes + end);
+    }
+    else
+    {
+      ensure();
+      data = bytes + pos;
+      value = Compression::multibyte_decode(data);
+    }
+    pos = data - bytes;
+    return value;
+  }
+
+  /**
+   * Read count integers into values
+   * @see Compression::multibyte_read()
+   */
+  void read(unsigned int *values, size_t count);
+
+  /**
+   * @see Compression::long_multibyte_read()
+   */
+  double readDouble();
+
+  /**
+   * @see Compression::string_read()
+   */
+  UString readString();
+
+  /**
+   * Bytes read since the reader was made, up to the end of the input
+   */
+  size_t consumed() const
+  {
+    return (start < 0 ? 0 : start - origin + (pos < end ? pos : end));
+  }
+
+  /**
+   * Give the bytes read ahead back to the file; called on destruction
+   */
+  void finish();
+};
+
 #endif
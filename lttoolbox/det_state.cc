@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lttoolbox/det_state.h>
+
+#include <unicode/uchar.h>
+#include <unicode/ustdio.h>
+
+void
+DetState::init(Node *initial, bool deterministic)
+{
+  where = initial;
+  dirty = false;
+  sequence.clear();
+  this->deterministic = deterministic;
+  general = false;
+  if(!deterministic && hasEpsilons(where))
+  {
+    toGeneral();
+  }
+}
+
+bool
+DetState::hasEpsilons(Node *node)
+{
+  uint32_t count;
+  node->find(0, count);
+  return count != 0;
+}
+
+void
+DetState::toGeneral()
+{
+  general = true;
+  state.init(where, sequence, dirty);
+}
+
+void
+DetState::follow(Dest const &d, int32_t old_sym, int32_t new_sym,
+                 bool case_variant)
+{
+  sequence.push_back({d.out_tag == old_sym ? new_sym : d.out_tag, d.out_weight});
+  where = where->target(d);
+  dirty = dirty || case_variant;
+  if(!deterministic && hasEpsilons(where))
+  {
+    toGeneral();
+  }
+}
+
+void
+DetState::step(int32_t input)
+{
+  if(general)
+  {
+    state.step(input);
+    return;
+  }
+  if(where == nullptr)
+  {
+    return;
+  }
+  if(input == 0)
+  {
+    where = nullptr;
+    return;
+  }
+
+  uint32_t count;
+  uint32_t pos = where->find(input, count);
+  if(count == 1)
+  {
+    follow(where->dests()[pos], 0, 0, false);
+  }
+  else if(count == 0)
+  {
+    where = nullptr;
+  }
+  else
+  {
+    toGeneral();
+    state.step(input);
+  }
+}
+
+void
+DetState::step_case_override(UChar32 val, bool caseSensitive)
+{
+  if(!u_isupper(val) || caseSensitive)
+  {
+    step(val);
+    return;
+  }
+  if(general)
+  {
+    state.step_case_override(val, caseSensitive);
+    return;
+  }
+  if(where == nullptr)
+  {
+    return;
+  }
+
+  // State follows the transitions on val and, marked as case variants,
+  // those on its lowercase, with the lowercase replaced by val in the
+  // output
+  UChar32 lower = u_tolower(val);
+  uint32_t count;
+  uint32_t lower_count = 0;
+  uint32_t pos;
+  uint32_t lower_pos = 0;
+  if(lower != val)
+  {
+    pos = where->findUpper(val, count);
+    lower_pos = where->find(lower, lower_count);
+  }
+  else
+  {
+    pos = where->find(val, count);
+  }
+  if(count + lower_count == 0)
+  {
+    where = nullptr;
+  }
+  else if(count + lower_count > 1)
+  {
+    toGeneral();
+    state.step_case_override(val, caseSensitive);
+  }
+  else if(count == 1)
+  {
+    follow(where->dests()[pos], lower, val, false);
+  }
+  else
+  {
+    follow(where->dests()[lower_pos], lower, val, true);
+  }
+}
+
+bool
+DetState::isFinal(FinalTable const &finals) const
+{
+  if(general)
+  {
+    return state.isFinal(finals);
+  }
+  return where != nullptr && finals.isFinal(where);
+}
+
+UString
+DetState::filterFinals(FinalTable const &finals,
+                       Alphabet const &alphabet,
+                       CharSet const &escaped_chars,
+                       bool display_weights,
+                       int max_analyses, int max_weight_classes,
+                       bool uppercase, bool firstupper, int firstchar) const
+{
+  if(general)
+  {
+    return state.filterFinals(finals, alphabet, escaped_chars, display_weights,
+                              max_analyses, max_weight_classes, uppercase,
+                              firstupper, firstchar);
+  }
+
+  UString result;
+  if(where == nullptr || max_analyses <= 0 || max_weight_classes <= 0)
+  {
+    return result;
+  }
+  auto fin = finals.find(where);
+  if(fin == nullptr)
+  {
+    return result;
+  }
+
+  result += '/';
+  double cost = fin->weight;
+  for(auto& it : sequence)
+  {
+    if(escaped_chars.contains(it.first))
+    {
+      result += '\\';
+    }
+    alphabet.getSymbol(result, it.first, dirty && uppercase);
+    cost += it.second;
+  }
+  if(dirty && firstupper)
+  {
+    int loc = firstchar + 1;
+    if(result[loc] == '~') loc++; // skip post-generation mark
+    result[loc] = u_toupper(result[loc]);
+  }
+  if(display_weights)
+  {
+    UChar w[16]{};
+    u_sprintf(w, "<W:%f>", cost);
+    result += w;
+  }
+  return result;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DETSTATE_
+#define _DETSTATE_
+
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+#include <lttoolbox/alphabet.h>
+#include <lttoolbox/char_set.h>
+#include <lttoolbox/final_table.h>
+#include <lttoolbox/node.h>
+#include <lttoolbox/state.h>
+#include <lttoolbox/ustring.h>
+
+/**
+ * Processing state that follows a single path while the transducer lets
+ * it, without the vector of paths and epsilon closures of State, and
+ * hands over to a State where the path branches.  It gives the same
+ * results as a State on the same transducer.
+ */
+class DetState
+{
+private:
+  /**
+   * Current node of the single path, nullptr once no path is left
+   */
+  Node *where = nullptr;
+
+  /**
+   * Whether the path was reached through a case variant of the input
+   */
+  bool dirty = false;
+
+  /**
+   * Output symbols of the path, with the weights of their transitions
+   */
+  std::vector<std::pair<int32_t, double>> sequence;
+
+  /**
+   * Whether the transducer is known to never branch, see
+   * TransExe::isDeterministic()
+   */
+  bool deterministic = false;
+
+  /**
+   * Whether the paths are in state instead
+   */
+  bool general = false;
+  State state;
+
+  /**
+   * Follow a transition of the current node, replacing old_sym by
+   * new_sym in its output, and hand over to state if the new node has
+   * epsilon transitions
+   */
+  void follow(Dest const &d, int32_t old_sym, int32_t new_sym,
+              bool case_variant);
+
+  static bool hasEpsilons(Node *node);
+
+  /**
+   * Move the single path into state
+   */
+  void toGeneral();
+
+public:
+  /**
+   * Start at the initial node of a transducer
+   * @param initial the initial node
+   * @param deterministic whether TransExe::isDeterministic() holds
+   */
+  void init(Node *initial, bool deterministic);
+
+  size_t size() const
+  {
+    return general ? state.size() : (where != nullptr);
+  }
+
+  /**
+   * Make a transition as State::step
+   * @param input the input symbol
+   */
+  void step(int32_t input);
+
+  /**
+   * Make a transition as State::step_case_override
+   * @param val the input symbol
+   * @param caseSensitive whether to leave uppercase input alone
+   */
+  void step_case_override(UChar32 val, bool caseSensitive);
+
+  bool isFinal(FinalTable const &finals) const;
+
+  /**
+   * The outputs of the final paths, as State::filterFinals
+   */
+  UString filterFinals(FinalTable const &finals,
+                       Alphabet const &a,
+                       CharSet const &escaped_chars,
+                       bool display_weights = false,
+                       int max_analyses = INT_MAX,
+                       int max_weight_classes = INT_MAX,
+                       bool uppercase = false,
+                       bool firstupper = false,
+                       int firstchar = 0) const;
+};
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lttoolbox/epsilon_table.h>
+#include <lttoolbox/trans_exe.h>
+
+void
+EpsilonTable::clear()
+{
+  ranges.clear();
+  spans.clear();
+  entries.clear();
+}
+
+bool
+EpsilonTable::addClosure(Node *node)
+{
+  // the same walk as State::epsilonClosure() makes from a single path
+  size_t start = entries.size();
+  Node *where = node;
+  int32_t parent = -1;
+  uint32_t depth = 0;
+  for (size_t k = start; ; k++) {
+    uint32_t count;
+    Dest const *d = where->dests() + where->find(0, count);
+    for (uint32_t j = 0; j != count; j++) {
+      if (entries.size() - start >= max_closure) {
+        entries.resize(start);
+        return false;
+      }
+      entries.push_back({where->target(d[j]), parent, d[j].out_tag,
+                         d[j].out_weight, depth + 1});
+    }
+    if (k == entries.size()) {
+      return true;
+    }
+    where = entries[k].target;
+    parent = k - start;
+    depth = entries[k].depth;
+  }
+}
+
+void
+EpsilonTable::addTransducer(TransExe &t)
+{
+  Node *nodes = t.getNodeList();
+  size_t count = t.getNumberOfNodes();
+  ranges.push_back({reinterpret_cast<uintptr_t>(nodes),
+                    count * sizeof(Node), spans.size()});
+  size_t limit = entries.size() + max_average * count + max_closure;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t begin = entries.size();
+    if (entries.size() < limit && addClosure(nodes + i)) {
+      spans.push_back({begin, static_cast<uint32_t>(entries.size())});
+    } else {
+      spans.push_back({UINT32_MAX, UINT32_MAX});
+    }
+  }
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LT_EPSILON_TABLE_H_
+#define _LT_EPSILON_TABLE_H_
+
+#include <lttoolbox/node.h>
+
+#include <cstdint>
+#include <vector>
+
+class TransExe;
+
+/**
+ * Epsilon closures of the nodes of a set of TransExe, worked out once so
+ * that State does not have to search every node it reaches for epsilon
+ * transitions.  The closure of a node lists the paths the epsilon
+ * transitions lead to in the order of a breadth first search, as a tree:
+ * every path extends the one before it in the list or the node itself.
+ */
+class EpsilonTable
+{
+public:
+  struct Entry
+  {
+    /**
+     * The node the path reaches
+     */
+    Node *target;
+
+    /**
+     * Position in the closure of the path this one extends, -1 for the
+     * node itself
+     */
+    int32_t parent;
+
+    /**
+     * Output of the last transition; an output of 0 adds nothing to the
+     * path, weight included
+     */
+    int32_t out_tag;
+    double out_weight;
+
+    /**
+     * Number of epsilon transitions from the node
+     */
+    uint32_t depth;
+  };
+
+private:
+  /**
+   * Closures larger than this are left to be found at runtime; so are
+   * epsilon loops, which never end
+   */
+  static constexpr size_t max_closure = 64;
+
+  /**
+   * Limit on the paths kept per node on average, beyond which the
+   * closures of the remaining nodes are left out too
+   */
+  static constexpr size_t max_average = 8;
+
+  /**
+   * Node list of a transducer and where its nodes start in spans
+   */
+  struct Range
+  {
+    uintptr_t begin;
+    uintptr_t size;
+    size_t first_node;
+  };
+
+  std::vector<Range> ranges;
+
+  /**
+   * Position of the closure of a node in entries, with begin set to
+   * UINT32_MAX for nodes whose closure is not in the table
+   */
+  struct Span
+  {
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  std::vector<Span> spans;
+  std::vector<Entry> entries;
+
+  /**
+   * Work out the closure of a node at the end of entries
+   * @return false if it is larger than max_closure
+   */
+  bool addClosure(Node *node);
+
+public:
+  void clear();
+
+  /**
+   * Cover the nodes of a transducer
+   */
+  void addTransducer(TransExe &t);
+
+  /**
+   * Epsilon closure of a node
+   * @param node the node
+   * @param begin first path of the closure
+   * @param end past the last path of the closure
+   * @return false if the closure is not in the table
+   */
+  bool find(Node const *node, Entry const *&begin, Entry const *&end) const
+  {
+    uintptr_t where = reinterpret_cast<uintptr_t>(node);
+    for (auto& r : ranges) {
+      uintptr_t diff = where - r.begin;
+      if (diff < r.size) {
+        Span const &span = spans[r.first_node + diff / sizeof(Node)];
+        if (span.begin == UINT32_MAX) {
+          return false;
+        }
+        begin = entries.data() + span.begin;
+        end = entries.data() + span.end;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Bytes taken by the closures
+   */
+  size_t memoryUsage() const
+  {
+    return ranges.capacity() * sizeof(Range) +
+           spans.capacity() * sizeof(Span) +
+           entries.capacity() * sizeof(Entry);
+  }
+};
+
+#endif
@@ -19,6 +19,8 @@
 #include <lttoolbox/expander.h>
 #include <lttoolbox/xml_parse_util.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <libxml/encoding.h>
@@ -49,6 +51,15 @@ Expander::expand(std::string const &file, UFILE* output)
     std::cerr << "Error: Parse error at the end of input." << std::endl;
   }
 
+  if(!batches.empty() && !batches.back().thread.joinable())
+  {
+    closeBatch(output);
+  }
+  while(!batches.empty())
+  {
+    writeBatch(output);
+  }
+
   xmlFreeTextReader(reader);
   xmlCleanupParser();
 }
@@ -61,6 +72,17 @@ Expander::procParDef()
   if(type != XML_READER_TYPE_END_ELEMENT)
   {
     current_paradigm = attrib(Compiler::COMPILER_N_ATTR);
+    // the entries of a paradigm defined again are added to a copy, so
+    // that what used it before keeps what it had then
+    for(auto *paradigms : {&paradigm, &paradigm_lr, &paradigm_rl})
+    {
+      auto it = paradigms->find(current_paradigm);
+      if(it != paradigms->end())
+      {
+        stored.push_back(*it->second);
+        it->second = &stored.back();
+      }
+    }
   }
   else
   {
@@ -357,21 +379,21 @@ Expander::procEntry(UFILE* output)
     return;
   }
 
-  EntList items, items_lr, items_rl;
+  Expansions items, items_lr, items_rl;
   if(attribute == Compiler::COMPILER_RESTRICTION_LR_VAL
    || (!varval.empty() && varval != variant && attribute != Compiler::COMPILER_RESTRICTION_RL_VAL)
    || (!varl.empty() && varl != variant_left))
   {
-    items_lr.push_back(make_pair(""_u, ""_u));
+    items_lr = Expansions::empty_pair();
   }
   else if(attribute == Compiler::COMPILER_RESTRICTION_RL_VAL
         || (!varr.empty() && varr != variant_right))
   {
-    items_rl.push_back(make_pair(""_u, ""_u));
+    items_rl = Expansions::empty_pair();
   }
   else
   {
-    items.push_back(make_pair(""_u, ""_u));
+    items = Expansions::empty_pair();
   }
 
   while(true)
@@ -431,69 +453,68 @@ Expander::procEntry(UFILE* output)
 
       if(attribute == Compiler::COMPILER_RESTRICTION_LR_VAL)
       {
-        if(paradigm[p].size() == 0 && paradigm_lr[p].size() == 0)
+        if(defined(paradigm, p).count == 0 && defined(paradigm_lr, p).count == 0)
         {
           skip(name, Compiler::COMPILER_ENTRY_ELEM);
           return;
         }
-        EntList first = items_lr;
-        append(first, paradigm[p]);
-        append(items_lr, paradigm_lr[p]);
-        items_lr.insert(items_lr.end(), first.begin(), first.end());
+        Expansions first = items_lr;
+        append(first, reference(paradigm, p));
+        append(items_lr, reference(paradigm_lr, p));
+        insert(items_lr, first);
       }
       else if(attribute == Compiler::COMPILER_RESTRICTION_RL_VAL)
       {
-        if(paradigm[p].size() == 0 && paradigm_rl[p].size() == 0)
+        if(defined(paradigm, p).count == 0 && defined(paradigm_rl, p).count == 0)
         {
           skip(name, Compiler::COMPILER_ENTRY_ELEM);
           return;
         }
-        EntList first = items_rl;
-        append(first, paradigm[p]);
-        append(items_rl, paradigm_rl[p]);
-        items_rl.insert(items_rl.end(), first.begin(), first.end());
+        Expansions first = items_rl;
+        append(first, reference(paradigm, p));
+        append(items_rl, reference(paradigm_rl, p));
+        insert(items_rl, first);
       }
       else
       {
-        if(paradigm_lr[p].size() > 0)
+        if(defined(paradigm_lr, p).count > 0)
         {
-          items_lr.insert(items_lr.end(), items.begin(), items.end());
+          insert(items_lr, items);
         }
-        if(paradigm_rl[p].size() > 0)
+        if(defined(paradigm_rl, p).count > 0)
         {
-          items_rl.insert(items_rl.end(), items.begin(), items.end());
+          insert(items_rl, items);
         }
 
-        append(items_lr, paradigm_lr[p]);
-        append(items_rl, paradigm_rl[p]);
-        append(items, paradigm[p]);
+        append(items_lr, reference(paradigm_lr, p));
+        append(items_rl, reference(paradigm_rl, p));
+        append(items, reference(paradigm, p));
       }
     }
     else if(name == Compiler::COMPILER_ENTRY_ELEM && type == XML_READER_TYPE_END_ELEMENT)
     {
       if(current_paradigm.empty())
       {
-        for(auto& it : items)
+        if(batches.empty() || batches.back().thread.joinable())
         {
-          u_fprintf(output, "%S:%S\n", it.first.c_str(), it.second.c_str());
+          batches.emplace_back();
         }
-        for(auto& it : items_lr)
+        Batch &batch = batches.back();
+        for(auto *it : {&items, &items_lr, &items_rl})
         {
-          u_fprintf(output, "%S:>:%S\n", it.first.c_str(), it.second.c_str());
+          batch.count += std::min<size_t>(it->count, 1 << 12);
+          batch.expansions.push_back(std::move(*it));
         }
-        for(auto& it : items_rl)
+        if(batch.count >= 1 << 12)
         {
-          u_fprintf(output, "%S:<:%S\n", it.first.c_str(), it.second.c_str());
+          closeBatch(output);
         }
       }
       else
       {
-        paradigm_lr[current_paradigm].insert(paradigm_lr[current_paradigm].end(),
-                                             items_lr.begin(), items_lr.end());
-        paradigm_rl[current_paradigm].insert(paradigm_rl[current_paradigm].end(),
-                                             items_rl.begin(), items_rl.end());
-        paradigm[current_paradigm].insert(paradigm[current_paradigm].end(),
-                                          items.begin(), items.end());
+        insert(defined(paradigm_lr, current_paradigm), items_lr);
+        insert(defined(paradigm_rl, current_paradigm), items_rl);
+        insert(defined(paradigm, current_paradigm), items);
       }
 
       return;
@@ -594,45 +615,176 @@ Expander::procRegexp()
   return ret;
 }
 
+Expander::Expansions
+Expander::Expansions::empty_pair()
+{
+  Expansions e;
+  e.chains.push_back({Piece()});
+  e.count = 1;
+  return e;
+}
+
+Expander::Expansions &
+Expander::defined(std::map<UString, Expansions *> &paradigms,
+                  UString const &name)
+{
+  Expansions *&e = paradigms[name];
+  if(e == nullptr)
+  {
+    stored.emplace_back();
+    e = &stored.back();
+  }
+  return *e;
+}
+
+Expander::Expansions const &
+Expander::reference(std::map<UString, Expansions *> &paradigms,
+                    UString const &name)
+{
+  Expansions &e = defined(paradigms, name);
+  if(name == current_paradigm)
+  {
+    // only what it has so far, as if it were spelt out now
+    stored.push_back(e);
+    return stored.back();
+  }
+  return e;
+}
+
+void
+Expander::append(Expansions &result,
+                 Expansions const &endings)
+{
+  for(auto& chain : result.chains)
+  {
+    Piece p;
+    p.paradigm = &endings;
+    chain.push_back(p);
+  }
+  if(result.count != 0 && endings.count > SIZE_MAX / result.count)
+  {
+    result.count = SIZE_MAX;
+  }
+  else
+  {
+    result.count *= endings.count;
+  }
+}
+
+void
+Expander::append(Expansions &result, UStringView endings)
+{
+  append(result, std::make_pair(UString(endings), UString(endings)));
+}
+
 void
-Expander::append(EntList &result,
-                 EntList const &endings)
+Expander::append(Expansions &result,
+                 std::pair<UString, UString> const &endings)
+{
+  for(auto& chain : result.chains)
+  {
+    if(chain.back().paradigm != nullptr)
+    {
+      chain.push_back(Piece());
+    }
+    chain.back().fixed.first.append(endings.first);
+    chain.back().fixed.second.append(endings.second);
+  }
+}
+
+void
+Expander::insert(Expansions &result, Expansions const &other)
 {
-  EntList temp;
+  result.chains.insert(result.chains.end(), other.chains.begin(), other.chains.end());
+  result.count = (SIZE_MAX - result.count < other.count ? SIZE_MAX : result.count + other.count);
+}
 
-  for(auto& it : result)
+void
+Expander::spell(std::vector<Piece> const &chain, size_t piece,
+                Rest const *rest, UString &left, UString &right,
+                UStringView separator, UString &text)
+{
+  if(piece == chain.size())
   {
-    for(auto& it2 : endings)
+    if(rest != nullptr)
+    {
+      spell(*rest->chain, rest->piece, rest->next, left, right, separator, text);
+    }
+    else
     {
-      temp.push_back(std::pair<UString, UString>(it.first + it2.first,
-                          it.second + it2.second));
+      text.append(left);
+      text.append(separator);
+      text.append(right);
+      text += '\n';
     }
+    return;
   }
 
-  result = temp;
+  Piece const &p = chain[piece];
+  if(p.paradigm == nullptr)
+  {
+    size_t const l = left.size(), r = right.size();
+    left.append(p.fixed.first);
+    right.append(p.fixed.second);
+    spell(chain, piece + 1, rest, left, right, separator, text);
+    left.resize(l);
+    right.resize(r);
+  }
+  else
+  {
+    Rest const after{&chain, piece + 1, rest};
+    for(auto const &c : p.paradigm->chains)
+    {
+      spell(c, 0, &after, left, right, separator, text);
+    }
+  }
 }
 
 void
-Expander::append(EntList &result, UStringView endings)
+Expander::spellBatch(Batch &batch)
 {
-  for(auto& it : result)
+  static constexpr UStringView separators[] = {u":", u":>:", u":<:"};
+  UString left, right;
+  for(size_t i = 0; i < batch.expansions.size(); i++)
   {
-    it.first.append(endings);
-    it.second.append(endings);
+    for(auto const &chain : batch.expansions[i].chains)
+    {
+      spell(chain, 0, nullptr, left, right, separators[i % 3], batch.text);
+    }
   }
+  batch.expansions.clear();
 }
 
 void
-Expander::append(EntList &result,
-                 std::pair<UString, UString> const &endings)
+Expander::closeBatch(UFILE *output)
 {
-  for(auto& it : result)
+  Batch &batch = batches.back();
+  if(!jobs)
   {
-    it.first.append(endings.first);
-    it.second.append(endings.second);
+    spellBatch(batch);
+    writeBatch(output);
+    return;
+  }
+  batch.thread = std::thread(spellBatch, std::ref(batch));
+  size_t const threads = std::max(1u, std::thread::hardware_concurrency());
+  while(batches.size() > threads)
+  {
+    writeBatch(output);
   }
 }
 
+void
+Expander::writeBatch(UFILE *output)
+{
+  Batch &batch = batches.front();
+  if(batch.thread.joinable())
+  {
+    batch.thread.join();
+  }
+  write(batch.text, output);
+  batches.pop_front();
+}
+
 void
 Expander::setAltValue(UStringView a)
 {
@@ -662,3 +814,9 @@ Expander::setKeepBoundaries(bool keep)
 {
   keep_boundaries = keep;
 }
+
+void
+Expander::setJobs(bool j)
+{
+  jobs = j;
+}
@@ -19,11 +19,12 @@
 
 #include <lttoolbox/ustring.h>
 
+#include <deque>
 #include <map>
 #include <libxml/xmlreader.h>
 #include <string>
-
-typedef std::vector<std::pair<UString, UString> > EntList;
+#include <thread>
+#include <vector>
 
 /**
  * An expander of dictionaries
@@ -72,14 +73,132 @@ private:
    */
   bool keep_boundaries;
 
+  struct Expansions;
+
+  /**
+   * A piece of what an entry expands to: a fixed pair of strings, or
+   * every pair a paradigm expands to
+   */
+  struct Piece
+  {
+    std::pair<UString, UString> fixed;
+    Expansions const *paradigm = nullptr;
+  };
+
+  /**
+   * The pairs of strings an entry or paradigm expands to, kept as the
+   * chains of pieces they are concatenated from instead of spelt out,
+   * which nested paradigms would multiply
+   */
+  struct Expansions
+  {
+    std::vector<std::vector<Piece>> chains;
+
+    /**
+     * The number of pairs, or SIZE_MAX if there are more
+     */
+    size_t count = 0;
+
+    /**
+     * The single empty pair
+     */
+    static Expansions empty_pair();
+  };
+
+  /**
+   * The pieces still to spell after the chain being spelt
+   */
+  struct Rest
+  {
+    std::vector<Piece> const *chain;
+    size_t piece;
+    Rest const *next;
+  };
+
+  /**
+   * Entries to spell out, as their expansions for both directions, for
+   * left to right and for right to left
+   */
+  struct Batch
+  {
+    std::vector<Expansions> expansions;
+    size_t count = 0;
+    UString text;
+    std::thread thread;
+  };
+
   /**
    * Paradigms
    */
-  std::map<UString, EntList> paradigm;
+  std::map<UString, Expansions *> paradigm;
+
+  std::map<UString, Expansions *> paradigm_lr;
+
+  std::map<UString, Expansions *> paradigm_rl;
+
+  /**
+   * Where the paradigms are, with the copies of those that were used
+   * while they were being defined or before being defined again, which
+   * stay as they were for what used them
+   */
+  std::deque<Expansions> stored;
+
+  /**
+   * Spell the entries out on threads of their own
+   */
+  bool jobs = false;
+
+  /**
+   * The batches of entries being spelt out, in the order of the
+   * dictionary, the last one still being filled
+   */
+  std::deque<Batch> batches;
 
-  std::map<UString, EntList> paradigm_lr;
+  /**
+   * Get a paradigm, adding it empty if it is not there
+   * @param paradigms the paradigms of one direction
+   * @param name the name of the paradigm
+   */
+  Expansions & defined(std::map<UString, Expansions *> &paradigms,
+                       UString const &name);
 
-  std::map<UString, EntList> paradigm_rl;
+  /**
+   * Get a paradigm to append, copying it if it is the one being defined
+   * @param paradigms the paradigms of one direction
+   * @param name the name of the paradigm
+   */
+  Expansions const & reference(std::map<UString, Expansions *> &paradigms,
+                               UString const &name);
+
+  /**
+   * Start spelling out the batch being filled, and write out the
+   * batches before it that are done, keeping no more of them than
+   * there are threads
+   * @param output the output stream
+   */
+  void closeBatch(UFILE *output);
+
+  /**
+   * Write out the first batch when it is spelt out
+   * @param output the output stream
+   */
+  void writeBatch(UFILE *output);
+
+  /**
+   * Spell out the entries of a batch into its text
+   */
+  static void spellBatch(Batch &batch);
+
+  /**
+   * Spell out every pair of a chain from one of its pieces on and the
+   * pieces after it
+   * @param left, right the strings spelt so far
+   * @param separator what goes between the two strings of a pair
+   * @param text where the pairs go, one per line
+   */
+  static void spell(std::vector<Piece> const &chain, size_t piece,
+                    Rest const *rest, UString &left, UString &right,
+                    UStringView separator, UString &text);
 
   /**
    * Method to parse an XML Node
@@ -174,10 +293,10 @@ private:
    * Append a list of endings to a list of current transductions.
    * @param result the current partial transductions, and after calling
    *               this method, the result of concatenations.
-   * @param endings the endings to be appended.
+   * @param endings the endings to be appended, which must outlive result
    */
-  static void append(EntList &result,
-                     EntList const &endings);
+  static void append(Expansions &result,
+                     Expansions const &endings);
 
   /**
    * Append a list of endings to a list of current transductions.
@@ -185,7 +304,7 @@ private:
    *               this method, the result of concatenations.
    * @param endings the endings to be appended.
    */
-  static void append(EntList &result, UStringView endings);
+  static void append(Expansions &result, UStringView endings);
 
   /**
    * Append a list of endings to a list of current transductions.
@@ -193,9 +312,16 @@ private:
    *               this method, the result of concatenations.
    * @param endings the endings to be appended.
    */
-  static void append(EntList &result,
+  static void append(Expansions &result,
                      std::pair<UString, UString> const &endings);
 
+  /**
+   * Add the transductions of a list after those of another
+   * @param result the list added to
+   * @param other the list added
+   */
+  static void insert(Expansions &result, Expansions const &other);
+
 public:
   /**
    * Constructor
@@ -242,6 +368,13 @@ public:
    */
    void setKeepBoundaries(bool keep_boundaries = false);
 
+  /**
+   * Set whether to spell out the entries on all the cpu cores, which
+   * still writes them in the order of the dictionary
+   * @param jobs true, false
+   */
+   void setJobs(bool jobs);
+
 };
 
 #endif
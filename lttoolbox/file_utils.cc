@@ -18,7 +18,12 @@
 #include <lttoolbox/file_utils.h>
 #include <lttoolbox/compression.h>
 
+#include <algorithm>
 #include <cstring>
+#include <deque>
+#include <exception>
+#include <sstream>
+#include <thread>
 
 UFILE*
 openOutTextFile(const std::string& fname)
@@ -66,42 +71,240 @@ openInBinFile(const std::string& fname)
 }
 
 void
-writeTransducerSet(FILE* output, UStringView letters,
-                   Alphabet& alpha,
-                   std::map<UString, Transducer>& trans)
+readStateVisits(FILE* input, StateVisits& visits)
 {
-  fwrite_unlocked(HEADER_LTTOOLBOX, 1, 4, output);
-  uint64_t features = 0;
-  write_le(output, features);
+  std::string line;
+  size_t number = 0;
+  int c;
+  do {
+    c = fgetc_unlocked(input);
+    if (c != '\n' && c != EOF) {
+      line += static_cast<char>(c);
+      continue;
+    }
+    number++;
+    if (line.empty()) {
+      continue;
+    }
+    size_t state = line.find('\t');
+    size_t count = (state == std::string::npos ? state : line.find('\t', state + 1));
+    if (count == std::string::npos) {
+      std::cerr << "Error: Malformed profile line " << number << "." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (line.find('\t', count + 1) != std::string::npos) {
+      // a transition, which does not change the layout of the states
+      line.clear();
+      continue;
+    }
+    auto& section = visits[to_ustring(line.substr(0, state).c_str())];
+    size_t n = strtoull(line.c_str() + state + 1, nullptr, 10);
+    if (n >= section.size()) {
+      section.resize(n + 1, 0);
+    }
+    section[n] += strtoull(line.c_str() + count + 1, nullptr, 10);
+    line.clear();
+  } while (c != EOF);
+}
+
+namespace {
+
+uint64_t
+checksum(char const* data, size_t length, uint64_t hash = 14695981039346656037ull)
+{
+  // FNV-1a
+  for (size_t i = 0; i < length; i++) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+void
+readBytes(FILE* input, uint64_t offset, uint64_t length, std::vector<char>& bytes)
+{
+  bytes.resize(length);
+  if (fseek(input, static_cast<long>(offset), SEEK_SET) != 0 ||
+      fread_unlocked(bytes.data(), 1, length, input) != length) {
+    throw std::runtime_error("Failed to read section of transducer");
+  }
+}
+
+void
+copyBytes(FILE* input, FILE* output)
+{
+  rewind(input);
+  char buffer[1 << 16];
+  size_t n;
+  while ((n = fread_unlocked(buffer, 1, sizeof(buffer), input)) > 0) {
+    if (fwrite_unlocked(buffer, 1, n, output) != n) {
+      throw std::runtime_error("Failed to write transducer");
+    }
+  }
+}
+
+void
+verifySection(FILE* input, SectionEntry const& entry)
+{
+  std::vector<char> bytes;
+  readSectionBytes(input, entry, bytes);
+  fseek(input, static_cast<long>(entry.offset), SEEK_SET);
+}
+
+void
+writeACX(FILE* output, ACXMap const& acx)
+{
+  Compression::multibyte_write(acx.size(), output);
+  for (auto& it : acx) {
+    Compression::multibyte_write(it.first, output);
+    Compression::multibyte_write(it.second.size(), output);
+    for (auto c : it.second) {
+      Compression::multibyte_write(c, output);
+    }
+  }
+}
+
+void
+readACXTable(FILE* input, ACXMap* acx)
+{
+  MultibyteReader in(input);
+  for (int len = in.read(); len > 0; len--) {
+    int32_t c = static_cast<int32_t>(in.read());
+    for (int n = in.read(); n > 0; n--) {
+      int32_t equivalent = static_cast<int32_t>(in.read());
+      if (acx) {
+        (*acx)[c].insert(equivalent);
+      }
+    }
+  }
+  in.finish();
+}
 
+void
+writeSections(FILE* output, UStringView letters, Alphabet& alpha,
+              std::map<UString, Transducer>& trans, bool mmap,
+              StateVisits const *visits, SectionDirectory* directory,
+              ACXMap const* acx)
+{
   Compression::string_write(letters, output);
   alpha.write(output);
+  if (acx) {
+    writeACX(output, *acx);
+  }
   Compression::multibyte_write(trans.size(), output);
   for (auto& it : trans) {
     Compression::string_write(it.first, output);
-    it.second.write(output);
+    if (visits && visits->count(it.first)) {
+      it.second.renumber(visits->at(it.first));
+    }
+    long start = (directory ? ftell(output) : 0);
+    if (mmap) {
+      TransExe te;
+      te.build(it.second, alpha);
+      te.write(output);
+    } else {
+      it.second.write(output);
+    }
+    if (directory) {
+      SectionEntry entry;
+      entry.name = it.first;
+      entry.offset = start;
+      entry.length = ftell(output) - start;
+      directory->push_back(entry);
+    }
     std::cout << it.first << " " << it.second.size();
     std::cout << " " << it.second.numberOfTransitions() << std::endl;
   }
 }
 
+}
+
+void
+writeTransducerSet(FILE* output, UStringView letters,
+                   Alphabet& alpha,
+                   std::map<UString, Transducer>& trans, bool mmap,
+                   StateVisits const *visits, bool directory,
+                   ACXMap const* acx)
+{
+  if (acx && acx->empty()) {
+    acx = nullptr;
+  }
+  fwrite_unlocked(HEADER_LTTOOLBOX, 1, 4, output);
+  uint64_t features = 0;
+  if (directory) {
+    features |= LTF_DIRECTORY;
+  }
+  if (acx) {
+    features |= LTF_ACX;
+  }
+  write_le(output, features);
+
+  if (!directory) {
+    writeSections(output, letters, alpha, trans, mmap, visits, nullptr, acx);
+    return;
+  }
+
+  // The sections are written to a temporary file first, as the
+  // directory before them needs their offsets (from the start of the
+  // body, which is aligned like the mapped images in it) and checksums
+  FILE* body = tmpfile();
+  FILE* head = tmpfile();
+  if (!body || !head) {
+    throw std::runtime_error("Failed to create temporary file for the section directory");
+  }
+  SectionDirectory entries;
+  writeSections(body, letters, alpha, trans, mmap, visits, &entries, acx);
+  fflush(body);
+
+  std::vector<char> bytes;
+  Compression::multibyte_write(entries.size(), head);
+  for (auto& entry : entries) {
+    readBytes(body, entry.offset, entry.length, bytes);
+    if (entry.length >= 12 && strncmp(bytes.data(), HEADER_TRANSDUCER, 4) == 0) {
+      fseek(body, static_cast<long>(entry.offset + 4), SEEK_SET);
+      entry.features = read_le<uint64_t>(body);
+    }
+    entry.checksum = checksum(bytes.data(), bytes.size());
+    Compression::string_write(entry.name, head);
+    write_le(head, entry.features);
+    write_le(head, entry.offset);
+    write_le(head, entry.length);
+    write_le(head, entry.checksum);
+  }
+  uint64_t size = 4 + sizeof(features) + ftell(head) + sizeof(uint64_t);
+  uint64_t padding = (sizeof(int64_t) - size % sizeof(int64_t)) % sizeof(int64_t);
+  write_le(head, padding);
+  for (uint64_t i = 0; i < padding; i++) {
+    fputc_unlocked(0, head);
+  }
+
+  copyBytes(head, output);
+  copyBytes(body, output);
+  fclose(head);
+  fclose(body);
+}
+
 void
 writeTransducerSet(FILE* output, const std::set<UChar32>& letters,
                    Alphabet& alpha,
-                   std::map<UString, Transducer>& trans)
+                   std::map<UString, Transducer>& trans, bool mmap,
+                   StateVisits const *visits, bool directory,
+                   ACXMap const* acx)
 {
-  writeTransducerSet(output, UString(letters.begin(), letters.end()), alpha, trans);
+  writeTransducerSet(output, UString(letters.begin(), letters.end()), alpha, trans, mmap, visits, directory, acx);
 }
 
 void
-readShared(FILE* input, std::set<UChar32>& letters, Alphabet& alpha)
+readShared(FILE* input, std::set<UChar32>& letters, Alphabet& alpha,
+           SectionDirectory* directory = nullptr, ACXMap* acx = nullptr)
 {
   fpos_t pos;
+  uint64_t features = 0;
   if (fgetpos(input, &pos) == 0) {
     char header[4]{};
     fread_unlocked(header, 1, 4, input);
     if (strncmp(header, HEADER_LTTOOLBOX, 4) == 0) {
-      auto features = read_le<uint64_t>(input);
+      features = read_le<uint64_t>(input);
       if (features >= LTF_UNKNOWN) {
         throw std::runtime_error("FST has features that are unknown to this version of lttoolbox - upgrade!");
       }
@@ -111,35 +314,701 @@ readShared(FILE* input, std::set<UChar32>& letters, Alphabet& alpha)
     }
   }
 
-  for (int len = Compression::multibyte_read(input); len > 0; len--) {
-    letters.insert(static_cast<UChar32>(Compression::multibyte_read(input)));
+  if (features & LTF_DIRECTORY) {
+    // readers that go through the sections in order just skip it
+    SectionDirectory entries;
+    for (int len = Compression::multibyte_read(input); len > 0; len--) {
+      SectionEntry entry;
+      entry.name = Compression::string_read(input);
+      entry.features = read_le<uint64_t>(input);
+      entry.offset = read_le<uint64_t>(input);
+      entry.length = read_le<uint64_t>(input);
+      entry.checksum = read_le<uint64_t>(input);
+      entries.push_back(entry);
+    }
+    for (uint64_t padding = read_le<uint64_t>(input); padding > 0; padding--) {
+      fgetc_unlocked(input);
+    }
+    if (directory) {
+      uint64_t body = ftell(input);
+      for (auto& entry : entries) {
+        entry.offset += body;
+      }
+      directory->swap(entries);
+    }
   }
 
+  MultibyteReader in(input);
+  for (int len = in.read(); len > 0; len--) {
+    letters.insert(static_cast<UChar32>(in.read()));
+  }
+  in.finish();
+
   alpha.read(input);
+
+  if (features & LTF_ACX) {
+    readACXTable(input, acx);
+  }
+}
+
+int
+readTransducerSetHeader(FILE* input, std::set<UChar32>& letters,
+                        Alphabet& alpha, ACXMap* acx)
+{
+  readShared(input, letters, alpha, nullptr, acx);
+  return Compression::multibyte_read(input);
 }
 
 void
 readTransducerSet(FILE* input, std::set<UChar32>& letters,
                   Alphabet& alpha,
-                  std::map<UString, Transducer>& trans)
+                  std::map<UString, Transducer>& trans, ACXMap* acx)
 {
-  readShared(input, letters, alpha);
+  readShared(input, letters, alpha, nullptr, acx);
 
   for (int len = Compression::multibyte_read(input); len > 0; len--) {
     UString name = Compression::string_read(input);
-    trans[name].read(input);
+    if (TransExe::isMapped(input)) {
+      TransExe te;
+      te.read(input, alpha);
+      te.unpack(trans[name], alpha);
+    } else {
+      trans[name].read(input);
+    }
+  }
+}
+
+namespace {
+
+/**
+ * The length of the transducer at data, found by going through its
+ * numbers without building anything; 0 if it is in the mapped format
+ */
+size_t
+transducerLength(unsigned char const* data, size_t length)
+{
+  size_t header = 0;
+  bool read_weights = false;
+  if (length >= 12 && memcmp(data, HEADER_TRANSDUCER, 4) == 0) {
+    auto features = read_le(data + 4);
+    if (features >= TDF_UNKNOWN || (features & TDF_MMAP)) {
+      return 0;
+    }
+    read_weights = (features & TDF_WEIGHTS);
+    header = 12;
+  }
+  MultibyteReader in(data + header, length - header);
+  in.read();
+  for (unsigned int finals = in.read(); finals > 0; finals--) {
+    in.read();
+    if (read_weights) {
+      in.readDouble();
+    }
+  }
+  unsigned int values[2];
+  for (unsigned int states = in.read(); states > 0; states--) {
+    for (unsigned int n = in.read(); n > 0; n--) {
+      in.read(values, 2);
+      if (read_weights) {
+        in.readDouble();
+      }
+    }
+  }
+  return header + in.consumed();
+}
+
+/**
+ * Find the count sections in the bytes of a dictionary after the number
+ * of them
+ * @return false if any of them is in the mapped format
+ */
+bool
+scanSections(std::vector<unsigned char> const& body, size_t count,
+             SectionDirectory& directory)
+{
+  size_t offset = 0;
+  for (; count > 0 && offset < body.size(); count--) {
+    SectionEntry entry;
+    {
+      MultibyteReader in(body.data() + offset, body.size() - offset);
+      entry.name = in.readString();
+      offset += in.consumed();
+    }
+    entry.offset = offset;
+    entry.length = transducerLength(body.data() + offset, body.size() - offset);
+    if (entry.length == 0) {
+      return false;
+    }
+    offset += entry.length;
+    directory.push_back(entry);
+  }
+  return count == 0;
+}
+
+/**
+ * A transducer decoded into arrays, with the transitions of each state
+ * in the order they are written
+ */
+struct FlatTransducer
+{
+  struct Arc
+  {
+    int32_t tag;
+    int target;
+    double weight;
+  };
+  int initial = 0;
+  std::vector<std::pair<int, double>> finals;
+  std::vector<uint32_t> first; // where the transitions of each state start
+  std::vector<Arc> arcs;
+
+  int states() const
+  {
+    return first.size() - 1;
+  }
+};
+
+/**
+ * Decode the transducer at data, which is not in the mapped format
+ */
+void
+decodeFlat(unsigned char const* data, size_t length, FlatTransducer& t)
+{
+  size_t header = 0;
+  bool read_weights = false;
+  if (length >= 12 && memcmp(data, HEADER_TRANSDUCER, 4) == 0) {
+    read_weights = (read_le(data + 4) & TDF_WEIGHTS);
+    header = 12;
+  }
+  MultibyteReader in(data + header, length - header);
+  t.initial = in.read();
+  int base = 0;
+  double weight = default_weight;
+  for (unsigned int finals = in.read(); finals > 0; finals--) {
+    base += in.read();
+    if (read_weights) {
+      weight = in.readDouble();
+    }
+    t.finals.push_back({base, weight});
+  }
+  int const states = in.read();
+  t.first.assign(1, 0);
+  for (int state = 0; state < states; state++) {
+    int32_t tag = 0;
+    for (unsigned int n = in.read(); n > 0; n--) {
+      tag += in.read();
+      int target = (state + in.read()) % states;
+      if (read_weights) {
+        weight = in.readDouble();
+      }
+      t.arcs.push_back({tag, target, weight});
+    }
+    t.first.push_back(t.arcs.size());
+  }
+}
+
+/**
+ * Write t as Transducer::write() would write it
+ */
+void
+encodeFlat(FlatTransducer const& t, FILE* output)
+{
+  bool write_weights = false;
+  for (auto& it : t.finals) {
+    write_weights = write_weights || it.second != default_weight;
+  }
+  for (auto& it : t.arcs) {
+    write_weights = write_weights || it.weight != default_weight;
+  }
+  uint64_t features = 0;
+  if (write_weights) {
+    features |= TDF_WEIGHTS;
+  }
+  fwrite_unlocked(HEADER_TRANSDUCER, 1, 4, output);
+  write_le(output, features);
+
+  Compression::multibyte_write(t.initial, output);
+  Compression::multibyte_write(t.finals.size(), output);
+  int base = 0;
+  for (auto& it : t.finals) {
+    Compression::multibyte_write(it.first - base, output);
+    base = it.first;
+    if (write_weights) {
+      Compression::long_multibyte_write(it.second, output);
+    }
+  }
+
+  base = t.states();
+  Compression::multibyte_write(base, output);
+  for (int state = 0; state < base; state++) {
+    Compression::multibyte_write(t.first[state + 1] - t.first[state], output);
+    int32_t tagbase = 0;
+    for (uint32_t i = t.first[state]; i < t.first[state + 1]; i++) {
+      auto& arc = t.arcs[i];
+      Compression::multibyte_write(arc.tag - tagbase, output);
+      tagbase = arc.tag;
+      Compression::multibyte_write(arc.target >= state ? arc.target - state
+                                                       : arc.target + base - state,
+                                   output);
+      if (write_weights) {
+        Compression::long_multibyte_write(arc.weight, output);
+      }
+    }
+  }
+}
+
+/**
+ * Renumber the symbols of the transitions of t from the alphabet from
+ * to the alphabet to, as Transducer::updateAlphabet() does, through a
+ * table kept for all the transducers using from; the transitions of
+ * each state are sorted again by their new symbols
+ */
+void
+relabelFlat(FlatTransducer& t, Alphabet const& from, Alphabet& to,
+            bool pairs, std::map<int32_t, int32_t>& table)
+{
+  // the new symbols are added in the order updateAlphabet() adds them
+  std::set<int32_t> labels;
+  std::set<int32_t> symbols;
+  for (auto& it : t.arcs) {
+    if (table.find(it.tag) != table.end() || !labels.insert(it.tag).second) {
+      continue;
+    }
+    if (!pairs) {
+      if (it.tag < 0) {
+        symbols.insert(it.tag);
+      }
+      continue;
+    }
+    auto& pr = from.decode(it.tag);
+    if (pr.first < 0) {
+      symbols.insert(pr.first);
+    }
+    if (pr.second < 0) {
+      symbols.insert(pr.second);
+    }
+  }
+  std::map<int32_t, int32_t> symbol_update;
+  for (auto& it : symbols) {
+    UString s;
+    from.getSymbol(s, it);
+    to.includeSymbol(s);
+    symbol_update[it] = to(s);
+  }
+  for (auto& it : labels) {
+    if (!pairs) {
+      table[it] = (it < 0 ? symbol_update[it] : it);
+      continue;
+    }
+    auto& pr = from.decode(it);
+    int32_t l = (pr.first < 0 ? symbol_update[pr.first] : pr.first);
+    int32_t r = (pr.second < 0 ? symbol_update[pr.second] : pr.second);
+    table[it] = to(l, r);
+  }
+
+  for (auto& it : t.arcs) {
+    it.tag = table[it.tag];
+  }
+  auto const byTag = [](FlatTransducer::Arc const& a, FlatTransducer::Arc const& b) {
+    return a.tag < b.tag;
+  };
+  for (int state = 0; state < t.states(); state++) {
+    auto begin = t.arcs.begin() + t.first[state];
+    auto end = t.arcs.begin() + t.first[state + 1];
+    if (!std::is_sorted(begin, end, byTag)) {
+      std::stable_sort(begin, end, byTag);
+    }
+  }
+}
+
+/**
+ * Make t the union of t and other, by putting the states of other after
+ * those of t and a new initial state after both with epsilon
+ * transitions to their initial states
+ */
+void
+unionFlat(FlatTransducer& t, FlatTransducer const& other)
+{
+  int const offset = t.states();
+  uint32_t const arcs = t.arcs.size();
+  for (size_t i = 1; i < other.first.size(); i++) {
+    t.first.push_back(other.first[i] + arcs);
+  }
+  for (auto& it : other.arcs) {
+    t.arcs.push_back({it.tag, it.target + offset, it.weight});
+  }
+  for (auto& it : other.finals) {
+    t.finals.push_back({it.first + offset, it.second});
+  }
+  t.arcs.push_back({0, t.initial, default_weight});
+  t.arcs.push_back({0, other.initial + offset, default_weight});
+  t.first.push_back(t.arcs.size());
+  t.initial = t.states() - 1;
+}
+
+/**
+ * Call work for 0 up to n on as many threads as there are cores, and
+ * throw the first exception any of the calls threw once all are done
+ */
+void
+onThreads(size_t n, std::function<void(size_t)> const& work)
+{
+  std::vector<std::exception_ptr> errors(n);
+  auto run = [&](size_t i) {
+    try {
+      work(i);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  };
+  size_t max_running = std::max(1u, std::thread::hardware_concurrency());
+  std::deque<std::thread> running;
+  for (size_t i = 0; i < n; i++) {
+    if (running.size() >= max_running) {
+      running.front().join();
+      running.pop_front();
+    }
+    running.emplace_back(run, i);
+  }
+  for (auto& thread : running) {
+    thread.join();
+  }
+  for (auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+/**
+ * Decode the sections in body on as many threads as there are cores,
+ * checking them against their checksums if verify
+ */
+void
+decodeSections(std::vector<unsigned char> const& body,
+               SectionDirectory const& directory, bool verify,
+               Alphabet const& alpha, std::map<UString, TransExe>& trans)
+{
+  std::vector<TransExe*> targets;
+  for (auto& entry : directory) {
+    targets.push_back(&trans[entry.name]);
+  }
+  onThreads(directory.size(), [&](size_t i) {
+    SectionEntry const& entry = directory[i];
+    char const* data = reinterpret_cast<char const*>(body.data()) + entry.offset;
+    if (verify && checksum(data, entry.length) != entry.checksum) {
+      std::ostringstream msg;
+      msg << "Section " << entry.name << " does not match its checksum";
+      throw std::runtime_error(msg.str());
+    }
+    targets[i]->read(body.data() + entry.offset, entry.length, alpha);
+  });
+}
+
+/**
+ * Read the rest of input from start, which it is at
+ */
+bool
+readRest(FILE* input, std::vector<unsigned char>& body)
+{
+  char buffer[1 << 16];
+  size_t n;
+  while ((n = fread_unlocked(buffer, 1, sizeof(buffer), input)) > 0) {
+    body.insert(body.end(), buffer, buffer + n);
+  }
+  return !ferror(input);
+}
+
+/**
+ * Read the letters, the alphabet and the bytes of the sections of a
+ * dictionary, found by going through their numbers
+ */
+void
+readEncoded(FILE* input, std::set<UChar32>& letters, Alphabet& alpha,
+            ACXMap& acx, std::vector<unsigned char>& body,
+            SectionDirectory& sections)
+{
+  int count = readTransducerSetHeader(input, letters, alpha, &acx);
+  if (!readRest(input, body)) {
+    throw std::runtime_error("Failed to read sections of transducer");
+  }
+  if (!scanSections(body, count, sections)) {
+    throw std::runtime_error("A section is in the memory mapped format, which can't be changed without rebuilding it");
+  }
+}
+
+/**
+ * Write the header of a dictionary, up to the number of its sections
+ */
+void
+writeEncodedHeader(FILE* output, std::set<UChar32> const& letters,
+                   Alphabet& alpha, ACXMap const& acx, size_t sections)
+{
+  uint64_t features = 0;
+  if (!acx.empty()) {
+    features |= LTF_ACX;
+  }
+  fwrite_unlocked(HEADER_LTTOOLBOX, 1, 4, output);
+  write_le(output, features);
+  Compression::string_write(UString(letters.begin(), letters.end()), output);
+  alpha.write(output);
+  if (!acx.empty()) {
+    writeACX(output, acx);
+  }
+  Compression::multibyte_write(sections, output);
+}
+
+}
+
+
+void
+appendTransducerSets(FILE* input1, FILE* input2, FILE* output,
+                     bool pairs, bool keep)
+{
+  std::set<UChar32> letters1, letters2;
+  Alphabet alpha1, alpha2;
+  ACXMap acx1, acx2;
+  std::vector<unsigned char> body1, body2;
+  SectionDirectory sections1, sections2;
+  readEncoded(input1, letters1, alpha1, acx1, body1, sections1);
+  readEncoded(input2, letters2, alpha2, acx2, body2, sections2);
+  letters1.insert(letters2.begin(), letters2.end());
+  for (auto& it : acx2) {
+    acx1[it.first].insert(it.second.begin(), it.second.end());
+  }
+
+  // The sections of the first dictionary keep their bytes, as its
+  // alphabet only grows; those of the second are decoded, renumbered
+  // and written again, joined to those of the first of the same name
+  std::map<UString, std::pair<SectionEntry const*, SectionEntry const*>> trans;
+  for (auto& it : sections1) {
+    trans[it.name].first = &it;
+  }
+  for (auto& it : sections2) {
+    if (trans[it.name].first != nullptr && keep) {
+      continue;
+    }
+    trans[it.name].second = &it;
+  }
+  std::map<int32_t, int32_t> table;
+  std::vector<FlatTransducer> joined(trans.size());
+  size_t i = 0;
+  for (auto& it : trans) {
+    SectionEntry const* second = it.second.second;
+    if (second != nullptr) {
+      FlatTransducer& t = joined[i];
+      decodeFlat(body2.data() + second->offset, second->length, t);
+      relabelFlat(t, alpha2, alpha1, pairs, table);
+      if (it.second.first != nullptr) {
+        FlatTransducer first;
+        decodeFlat(body1.data() + it.second.first->offset, it.second.first->length, first);
+        unionFlat(first, t);
+        std::swap(first, t);
+      }
+    }
+    i++;
+  }
+
+  writeEncodedHeader(output, letters1, alpha1, acx1, trans.size());
+  i = 0;
+  for (auto& it : trans) {
+    Compression::string_write(it.first, output);
+    if (it.second.second != nullptr) {
+      encodeFlat(joined[i], output);
+    } else {
+      SectionEntry const* first = it.second.first;
+      fwrite_unlocked(body1.data() + first->offset, 1, first->length, output);
+    }
+    i++;
+  }
+}
+
+void
+relabelTransducerSet(FILE* input, FILE* output,
+                     std::function<int32_t(Alphabet&, int32_t)> const& relabel,
+                     bool keep_acx)
+{
+  std::set<UChar32> letters;
+  Alphabet alpha;
+  ACXMap acx;
+  std::vector<unsigned char> body;
+  SectionDirectory sections;
+  readEncoded(input, letters, alpha, acx, body, sections);
+  if (!keep_acx) {
+    acx.clear();
+  }
+
+  std::vector<FlatTransducer> trans(sections.size());
+  onThreads(sections.size(), [&](size_t i) {
+    decodeFlat(body.data() + sections[i].offset, sections[i].length, trans[i]);
+  });
+  body.clear();
+
+  // asked in the order of the transitions, and only once a symbol, as
+  // relabel may add to the alphabet
+  int32_t const unknown = -2;
+  std::vector<int32_t> table;
+  for (auto& t : trans) {
+    for (auto& arc : t.arcs) {
+      if (static_cast<size_t>(arc.tag) >= table.size()) {
+        table.resize(arc.tag + 1, unknown);
+      }
+      if (table[arc.tag] == unknown) {
+        table[arc.tag] = relabel(alpha, arc.tag);
+      }
+    }
+  }
+
+  auto const byTag = [](FlatTransducer::Arc const& a, FlatTransducer::Arc const& b) {
+    return a.tag < b.tag;
+  };
+  onThreads(trans.size(), [&](size_t i) {
+    FlatTransducer& t = trans[i];
+    uint32_t kept = 0;
+    for (int state = 0; state < t.states(); state++) {
+      uint32_t const start = kept;
+      for (uint32_t j = t.first[state]; j < t.first[state + 1]; j++) {
+        int32_t const tag = table[t.arcs[j].tag];
+        if (tag != -1) {
+          t.arcs[kept] = t.arcs[j];
+          t.arcs[kept].tag = tag;
+          kept++;
+        }
+      }
+      t.first[state] = start;
+      auto begin = t.arcs.begin() + start;
+      auto end = t.arcs.begin() + kept;
+      if (!std::is_sorted(begin, end, byTag)) {
+        std::stable_sort(begin, end, byTag);
+      }
+    }
+    t.first.back() = kept;
+    t.arcs.resize(kept);
+  });
+
+  writeEncodedHeader(output, letters, alpha, acx, sections.size());
+  for (size_t i = 0; i < sections.size(); i++) {
+    Compression::string_write(sections[i].name, output);
+    encodeFlat(trans[i], output);
+    // as writeTransducerSet() tells
+    std::cout << sections[i].name << " " << trans[i].states();
+    std::cout << " " << trans[i].arcs.size() << std::endl;
   }
 }
 
 void
 readTransducerSet(FILE* input, std::set<UChar32>& letters,
                   Alphabet& alpha,
-                  std::map<UString, TransExe>& trans)
+                  std::map<UString, TransExe>& trans, bool jobs,
+                  ACXMap* acx)
 {
-  readShared(input, letters, alpha);
+  SectionDirectory directory;
+  std::vector<unsigned char> body;
+  if (jobs && readSectionDirectory(input, letters, alpha, directory, acx)) {
+    bool mapped = false;
+    uint64_t first = UINT64_MAX;
+    uint64_t last = 0;
+    for (auto& entry : directory) {
+      mapped = mapped || (entry.features & TDF_MMAP);
+      first = std::min(first, entry.offset);
+      last = std::max(last, entry.offset + entry.length);
+    }
+    if (mapped || directory.size() < 2) {
+      // mapped images are not decoded, so there is nothing to share out
+      for (auto& entry : directory) {
+        readSection(input, entry, alpha, trans[entry.name]);
+      }
+      fseek(input, static_cast<long>(last), SEEK_SET);
+      return;
+    }
+    body.resize(last);
+    if (fseek(input, static_cast<long>(first), SEEK_SET) != 0 ||
+        fread_unlocked(body.data() + first, 1, last - first, input) != last - first) {
+      throw std::runtime_error("Failed to read sections of transducer");
+    }
+    // the bytes before the first section are left unused, so that the
+    // offsets of the directory can index the body as they are
+    decodeSections(body, directory, true, alpha, trans);
+    return;
+  }
 
-  for (int len = Compression::multibyte_read(input); len > 0; len--) {
+  readShared(input, letters, alpha, nullptr, acx);
+
+  // going through the numbers first costs about a sixth of decoding
+  // them, more than can be won back with one big section and a small
+  // one, the usual analyser
+  int count = Compression::multibyte_read(input);
+  long start = (jobs && count > 2 ? ftell(input) : -1);
+  if (start >= 0 && readRest(input, body) &&
+      scanSections(body, count, directory)) {
+    decodeSections(body, directory, false, alpha, trans);
+    uint64_t end = directory.back().offset + directory.back().length;
+    fseek(input, start + static_cast<long>(end), SEEK_SET);
+    return;
+  }
+  if (start >= 0) {
+    fseek(input, start, SEEK_SET);
+  }
+
+  for (int len = count; len > 0; len--) {
     UString name = Compression::string_read(input);
     trans[name].read(input, alpha);
   }
 }
+
+bool
+readSectionDirectory(FILE* input, std::set<UChar32>& letters,
+                     Alphabet& alpha, SectionDirectory& directory,
+                     ACXMap* acx)
+{
+  long start = ftell(input);
+  if (start < 0) {
+    return false;
+  }
+  char header[4]{};
+  bool found = false;
+  if (fread_unlocked(header, 1, 4, input) == 4 &&
+      strncmp(header, HEADER_LTTOOLBOX, 4) == 0) {
+    auto features = read_le<uint64_t>(input);
+    found = (features & LTF_DIRECTORY) && features < LTF_UNKNOWN;
+  }
+  if (fseek(input, start, SEEK_SET) != 0 || !found) {
+    return false;
+  }
+  directory.clear();
+  readShared(input, letters, alpha, &directory, acx);
+  return true;
+}
+
+void
+readSectionBytes(FILE* input, SectionEntry const& entry, std::vector<char>& bytes)
+{
+  readBytes(input, entry.offset, entry.length, bytes);
+  if (checksum(bytes.data(), bytes.size()) != entry.checksum) {
+    std::ostringstream msg;
+    msg << "Section " << entry.name << " does not match its checksum";
+    throw std::runtime_error(msg.str());
+  }
+}
+
+void
+readSection(FILE* input, SectionEntry const& entry, Alphabet& alpha,
+            Transducer& trans)
+{
+  if (entry.features & TDF_MMAP) {
+    TransExe te;
+    readSection(input, entry, alpha, te);
+    te.unpack(trans, alpha);
+    return;
+  }
+  verifySection(input, entry);
+  trans.read(input);
+}
+
+void
+readSection(FILE* input, SectionEntry const& entry, Alphabet& alpha,
+            TransExe& trans)
+{
+  verifySection(input, entry);
+  trans.read(input, alpha);
+}
@@ -16,28 +16,153 @@
  */
 
 #ifndef __FILE_UTILS_H__
+#define __FILE_UTILS_H__
 
+#include <lttoolbox/acx.h>
 #include <lttoolbox/alphabet.h>
 #include <lttoolbox/transducer.h>
 #include <lttoolbox/trans_exe.h>
 
+#include <cstdint>
 #include <cstdio>
+#include <functional>
+#include <vector>
+
+/**
+ * Visits to the states of the transducers of a dictionary, by section
+ * name and position of the state, as lt-proc --profile writes them
+ */
+typedef std::map<UString, std::vector<uint64_t>> StateVisits;
+
+/**
+ * Where a section is in a dictionary written with a directory: the
+ * features of its transducer (TD_FEATURES), the position and length of
+ * the transducer and a checksum of its bytes
+ */
+struct SectionEntry
+{
+  UString name;
+  uint64_t features = 0;
+  uint64_t offset = 0;
+  uint64_t length = 0;
+  uint64_t checksum = 0;
+};
+
+typedef std::vector<SectionEntry> SectionDirectory;
 
 UFILE* openOutTextFile(const std::string& fname);
 FILE* openOutBinFile(const std::string& fname);
 FILE* openInBinFile(const std::string& fname);
 
+/**
+ * Read the visits to states written by FSTProcessor::writeProfile(),
+ * skipping those to transitions
+ */
+void readStateVisits(FILE* input, StateVisits& visits);
+
+/**
+ * Write a dictionary; with visits, the transducers it has visits to are
+ * renumbered with them first (see Transducer::renumber()); with
+ * directory, a SectionDirectory is written before the sections so that
+ * readers can seek to each of them; with acx, the equivalence classes
+ * are written for lt-proc to apply at lookup instead of having been
+ * expanded into the transducers, see Transducer::applyACX()
+ */
 void writeTransducerSet(FILE* output, UStringView letters,
                         Alphabet& alpha,
-                        std::map<UString, Transducer>& trans);
+                        std::map<UString, Transducer>& trans,
+                        bool mmap = false,
+                        StateVisits const *visits = nullptr,
+                        bool directory = false,
+                        ACXMap const *acx = nullptr);
 void writeTransducerSet(FILE* output, const std::set<UChar32>& letters,
                         Alphabet& alpha,
-                        std::map<UString, Transducer>& trans);
+                        std::map<UString, Transducer>& trans,
+                        bool mmap = false,
+                        StateVisits const *visits = nullptr,
+                        bool directory = false,
+                        ACXMap const *acx = nullptr);
+/**
+ * Read a dictionary; the equivalence classes it was written with are
+ * read into acx if given and skipped otherwise, as they are by the
+ * other readers
+ */
 void readTransducerSet(FILE* input, std::set<UChar32>& letters,
                        Alphabet& alpha,
-                       std::map<UString, Transducer>& trans);
+                       std::map<UString, Transducer>& trans,
+                       ACXMap* acx = nullptr);
+/**
+ * Append the sections of the dictionary in input2 to those of the one in
+ * input1 and write the result to output, working on the encoded
+ * transducers rather than building them. Those of input1 are copied as
+ * they are; those of input2 have their symbols renumbered through a
+ * table of them. A section in both is kept from input1 with keep, and
+ * otherwise becomes the union of the two under a new initial state,
+ * which is not minimised. Throws std::runtime_error if a section is in
+ * the mapped format
+ * @param pairs false if the transducers are one-sided, as in
+ *        Transducer::updateAlphabet()
+ */
+void appendTransducerSets(FILE* input1, FILE* input2, FILE* output,
+                          bool pairs, bool keep);
+
+/**
+ * Write the dictionary in input to output with the symbol of every
+ * transition replaced by the one relabel gives for it, -1 to drop the
+ * transition, working on the encoded transducers rather than building
+ * them, as many at a time as there are cores. relabel is asked once for
+ * each symbol, in the order the transitions come in, so that it can add
+ * to the alphabet what Transducer::invert() would, numbered the same.
+ * Nothing is minimised. Throws std::runtime_error if a section is in the
+ * mapped format
+ * @param keep_acx write the equivalence classes of input to output
+ */
+void relabelTransducerSet(FILE* input, FILE* output,
+                          std::function<int32_t(Alphabet&, int32_t)> const& relabel,
+                          bool keep_acx);
+
+/**
+ * Read the letters and the alphabet of a dictionary, leaving the input
+ * at the name of its first section
+ * @return how many sections there are
+ */
+int readTransducerSetHeader(FILE* input, std::set<UChar32>& letters,
+                            Alphabet& alpha, ACXMap* acx = nullptr);
+/**
+ * Read a dictionary for processing; with jobs, the sections are decoded
+ * on threads of their own if the input can seek, found through the
+ * directory if the dictionary has one and by going through their
+ * numbers first if not
+ */
 void readTransducerSet(FILE* input, std::set<UChar32>& letters,
                        Alphabet& alpha,
-                       std::map<UString, TransExe>& trans);
+                       std::map<UString, TransExe>& trans,
+                       bool jobs = false, ACXMap* acx = nullptr);
+
+/**
+ * Read the letters, the alphabet and the directory of a dictionary, with
+ * the offsets of the sections made positions in the input
+ * @return false, leaving the input where it was, if the dictionary has
+ *         no directory or the input can't seek
+ */
+bool readSectionDirectory(FILE* input, std::set<UChar32>& letters,
+                          Alphabet& alpha, SectionDirectory& directory,
+                          ACXMap* acx = nullptr);
+
+/**
+ * Read one section of a dictionary listed in its directory, throwing
+ * std::runtime_error if its bytes don't match the checksum
+ */
+void readSection(FILE* input, SectionEntry const& entry, Alphabet& alpha,
+                 Transducer& trans);
+void readSection(FILE* input, SectionEntry const& entry, Alphabet& alpha,
+                 TransExe& trans);
+
+/**
+ * Read the bytes of one section of a dictionary listed in its directory,
+ * throwing std::runtime_error if they don't match the checksum
+ */
+void readSectionBytes(FILE* input, SectionEntry const& entry,
+                      std::vector<char>& bytes);
 
 #endif // __FILE_UTILS_H__
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lttoolbox/final_table.h>
+#include <lttoolbox/trans_exe.h>
+
+#include <algorithm>
+
+void
+FinalTable::clear()
+{
+  ranges.clear();
+  bits.clear();
+  entries.clear();
+}
+
+void
+FinalTable::addTransducer(TransExe &t)
+{
+  size_t first_bit = bits.size() * 64;
+  size_t nodes = t.getNumberOfNodes();
+  ranges.push_back({reinterpret_cast<uintptr_t>(t.getNodeList()),
+                    nodes * sizeof(Node), first_bit});
+  bits.resize((first_bit + nodes + 63) / 64, 0);
+}
+
+void
+FinalTable::addFinals(std::map<Node *, double> const &finals,
+                      unsigned int classes)
+{
+  for (auto& it : finals) {
+    size_t bit = bitOf(it.first);
+    if (bit == SIZE_MAX) {
+      continue;
+    }
+    bits[bit >> 6] |= uint64_t(1) << (bit & 63);
+    entries.push_back({it.first, it.second, classes});
+  }
+
+  // merge the entries of nodes added more than once, the last weight
+  // winning
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](Entry const &a, Entry const &b) {
+                     return a.node < b.node;
+                   });
+  size_t out = 0;
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (out > 0 && entries[out-1].node == entries[i].node) {
+      entries[out-1].weight = entries[i].weight;
+      entries[out-1].classes |= entries[i].classes;
+    } else {
+      entries[out++] = entries[i];
+    }
+  }
+  entries.resize(out);
+}
+
+FinalTable::Entry const *
+FinalTable::find(Node const *node) const
+{
+  if (!isFinal(node)) {
+    return nullptr;
+  }
+  auto pos = std::lower_bound(entries.begin(), entries.end(), node,
+                              [](Entry const &a, Node const *b) {
+                                return a.node < b;
+                              });
+  return (pos != entries.end() && pos->node == node) ? &*pos : nullptr;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LT_FINAL_TABLE_H_
+#define _LT_FINAL_TABLE_H_
+
+#include <lttoolbox/node.h>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+class TransExe;
+
+/**
+ * Final nodes of a set of TransExe, with their weights and the classes
+ * (sections) they belong to.  Every node has one bit telling whether it
+ * is final, found from its position in the node list of its transducer,
+ * so a non-final node is rejected without searching; the weight and
+ * classes of final nodes are kept in a sorted array.
+ */
+class FinalTable
+{
+public:
+  /**
+   * Classes of final nodes, as used by FSTProcessor for the section types
+   */
+  enum Class
+  {
+    fc_inconditional = 1,
+    fc_standard = 2,
+    fc_postblank = 4,
+    fc_preblank = 8
+  };
+
+  struct Entry
+  {
+    Node const *node;
+    double weight;
+    unsigned int classes;
+  };
+
+private:
+  /**
+   * Node list of a transducer and where its bits start in bits
+   */
+  struct Range
+  {
+    uintptr_t begin;
+    uintptr_t size;
+    size_t first_bit;
+  };
+
+  std::vector<Range> ranges;
+  std::vector<uint64_t> bits;
+  std::vector<Entry> entries;
+
+  /**
+   * Bit number of a node, or SIZE_MAX if it is in none of the transducers
+   */
+  size_t bitOf(Node const *node) const
+  {
+    uintptr_t where = reinterpret_cast<uintptr_t>(node);
+    for (auto& r : ranges) {
+      uintptr_t diff = where - r.begin;
+      if (diff < r.size) {
+        return r.first_bit + diff / sizeof(Node);
+      }
+    }
+    return SIZE_MAX;
+  }
+
+public:
+  void clear();
+
+  /**
+   * Cover the nodes of a transducer
+   */
+  void addTransducer(TransExe &t);
+
+  /**
+   * Mark nodes as final, with the weight given and the classes given
+   * added to those they already have; the nodes have to belong to a
+   * transducer added before
+   */
+  void addFinals(std::map<Node *, double> const &finals,
+                 unsigned int classes = 0);
+
+  bool isFinal(Node const *node) const
+  {
+    size_t bit = bitOf(node);
+    return bit != SIZE_MAX && ((bits[bit >> 6] >> (bit & 63)) & 1);
+  }
+
+  /**
+   * Weight and classes of a final node
+   * @return the entry, or nullptr if the node is not final
+   */
+  Entry const * find(Node const *node) const;
+
+  bool empty() const
+  {
+    return entries.empty();
+  }
+
+  /**
+   * Bytes taken by the table
+   */
+  size_t memoryUsage() const
+  {
+    return ranges.capacity() * sizeof(Range) +
+           bits.capacity() * sizeof(uint64_t) +
+           entries.capacity() * sizeof(Entry);
+  }
+};
+
+#endif
@@ -21,28 +21,436 @@
 #include <lttoolbox/file_utils.h>
 #include <lttoolbox/stream_reader.h>
 #include <lttoolbox/string_utils.h>
+#include <lttoolbox/simd.h>
 #include <lttoolbox/symbol_iter.h>
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <sstream>
+#include <thread>
 #include <cerrno>
+#include <cinttypes>
 #include <climits>
+#include <unicode/utf16.h>
 
+namespace {
 
-FSTProcessor::FSTProcessor()
+/**
+ * Adds the time from its construction to its destruction to a counter of
+ * an FSTStats, if there is one
+ */
+class StatsTimer
+{
+private:
+  std::atomic<uint64_t> *total = nullptr;
+  std::chrono::steady_clock::time_point start;
+
+public:
+  StatsTimer(FSTStats *stats, std::atomic<uint64_t> FSTStats::*counter)
+  {
+    if(stats != nullptr)
+    {
+      total = &(stats->*counter);
+      start = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~StatsTimer()
+  {
+    if(total != nullptr)
+    {
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      total->fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                       std::memory_order_relaxed);
+    }
+  }
+};
+
+/**
+ * str as the contents of a JSON string
+ */
+std::string
+jsonEscaped(std::string const &str)
+{
+  std::string result;
+  for(unsigned char c : str)
+  {
+    if(c == '"' || c == '\\')
+    {
+      result += '\\';
+      result += c;
+    }
+    else if(c < 0x20)
+    {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      result += code;
+    }
+    else
+    {
+      result += c;
+    }
+  }
+  return result;
+}
+
+/**
+ * Upper bound in nanoseconds of a bucket of FSTStats::latency
+ */
+uint64_t
+latencyBound(size_t bucket)
+{
+  if(bucket < 4)
+  {
+    return bucket;
+  }
+  int const shift = bucket / 4 - 2;
+  return ((uint64_t(5 + bucket % 4) << shift) - 1);
+}
+
+}
+
+void
+FSTStats::addLatency(uint64_t ns)
+{
+  size_t bucket = ns;
+  if(ns >= 4)
+  {
+    // two bits after the highest one
+    int high = 2;
+    while((ns >> (high + 1)) != 0)
+    {
+      high++;
+    }
+    bucket = 4 * high + ((ns >> (high - 2)) & 3);
+  }
+  latency[bucket].fetch_add(1, std::memory_order_relaxed);
+  if(slow_token != 0 && ns >= slow_token)
+  {
+    slow_tokens.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+uint64_t
+FSTStats::latencyQuantile(double q) const
+{
+  uint64_t total = 0;
+  for(auto &bucket : latency)
+  {
+    total += bucket;
+  }
+  uint64_t const target = static_cast<uint64_t>(q * total);
+  uint64_t seen = 0;
+  for(size_t i = 0; i != latency_buckets; i++)
+  {
+    seen += latency[i];
+    if(seen > target)
+    {
+      return latencyBound(i);
+    }
+  }
+  return 0;
+}
+
+void
+FSTStats::write(FILE *output, bool json) const
+{
+  uint64_t const steps = state.steps;
+  double const mean = steps == 0 ? 0.0 : static_cast<double>(state.paths) / steps;
+  if(json)
+  {
+    fprintf(output, "{\"characters\": %" PRIu64 ", \"tokens\": %" PRIu64
+            ", \"unknown\": %" PRIu64 ", \"steps\": %" PRIu64
+            ", \"mean_paths\": %.3f, \"max_paths\": %" PRIu64
+            ", \"epsilon_paths\": %" PRIu64 ", \"output_bytes\": %" PRIu64
+            ", \"read_seconds\": %.6f, \"step_seconds\": %.6f"
+            ", \"filter_seconds\": %.6f, \"output_seconds\": %.6f"
+            ", \"token_p50_seconds\": %.9f, \"token_p99_seconds\": %.9f"
+            ", \"token_p999_seconds\": %.9f, \"slow_tokens\": %" PRIu64 "}\n",
+            characters.load(), tokens.load(), unknown.load(), steps, mean,
+            state.max_paths.load(), state.epsilon_paths.load(),
+            state.output_bytes.load(), read_time / 1e9, step_time / 1e9,
+            filter_time / 1e9, output_time / 1e9, latencyQuantile(0.5) / 1e9,
+            latencyQuantile(0.99) / 1e9, latencyQuantile(0.999) / 1e9,
+            slow_tokens.load());
+  }
+  else
+  {
+    fprintf(output, "characters:     %" PRIu64 "\n", characters.load());
+    fprintf(output, "tokens:         %" PRIu64 "\n", tokens.load());
+    fprintf(output, "unknown:        %" PRIu64 "\n", unknown.load());
+    fprintf(output, "steps:          %" PRIu64 "\n", steps);
+    fprintf(output, "active paths:   %.3f mean, %" PRIu64 " max\n", mean,
+            state.max_paths.load());
+    fprintf(output, "epsilon paths:  %" PRIu64 "\n", state.epsilon_paths.load());
+    fprintf(output, "output bytes:   %" PRIu64 "\n", state.output_bytes.load());
+    fprintf(output, "read time:      %.6f s\n", read_time / 1e9);
+    fprintf(output, "step time:      %.6f s\n", step_time / 1e9);
+    fprintf(output, "filter time:    %.6f s\n", filter_time / 1e9);
+    fprintf(output, "output time:    %.6f s\n", output_time / 1e9);
+    fprintf(output, "token time:     %.9f s p50, %.9f s p99, %.9f s p999\n",
+            latencyQuantile(0.5) / 1e9, latencyQuantile(0.99) / 1e9,
+            latencyQuantile(0.999) / 1e9);
+    fprintf(output, "slow tokens:    %" PRIu64 "\n", slow_tokens.load());
+  }
+  fflush(output);
+}
+
+void
+FSTStats::reset()
+{
+  for(auto counter : {&state.steps, &state.paths, &state.max_paths,
+                      &state.epsilon_paths, &state.output_bytes, &characters,
+                      &tokens, &unknown, &read_time, &step_time,
+                      &filter_time, &output_time, &slow_tokens})
+  {
+    counter->store(0);
+  }
+  for(auto &bucket : latency)
+  {
+    bucket.store(0);
+  }
+}
+
+uint64_t
+FSTMemoryReport::dictionary() const
+{
+  uint64_t total = alphabet + finals + epsilon_table + initial_state +
+                   char_sets + restore_chars + composition;
+  for(auto &section : sections)
+  {
+    total += section.bytes;
+  }
+  return total;
+}
+
+uint64_t
+FSTMemoryReport::session() const
+{
+  return states + input_buffer + queues + caches + scratch;
+}
+
+void
+FSTMemoryReport::write(FILE *output, bool json) const
+{
+  if(json)
+  {
+    fprintf(output, "{\"dictionary_bytes\": %" PRIu64 ", \"sections\": [",
+            dictionary());
+    for(size_t i = 0; i < sections.size(); i++)
+    {
+      std::string name;
+      for(char c : sections[i].name)
+      {
+        if(c == '"' || c == '\\')
+        {
+          name += '\\';
+        }
+        name += c;
+      }
+      fprintf(output, "%s{\"name\": \"%s\", \"nodes\": %" PRIu64
+              ", \"bytes\": %" PRIu64 ", \"mapped_bytes\": %" PRIu64 "}",
+              i > 0 ? ", " : "", name.c_str(), sections[i].nodes,
+              sections[i].bytes, sections[i].mapped);
+    }
+    fprintf(output, "], \"alphabet\": %" PRIu64 ", \"finals\": %" PRIu64
+            ", \"epsilon_table\": %" PRIu64 ", \"initial_state\": %" PRIu64
+            ", \"char_sets\": %" PRIu64 ", \"restore_chars\": %" PRIu64
+            ", \"composition\": %" PRIu64 ", \"session_bytes\": %" PRIu64
+            ", \"states\": %" PRIu64 ", \"input_buffer\": %" PRIu64
+            ", \"queues\": %" PRIu64 ", \"caches\": %" PRIu64
+            ", \"scratch\": %" PRIu64 "}\n",
+            alphabet, finals, epsilon_table, initial_state, char_sets,
+            restore_chars, composition, session(), states, input_buffer,
+            queues, caches, scratch);
+  }
+  else
+  {
+    fprintf(output, "dictionary:     %" PRIu64 " bytes\n", dictionary());
+    for(auto &section : sections)
+    {
+      fprintf(output, "  %s: %" PRIu64 " nodes, %" PRIu64 " bytes",
+              section.name.c_str(), section.nodes, section.bytes);
+      if(section.mapped > 0)
+      {
+        fprintf(output, ", %" PRIu64 " bytes mapped", section.mapped);
+      }
+      fprintf(output, "\n");
+    }
+    fprintf(output, "  alphabet:     %" PRIu64 " bytes\n", alphabet);
+    fprintf(output, "  finals:       %" PRIu64 " bytes\n", finals);
+    fprintf(output, "  epsilons:     %" PRIu64 " bytes\n", epsilon_table);
+    fprintf(output, "  initial:      %" PRIu64 " bytes\n", initial_state);
+    fprintf(output, "  char sets:    %" PRIu64 " bytes\n", char_sets);
+    fprintf(output, "  restoration:  %" PRIu64 " bytes\n", restore_chars);
+    fprintf(output, "  composition:  %" PRIu64 " bytes\n", composition);
+    fprintf(output, "session:        %" PRIu64 " bytes\n", session());
+    fprintf(output, "  states:       %" PRIu64 " bytes\n", states);
+    fprintf(output, "  input buffer: %" PRIu64 " bytes\n", input_buffer);
+    fprintf(output, "  queues:       %" PRIu64 " bytes\n", queues);
+    fprintf(output, "  caches:       %" PRIu64 " bytes\n", caches);
+    fprintf(output, "  scratch:      %" PRIu64 " bytes\n", scratch);
+  }
+  fflush(output);
+}
+
+
+void
+FSTDictionary::reportMemory(FSTMemoryReport &report) const
+{
+  // a node of a std::map or std::set holds the value, three pointers
+  // and the colour
+  auto const map_bytes = [](auto const &map) -> uint64_t {
+    return map.size() * (sizeof(*map.begin()) + 4 * sizeof(void *));
+  };
+
+  for(auto &it : transducers)
+  {
+    std::ostringstream name;
+    name << it.first;
+    FSTMemoryReport::Section section;
+    section.name = name.str();
+    section.nodes = it.second.getNumberOfNodes();
+    section.bytes = it.second.memoryUsage();
+    section.mapped = it.second.mappedSize();
+    report.sections.push_back(section);
+  }
+
+  report.alphabet = alphabet.memoryUsage();
+  report.finals = map_bytes(inconditional) + map_bytes(standard) +
+                  map_bytes(postblank) + map_bytes(preblank) +
+                  map_bytes(all_finals) + final_table.memoryUsage();
+  report.epsilon_table = epsilon_table.memoryUsage();
+  report.initial_state = initial_state.memoryUsage();
+  report.char_sets = alphabetic_chars.memoryUsage() +
+                     word_chars.memoryUsage() + escaped_chars.memoryUsage() +
+                     ignored_chars.memoryUsage();
+  for(auto &chars : reachable_chars)
+  {
+    report.char_sets += sizeof(CharSet) + chars.memoryUsage();
+  }
+  report.restore_chars = map_bytes(rcx_map) + map_bytes(rcx_alternatives);
+  for(auto &it : rcx_map)
+  {
+    report.restore_chars += map_bytes(it.second);
+  }
+  report.restore_chars += map_bytes(acx_map);
+  for(auto &it : acx_map)
+  {
+    report.restore_chars += it.second.capacity() * sizeof(int32_t);
+  }
+  for(auto &it : rcx_alternatives)
+  {
+    report.restore_chars += (it.second.exact.capacity() +
+                             it.second.folded.capacity()) * sizeof(int32_t);
+  }
+  if(composition != nullptr)
+  {
+    FSTMemoryReport composed;
+    composition->reportMemory(composed);
+    report.composition = composed.dictionary() +
+                         composition_tags.capacity() * sizeof(int32_t);
+  }
+}
+
+void
+FSTDictionary::buildAlternatives()
+{
+  // what the characters of the input may stand for besides themselves
+  std::map<int, std::set<int>> equivalents;
+  for(auto &it : acx_map)
+  {
+    for(auto c : it.second)
+    {
+      if(c != it.first)
+      {
+        equivalents[c].insert(it.first);
+      }
+    }
+  }
+  std::set<int> chars;
+  for(auto &it : rcx_map)
+  {
+    chars.insert(it.first);
+  }
+  for(auto &it : equivalents)
+  {
+    chars.insert(it.first);
+    UChar32 upper = u_toupper(it.first);
+    if(upper != it.first && u_tolower(upper) == it.first)
+    {
+      chars.insert(upper);
+    }
+  }
+
+  std::set<int> const none;
+  auto const lookup = [&none](std::map<int, std::set<int>> const &map,
+                              int c) -> std::set<int> const & {
+    auto it = map.find(c);
+    return it == map.end() ? none : it->second;
+  };
+  rcx_alternatives.clear();
+  for(auto c : chars)
+  {
+    auto &alts = rcx_alternatives[c];
+    std::set<int> const &equiv = lookup(equivalents, c);
+    alts.exact.assign(equiv.begin(), equiv.end());
+    alts.folded = alts.exact;
+    alts.exact_equivalents = equiv.size();
+    alts.folded_equivalents = equiv.size();
+    std::set<int> const &restored = lookup(rcx_map, c);
+    std::set<int> folded = restored;
+    if(u_isupper(c))
+    {
+      UChar32 lower = u_tolower(c);
+      folded.insert(lower);
+      folded.insert(lookup(equivalents, lower).begin(),
+                    lookup(equivalents, lower).end());
+      folded.insert(lookup(rcx_map, lower).begin(),
+                    lookup(rcx_map, lower).end());
+    }
+    for(auto r : restored)
+    {
+      if(equiv.find(r) == equiv.end())
+      {
+        alts.exact.push_back(r);
+      }
+    }
+    for(auto r : folded)
+    {
+      if(equiv.find(r) == equiv.end())
+      {
+        alts.folded.push_back(r);
+      }
+    }
+  }
+}
+
+FSTDictionary::FSTDictionary()
 {
-  // escaped_chars chars
-  escaped_chars.insert('[');
-  escaped_chars.insert(']');
-  escaped_chars.insert('{');
-  escaped_chars.insert('}');
-  escaped_chars.insert('^');
-  escaped_chars.insert('$');
-  escaped_chars.insert('/');
-  escaped_chars.insert('\\');
-  escaped_chars.insert('@');
-  escaped_chars.insert('<');
-  escaped_chars.insert('>');
+  escaped_units = u"[]{}^$/\\@<>";
+  for(auto c : escaped_units)
+  {
+    escaped_chars.insert(c);
+  }
 
+  // what u_isalnum() accepts
+  u_enumCharTypes([](const void *context, UChar32 start, UChar32 limit,
+                     UCharCategory type) {
+    if ((U_MASK(type) & (U_GC_L_MASK | U_GC_ND_MASK)) != 0) {
+      CharSet *chars = static_cast<CharSet *>(const_cast<void *>(context));
+      for (UChar32 c = start; c < limit; c++) {
+        chars->insert(c);
+      }
+    }
+    return static_cast<UBool>(true);
+  }, &word_chars);
+}
+
+FSTProcessor::FSTProcessor() :
+dict(std::make_shared<FSTDictionary>())
+{
   if(useDefaultIgnoredChars)
   {
     initDefaultIgnoredCharacters();
@@ -56,17 +464,29 @@ FSTProcessor::streamError()
 }
 
 void
-FSTProcessor::maybeFlush(UFILE* output, bool at_null)
+FSTProcessor::modifyDictionary()
+{
+  if(dict.use_count() > 1)
+  {
+    throw Exception("Error: Cannot modify a dictionary shared with other processors.");
+  }
+  clearCaches();
+}
+
+void
+FSTProcessor::maybeFlush(OutputBuffer& output, bool at_null)
 {
   if (at_null) {
-    u_fputc('\0', output);
-    u_fflush(output);
+    output.put('\0');
+    output.flush();
+    writeStats();
   }
 }
 
 void
 FSTProcessor::parseICX(std::string const &file)
 {
+  modifyDictionary();
   if(useIgnoredChars)
   {
     reader = xmlReaderForFile(file.c_str(), NULL, 0);
@@ -82,7 +502,7 @@ FSTProcessor::parseICX(std::string const &file)
       ret = xmlTextReaderRead(reader);
     }
     // No point trying to process ignored chars if there are none
-    if(ignored_chars.size() == 0)
+    if(dict->ignored_chars.size() == 0)
     {
       useIgnoredChars = false;
     }
@@ -92,6 +512,7 @@ FSTProcessor::parseICX(std::string const &file)
 void
 FSTProcessor::parseRCX(std::string const &file)
 {
+  modifyDictionary();
   if(useRestoreChars)
   {
     reader = xmlReaderForFile(file.c_str(), NULL, 0);
@@ -106,6 +527,7 @@ FSTProcessor::parseRCX(std::string const &file)
       procNodeRCX();
       ret = xmlTextReaderRead(reader);
     }
+    dict->buildAlternatives();
   }
 }
 
@@ -123,7 +545,7 @@ FSTProcessor::procNodeICX()
   }
   else if(name == XML_CHAR_ELEM)
   {
-    ignored_chars.insert(static_cast<int32_t>(XMLParseUtil::attrib(reader, XML_VALUE_ATTR)[0]));
+    dict->ignored_chars.insert(static_cast<int32_t>(XMLParseUtil::attrib(reader, XML_VALUE_ATTR)[0]));
   }
   else if(name == XML_COMMENT_NODE)
   {
@@ -140,7 +562,7 @@ FSTProcessor::procNodeICX()
 void
 FSTProcessor::initDefaultIgnoredCharacters()
 {
-  ignored_chars.insert(173); // '\u00AD', soft hyphen
+  dict->ignored_chars.insert(173); // '\u00AD', soft hyphen
 }
 
 void
@@ -161,7 +583,7 @@ FSTProcessor::procNodeRCX()
   }
   else if(name == XML_RESTORE_CHAR_ELEM)
   {
-    rcx_map[rcx_current_char].insert(static_cast<int32_t>(XMLParseUtil::attrib(reader, XML_VALUE_ATTR)[0]));
+    dict->rcx_map[rcx_current_char].insert(static_cast<int32_t>(XMLParseUtil::attrib(reader, XML_VALUE_ATTR)[0]));
   }
   else if(name == XML_COMMENT_NODE)
   {
@@ -193,18 +615,22 @@ FSTProcessor::readAnalysis(InputFile& input)
   } else if(val == U_EOF) {
     val = 0;
   }
+  if(stats != nullptr)
+  {
+    stats->characters.fetch_add(1, std::memory_order_relaxed);
+  }
 
-  while ((useIgnoredChars || useDefaultIgnoredChars) && ignored_chars.find(val) != ignored_chars.end())
+  while ((useIgnoredChars || useDefaultIgnoredChars) && dict->ignored_chars.contains(val))
   {
     val = input.get();
   }
 
-  if(escaped_chars.find(val) != escaped_chars.end())
+  if(dict->escaped_chars.contains(val))
   {
     switch(val)
     {
       case '<':
-        altval = alphabet(input.readBlock('<', '>'));
+        altval = dict->alphabet(input.readBlock('<', '>'));
         input_buffer.add(altval);
         return altval;
 
@@ -257,12 +683,12 @@ FSTProcessor::readTMAnalysis(InputFile& input)
     return 0;
   }
 
-  if(escaped_chars.find(val) != escaped_chars.end() || u_isdigit(val))
+  if(dict->escaped_chars.contains(val) || u_isdigit(val))
   {
     switch(val)
     {
       case '<':
-        altval = alphabet(input.readBlock('<', '>'));
+        altval = dict->alphabet(input.readBlock('<', '>'));
         input_buffer.add(altval);
         return altval;
 
@@ -305,9 +731,9 @@ FSTProcessor::readTMAnalysis(InputFile& input)
             val = input.get();
           } while(u_isdigit(val));
           input.unget(val);
-          input_buffer.add(alphabet(u"<n>"));
-          numbers.push_back(ws);
-          return alphabet(u"<n>");
+          input_buffer.add(dict->alphabet(u"<n>"));
+          input_numbers[input_buffer.getPos()-1] = ws;
+          return dict->alphabet(u"<n>");
         }
         break;
 
@@ -323,7 +749,8 @@ FSTProcessor::readTMAnalysis(InputFile& input)
 bool
 FSTProcessor::readTransliterationBlank(InputFile& input)
 {
-  UString blank;
+  UString &blank = transliteration_blank;
+  blank.clear();
   while (!input.eof()) {
     UChar32 c = input.get();
     if (u_isspace(c)) {
@@ -356,13 +783,12 @@ FSTProcessor::readTransliterationWord(InputFile& input)
   }
 
   UString wblank;
-  std::vector<int32_t> word;
   if (input.peek() == '[') {
     input.get();
     wblank = input.finishWBlank();
     while (!input.eof()) {
       if (readTransliterationBlank(input)) {
-        word.push_back(static_cast<int32_t>(' '));
+        transliteration_queue.add(static_cast<int32_t>(' '));
         if (input.peek() == '[') break;
       } else {
         UChar32 c = input.get();
@@ -370,14 +796,14 @@ FSTProcessor::readTransliterationWord(InputFile& input)
           input.unget(c);
           break;
         } else if (c == '\\') {
-          word.push_back(static_cast<int32_t>(input.get()));
+          transliteration_queue.add(static_cast<int32_t>(input.get()));
         } else if (c == '<') {
-          word.push_back(alphabet(input.readBlock('<', '>')));
+          transliteration_queue.add(dict->alphabet(input.readBlock('<', '>')));
         } else if (c == '\0') {
           input.unget(c);
           break;
         } else {
-          word.push_back(static_cast<int32_t>(c));
+          transliteration_queue.add(static_cast<int32_t>(c));
         }
       }
     }
@@ -392,29 +818,28 @@ FSTProcessor::readTransliterationWord(InputFile& input)
         input.unget(c);
         break;
       } else if (c == '\\') {
-        word.push_back(static_cast<int32_t>(input.get()));
+        transliteration_queue.add(static_cast<int32_t>(input.get()));
       } else if (c == '<') {
-        word.push_back(alphabet(input.readBlock('<', '>')));
+        transliteration_queue.add(dict->alphabet(input.readBlock('<', '>')));
       } else {
-        word.push_back(static_cast<int32_t>(c));
+        transliteration_queue.add(static_cast<int32_t>(c));
       }
     }
   }
-  if (word.empty()) {
+  if (!transliteration_queue.finish()) {
     return false;
   }
-  wblankqueue.push_back(wblank);
-  transliteration_queue.push_back(word);
+  wblankqueue.push(wblank);
 
   return true;
 }
 
 void
-FSTProcessor::flushBlanks(UFILE *output)
+FSTProcessor::flushBlanks(OutputBuffer& output)
 {
   for(size_t i = blankqueue.size(); i > 0; i--)
   {
-    write(blankqueue.front(), output);
+    output.write(blankqueue.front());
     blankqueue.pop();
   }
 }
@@ -422,35 +847,38 @@ FSTProcessor::flushBlanks(UFILE *output)
 void
 FSTProcessor::calcInitial()
 {
-  for(auto& it : transducers) {
-    root.addTransition(0, 0, it.second.getInitial(), default_weight);
+  dict->epsilon_table.clear();
+  for(auto& it : dict->transducers) {
+    dict->root.addTransition(0, 0, it.second.getInitial(), dict->default_weight);
+    dict->epsilon_table.addTransducer(it.second);
   }
 
-  initial_state.init(&root);
+  dict->initial_state.setEpsilonTable(&dict->epsilon_table);
+  dict->initial_state.init(&dict->root);
 }
 
 void
 FSTProcessor::classifyFinals()
 {
-  for(auto& it : transducers) {
+  for(auto& it : dict->transducers) {
     if(StringUtils::endswith(it.first, u"@inconditional"))
     {
-      inconditional.insert(it.second.getFinals().begin(),
+      dict->inconditional.insert(it.second.getFinals().begin(),
                            it.second.getFinals().end());
     }
     else if(StringUtils::endswith(it.first, u"@standard"))
     {
-      standard.insert(it.second.getFinals().begin(),
+      dict->standard.insert(it.second.getFinals().begin(),
                       it.second.getFinals().end());
     }
     else if(StringUtils::endswith(it.first, u"@postblank"))
     {
-      postblank.insert(it.second.getFinals().begin(),
+      dict->postblank.insert(it.second.getFinals().begin(),
                        it.second.getFinals().end());
     }
     else if(StringUtils::endswith(it.first, u"@preblank"))
     {
-      preblank.insert(it.second.getFinals().begin(),
+      dict->preblank.insert(it.second.getFinals().begin(),
                       it.second.getFinals().end());
     }
     else
@@ -462,43 +890,163 @@ FSTProcessor::classifyFinals()
   }
 }
 
+void
+FSTProcessor::buildFinalTable()
+{
+  dict->final_table.clear();
+  for(auto& it : dict->transducers)
+  {
+    dict->final_table.addTransducer(it.second);
+  }
+  dict->final_table.addFinals(dict->all_finals);
+  dict->final_table.addFinals(dict->inconditional, FinalTable::fc_inconditional);
+  dict->final_table.addFinals(dict->standard, FinalTable::fc_standard);
+  dict->final_table.addFinals(dict->postblank, FinalTable::fc_postblank);
+  dict->final_table.addFinals(dict->preblank, FinalTable::fc_preblank);
+}
+
 UString
 FSTProcessor::filterFinals(const State& state, UStringView casefrom)
 {
+  if(dict->composition != nullptr)
+  {
+    return composeFinals(state, casefrom);
+  }
+  StatsTimer timer(stats, &FSTStats::filter_time);
   bool firstupper = false, uppercase = false;
   if (!dictionaryCase) {
     firstupper = u_isupper(casefrom[0]);
     uppercase = (casefrom.size() > 1 &&
                  firstupper && u_isupper(casefrom[casefrom.size()-1]));
   }
-  return state.filterFinals(all_finals, alphabet, escaped_chars,
+  return state.filterFinals(dict->final_table, dict->alphabet, dict->escaped_chars,
                             displayWeightsMode, maxAnalyses, maxWeightClasses,
                             uppercase, firstupper, 0);
 }
 
+template <bool sao>
+UString
+FSTProcessor::analysisFinals(const State& state, UStringView casefrom)
+{
+  if(!sao)
+  {
+    return filterFinals(state, casefrom);
+  }
+  StatsTimer timer(stats, &FSTStats::filter_time);
+  bool firstupper = !casefrom.empty() && u_isupper(casefrom[0]);
+  bool uppercase = firstupper && u_isupper(casefrom.back());
+  return state.filterFinalsSAO(dict->final_table, dict->alphabet,
+                               dict->escaped_chars, uppercase, firstupper);
+}
+
+UString
+FSTProcessor::composeFinals(State const &state, UStringView casefrom)
+{
+  StatsTimer timer(stats, &FSTStats::filter_time);
+  FSTDictionary const &g = *dict->composition;
+  bool firstupper = false, uppercase = false;
+  if (!dictionaryCase) {
+    firstupper = u_isupper(casefrom[0]);
+    uppercase = (casefrom.size() > 1 &&
+                 firstupper && u_isupper(casefrom[casefrom.size()-1]));
+  }
+
+  std::vector<State::FinalPath> paths, outputs;
+  state.finalPaths(dict->final_table, paths);
+  std::vector<UString> candidates;
+  std::vector<std::pair<double, size_t>> costs;
+  UString key;
+  for (auto& path : paths) {
+    // the output in the symbols of g, two code units a symbol
+    key.clear();
+    bool known = true;
+    for (auto sym : path.symbols) {
+      if (sym < 0) {
+        sym = dict->composition_tags[-1 - sym];
+        known = known && sym != 0;
+      }
+      key += static_cast<UChar>(static_cast<uint32_t>(sym) >> 16);
+      key += static_cast<UChar>(sym & 0xFFFF);
+    }
+    if (!known) continue;
+    auto cached = composition_cache.find(key);
+    if (cached != nullptr) {
+      outputs = *cached;
+    } else {
+      State s = g.initial_state;
+      for (size_t i = 0; i < key.size() && s.size() != 0; i += 2) {
+        s.step(static_cast<int32_t>((static_cast<uint32_t>(key[i]) << 16) | key[i+1]));
+      }
+      s.finalPaths(g.final_table, outputs);
+      size_t bytes = 0;
+      for (auto& out : outputs) {
+        bytes += sizeof(out) + out.symbols.size() * sizeof(int32_t);
+      }
+      composition_cache.insert(key, outputs, bytes);
+    }
+    for (auto& out : outputs) {
+      UString temp;
+      for (auto sym : out.symbols) {
+        if (dict->escaped_chars.contains(sym)) temp += '\\';
+        g.alphabet.getSymbol(temp, sym, path.dirty && uppercase);
+      }
+      if (path.dirty && firstupper && !temp.empty()) {
+        size_t loc = (temp[0] == '~' && temp.size() > 1) ? 1 : 0; // skip post-generation mark
+        temp[loc] = u_toupper(temp[loc]);
+      }
+      costs.push_back({path.weight + out.weight, candidates.size()});
+      candidates.push_back(std::move(temp));
+    }
+  }
+
+  State::selectNFinals(costs, maxAnalyses, maxWeightClasses);
+  std::vector<UString> result;
+  UString lf;
+  for (auto& it : costs) {
+    UString const &text = candidates[it.second];
+    if (std::find(result.begin(), result.end(), text) != result.end()) continue;
+    result.push_back(text);
+    lf += '/';
+    lf += text;
+    if (displayWeightsMode) {
+      UChar w[16]{};
+      u_sprintf(w, "<W:%f>", it.first);
+      lf += w;
+    }
+  }
+  return lf;
+}
+
 void
-FSTProcessor::writeEscaped(UStringView str, UFILE *output)
+FSTProcessor::writeEscaped(UStringView str, OutputBuffer& output)
 {
-  for(unsigned int i = 0, limit = str.size(); i < limit; i++)
+  UString const &units = dict->escaped_units;
+  size_t i = 0;
+  while(i < str.size())
   {
-    if(escaped_chars.find(str[i]) != escaped_chars.end())
+    size_t const next = i + Simd::findUnit(str.data() + i, str.size() - i,
+                                           units.data(), units.size());
+    output.write(str.substr(i, next - i));
+    if(next == str.size())
     {
-      u_fputc('\\', output);
+      break;
     }
-    u_fputc(str[i], output);
+    output.put('\\');
+    output.put(str[next]);
+    i = next + 1;
   }
 }
 
 size_t
-FSTProcessor::writeEscapedPopBlanks(UStringView str, UFILE *output)
+FSTProcessor::writeEscapedPopBlanks(UStringView str, OutputBuffer& output)
 {
   size_t postpop = 0;
   for (unsigned int i = 0, limit = str.size(); i < limit; i++)
   {
-    if (escaped_chars.find(str[i]) != escaped_chars.end()) {
-      u_fputc('\\', output);
+    if (dict->escaped_chars.contains(str[i])) {
+      output.put('\\');
     }
-    u_fputc(str[i], output);
+    output.put(str[i]);
     if (str[i] == ' ') {
       if (blankqueue.front() == " "_u) {
         blankqueue.pop();
@@ -511,57 +1059,131 @@ FSTProcessor::writeEscapedPopBlanks(UStringView str, UFILE *output)
 }
 
 void
-FSTProcessor::writeEscapedWithTags(UStringView str, UFILE *output)
+FSTProcessor::writeEscapedWithTags(UStringView str, OutputBuffer& output)
 {
   for(unsigned int i = 0, limit = str.size(); i < limit; i++)
   {
     if(str[i] == '<' && i >=1 && str[i-1] != '\\')
     {
-      write(str.substr(i), output);
+      output.write(str.substr(i));
       return;
     }
 
-    if(escaped_chars.find(str[i]) != escaped_chars.end())
+    if(dict->escaped_chars.contains(str[i]))
     {
-      u_fputc('\\', output);
+      output.put('\\');
     }
-    u_fputc(str[i], output);
+    output.put(str[i]);
   }
 }
 
 
 
 void
-FSTProcessor::printWord(UStringView sf, UStringView lf, UFILE *output)
+FSTProcessor::printWord(UStringView sf, UStringView lf, OutputBuffer& output)
 {
-  u_fputc('^', output);
+  StatsTimer timer(stats, &FSTStats::output_time);
+  if(stats != nullptr)
+  {
+    stats->tokens.fetch_add(1, std::memory_order_relaxed);
+  }
+  output.put('^');
   writeEscaped(sf, output);
-  write(lf, output);
-  u_fputc('$', output);
+  output.write(lf);
+  output.put('$');
 }
 
 void
-FSTProcessor::printWordPopBlank(UStringView sf, UStringView lf, UFILE *output)
+FSTProcessor::printWordPopBlank(UStringView sf, UStringView lf, OutputBuffer& output)
 {
-  u_fputc('^', output);
+  StatsTimer timer(stats, &FSTStats::output_time);
+  if(stats != nullptr)
+  {
+    stats->tokens.fetch_add(1, std::memory_order_relaxed);
+  }
+  output.put('^');
   size_t postpop = writeEscapedPopBlanks(sf, output);
-  u_fprintf(output, "%.*S$", lf.size(), lf.data());
+  output.write(lf);
+  output.put('$');
   while (postpop-- && blankqueue.size() > 0)
   {
-    write(blankqueue.front(), output);
+    output.write(blankqueue.front());
     blankqueue.pop();
   }
 }
 
 void
-FSTProcessor::printUnknownWord(UStringView sf, UFILE *output)
+FSTProcessor::printUnknownWord(UStringView sf, OutputBuffer& output)
 {
-  u_fputc('^', output);
+  StatsTimer timer(stats, &FSTStats::output_time);
+  if(stats != nullptr)
+  {
+    stats->tokens.fetch_add(1, std::memory_order_relaxed);
+    stats->unknown.fetch_add(1, std::memory_order_relaxed);
+  }
+  output.put('^');
   writeEscaped(sf, output);
-  u_fputc('/', output);
-  u_fputc('*', output);
+  output.put('/');
+  output.put('*');
   writeEscaped(sf, output);
-  u_fputc('$', output);
+  output.put('$');
+}
+
+template <bool sao>
+void
+FSTProcessor::printAnalysis(UStringView sf, UStringView lf, OutputBuffer& output)
+{
+  if(!sao)
+  {
+    printWordPopBlank(sf, lf, output);
+    return;
+  }
+  StatsTimer timer(stats, &FSTStats::output_time);
+  if(stats != nullptr)
+  {
+    stats->tokens.fetch_add(1, std::memory_order_relaxed);
+  }
+  printSAOWord(lf, output);
+  size_t postpop = 0;
+  for(auto c : sf)
+  {
+    if(c == ' ')
+    {
+      if(!blankqueue.empty() && blankqueue.front() == " "_u)
+      {
+        blankqueue.pop();
+      }
+      else
+      {
+        postpop++;
+      }
+    }
+  }
+  while(postpop-- && blankqueue.size() > 0)
+  {
+    output.write(blankqueue.front());
+    blankqueue.pop();
+  }
+}
+
+template <bool sao>
+void
+FSTProcessor::printUnknown(UStringView sf, OutputBuffer& output)
+{
+  if(!sao)
+  {
+    printUnknownWord(sf, output);
+    return;
+  }
+  StatsTimer timer(stats, &FSTStats::output_time);
+  if(stats != nullptr)
+  {
+    stats->tokens.fetch_add(1, std::memory_order_relaxed);
+    stats->unknown.fetch_add(1, std::memory_order_relaxed);
+  }
+  output.write(u"<d>");
+  output.write(sf);
+  output.write(u"</d>");
 }
 
 unsigned int
@@ -569,7 +1191,7 @@ FSTProcessor::lastBlank(UStringView str)
 {
   for(int i = static_cast<int>(str.size())-1; i >= 0; i--)
   {
-    if(alphabetic_chars.find(str[i]) == alphabetic_chars.end())
+    if(!dict->alphabetic_chars.contains(str[i]))
     {
       return static_cast<unsigned int>(i);
     }
@@ -579,7 +1201,7 @@ FSTProcessor::lastBlank(UStringView str)
 }
 
 void
-FSTProcessor::printSpace(UChar32 val, UFILE *output)
+FSTProcessor::printSpace(UChar32 val, OutputBuffer& output)
 {
   if(blankqueue.size() > 0)
   {
@@ -587,26 +1209,26 @@ FSTProcessor::printSpace(UChar32 val, UFILE *output)
   }
   else
   {
-    u_fputc(val, output);
+    output.put(val);
   }
 }
 
 void
-FSTProcessor::printChar(UChar32 val, UFILE* output)
+FSTProcessor::printChar(UChar32 val, OutputBuffer& output)
 {
   if (u_isspace(val)) {
     if (blankqueue.size() > 0) {
-      write(blankqueue.front(), output);
+      output.write(blankqueue.front());
       blankqueue.pop();
     } else {
-      u_fputc(val, output);
+      output.put(val);
     }
   } else {
     if (isEscaped(val)) {
-      u_fputc('\\', output);
+      output.put('\\');
     }
     if (val) {
-      u_fputc(val, output);
+      output.put(val);
     }
   }
 }
@@ -614,52 +1236,129 @@ FSTProcessor::printChar(UChar32 val, UFILE* output)
 bool
 FSTProcessor::isEscaped(UChar32 c) const
 {
-  return escaped_chars.find(c) != escaped_chars.end();
+  return dict->escaped_chars.contains(c);
 }
 
 bool
 FSTProcessor::isAlphabetic(UChar32 c) const
 {
-  return u_isalnum(c) || alphabetic_chars.find(c) != alphabetic_chars.end();
+  return dict->word_chars.contains(c);
 }
 
 void
 FSTProcessor::load(FILE *input)
 {
-  readTransducerSet(input, alphabetic_chars, alphabet, transducers);
+  modifyDictionary();
+  std::set<UChar32> letters;
+  // the sections are independent of each other, so big dictionaries
+  // with several of them load faster decoding them on all the cores
+  dict->acx_map.clear();
+  readTransducerSet(input, letters, dict->alphabet, dict->transducers,
+                    std::thread::hardware_concurrency() > 1, &dict->acx_map);
+  for (auto c : letters) {
+    dict->alphabetic_chars.insert(c);
+    dict->word_chars.insert(c);
+  }
+  dict->buildAlternatives();
 }
 
 void
-FSTProcessor::initAnalysis()
+FSTProcessor::reload(FILE *input)
 {
-  calcInitial();
-  classifyFinals();
-  all_finals = standard;
-  all_finals.insert(inconditional.begin(), inconditional.end());
-  all_finals.insert(postblank.begin(), postblank.end());
-  all_finals.insert(preblank.begin(), preblank.end());
+  std::shared_ptr<FSTDictionary> old = dict;
+  dict = std::make_shared<FSTDictionary>();
+  clearCaches();
+  try
+  {
+    dict->escaped_chars = old->escaped_chars;
+    dict->escaped_units = old->escaped_units;
+    dict->ignored_chars = old->ignored_chars;
+    dict->rcx_map = old->rcx_map;
+    dict->stats.slow_token = old->stats.slow_token;
+    load(input);
+    if(dict->transducers.empty())
+    {
+      throw Exception("Error: No transducers read, keeping the current dictionary.");
+    }
+    if(old->composition != nullptr)
+    {
+      dict->composition = old->composition;
+      mapCompositionTags();
+    }
+    if(old->init != nullptr)
+    {
+      (this->*old->init)();
+    }
+    if(old->beam.max_paths != 0)
+    {
+      setMaxActivePaths(old->beam.max_paths, old->beam.max_per_output);
+    }
+    if(stats != nullptr)
+    {
+      setStatsOutput(stats_output, stats_json);
+    }
+    if(!old->profile.transducers.empty())
+    {
+      startProfile(old->profile.period);
+    }
+  }
+  catch(...)
+  {
+    dict = old;
+    clearCaches();
+    throw;
+  }
+}
+
+void
+FSTProcessor::initAnalysis()
+{
+  modifyDictionary();
+  calcInitial();
+  classifyFinals();
+  dict->all_finals = dict->standard;
+  dict->all_finals.insert(dict->inconditional.begin(), dict->inconditional.end());
+  dict->all_finals.insert(dict->postblank.begin(), dict->postblank.end());
+  dict->all_finals.insert(dict->preblank.begin(), dict->preblank.end());
+  buildFinalTable();
+  dict->initial_state.reachableChars(dict->reachable_chars, 8);
+  if(maxWeightClasses != INT_MAX)
+  {
+    dict->negative_weights = false;
+    for(auto &it : dict->transducers)
+    {
+      dict->negative_weights |= it.second.hasNegativeWeights();
+    }
+  }
+  dict->init = &FSTProcessor::initAnalysis;
 }
 
 void
 FSTProcessor::initTMAnalysis()
 {
+  modifyDictionary();
   calcInitial();
 
-  for(auto& it : transducers) {
-    all_finals.insert(it.second.getFinals().begin(),
+  for(auto& it : dict->transducers) {
+    dict->all_finals.insert(it.second.getFinals().begin(),
                       it.second.getFinals().end());
   }
+  buildFinalTable();
+  dict->init = &FSTProcessor::initTMAnalysis;
 }
 
 void
 FSTProcessor::initGeneration()
 {
+  modifyDictionary();
   setIgnoredChars(false);
   calcInitial();
-  for(auto& it : transducers) {
-    all_finals.insert(it.second.getFinals().begin(),
+  for(auto& it : dict->transducers) {
+    dict->all_finals.insert(it.second.getFinals().begin(),
                       it.second.getFinals().end());
   }
+  buildFinalTable();
+  dict->init = &FSTProcessor::initGeneration;
 }
 
 void
@@ -680,7 +1379,7 @@ FSTProcessor::compoundAnalysis(UString input_word)
 {
   const int MAX_COMBINATIONS = 32767;
 
-  State current_state = initial_state;
+  State current_state = dict->initial_state;
 
   for(unsigned int i=0; i<input_word.size(); i++)
   {
@@ -699,7 +1398,8 @@ FSTProcessor::compoundAnalysis(UString input_word)
 
     if(i < input_word.size()-1)
     {
-      current_state.restartFinals(all_finals, compoundOnlyLSymbol, &initial_state, '+');
+      current_state.restartFinals(dict->final_table, compoundOnlyLSymbol, &dict->initial_state, '+');
+      current_state.pruneDominatedCompounds(compoundOnlyLSymbol, compoundRSymbol, '+');
     }
 
     if(current_state.size()==0)
@@ -718,30 +1418,31 @@ FSTProcessor::compoundAnalysis(UString input_word)
 void
 FSTProcessor::initDecompositionSymbols()
 {
-  if((compoundOnlyLSymbol=alphabet(u"<:co:only-L>")) == 0
-     && (compoundOnlyLSymbol=alphabet(u"<:compound:only-L>")) == 0
-     && (compoundOnlyLSymbol=alphabet(u"<@co:only-L>")) == 0
-     && (compoundOnlyLSymbol=alphabet(u"<@compound:only-L>")) == 0
-     && (compoundOnlyLSymbol=alphabet(u"<compound-only-L>")) == 0)
+  modifyDictionary();
+  if((compoundOnlyLSymbol=dict->alphabet(u"<:co:only-L>")) == 0
+     && (compoundOnlyLSymbol=dict->alphabet(u"<:compound:only-L>")) == 0
+     && (compoundOnlyLSymbol=dict->alphabet(u"<@co:only-L>")) == 0
+     && (compoundOnlyLSymbol=dict->alphabet(u"<@compound:only-L>")) == 0
+     && (compoundOnlyLSymbol=dict->alphabet(u"<compound-only-L>")) == 0)
   {
     std::cerr << "Warning: Decomposition symbol <:compound:only-L> not found" << std::endl;
   }
   else if(!showControlSymbols)
   {
-    alphabet.setSymbol(compoundOnlyLSymbol, u"");
+    dict->alphabet.setSymbol(compoundOnlyLSymbol, u"");
   }
 
-  if((compoundRSymbol=alphabet(u"<:co:R>")) == 0
-     && (compoundRSymbol=alphabet(u"<:compound:R>")) == 0
-     && (compoundRSymbol=alphabet(u"<@co:R>")) == 0
-     && (compoundRSymbol=alphabet(u"<@compound:R>")) == 0
-     && (compoundRSymbol=alphabet(u"<compound-R>")) == 0)
+  if((compoundRSymbol=dict->alphabet(u"<:co:R>")) == 0
+     && (compoundRSymbol=dict->alphabet(u"<:compound:R>")) == 0
+     && (compoundRSymbol=dict->alphabet(u"<@co:R>")) == 0
+     && (compoundRSymbol=dict->alphabet(u"<@compound:R>")) == 0
+     && (compoundRSymbol=dict->alphabet(u"<compound-R>")) == 0)
   {
     std::cerr << "Warning: Decomposition symbol <:compound:R> not found" << std::endl;
   }
   else if(!showControlSymbols)
   {
-    alphabet.setSymbol(compoundRSymbol, u"");
+    dict->alphabet.setSymbol(compoundRSymbol, u"");
   }
 }
 
@@ -752,76 +1453,274 @@ FSTProcessor::initDecomposition()
   do_decomposition = true;
   initAnalysis();
   initDecompositionSymbols();
+  dict->init = &FSTProcessor::initDecomposition;
+}
+
+template <bool sao>
+int32_t
+FSTProcessor::readCachedAnalysis(InputFile& input, OutputBuffer& output)
+{
+  size_t start = input_buffer.getPos();
+  cache_key.assign(2, 0);
+  int32_t val;
+  size_t length = 0;
+  while((val = sao ? readSAO(input) : readAnalysis(input)) > 0 &&
+        isAlphabetic(val) && length < max_cached_run)
+  {
+    dict->alphabet.getSymbol(cache_key, val);
+    length++;
+  }
+  if(val <= 0 || length == 0 || isAlphabetic(val))
+  {
+    input_buffer.setPos(start);
+    return 0;
+  }
+  cache_key[0] = static_cast<UChar>(static_cast<uint32_t>(val) >> 16);
+  cache_key[1] = static_cast<UChar>(val & 0xFFFF);
+
+  CachedAnalysis const *entry = analysis_cache.find(cache_key);
+  if(entry == nullptr)
+  {
+    input_buffer.setPos(start);
+    return 0;
+  }
+
+  UStringView sf = UStringView(cache_key).substr(2);
+  switch(entry->kind)
+  {
+    case ck_word:
+      printAnalysis<sao>(UStringView(sf).substr(0, entry->last_size), entry->lf, output);
+      break;
+
+    case ck_postblank:
+      printAnalysis<sao>(UStringView(sf).substr(0, entry->last_size), entry->lf, output);
+      output.put(' ');
+      break;
+
+    case ck_preblank:
+      output.put(' ');
+      printAnalysis<sao>(UStringView(sf).substr(0, entry->last_size), entry->lf, output);
+      break;
+
+    case ck_unknown:
+      if(!entry->lf.empty())
+      {
+        printWord(sf, entry->lf, output);
+      }
+      else
+      {
+        printUnknown<sao>(sf, output);
+      }
+      break;
+  }
+  input_buffer.setPos(start + entry->advance);
+  return val;
+}
+
+void
+FSTProcessor::cacheAnalysis(UStringView sf, int32_t next, CachedKind kind,
+                            UStringView lf, size_t last_size, size_t start)
+{
+  if(!analysis_cache.enabled() || next <= 0 || isAlphabetic(next) ||
+     sf.empty() || firstNotAlpha(sf).i_utf16 != sf.size() ||
+     firstNotAlpha(sf).i_codepoint > max_cached_run)
+  {
+    return;
+  }
+  size_t advance = input_buffer.diffPrevPos(start);
+  if(advance == 0)
+  {
+    return;
+  }
+  cache_key.assign(2, 0);
+  cache_key[0] = static_cast<UChar>(static_cast<uint32_t>(next) >> 16);
+  cache_key[1] = static_cast<UChar>(next & 0xFFFF);
+  cache_key.append(sf);
+
+  CachedAnalysis entry;
+  entry.lf = lf;
+  entry.last_size = last_size;
+  entry.advance = advance;
+  entry.kind = kind;
+  analysis_cache.insert(cache_key, entry, lf.size() * sizeof(UChar));
 }
 
 void
 FSTProcessor::analysis(InputFile& input, UFILE *output)
+{
+  OutputBuffer buffer(output, threadedOutput);
+  analysis(input, buffer);
+}
+
+void
+FSTProcessor::analysis(InputFile& input, OutputBuffer& output)
 {
   if(getNullFlush())
   {
     analysis_wrapper_null_flush(input, output);
   }
 
+  analyseBlock(input, output);
+}
+
+bool
+FSTProcessor::analysisRequest(InputFile& input, OutputBuffer& output)
+{
+  if(input.eof())
+  {
+    return false;
+  }
+  analyseBlock(input, output);
+  output.put('\0');
+  output.flush();
+  writeStats();
+  // analyse() doesn't always leave input_buffer empty, and what it left
+  // would be read again as the start of the next request
+  input_buffer.skip();
+  return true;
+}
+
+void
+FSTProcessor::analyseBlock(InputFile& input, OutputBuffer& output)
+{
+  if(useRestoreChars || !dict->acx_map.empty())
+  {
+    if(do_decomposition)
+    {
+      analyse<true, true, false>(input, output);
+    }
+    else
+    {
+      analyse<true, false, false>(input, output);
+    }
+  }
+  else if(do_decomposition)
+  {
+    analyse<false, true, false>(input, output);
+  }
+  else
+  {
+    analyse<false, false, false>(input, output);
+  }
+}
+
+State::Best *
+FSTProcessor::bestPaths()
+{
+  if(do_decomposition || dict->composition != nullptr)
+  {
+    return nullptr;
+  }
+  best_paths.max_analyses = maxAnalyses > 0 && maxAnalyses != INT_MAX ? maxAnalyses : 0;
+  best_paths.max_weight_classes = 0;
+  if(maxWeightClasses > 0 && maxWeightClasses != INT_MAX && !dict->negative_weights)
+  {
+    best_paths.max_weight_classes = maxWeightClasses;
+  }
+  if(best_paths.max_analyses == 0 && best_paths.max_weight_classes == 0)
+  {
+    return nullptr;
+  }
+  return &best_paths;
+}
+
+template <bool restore_chars, bool decomposition, bool sao>
+void
+FSTProcessor::analyse(InputFile& input, OutputBuffer& output)
+{
   bool last_incond = false;
   bool last_postblank = false;
   bool last_preblank = false;
-  State current_state = initial_state;
-  UString lf;            // analysis (lexical form and tags)
-  UString sf;            // surface form
-  UString lf_spcmp;      // space compound analysis
+  State &current_state = analysis_scratch.current_state;
+  // filterFinalsSAO() doesn't limit the analyses
+  State::Best *best = sao ? nullptr : bestPaths();
+  current_state = dict->initial_state;
+  current_state.setBest(best);
+  UString &lf = analysis_scratch.lf;             // analysis (lexical form and tags)
+  UString &sf = analysis_scratch.sf;             // surface form
+  UString &lf_spcmp = analysis_scratch.lf_spcmp; // space compound analysis
+  lf.clear();
+  sf.clear();
+  lf_spcmp.clear();
   bool seen_cpL = false; // have we seen a <compound-only-L> tag so far
   size_t last_start = input_buffer.getPos(); // position in input_buffer when sf was last cleared
   size_t last = 0;       // position in input_buffer after last analysis
   size_t last_size = 0;  // size of sf at last analysis
-  std::map<int, std::set<int> >::iterator rcx_map_ptr;
+  size_t depth = 0;      // steps since current_state was initial
+  std::vector<CharSet> const &reachable = dict->reachable_chars;
+  std::map<int, FSTDictionary::RestoreChars>::const_iterator rcx_ptr;
+  std::chrono::steady_clock::time_point token_start; // with stats, when sf was last empty
+  size_t token_paths = 0;                            // and most paths since
 
   UChar32 val;
   do
   {
-    val = readAnalysis(input);
+    if(stats != nullptr && sf.empty())
+    {
+      token_start = std::chrono::steady_clock::now();
+      token_paths = 0;
+    }
+    if(sf.empty() && analysis_cache.enabled() &&
+       (val = readCachedAnalysis<sao>(input, output)) != 0)
+    {
+      last_start = input_buffer.getPos();
+      input_buffer.commit(last_start);
+      continue;
+    }
+    {
+      StatsTimer timer(stats, &FSTStats::read_time);
+      val = sao ? readSAO(input) : readAnalysis(input);
+    }
     // test for final states
-    if(current_state.isFinal(all_finals))
+    unsigned int final_classes = current_state.finalClasses(dict->final_table);
+    if(final_classes != 0 && dict->composition != nullptr &&
+       analysisFinals<sao>(current_state, sf).empty())
+    {
+      // nothing the analyser reaches here goes through the composition
+      final_classes = 0;
+    }
+    if(final_classes != 0)
     {
-      if(current_state.isFinal(inconditional))
+      if(final_classes & FinalTable::fc_inconditional)
       {
-        if(do_decomposition && compoundOnlyLSymbol != 0)
+        if(decomposition && compoundOnlyLSymbol != 0)
         {
           current_state.pruneStatesWithForbiddenSymbol(compoundOnlyLSymbol);
         }
-        lf = filterFinals(current_state, sf);
+        lf = analysisFinals<sao>(current_state, sf);
         last_incond = true;
         last = input_buffer.getPos();
         last_size = sf.size();
       }
-      else if(current_state.isFinal(postblank))
+      else if(final_classes & FinalTable::fc_postblank)
       {
-        if(do_decomposition && compoundOnlyLSymbol != 0)
+        if(decomposition && compoundOnlyLSymbol != 0)
         {
           current_state.pruneStatesWithForbiddenSymbol(compoundOnlyLSymbol);
         }
-        lf = filterFinals(current_state, sf);
+        lf = analysisFinals<sao>(current_state, sf);
         last_postblank = true;
         last = input_buffer.getPos();
         last_size = sf.size();
       }
-      else if(current_state.isFinal(preblank))
+      else if(final_classes & FinalTable::fc_preblank)
       {
-        if(do_decomposition && compoundOnlyLSymbol != 0)
+        if(decomposition && compoundOnlyLSymbol != 0)
         {
           current_state.pruneStatesWithForbiddenSymbol(compoundOnlyLSymbol);
         }
-        lf = filterFinals(current_state, sf);
+        lf = analysisFinals<sao>(current_state, sf);
         last_preblank = true;
         last = input_buffer.getPos();
         last_size = sf.size();
       }
       else if(!isAlphabetic(val))
       {
-        if(do_decomposition && compoundOnlyLSymbol != 0)
+        if(decomposition && compoundOnlyLSymbol != 0)
         {
           current_state.pruneStatesWithForbiddenSymbol(compoundOnlyLSymbol);
         }
-        lf = filterFinals(current_state, sf);
+        lf = analysisFinals<sao>(current_state, sf);
         last_postblank = false;
         last_preblank = false;
         last_incond = false;
@@ -830,7 +1729,7 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
       }
       else { // isAlphabetic, standard type section
         // Record if a compound might be possible
-        if (do_decomposition && compoundOnlyLSymbol != 0
+        if (decomposition && compoundOnlyLSymbol != 0
             && current_state.hasSymbol(compoundOnlyLSymbol)) {
           seen_cpL = true;
         }
@@ -847,37 +1746,50 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
       last_size = sf.size();
     }
 
-    if(useRestoreChars && rcx_map.find(val) != rcx_map.end())
     {
-      rcx_map_ptr = rcx_map.find(val);
-      std::set<int> tmpset = rcx_map_ptr->second;
-      if(!u_isupper(val) || beCaseSensitive(current_state))
+      StatsTimer timer(stats, &FSTStats::step_time);
+      if(restore_chars &&
+         (rcx_ptr = dict->rcx_alternatives.find(val)) != dict->rcx_alternatives.end())
       {
-        current_state.step(val, tmpset);
-      }
-      else if(rcx_map.find(u_tolower(val)) != rcx_map.end())
-      {
-        rcx_map_ptr = rcx_map.find(tolower(val));
-        tmpset.insert(tolower(val));
-        tmpset.insert(rcx_map_ptr->second.begin(), rcx_map_ptr->second.end());
-        current_state.step(val, tmpset);
+        if(!u_isupper(val) || beCaseSensitive(current_state))
+        {
+          current_state.step(val, rcx_ptr->second.exact,
+                             rcx_ptr->second.exact_equivalents);
+        }
+        else
+        {
+          current_state.step(val, rcx_ptr->second.folded,
+                             rcx_ptr->second.folded_equivalents);
+        }
       }
       else
       {
-        tmpset.insert(tolower(val));
-        current_state.step(val, tmpset);
+        bool const case_sensitive = beCaseSensitive(current_state);
+        CharSet const *chars = reachable.empty() ? nullptr :
+                               &reachable[std::min(depth, reachable.size() - 1)];
+        if(chars != nullptr && val > 0 && !chars->contains(val) &&
+           (case_sensitive || !u_isupper(val) || !chars->contains(u_tolower(val))))
+        {
+          // no path could take it: the token ends here
+          current_state.clear();
+        }
+        else
+        {
+          current_state.step_case(val, case_sensitive);
+        }
       }
     }
-    else
+    depth++;
+    if(stats != nullptr && current_state.size() > token_paths)
     {
-       	    current_state.step_case(val, beCaseSensitive(current_state));
+      token_paths = current_state.size();
     }
 
     if(current_state.size() != 0)
     {
       if(val != 0)
       {
-        alphabet.getSymbol(sf, val);
+        dict->alphabet.getSymbol(sf, val);
       }
     }
     else
@@ -892,8 +1804,8 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
         int oldval = val;
         UString oldsf = sf;
         do {
-          alphabet.getSymbol(sf, val);
-        } while ((val = readAnalysis(input)) && isAlphabetic(val));
+          dict->alphabet.getSymbol(sf, val);
+        } while ((val = (sao ? readSAO(input) : readAnalysis(input))) && isAlphabetic(val));
         lf_spcmp = compoundAnalysis(sf);
         if(lf_spcmp.empty()) {  // didn't work, rewind!
           input_buffer.back(sf.size() - oldsf.size());
@@ -908,7 +1820,7 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
       seen_cpL = false;
 
       if(!lf_spcmp.empty()) {
-        printWordPopBlank(sf, lf_spcmp, output);
+        printAnalysis<sao>(sf, lf_spcmp, output);
       }
       else if(!isAlphabetic(val) && sf.empty())
       {
@@ -916,26 +1828,29 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
       }
       else if(last_postblank)
       {
-        printWordPopBlank(sf.substr(0, last_size),
+        printAnalysis<sao>(UStringView(sf).substr(0, last_size),
                           lf, output);
-        u_fputc(' ', output);
+        output.put(' ');
         input_buffer.setPos(last);
         input_buffer.back(1);
+        cacheAnalysis(sf, val, ck_postblank, lf, last_size, last_start);
       }
       else if(last_preblank)
       {
-        u_fputc(' ', output);
-        printWordPopBlank(sf.substr(0, last_size),
+        output.put(' ');
+        printAnalysis<sao>(UStringView(sf).substr(0, last_size),
                           lf, output);
         input_buffer.setPos(last);
         input_buffer.back(1);
+        cacheAnalysis(sf, val, ck_preblank, lf, last_size, last_start);
       }
       else if(last_incond)
       {
-        printWordPopBlank(sf.substr(0, last_size),
+        printAnalysis<sao>(UStringView(sf).substr(0, last_size),
                           lf, output);
         input_buffer.setPos(last);
         input_buffer.back(1);
+        cacheAnalysis(sf, val, ck_word, lf, last_size, last_start);
       }
       else if(isAlphabetic(val) &&
                // we can't skip back a blank:
@@ -945,9 +1860,9 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
       {
         do
         {
-          alphabet.getSymbol(sf, val);
+          dict->alphabet.getSymbol(sf, val);
         }
-        while((val = readAnalysis(input)) && isAlphabetic(val));
+        while((val = (sao ? readSAO(input) : readAnalysis(input))) && isAlphabetic(val));
 
         auto limit = firstNotAlpha(sf);
         if(limit.i_codepoint == 0)
@@ -959,22 +1874,24 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
         {
           input_buffer.setPos(last_start + limit.i_codepoint);
           UString unknown_word = sf.substr(0, limit.i_utf16);
-          if(do_decomposition)
+          UString compound;
+          if(decomposition)
           {
-            UString compound = compoundAnalysis(unknown_word);
+            compound = compoundAnalysis(unknown_word);
             if(!compound.empty())
             {
               printWord(unknown_word, compound, output);
             }
             else
             {
-              printUnknownWord(unknown_word, output);
+              printUnknown<sao>(unknown_word, output);
             }
           }
           else
           {
-            printUnknownWord(unknown_word, output);
+            printUnknown<sao>(unknown_word, output);
           }
+          cacheAnalysis(sf, val, ck_unknown, compound, 0, last_start);
         }
       }
       else if(lf.empty())
@@ -989,41 +1906,51 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
         {
           input_buffer.setPos(last_start + limit.i_codepoint);
           UString unknown_word = sf.substr(0, limit.i_utf16);
-          if(do_decomposition)
+          UString compound;
+          if(decomposition)
           {
-            UString compound = compoundAnalysis(unknown_word);
+            compound = compoundAnalysis(unknown_word);
             if(!compound.empty())
             {
               printWord(unknown_word, compound, output);
             }
             else
             {
-              printUnknownWord(unknown_word, output);
+              printUnknown<sao>(unknown_word, output);
             }
           }
           else
           {
-            printUnknownWord(unknown_word, output);
+            printUnknown<sao>(unknown_word, output);
           }
+          cacheAnalysis(sf, val, ck_unknown, compound, 0, last_start);
         }
       }
       else
       {
-        printWordPopBlank(sf.substr(0, last_size),
+        printAnalysis<sao>(UStringView(sf).substr(0, last_size),
                           lf, output);
         input_buffer.setPos(last);
         input_buffer.back(1);
+        cacheAnalysis(sf, val, ck_word, lf, last_size, last_start);
       }
       if(val == 0) {
         if(!input_buffer.isEmpty()) {
           input_buffer.setPos(last+1);
         }
       }
+      if(stats != nullptr && !sf.empty())
+      {
+        countToken(token_start, sf, token_paths);
+      }
 
-      current_state = initial_state;
+      current_state = dict->initial_state;
+      current_state.setBest(best);
+      depth = 0;
       lf.clear();
       sf.clear();
       last_start = input_buffer.getPos();
+      input_buffer.commit(last_start);
       last_incond = false;
       last_postblank = false;
       last_preblank = false;
@@ -1036,23 +1963,14 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
 }
 
 void
-FSTProcessor::analysis_wrapper_null_flush(InputFile& input, UFILE *output)
+FSTProcessor::analysis_wrapper_null_flush(InputFile& input, OutputBuffer& output)
 {
   setNullFlush(false);
-  while(!input.eof())
-  {
-    analysis(input, output);
-    u_fputc('\0', output);
-    u_fflush(output);
-    // analysis() doesn't always leave input_buffer empty
-    // which results in repeatedly analyzing the same string
-    // so clear it here
-    while (!input_buffer.isEmpty()) input_buffer.next();
-  }
+  while(analysisRequest(input, output));
 }
 
 void
-FSTProcessor::generation_wrapper_null_flush(InputFile& input, UFILE *output,
+FSTProcessor::generation_wrapper_null_flush(InputFile& input, OutputBuffer& output,
                                             GenerationMode mode)
 {
   setNullFlush(false);
@@ -1061,13 +1979,14 @@ FSTProcessor::generation_wrapper_null_flush(InputFile& input, UFILE *output,
   while(!input.eof())
   {
     generation(input, output, mode);
-    u_fputc('\0', output);
-    u_fflush(output);
+    output.put('\0');
+    output.flush();
+    writeStats();
   }
 }
 
 void
-FSTProcessor::tm_wrapper_null_flush(InputFile& input, UFILE *output,
+FSTProcessor::tm_wrapper_null_flush(InputFile& input, OutputBuffer& output,
                                     TranslationMemoryMode tm_mode)
 {
   setNullFlush(false);
@@ -1076,37 +1995,44 @@ FSTProcessor::tm_wrapper_null_flush(InputFile& input, UFILE *output,
   while(!input.eof())
   {
     tm_analysis(input, output, tm_mode);
-    u_fputc('\0', output);
-    u_fflush(output);
+    output.put('\0');
+    output.flush();
+    writeStats();
   }
 }
 
 
 void
 FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode tm_mode)
+{
+  OutputBuffer buffer(output, threadedOutput);
+  tm_analysis(input, buffer, tm_mode);
+}
+
+void
+FSTProcessor::tm_analysis(InputFile& input, OutputBuffer& output, TranslationMemoryMode tm_mode)
 {
   if(getNullFlush())
   {
     tm_wrapper_null_flush(input, output, tm_mode);
   }
 
-  State current_state = initial_state;
+  State current_state = dict->initial_state;
   UString lf;     //lexical form
   UString sf;     //surface form
-  int last = 0;
+  size_t last = 0;
 
   while(int32_t val = readTMAnalysis(input))
   {
     // test for final states
-    if(current_state.isFinal(all_finals))
+    if(current_state.isFinal(dict->final_table))
     {
       if(u_ispunct(val) || (tm_mode == tm_space && u_isspace(val)))
       {
-        lf = current_state.filterFinalsTM(all_finals, alphabet,
-                                          escaped_chars,
+        lf = current_state.filterFinalsTM(dict->final_table, dict->alphabet,
+                                          dict->escaped_chars,
                                           blankqueue, numbers).substr(1);
         last = input_buffer.getPos();
-        numbers.clear();
       }
     }
     else if(sf.empty() && u_isspace(val))
@@ -1121,7 +2047,8 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
     {
       if(val == -1)
       {
-        sf.append(numbers[numbers.size()-1]);
+        numbers.push_back(input_numbers[input_buffer.getPos()-1]);
+        sf.append(numbers.back());
       }
       else if(isLastBlankTM && val == ' ')
       {
@@ -1129,7 +2056,7 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
       }
       else
       {
-        alphabet.getSymbol(sf, val);
+        dict->alphabet.getSymbol(sf, val);
       }
     }
     else
@@ -1144,9 +2071,9 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
         {
           if(isEscaped(val))
           {
-            u_fputc('\\', output);
+            output.put('\\');
           }
-          u_fputc(val, output);
+          output.put(val);
         }
       }
       else if(!u_isspace(val) && !u_ispunct(val) &&
@@ -1158,7 +2085,7 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
         {
           if(val == -1)
           {
-            sf.append(numbers[numbers.size()-1]);
+            sf.append(input_numbers[input_buffer.getPos()-1]);
           }
           else if(isLastBlankTM && val == ' ')
           {
@@ -1166,19 +2093,19 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
           }
           else
           {
-            alphabet.getSymbol(sf, val);
+            dict->alphabet.getSymbol(sf, val);
           }
         }
         while((val = readTMAnalysis(input)) && !u_isspace(val) && !u_ispunct(val));
 
         if(val == 0)
         {
-          write(sf, output);
+          output.write(sf);
           return;
         }
 
         input_buffer.back(1);
-        write(sf, output);
+        output.write(sf);
 
         while(blankqueue.size() > 0)
         {
@@ -1194,7 +2121,7 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
         unsigned int size = sf.size();
         limit = (limit == static_cast<unsigned int>(UString::npos)?size:limit);
         input_buffer.back(1+(size-limit));
-        write(sf.substr(0, limit), output);
+        output.write(sf.substr(0, limit));
 */      }
       else if(lf.empty())
       {
@@ -1202,10 +2129,10 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
         unsigned int size = sf.size();
         limit = (limit == static_cast<unsigned int >(UString::npos)?size:limit);
         input_buffer.back(1+(size-limit));
-        write(sf.substr(0, limit), output);
+        output.write(sf.substr(0, limit));
 */
         input_buffer.back(1);
-        write(sf, output);
+        output.write(sf);
 
         while(blankqueue.size() > 0)
         {
@@ -1219,15 +2146,20 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
       }
       else
       {
-        u_fprintf(output, "[%S]", lf.c_str());
+        output.put('[');
+        output.write(lf);
+        output.put(']');
         input_buffer.setPos(last);
         input_buffer.back(1);
       }
 
-      current_state = initial_state;
+      current_state = dict->initial_state;
       lf.clear();
       sf.clear();
       numbers.clear();
+      input_buffer.commit(input_buffer.getPos());
+      input_numbers.erase(input_numbers.begin(),
+                          input_numbers.lower_bound(input_buffer.getPos()));
     }
   }
 
@@ -1238,34 +2170,42 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
 
 void
 FSTProcessor::generation(InputFile& input, UFILE *output, GenerationMode mode)
+{
+  OutputBuffer buffer(output, threadedOutput);
+  generation(input, buffer, mode);
+}
+
+void
+FSTProcessor::generation(InputFile& input, OutputBuffer& output, GenerationMode mode)
 {
   StreamReader reader(&input);
-  reader.alpha = &alphabet;
+  reader.alpha = &dict->alphabet;
+  reader.views = true;
   State current_state;
 
   while (!reader.at_eof) {
     reader.next();
-    write(reader.blank, output);
-    write(reader.wblank, output);
-    if (!reader.readings.empty()) {
-      auto& rd = reader.readings[0];
+    output.write(reader.blank);
+    output.write(reader.wblank);
+    if (!reader.reading_views.empty()) {
+      auto& rd = reader.reading_views[0];
       bool skip = false;
       switch (rd.mark) {
       case '=':
-        u_fputc('=', output);
+        output.put('=');
         break;
       case '*':
       case '%':
         skip = true;
         if (mode == gm_tagged_nm) {
-          u_fputc('^', output);
+          output.put('^');
           writeEscaped(removeTags(rd.content), output);
-          u_fputc('/', output);
-          u_fputc(rd.mark, output);
+          output.put('/');
+          output.put(rd.mark);
           writeEscapedWithTags(rd.content, output);
-          u_fputc('$', output);
+          output.put('$');
         } else {
-          if (mode != gm_clean) u_fputc(rd.mark, output);
+          if (mode != gm_clean) output.put(rd.mark);
           writeEscaped(rd.content, output);
         }
         break;
@@ -1273,23 +2213,23 @@ FSTProcessor::generation(InputFile& input, UFILE *output, GenerationMode mode)
         skip = true;
         switch (mode) {
         case gm_all:
-          u_fputc(rd.mark, output);
+          output.put(rd.mark);
           writeEscaped(rd.content, output);
           break;
         case gm_unknown:
         case gm_tagged:
-          u_fputc(rd.mark, output);
+          output.put(rd.mark);
           [[fallthrough]];
         case gm_clean:
           writeEscaped(removeTags(rd.content), output);
           break;
         case gm_tagged_nm:
-          u_fputc('^', output);
+          output.put('^');
           writeEscaped(removeTags(rd.content), output);
-          u_fputc('/', output);
-          u_fputc(rd.mark, output);
+          output.put('/');
+          output.put(rd.mark);
           writeEscapedWithTags(rd.content, output);
-          u_fputc('$', output);
+          output.put('$');
           break;
         default:
           break;
@@ -1297,68 +2237,56 @@ FSTProcessor::generation(InputFile& input, UFILE *output, GenerationMode mode)
         break;
       }
       if (!skip) {
-        current_state = initial_state;
-        for (auto& sym : reader.readings[0].symbols) {
-          if (!alphabet.isTag(sym) && u_isupper(sym) &&
-              !beCaseSensitive(current_state)) {
-            if (mode == gm_carefulcase) {
-              current_state.step_careful(sym, u_tolower(sym));
-            }
-            else {
-              current_state.step(sym, u_tolower(sym));
-            }
-          }
-          else current_state.step(sym);
+        std::chrono::steady_clock::time_point start;
+        size_t paths = 0;
+        if (stats != nullptr) {
+          start = std::chrono::steady_clock::now();
         }
-        if (current_state.isFinal(all_finals)) {
-          bool firstupper = false, uppercase = false;
-          if (!dictionaryCase) {
-            uppercase = rd.content.size() > 1 && u_isupper(rd.content[1]);
-            firstupper= u_isupper(rd.content[0]);
-          }
-
+        auto const &found = lookupGeneration(rd, mode, current_state, paths);
+        if (found.first) {
           if (mode == gm_tagged || mode == gm_tagged_nm) {
-            u_fputc('^', output);
+            output.put('^');
           }
 
-          write(current_state.filterFinals(all_finals, alphabet, escaped_chars,
-                                           displayWeightsMode, maxAnalyses,
-                                           maxWeightClasses,
-                                           uppercase, firstupper).substr(1), output);
+          output.write(found.second);
           if (mode == gm_tagged || mode == gm_tagged_nm) {
-            u_fputc('/', output);
+            output.put('/');
             writeEscapedWithTags(rd.content, output);
-            u_fputc('$', output);
+            output.put('$');
           }
         } else {
           switch (mode) {
           case gm_all:
-            u_fputc('#', output);
+            output.put('#');
             writeEscaped(rd.content, output);
             break;
           case gm_carefulcase:
           case gm_unknown:
           case gm_tagged:
-            if (!rd.content.empty()) u_fputc('#', output);
+            if (!rd.content.empty()) output.put('#');
             [[fallthrough]];
           case gm_clean:
             writeEscaped(removeTags(rd.content), output);
             break;
           case gm_tagged_nm:
-            u_fputc('^', output);
+            output.put('^');
             writeEscaped(removeTags(rd.content), output);
-            u_fputc('/', output);
-            u_fputc('#', output);
+            output.put('/');
+            output.put('#');
             writeEscapedWithTags(rd.content, output);
-            u_fputc('$', output);
+            output.put('$');
             break;
           }
         }
+        if (stats != nullptr) {
+          countToken(start, rd.content, paths);
+        }
       }
     }
     if (reader.at_null) {
-      u_fputc('\0', output);
-      u_fflush(output);
+      output.put('\0');
+      output.flush();
+      writeStats();
     }
   }
 }
@@ -1379,12 +2307,36 @@ FSTProcessor::intergeneration(InputFile& input, UFILE *output)
 
 void
 FSTProcessor::transliteration(InputFile& input, UFILE *output)
+{
+  OutputBuffer buffer(output, threadedOutput);
+  transliteration(input, buffer);
+}
+
+void
+FSTProcessor::transliteration(InputFile& input, OutputBuffer& output)
+{
+  if(dict->transducers.size() == 1)
+  {
+    auto& transducer = dict->transducers.begin()->second;
+    DetState initial;
+    initial.init(transducer.getInitial(), transducer.isDeterministic());
+    transliterate(input, output, initial);
+  }
+  else
+  {
+    transliterate(input, output, dict->initial_state);
+  }
+}
+
+template <class S>
+void
+FSTProcessor::transliterate(InputFile& input, OutputBuffer& output, S const &initial_state)
 {
   size_t start_pos = 0;
   size_t cur_word = 0;
   size_t cur_pos = 0;
   size_t match_pos = 0;
-  State current_state = initial_state;
+  S current_state = initial_state;
   UString last_match;
   int space_diff = 0;
 
@@ -1403,39 +2355,33 @@ FSTProcessor::transliteration(InputFile& input, UFILE *output)
         if (input.eof()) {
           break;
         } else {
-          u_fputc(input.get(), output);
-          u_fflush(output);
+          output.put(input.get());
+          output.flush();
           continue;
         }
       }
     }
 
-    if (current_state.isFinal(all_finals)) {
-      last_match = current_state.filterFinals(all_finals, alphabet,
-                                              escaped_chars, displayWeightsMode,
+    if (current_state.isFinal(dict->final_table)) {
+      last_match = current_state.filterFinals(dict->final_table, dict->alphabet,
+                                              dict->escaped_chars, displayWeightsMode,
                                               1, maxWeightClasses,
                                               uppercase, firstupper);
       while (cur_word > 0) {
         if (cur_word == 1) {
           if (cur_pos == 0 && last_match[last_match.size()-1] == ' ') {
-            match_pos = transliteration_queue.front().size();
-            last_match = last_match.substr(0, last_match.size()-1);
+            match_pos = transliteration_queue.length(0);
+            last_match.pop_back();
             break;
           } else {
-            cur_pos += transliteration_queue.front().size() + 1;
+            cur_pos += transliteration_queue.length(0) + 1;
           }
         }
-        std::vector<int32_t> word = transliteration_queue.front();
-        transliteration_queue.pop_front();
-        word.push_back(static_cast<int32_t>(' '));
-        word.insert(word.end(), transliteration_queue.front().begin(),
-                    transliteration_queue.front().end());
-        transliteration_queue.pop_front();
-        transliteration_queue.push_front(word);
-        UString wblank = wblankqueue.front();
-        wblankqueue.pop_front();
+        transliteration_queue.joinFront();
+        UString wblank(wblankqueue.front());
+        wblankqueue.pop();
         wblank = StringUtils::merge_wblanks(wblank, wblankqueue.front());
-        wblankqueue.pop_front();
+        wblankqueue.pop();
         wblankqueue.push_front(wblank);
         cur_word--;
       }
@@ -1446,8 +2392,8 @@ FSTProcessor::transliteration(InputFile& input, UFILE *output)
 
     int32_t sym = 0;
     bool is_end = false;
-    if (cur_pos < transliteration_queue[cur_word].size()) {
-      sym = transliteration_queue[cur_word][cur_pos];
+    if (cur_pos < transliteration_queue.length(cur_word)) {
+      sym = transliteration_queue.word(cur_word)[cur_pos];
       cur_pos++;
     } else {
       if (cur_word + 1 == transliteration_queue.size() &&
@@ -1481,51 +2427,43 @@ FSTProcessor::transliteration(InputFile& input, UFILE *output)
       if (last_match.empty()) {
         start_pos++;
       } else {
-        std::vector<int32_t> match = alphabet.tokenize(last_match.substr(1));
+        auto& match = transliteration_match;
+        dict->alphabet.tokenize(UStringView(last_match).substr(1), match);
         last_match.clear();
-        std::vector<int32_t> word = transliteration_queue.front();
-        transliteration_queue.pop_front();
+        int32_t const *word = transliteration_queue.word(0);
         size_t i = 0;
         for (; i < match.size() && i < match_pos - start_pos; i++) {
           if (match[match.size()-i-1] != word[match_pos-i-1]) {
             break;
           }
         }
-        std::vector<int32_t> new_word;
-        new_word.insert(new_word.end(), word.begin(), word.begin()+start_pos);
-        new_word.insert(new_word.end(), match.begin(), match.end());
-        new_word.insert(new_word.end(), word.begin()+match_pos, word.end());
-        transliteration_queue.push_front(new_word);
-        int sf_spaces = 0;
-        int lf_spaces = 0;
-        for (auto c : word) {
-          if (c == static_cast<int32_t>(' ')) sf_spaces++;
-        }
-        for (auto c : new_word) {
-          if (c == static_cast<int32_t>(' ')) lf_spaces++;
-        }
+        // the match replaces start_pos..match_pos of the word
+        int sf_spaces = std::count(word + start_pos, word + match_pos,
+                                   static_cast<int32_t>(' '));
+        int lf_spaces = std::count(match.begin(), match.end(),
+                                   static_cast<int32_t>(' '));
         space_diff += (lf_spaces - sf_spaces);
+        transliteration_queue.replaceFront(start_pos, match_pos, match);
         size_t last_start = start_pos;
         start_pos = match_pos - i;
         if (start_pos == last_start) start_pos++;
         cur_pos = start_pos;
         cur_word = 0;
       }
-      if (start_pos >= transliteration_queue.front().size()) {
-        write(blankqueue.front(), output);
+      if (start_pos >= transliteration_queue.length(0)) {
+        output.write(blankqueue.front());
         blankqueue.pop();
         bool has_wblank = !wblankqueue.front().empty();
-        write(wblankqueue.front(), output);
-        wblankqueue.pop_front();
-        auto word = transliteration_queue.front();
-        transliteration_queue.pop_front();
-        int space_count = 0;
-        for (auto c : word) {
-          if (c == static_cast<int32_t>(' ')) space_count++;
-        }
+        output.write(wblankqueue.front());
+        wblankqueue.pop();
+        int32_t const *word = transliteration_queue.word(0);
+        int32_t const *word_end = word + transliteration_queue.length(0);
+        int space_count = std::count(word, word_end, static_cast<int32_t>(' '));
         int space_out = 0;
-        UString out;
-        for (auto c : word) {
+        UString &out = transliteration_out;
+        out.clear();
+        for (int32_t const *it = word; it != word_end; it++) {
+          int32_t const c = *it;
           if (c == ' ') {
             if (space_out + space_diff >= space_count) {
               out += ' ';
@@ -1540,16 +2478,17 @@ FSTProcessor::transliteration(InputFile& input, UFILE *output)
             if (c > 0 && isEscaped(c)) {
               out += '\\';
             }
-            alphabet.getSymbol(out, c);
+            dict->alphabet.getSymbol(out, c);
           }
         }
-        write(out, output);
+        output.write(out);
+        transliteration_queue.pop();
         if (has_wblank) {
-          write(WBLANK_FINAL, output);
+          output.write(WBLANK_FINAL);
         }
         while (space_diff < 0) {
           if (blankqueue.front() != " "_u) {
-            write(blankqueue.front(), output);
+            output.write(blankqueue.front());
           }
           blankqueue.pop();
           space_diff++;
@@ -1570,38 +2509,53 @@ FSTProcessor::transliteration(InputFile& input, UFILE *output)
 }
 
 bool
-FSTProcessor::step_biltrans(UStringView word, std::vector<UString>& result, UString& queue)
+FSTProcessor::step_biltrans(UStringView word)
 {
-  State current_state = initial_state;
+  biltrans_state = dict->initial_state;
+  biltrans_forms.clear();
+  biltrans_ends.clear();
+  biltrans_queue.clear();
   bool firstupper = u_isupper(word[0]);
   bool uppercase = firstupper && u_isupper(word[1]);
   for (auto symbol : symbol_iter(word)) {
-    int32_t val = (symbol.size() == 1 ? symbol[0] : alphabet(symbol));
-    if (current_state.size() != 0) {
-      current_state.step(val, beCaseSensitive(current_state));
-    }
-    if (current_state.isFinal(all_finals)) {
-      current_state.filterFinalsArray(result,
-                                      all_finals, alphabet,
-                                      escaped_chars,
+    int32_t val = (symbol.size() == 1 ? symbol[0] : dict->alphabet(symbol));
+    if (biltrans_state.size() != 0) {
+      biltrans_state.step(val, beCaseSensitive(biltrans_state));
+    }
+    if (biltrans_state.isFinal(dict->final_table)) {
+      biltrans_state.filterFinalsInto(biltrans_forms, biltrans_ends,
+                                      dict->final_table, dict->alphabet,
+                                      dict->escaped_chars,
                                       displayWeightsMode, maxAnalyses, maxWeightClasses,
                                       uppercase, firstupper, 0);
     }
-    if (current_state.size() == 0) {
-      if (!result.empty()) queue.append(symbol);
+    if (biltrans_state.size() == 0) {
+      if (!biltrans_ends.empty()) biltrans_queue.append(symbol);
       else return false;
     }
   }
-  return !result.empty();
+  return !biltrans_ends.empty();
 }
 
-UString
-FSTProcessor::biltransfull(UStringView input_word, bool with_delim)
+void
+FSTProcessor::biltransUnknown(UStringView input_word, bool with_delim,
+                              UString &out)
+{
+  if (with_delim) {
+    out.assign(u"^@");
+    out.append(input_word.substr(1));
+  } else {
+    out.assign(1, '@');
+    out.append(input_word);
+  }
+}
+
+void
+FSTProcessor::biltransfullUncached(UStringView input_word, UString &out,
+                                   bool with_delim)
 {
-  std::vector<UString> result;
   unsigned int start_point = 1;
   unsigned int end_point = input_word.size()-2;
-  UString queue;
   bool mark = false;
 
   if(with_delim == false)
@@ -1612,7 +2566,8 @@ FSTProcessor::biltransfull(UStringView input_word, bool with_delim)
 
   if(input_word[start_point] == '*')
   {
-    return US(input_word);
+    out.assign(input_word);
+    return;
   }
 
   if(input_word[start_point] == '=')
@@ -1622,31 +2577,30 @@ FSTProcessor::biltransfull(UStringView input_word, bool with_delim)
   }
 
   auto word = input_word.substr(start_point, end_point-start_point);
-  bool exists = step_biltrans(word, result, queue);
+  bool exists = step_biltrans(word);
   if (!exists) {
-    if (with_delim) return "^@"_u + US(input_word.substr(1));
-    else return "@"_u + US(input_word);
+    biltransUnknown(input_word, with_delim, out);
+    return;
   }
 
   if(start_point < (end_point - 3))
   {
-    return "^$"_u;
+    out.assign(u"^$");
+    return;
   }
   // attach unmatched queue automatically
 
-  return compose(result, queue, with_delim, mark);
+  composeBiltrans(out, biltrans_queue, with_delim, mark);
 }
 
 
 
-UString
-FSTProcessor::biltrans(UStringView input_word, bool with_delim)
+void
+FSTProcessor::biltransUncached(UStringView input_word, UString &out,
+                               bool with_delim)
 {
-  State current_state = initial_state;
-  std::vector<UString> result;
   unsigned int start_point = 1;
   unsigned int end_point = input_word.size()-2;
-  UString queue;
   bool mark = false;
 
   if(with_delim == false)
@@ -1657,7 +2611,8 @@ FSTProcessor::biltrans(UStringView input_word, bool with_delim)
 
   if(input_word[start_point] == '*')
   {
-    return US(input_word);
+    out.assign(input_word);
+    return;
   }
 
   if(input_word[start_point] == '=')
@@ -1667,15 +2622,30 @@ FSTProcessor::biltrans(UStringView input_word, bool with_delim)
   }
 
   UStringView word = input_word.substr(start_point, end_point-start_point);
-  bool exists = step_biltrans(word, result, queue);
+  bool exists = step_biltrans(word);
   if (!exists) {
-    if (with_delim) return "^@"_u + US(input_word.substr(1));
-    else return "@"_u + US(input_word);
+    biltransUnknown(input_word, with_delim, out);
+    return;
   }
 
   // attach unmatched queue automatically
 
-  return compose(result, queue, with_delim, mark);
+  composeBiltrans(out, biltrans_queue, with_delim, mark);
+}
+
+void
+FSTProcessor::composeBiltrans(UString &out, UStringView queue,
+                              bool delim, bool mark) const
+{
+  out.clear();
+  if (delim) out += '^';
+  if (mark) out += '=';
+  for (size_t i = 0, from = 0; i < biltrans_ends.size(); from = biltrans_ends[i++]) {
+    if (i > 0) out += '/';
+    out.append(biltrans_forms, from, biltrans_ends[i] - from);
+    out += queue;
+  }
+  if (delim) out += '$';
 }
 
 UString
@@ -1698,115 +2668,75 @@ FSTProcessor::compose(const std::vector<UString>& lexforms, UStringView queue,
 
 void
 FSTProcessor::bilingual(InputFile& input, UFILE *output, GenerationMode mode)
+{
+  OutputBuffer buffer(output, threadedOutput);
+  bilingual(input, buffer, mode);
+}
+
+void
+FSTProcessor::bilingual(InputFile& input, OutputBuffer& output, GenerationMode mode)
 {
   StreamReader reader(&input);
-  reader.alpha = &alphabet;
+  reader.alpha = &dict->alphabet;
   reader.add_unknowns = true;
+  reader.views = true;
 
   size_t index = (biltransSurfaceForms || biltransSurfaceFormsKeep ? 1 : 0);
 
   while (!reader.at_eof) {
     reader.next();
 
-    write(reader.blank, output);
-    write(reader.wblank, output);
+    output.write(reader.blank);
+    output.write(reader.wblank);
 
-    if (biltransSurfaceFormsKeep && !reader.readings.empty()) {
-      u_fputc('^', output);
-      write(reader.readings[0].content, output);
-      u_fputc((reader.readings.size() > 1 ? '/' : '$'), output);
+    if (biltransSurfaceFormsKeep && !reader.reading_views.empty()) {
+      output.put('^');
+      output.write(reader.reading_views[0].content);
+      output.put((reader.reading_views.size() > 1 ? '/' : '$'));
     }
 
-    if (index >= reader.readings.size()) {
+    if (index >= reader.reading_views.size()) {
       maybeFlush(output, reader.at_null);
       continue;
     }
 
-    if (!biltransSurfaceFormsKeep) u_fputc('^', output);
+    if (!biltransSurfaceFormsKeep) output.put('^');
 
-    if (reader.readings[index].mark == '*') {
-      u_fputc('*', output);
-      write(reader.readings[index].content, output);
-      u_fputc('/', output);
-      if (mode != gm_clean) u_fputc('*', output);
-      write(reader.readings[index].content, output);
-      u_fputc('$', output);
+    if (reader.reading_views[index].mark == '*') {
+      output.put('*');
+      output.write(reader.reading_views[index].content);
+      output.put('/');
+      if (mode != gm_clean) output.put('*');
+      output.write(reader.reading_views[index].content);
+      output.put('$');
       maybeFlush(output, reader.at_null);
       continue;
     }
 
-    auto& symbols = reader.readings[index].symbols;
+    auto& symbols = reader.reading_views[index].symbols;
 
     if (symbols.empty()) {
-      u_fputc('$', output);
+      output.put('$');
       maybeFlush(output, reader.at_null);
       continue;
     }
 
-    State current_state = initial_state;
-
-    bool firstupper = (symbols[0] > 0 && u_isupper(symbols[0]));
-    bool uppercase = (firstupper && symbols.size() > 1 &&
-                      symbols[1] > 0 && u_isupper(symbols[1]));
-
-    bool seenTags = false;
-    size_t queue_start = 0;
-    std::vector<UString> result;
-    if (reader.readings[index].mark == '#') current_state.step('#');
-    for (size_t i = 0; i < symbols.size(); i++) {
-      seenTags = seenTags || alphabet.isTag(symbols[i]);
-      current_state.step_case(symbols[i], beCaseSensitive(current_state));
-      if (current_state.isFinal(all_finals)) {
-        queue_start = i;
-        current_state.filterFinalsArray(result,
-                                        all_finals, alphabet, escaped_chars,
-                                        displayWeightsMode, maxAnalyses,
-                                        maxWeightClasses, uppercase,
-                                        firstupper, 0);
-      }
-    }
-    // if there are no tags, we only return complete matches
-    if (!seenTags && queue_start + 1 < symbols.size()) result.clear();
-
-    UString source;
-    size_t queue_pos = 0;
-    if (reader.readings[index].mark == '#') {
-      source += '#';
-      queue_pos = 1;
-    }
-    for (size_t i = 0; i < symbols.size(); i++) {
-      if (isEscaped(symbols[i]) || (i == 0 && symbols[i] == '*')) source += '\\';
-      alphabet.getSymbol(source, symbols[i]);
-      if (i == queue_start) queue_pos = source.size();
-    }
-
-    write(source, output);
-    u_fputc('/', output);
-
-    if (!result.empty()) {
-      write(compose(result, source.substr(queue_pos)), output);
-    } else {
-      u_fputc((mode == gm_all ? '#' : '@'), output);
-      write(source, output);
-    }
-    u_fputc('$', output);
+    output.write(lookupBilingual(reader.reading_views[index], mode));
 
     if (reader.at_null) {
-      u_fputc('\0', output);
-      u_fflush(output);
+      output.put('\0');
+      output.flush();
+      writeStats();
     }
   }
 }
 
-std::pair<UString, int>
-FSTProcessor::biltransWithQueue(UStringView input_word, bool with_delim)
+int
+FSTProcessor::biltransWithQueueUncached(UStringView input_word, UString &out,
+                                        bool with_delim)
 {
-  State current_state = initial_state;
-  std::vector<UString> result;
-  std::vector<UString> temp;
   unsigned int start_point = 1;
   unsigned int end_point = input_word.size()-2;
-  UString queue;
   bool mark = false;
   bool seentags = false;  // have we seen any tags at all in the analysis?
 
@@ -1818,7 +2748,8 @@ FSTProcessor::biltransWithQueue(UStringView input_word, bool with_delim)
 
   if(input_word[start_point] == '*')
   {
-    return {US(input_word), 0};
+    out.assign(input_word);
+    return 0;
   }
 
   if(input_word[start_point] == '=')
@@ -1830,75 +2761,68 @@ FSTProcessor::biltransWithQueue(UStringView input_word, bool with_delim)
   bool firstupper = u_isupper(input_word[start_point]);
   bool uppercase = firstupper && u_isupper(input_word[start_point+1]);
 
+  biltrans_state = dict->initial_state;
+  biltrans_forms.clear();
+  biltrans_ends.clear();
+  biltrans_queue.clear();
   UStringView word = input_word.substr(start_point, end_point-start_point);
   for (auto symbol : symbol_iter(word)) {
     int32_t val;
     if (symbol.size() == 1) {
       val = symbol[0];
     } else {
-      val = alphabet(symbol);
+      val = dict->alphabet(symbol);
       seentags = true;
     }
-    if(current_state.size() != 0)
+    if(biltrans_state.size() != 0)
     {
-      current_state.step_case(val, beCaseSensitive(current_state));
+      biltrans_state.step_case(val, beCaseSensitive(biltrans_state));
     }
-    if(current_state.isFinal(all_finals))
+    if(biltrans_state.isFinal(dict->final_table))
     {
-      current_state.filterFinalsArray(result, all_finals, alphabet,
-                                      escaped_chars,
+      biltrans_state.filterFinalsInto(biltrans_forms, biltrans_ends,
+                                      dict->final_table, dict->alphabet,
+                                      dict->escaped_chars,
                                       displayWeightsMode, maxAnalyses, maxWeightClasses,
                                       uppercase, firstupper, 0);
     }
 
-    if(current_state.size() == 0)
+    if(biltrans_state.size() == 0)
     {
-      if(!symbol.empty() && !result.empty())
+      if(!symbol.empty() && !biltrans_ends.empty())
       {
-        queue.append(symbol);
+        biltrans_queue.append(symbol);
       }
       else
       {
         // word is not present
-        if(with_delim)
-        {
-          return {"^@"_u + US(input_word.substr(1)), 0};
-        }
-        else
-        {
-          return {"@"_u + US(input_word), 0};
-        }
+        biltransUnknown(input_word, with_delim, out);
+        return 0;
       }
     }
   }
 
+  // the finals of the state the word ended in were filtered at its last
+  // symbol, if there were any
   if (!seentags
-      && current_state.filterFinals(all_finals, alphabet, escaped_chars,
-                                    displayWeightsMode, maxAnalyses, maxWeightClasses,
-                                    uppercase, firstupper, 0).empty())
+      && (!biltrans_state.isFinal(dict->final_table) || biltrans_ends.empty()))
   {
     // word is not present
-    if(with_delim)
-    {
-      return {"^@"_u + US(input_word.substr(1)), 0};
-    }
-    else
-    {
-      return {"@"_u + US(input_word), 0};
-    }
+    biltransUnknown(input_word, with_delim, out);
+    return 0;
   }
 
 
 
   // attach unmatched queue automatically
-  return {compose(result, queue, with_delim, mark), queue.size()};
+  composeBiltrans(out, biltrans_queue, with_delim, mark);
+  return biltrans_queue.size();
 }
 
-UString
-FSTProcessor::biltransWithoutQueue(UStringView input_word, bool with_delim)
+void
+FSTProcessor::biltransWithoutQueueUncached(UStringView input_word,
+                                           UString &out, bool with_delim)
 {
-  State current_state = initial_state;
-  std::vector<UString> result;
   unsigned int start_point = 1;
   unsigned int end_point = input_word.size()-2;
   bool mark = false;
@@ -1911,7 +2835,8 @@ FSTProcessor::biltransWithoutQueue(UStringView input_word, bool with_delim)
 
   if(input_word[start_point] == '*')
   {
-    return US(input_word);
+    out.assign(input_word);
+    return;
   }
 
   if(input_word[start_point] == '=')
@@ -1921,63 +2846,364 @@ FSTProcessor::biltransWithoutQueue(UStringView input_word, bool with_delim)
   }
 
   auto word = input_word.substr(start_point, end_point-start_point);
-  UString queue;
-  bool exists = step_biltrans(word, result, queue);
-  if (!exists || !queue.empty()) {
-    if (with_delim) return "^@"_u + US(input_word.substr(1));
-    else return "@"_u + US(input_word);
+  bool exists = step_biltrans(word);
+  if (!exists || !biltrans_queue.empty()) {
+    biltransUnknown(input_word, with_delim, out);
+    return;
   }
 
-  return compose(result, ""_u, with_delim, mark);
+  composeBiltrans(out, ""_u, with_delim, mark);
 }
 
-
-bool
-FSTProcessor::valid() const
+std::pair<UString, int> const &
+FSTProcessor::memoBiltrans(BiltransMode mode, UStringView input_word,
+                           bool with_delim)
 {
-  if(initial_state.isFinal(all_finals))
+  biltrans_key.assign(1, static_cast<UChar>(2 * mode + with_delim));
+  biltrans_key.append(input_word);
+  auto cached = biltrans_cache.find(biltrans_key);
+  if(cached != nullptr)
   {
-    std::cerr << "Error: Invalid dictionary (hint: the left side of an entry is empty)" << std::endl;
-    return false;
+    return *cached;
   }
-  else
+
+  biltrans_result.second = 0;
+  switch(mode)
   {
-    State s = initial_state;
-    s.step(' ');
-    if(s.size() != 0)
-    {
-      std::cerr << "Error: Invalid dictionary (hint: entry beginning with whitespace)" << std::endl;
-      return false;
-    }
-  }
+    case bm_biltrans:
+      biltransUncached(input_word, biltrans_result.first, with_delim);
+      break;
 
-  return true;
+    case bm_full:
+      biltransfullUncached(input_word, biltrans_result.first, with_delim);
+      break;
+
+    case bm_with_queue:
+      biltrans_result.second = biltransWithQueueUncached(input_word,
+                                                         biltrans_result.first,
+                                                         with_delim);
+      break;
+
+    case bm_without_queue:
+      biltransWithoutQueueUncached(input_word, biltrans_result.first,
+                                   with_delim);
+      break;
+  }
+  biltrans_cache.insert(biltrans_key, biltrans_result,
+                        biltrans_result.first.size() * sizeof(UChar));
+  return biltrans_result;
 }
 
-int
-FSTProcessor::readSAO(InputFile& input)
+std::pair<bool, UString> const &
+FSTProcessor::lookupGeneration(StreamReader::ReadingView const &rd,
+                               GenerationMode mode, State &current_state,
+                               size_t &paths)
 {
-  if(!input_buffer.isEmpty())
+  bool const cached = lookup_cache.enabled() && stats == nullptr &&
+                      dict->profile.transducers.empty();
+  if(cached)
   {
-    return input_buffer.next();
+    lookup_key.assign(1, 'g');
+    lookup_key += static_cast<UChar>(mode);
+    lookup_key.append(rd.content);
+    auto entry = lookup_cache.find(lookup_key);
+    if(entry != nullptr)
+    {
+      return *entry;
+    }
   }
 
-  UChar32 val = input.get();
-  if(input.eof())
+  current_state = dict->initial_state;
+  for (auto& sym : rd.symbols) {
+    if (!dict->alphabet.isTag(sym) && u_isupper(sym) &&
+        !beCaseSensitive(current_state)) {
+      if (mode == gm_carefulcase) {
+        current_state.step_case_careful(sym, false);
+      }
+      else {
+        current_state.step_case(sym, false);
+      }
+    }
+    else current_state.step(sym);
+    if (stats != nullptr && current_state.size() > paths) {
+      paths = current_state.size();
+    }
+  }
+  lookup_result.first = current_state.isFinal(dict->final_table);
+  lookup_result.second.clear();
+  if (lookup_result.first) {
+    bool firstupper = false, uppercase = false;
+    if (!dictionaryCase) {
+      uppercase = rd.content.size() > 1 && u_isupper(rd.content[1]);
+      firstupper= u_isupper(rd.content[0]);
+    }
+    lookup_result.second = current_state.filterFinals(dict->final_table, dict->alphabet, dict->escaped_chars,
+                                                      displayWeightsMode, maxAnalyses,
+                                                      maxWeightClasses,
+                                                      uppercase, firstupper).substr(1);
+  }
+
+  if(cached)
   {
-    return 0;
+    lookup_cache.insert(lookup_key, lookup_result,
+                        lookup_result.second.size() * sizeof(UChar));
   }
+  return lookup_result;
+}
 
-  if(escaped_chars.find(val) != escaped_chars.end())
+UString const &
+FSTProcessor::lookupBilingual(StreamReader::ReadingView const &rd,
+                              GenerationMode mode)
+{
+  bool const cached = lookup_cache.enabled() &&
+                      dict->profile.transducers.empty();
+  if(cached)
   {
-    if(val == '<')
+    lookup_key.assign(1, 'b');
+    lookup_key += static_cast<UChar>(mode);
+    lookup_key += static_cast<UChar>(rd.mark == '#');
+    lookup_key.append(rd.content);
+    auto entry = lookup_cache.find(lookup_key);
+    if(entry != nullptr)
     {
-      UString str = input.readBlock('<', '>');
-      if(StringUtils::startswith(str, u"<![CDATA["))
-      {
-        while(!StringUtils::endswith(str, u"]]>"))
-        {
-          str.append(input.readBlock('<', '>').substr(1));
+      return entry->second;
+    }
+  }
+
+  auto const &symbols = rd.symbols;
+  State current_state = dict->initial_state;
+
+  bool firstupper = (symbols[0] > 0 && u_isupper(symbols[0]));
+  bool uppercase = (firstupper && symbols.size() > 1 &&
+                    symbols[1] > 0 && u_isupper(symbols[1]));
+
+  bool seenTags = false;
+  size_t queue_start = 0;
+  std::vector<UString> result;
+  if (rd.mark == '#') current_state.step('#');
+  for (size_t i = 0; i < symbols.size(); i++) {
+    seenTags = seenTags || dict->alphabet.isTag(symbols[i]);
+    current_state.step_case(symbols[i], beCaseSensitive(current_state));
+    if (current_state.isFinal(dict->final_table)) {
+      queue_start = i;
+      current_state.filterFinalsArray(result,
+                                      dict->final_table, dict->alphabet, dict->escaped_chars,
+                                      displayWeightsMode, maxAnalyses,
+                                      maxWeightClasses, uppercase,
+                                      firstupper, 0);
+    }
+  }
+  // if there are no tags, we only return complete matches
+  if (!seenTags && queue_start + 1 < symbols.size()) result.clear();
+
+  UString source;
+  size_t queue_pos = 0;
+  if (rd.mark == '#') {
+    source += '#';
+    queue_pos = 1;
+  }
+  for (size_t i = 0; i < symbols.size(); i++) {
+    if (isEscaped(symbols[i]) || (i == 0 && symbols[i] == '*')) source += '\\';
+    dict->alphabet.getSymbol(source, symbols[i]);
+    if (i == queue_start) queue_pos = source.size();
+  }
+
+  UString &out = lookup_result.second;
+  out = source;
+  out += '/';
+  if (!result.empty()) {
+    out += compose(result, source.substr(queue_pos));
+  } else {
+    out += (mode == gm_all ? '#' : '@');
+    out += source;
+  }
+  out += '$';
+
+  if(cached)
+  {
+    lookup_cache.insert(lookup_key, lookup_result, out.size() * sizeof(UChar));
+  }
+  return out;
+}
+
+UString
+FSTProcessor::biltrans(UStringView input_word, bool with_delim)
+{
+  UString out;
+  biltrans(input_word, out, with_delim);
+  return out;
+}
+
+void
+FSTProcessor::biltrans(UStringView input_word, UString &out, bool with_delim)
+{
+  if(!biltrans_cache.enabled())
+  {
+    biltransUncached(input_word, out, with_delim);
+    return;
+  }
+  out = memoBiltrans(bm_biltrans, input_word, with_delim).first;
+}
+
+UString
+FSTProcessor::biltransfull(UStringView input_word, bool with_delim)
+{
+  UString out;
+  biltransfull(input_word, out, with_delim);
+  return out;
+}
+
+void
+FSTProcessor::biltransfull(UStringView input_word, UString &out, bool with_delim)
+{
+  if(!biltrans_cache.enabled())
+  {
+    biltransfullUncached(input_word, out, with_delim);
+    return;
+  }
+  out = memoBiltrans(bm_full, input_word, with_delim).first;
+}
+
+void
+FSTProcessor::analyseBatch(UStringView const *tokens, size_t count,
+                           std::vector<UString> *analyses,
+                           std::vector<double> *weights)
+{
+  // one state for the whole batch, so its buffers are only grown once
+  State current_state;
+  std::vector<double> unused_weights;
+  CharSet const no_escapes;
+  State::Best *best = bestPaths();
+
+  for(size_t i = 0; i < count; i++)
+  {
+    UStringView token = tokens[i];
+    std::vector<double> &token_weights = weights ? weights[i] : unused_weights;
+    analyses[i].clear();
+    token_weights.clear();
+    if(token.empty())
+    {
+      continue;
+    }
+
+    current_state = dict->initial_state;
+    current_state.setBest(best);
+    for(size_t j = 0; j < token.size() && current_state.size() != 0;)
+    {
+      UChar32 val;
+      U16_NEXT(token.data(), j, token.size(), val);
+      if((useIgnoredChars || useDefaultIgnoredChars) &&
+         dict->ignored_chars.contains(val))
+      {
+        continue;
+      }
+      current_state.step_case(val, beCaseSensitive(current_state));
+    }
+
+    if(current_state.isFinal(dict->final_table))
+    {
+      bool firstupper = false, uppercase = false;
+      if(!dictionaryCase)
+      {
+        firstupper = u_isupper(token[0]);
+        uppercase = (token.size() > 1 &&
+                     firstupper && u_isupper(token[token.size()-1]));
+      }
+      current_state.filterFinalsArray(analyses[i], token_weights,
+                                      dict->final_table, dict->alphabet,
+                                      no_escapes, maxAnalyses,
+                                      maxWeightClasses, uppercase,
+                                      firstupper, 0);
+    }
+  }
+}
+
+std::pair<UString, int>
+FSTProcessor::biltransWithQueue(UStringView input_word, bool with_delim)
+{
+  std::pair<UString, int> result;
+  result.second = biltransWithQueue(input_word, result.first, with_delim);
+  return result;
+}
+
+int
+FSTProcessor::biltransWithQueue(UStringView input_word, UString &out,
+                                bool with_delim)
+{
+  if(!biltrans_cache.enabled())
+  {
+    return biltransWithQueueUncached(input_word, out, with_delim);
+  }
+  auto const &result = memoBiltrans(bm_with_queue, input_word, with_delim);
+  out = result.first;
+  return result.second;
+}
+
+UString
+FSTProcessor::biltransWithoutQueue(UStringView input_word, bool with_delim)
+{
+  UString out;
+  biltransWithoutQueue(input_word, out, with_delim);
+  return out;
+}
+
+void
+FSTProcessor::biltransWithoutQueue(UStringView input_word, UString &out, bool with_delim)
+{
+  if(!biltrans_cache.enabled())
+  {
+    biltransWithoutQueueUncached(input_word, out, with_delim);
+    return;
+  }
+  out = memoBiltrans(bm_without_queue, input_word, with_delim).first;
+}
+
+bool
+FSTProcessor::valid() const
+{
+  if(dict->initial_state.isFinal(dict->final_table))
+  {
+    std::cerr << "Error: Invalid dictionary (hint: the left side of an entry is empty)" << std::endl;
+    return false;
+  }
+  else
+  {
+    State s = dict->initial_state;
+    s.step(' ');
+    if(s.size() != 0)
+    {
+      std::cerr << "Error: Invalid dictionary (hint: entry beginning with whitespace)" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int
+FSTProcessor::readSAO(InputFile& input)
+{
+  if(!input_buffer.isEmpty())
+  {
+    return input_buffer.next();
+  }
+
+  UChar32 val = input.get();
+  if(input.eof())
+  {
+    return 0;
+  }
+
+  if(dict->escaped_chars.contains(val))
+  {
+    if(val == '<')
+    {
+      UString str = input.readBlock('<', '>');
+      if(StringUtils::startswith(str, u"<![CDATA["))
+      {
+        while(!StringUtils::endswith(str, u"]]>"))
+        {
+          str.append(input.readBlock('<', '>').substr(1));
         }
         blankqueue.push(str);
         input_buffer.add(static_cast<int32_t>(' '));
@@ -2009,7 +3235,7 @@ FSTProcessor::readSAO(InputFile& input)
 }
 
 void
-FSTProcessor::printSAOWord(UStringView lf, UFILE *output)
+FSTProcessor::printSAOWord(UStringView lf, OutputBuffer& output)
 {
   for(unsigned int i = 1, limit = lf.size(); i != limit; i++)
   {
@@ -2017,149 +3243,35 @@ FSTProcessor::printSAOWord(UStringView lf, UFILE *output)
     {
       break;
     }
-    u_fputc(lf[i], output);
+    output.put(lf[i]);
   }
 }
 
 void
 FSTProcessor::SAO(InputFile& input, UFILE *output)
 {
-  bool last_incond = false;
-  bool last_postblank = false;
-  State current_state = initial_state;
-  UString lf;
-  UString sf;
-  int last = 0;
-
-  escaped_chars.clear();
-  escaped_chars.insert('\\');
-  escaped_chars.insert('<');
-  escaped_chars.insert('>');
+  OutputBuffer buffer(output, threadedOutput);
+  SAO(input, buffer);
+}
 
-  while(UChar32 val = readSAO(input))
+void
+FSTProcessor::SAO(InputFile& input, OutputBuffer& output)
+{
+  dict->escaped_units = u"\\<>";
+  dict->escaped_chars.clear();
+  for(auto c : dict->escaped_units)
   {
-    // test for final states
-    if(current_state.isFinal(all_finals))
-    {
-      if(current_state.isFinal(inconditional))
-      {
-        bool firstupper = u_isupper(sf[0]);
-        bool uppercase = firstupper && u_isupper(sf[sf.size()-1]);
-
-        lf = current_state.filterFinalsSAO(all_finals, alphabet,
-                                        escaped_chars,
-                                        uppercase, firstupper);
-        last_incond = true;
-        last = input_buffer.getPos();
-      }
-      else if(current_state.isFinal(postblank))
-      {
-        bool firstupper = u_isupper(sf[0]);
-        bool uppercase = firstupper && u_isupper(sf[sf.size()-1]);
-
-        lf = current_state.filterFinalsSAO(all_finals, alphabet,
-                                        escaped_chars,
-                                        uppercase, firstupper);
-        last_postblank = true;
-        last = input_buffer.getPos();
-      }
-      else if(!isAlphabetic(val))
-      {
-        bool firstupper = u_isupper(sf[0]);
-        bool uppercase = firstupper && u_isupper(sf[sf.size()-1]);
-
-        lf = current_state.filterFinalsSAO(all_finals, alphabet,
-                                        escaped_chars,
-                                        uppercase, firstupper);
-        last_postblank = false;
-        last_incond = false;
-        last = input_buffer.getPos();
-      }
-    }
-    else if(sf.empty() && u_isspace(val))
-    {
-      lf = "/*"_u;
-      lf.append(sf);
-      last_postblank = false;
-      last_incond = false;
-      last = input_buffer.getPos();
-    }
-
-    current_state.step_case(val, beCaseSensitive(current_state));
-
-    if(current_state.size() != 0)
-    {
-      alphabet.getSymbol(sf, val);
-    }
-    else
-    {
-      if(!isAlphabetic(val) && sf.empty())
-      {
-        if(u_isspace(val))
-        {
-          printSpace(val, output);
-        }
-        else
-        {
-          if(isEscaped(val))
-          {
-            u_fputc('\\', output);
-          }
-          u_fputc(val, output);
-        }
-      }
-      else if(last_incond)
-      {
-        printSAOWord(lf, output);
-        input_buffer.setPos(last);
-        input_buffer.back(1);
-      }
-      else if(last_postblank)
-      {
-        printSAOWord(lf, output);
-        u_fputc(' ', output);
-        input_buffer.setPos(last);
-        input_buffer.back(1);
-      }
-      else if(isAlphabetic(val) &&
-              ((sf.size()-input_buffer.diffPrevPos(last)) > lastBlank(sf) ||
-               lf.empty()))
-      {
-        do
-        {
-          alphabet.getSymbol(sf, val);
-        }
-        while((val = readSAO(input)) && isAlphabetic(val));
-
-        auto limit = firstNotAlpha(sf);
-        unsigned int size = sf.size(); // TODO: change these to character counts
-        input_buffer.back(1+(size-limit.i_utf16));
-        u_fprintf(output, "<d>%S</d>", sf.c_str());
-      }
-      else if(lf.empty())
-      {
-        auto limit = firstNotAlpha(sf);
-        unsigned int size = sf.size(); // TODO: change these to character counts
-        input_buffer.back(1+(size-limit.i_utf16));
-        u_fprintf(output, "<d>%S</d>", sf.c_str());
-      }
-      else
-      {
-        printSAOWord(lf, output);
-        input_buffer.setPos(last);
-        input_buffer.back(1);
-      }
-
-      current_state = initial_state;
-      lf.clear();
-      sf.clear();
-      last_incond = false;
-      last_postblank = false;
-    }
+    dict->escaped_chars.insert(c);
   }
 
-  // print remaining blanks
-  flushBlanks(output);
+  if(useRestoreChars || !dict->acx_map.empty())
+  {
+    analyse<true, false, true>(input, output);
+  }
+  else
+  {
+    analyse<false, false, true>(input, output);
+  }
 }
 
 UStringView
@@ -2193,12 +3305,14 @@ void
 FSTProcessor::setCaseSensitiveMode(bool value)
 {
   caseSensitive = value;
+  clearCaches();
 }
 
 void
 FSTProcessor::setDictionaryCaseMode(bool value)
 {
   dictionaryCase = value;
+  clearCaches();
 }
 
 void
@@ -2207,46 +3321,291 @@ FSTProcessor::setNullFlush(bool value)
   nullFlush = value;
 }
 
+void
+FSTProcessor::setThreadedOutput(bool value)
+{
+  threadedOutput = value;
+}
+
 void
 FSTProcessor::setIgnoredChars(bool value)
 {
   useIgnoredChars = value;
+  clearCaches();
 }
 
 void
 FSTProcessor::setRestoreChars(bool value)
 {
   useRestoreChars = value;
+  clearCaches();
 }
 
 void
 FSTProcessor::setUseDefaultIgnoredChars(bool value)
 {
   useDefaultIgnoredChars = value;
+  clearCaches();
 }
 
 void
 FSTProcessor::setDisplayWeightsMode(bool value)
 {
   displayWeightsMode = value;
+  clearCaches();
 }
 
 void
 FSTProcessor::setMaxAnalysesValue(int value)
 {
   maxAnalyses = value;
+  clearCaches();
 }
 
 void
 FSTProcessor::setMaxWeightClassesValue(int value)
 {
   maxWeightClasses = value;
+  clearCaches();
 }
 
 void
 FSTProcessor::setCompoundMaxElements(int value)
 {
   compound_max_elements = value;
+  clearCaches();
+}
+
+void
+FSTProcessor::clearCaches()
+{
+  analysis_cache.clear();
+  biltrans_cache.clear();
+  lookup_cache.clear();
+  composition_cache.clear();
+}
+
+void
+FSTProcessor::loadComposition(FILE *input)
+{
+  modifyDictionary();
+  FSTProcessor g;
+  g.load(input);
+  g.initBiltrans();
+  dict->composition = g.dict;
+  mapCompositionTags();
+  composition_cache.setCapacity(0, composition_cache_bytes);
+}
+
+void
+FSTProcessor::mapCompositionTags()
+{
+  Alphabet const &g = dict->composition->alphabet;
+  dict->composition_tags.assign(dict->alphabet.size(), 0);
+  for (size_t i = 0; i < dict->composition_tags.size(); i++) {
+    UString tag;
+    dict->alphabet.getSymbol(tag, -1 - static_cast<int32_t>(i));
+    if (g.isSymbolDefined(tag)) {
+      dict->composition_tags[i] = g(tag);
+    }
+  }
+}
+
+void
+FSTProcessor::setMaxActivePaths(size_t paths, size_t per_output)
+{
+  modifyDictionary();
+  dict->beam.max_paths = paths;
+  dict->beam.max_per_output = per_output;
+  dict->initial_state.setBeam(paths != 0 ? &dict->beam : nullptr);
+}
+
+uint64_t
+FSTProcessor::getActivePathsPruned() const
+{
+  return dict->beam.triggered;
+}
+
+void
+FSTProcessor::setStatsOutput(FILE *output, bool json)
+{
+  modifyDictionary();
+  stats = &dict->stats;
+  stats_output = output;
+  stats_json = json;
+  dict->initial_state.setStats(&dict->stats.state);
+}
+
+void
+FSTProcessor::startProfile(uint32_t period)
+{
+  modifyDictionary();
+  dict->profile = State::Profile();
+  dict->profile.period = period;
+  for(auto &it : dict->transducers)
+  {
+    dict->profile.add(it.second.getNodeList(), it.second.getNumberOfNodes());
+  }
+  dict->initial_state.setProfile(&dict->profile);
+}
+
+void
+FSTProcessor::writeProfile(FILE *output) const
+{
+  size_t i = 0;
+  for(auto &it : dict->transducers)
+  {
+    if(i == dict->profile.visits.size())
+    {
+      break;
+    }
+    std::ostringstream name;
+    name << it.first;
+    auto const &visits = dict->profile.visits[i++];
+    for(size_t node = 0; node < visits.size(); node++)
+    {
+      uint64_t const count = visits[node].load(std::memory_order_relaxed);
+      if(count != 0)
+      {
+        fprintf(output, "%s\t%zu\t%llu\n", name.str().c_str(), node,
+                static_cast<unsigned long long>(count));
+      }
+    }
+    auto const &arcs = dict->profile.arcs[i - 1];
+    auto const &first = dict->profile.first_arc[i - 1];
+    for(size_t node = 0; node + 1 < first.size(); node++)
+    {
+      for(size_t arc = first[node]; arc < first[node + 1]; arc++)
+      {
+        uint64_t const count = arcs[arc].load(std::memory_order_relaxed);
+        if(count != 0)
+        {
+          fprintf(output, "%s\t%zu\t%zu\t%llu\n", name.str().c_str(), node,
+                  arc - first[node], static_cast<unsigned long long>(count));
+        }
+      }
+    }
+  }
+}
+
+void
+FSTProcessor::setSlowTokenThreshold(double seconds)
+{
+  dict->stats.slow_token = static_cast<uint64_t>(seconds * 1e9);
+}
+
+void
+FSTProcessor::countToken(std::chrono::steady_clock::time_point start,
+                         UStringView sf, size_t paths)
+{
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  uint64_t const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  stats->addLatency(ns);
+  if(stats->slow_token != 0 && ns >= stats->slow_token)
+  {
+    std::ostringstream form;
+    form << sf;
+    if(stats_json)
+    {
+      fprintf(stats_output, "{\"slow_token\": \"%s\", \"seconds\": %.9f, \"paths\": %zu}\n",
+              jsonEscaped(form.str()).c_str(), ns / 1e9, paths);
+    }
+    else
+    {
+      fprintf(stats_output, "slow token:     %s (%.9f s, %zu paths)\n",
+              form.str().c_str(), ns / 1e9, paths);
+    }
+  }
+}
+
+void
+FSTProcessor::writeStats()
+{
+  if(stats != nullptr)
+  {
+    stats->write(stats_output, stats_json);
+    stats->reset();
+  }
+}
+
+FSTMemoryReport
+FSTProcessor::getMemoryReport() const
+{
+  FSTMemoryReport report;
+  dict->reportMemory(report);
+
+  report.states = analysis_scratch.current_state.memoryUsage() +
+                  biltrans_state.memoryUsage();
+  report.input_buffer = input_buffer.memoryUsage();
+  report.queues = blankqueue.memoryUsage() + wblankqueue.memoryUsage() +
+                  transliteration_queue.memoryUsage();
+  report.caches = analysis_cache.getBytes() + biltrans_cache.getBytes() +
+                  lookup_cache.getBytes() + composition_cache.getBytes();
+  for(auto text : {&analysis_scratch.lf, &analysis_scratch.sf,
+                   &analysis_scratch.lf_spcmp, &cache_key, &biltrans_key,
+                   &biltrans_result.first, &biltrans_forms, &biltrans_queue,
+                   &lookup_key, &lookup_result.second,
+                   &transliteration_blank, &transliteration_out})
+  {
+    report.scratch += text->capacity() * sizeof(UChar);
+  }
+  report.scratch += biltrans_ends.capacity() * sizeof(size_t) +
+                    transliteration_match.capacity() * sizeof(int32_t);
+  return report;
+}
+
+void
+FSTProcessor::setAnalysisCacheSize(size_t entries, size_t bytes)
+{
+  analysis_cache.setCapacity(entries, bytes);
+}
+
+uint64_t
+FSTProcessor::getAnalysisCacheHits() const
+{
+  return analysis_cache.getHits();
+}
+
+uint64_t
+FSTProcessor::getAnalysisCacheMisses() const
+{
+  return analysis_cache.getMisses();
+}
+
+void
+FSTProcessor::setBiltransCacheSize(size_t entries, size_t bytes)
+{
+  biltrans_cache.setCapacity(entries, bytes);
+}
+
+uint64_t
+FSTProcessor::getBiltransCacheHits() const
+{
+  return biltrans_cache.getHits();
+}
+
+uint64_t
+FSTProcessor::getBiltransCacheMisses() const
+{
+  return biltrans_cache.getMisses();
+}
+
+void
+FSTProcessor::setLookupCacheSize(size_t entries, size_t bytes)
+{
+  lookup_cache.setCapacity(entries, bytes);
+}
+
+uint64_t
+FSTProcessor::getLookupCacheHits() const
+{
+  return lookup_cache.getHits();
+}
+
+uint64_t
+FSTProcessor::getLookupCacheMisses() const
+{
+  return lookup_cache.getMisses();
 }
 
 bool
@@ -20,19 +20,29 @@
 
 #include <lttoolbox/ustring.h>
 #include <unicode/uchriter.h>
+#include <lttoolbox/acx.h>
 #include <lttoolbox/alphabet.h>
-#include <lttoolbox/buffer.h>
+#include <lttoolbox/blank_queue.h>
+#include <lttoolbox/symbol_queue.h>
+#include <lttoolbox/char_set.h>
+#include <lttoolbox/clock_cache.h>
+#include <lttoolbox/det_state.h>
 #include <lttoolbox/my_stdio.h>
+#include <lttoolbox/segmented_buffer.h>
 #include <lttoolbox/state.h>
+#include <lttoolbox/stream_reader.h>
 #include <lttoolbox/trans_exe.h>
 #include <lttoolbox/input_file.h>
+#include <lttoolbox/output_buffer.h>
 #include <libxml/xmlreader.h>
 
-#include <deque>
+#include <atomic>
+#include <chrono>
 #include <map>
-#include <queue>
+#include <memory>
 #include <set>
 #include <string>
+#include <vector>
 #include <cstdint>
 
 /**
@@ -59,11 +69,152 @@ enum TranslationMemoryMode
 
 
 /**
- * Class that implements the FST-based modules of the system
+ * Counters of the work done by the processors sharing a dictionary, see
+ * FSTProcessor::setStatsOutput().  The times are in nanoseconds.
  */
-class FSTProcessor
+struct FSTStats
+{
+  /**
+   * Counters of the states
+   */
+  State::Stats state;
+
+  /**
+   * Characters read from the input, escapes and tags counting as one
+   */
+  std::atomic<uint64_t> characters{0};
+
+  /**
+   * Lexical units written, and how many of them were unknown words
+   */
+  std::atomic<uint64_t> tokens{0};
+  std::atomic<uint64_t> unknown{0};
+
+  std::atomic<uint64_t> read_time{0};
+  std::atomic<uint64_t> step_time{0};
+  std::atomic<uint64_t> filter_time{0};
+  std::atomic<uint64_t> output_time{0};
+
+  /**
+   * Histogram of the time taken by every token, from its first character
+   * to its output, in buckets of a quarter of a power of two nanoseconds
+   */
+  static constexpr size_t latency_buckets = 256;
+  std::atomic<uint64_t> latency[latency_buckets] = {};
+
+  /**
+   * Tokens taking at least this many nanoseconds are written to the
+   * output of the statistics as they come, 0 for none
+   */
+  uint64_t slow_token = 0;
+
+  /**
+   * Number of tokens taking at least slow_token
+   */
+  std::atomic<uint64_t> slow_tokens{0};
+
+  /**
+   * Add a token that took ns nanoseconds to the histogram
+   */
+  void addLatency(uint64_t ns);
+
+  /**
+   * Time in nanoseconds (the upper bound of its bucket) that the fraction
+   * q of the tokens of the histogram did not exceed
+   */
+  uint64_t latencyQuantile(double q) const;
+
+  /**
+   * Write the counters to output, as one line of JSON if json and as
+   * lines of text otherwise
+   */
+  void write(FILE *output, bool json) const;
+
+  /**
+   * Set all the counters to 0
+   */
+  void reset();
+};
+
+/**
+ * Bytes of memory taken by an FSTProcessor, see
+ * FSTProcessor::getMemoryReport().  The dictionary is shared by the
+ * processors copied from the one that loaded it; the session is what
+ * the processor keeps for the streams it processes, and as its buffers
+ * keep their capacity, that is the most they needed so far.  The sizes
+ * come from the sizes and capacities of the containers, leaving out the
+ * overhead of the allocator.
+ */
+struct FSTMemoryReport
+{
+  /**
+   * A section of the dictionary: the nodes of its transducer, the bytes
+   * it owns and those of the image mapped from the file, which are only
+   * resident as far as they are read and are shared with the other
+   * processes mapping the file
+   */
+  struct Section
+  {
+    std::string name;
+    uint64_t nodes = 0;
+    uint64_t bytes = 0;
+    uint64_t mapped = 0;
+  };
+  std::vector<Section> sections;
+
+  /**
+   * The rest of the dictionary: the alphabet, the maps and table of the
+   * final nodes, the epsilon closures, the initial state, the character
+   * classes, the restorations of the RCX file and, whole, the dictionary
+   * composed with
+   */
+  uint64_t alphabet = 0;
+  uint64_t finals = 0;
+  uint64_t epsilon_table = 0;
+  uint64_t initial_state = 0;
+  uint64_t char_sets = 0;
+  uint64_t restore_chars = 0;
+  uint64_t composition = 0;
+
+  /**
+   * The session: the states kept between tokens, the input buffer, the
+   * queues of blanks and words, the caches and the strings kept for
+   * their storage
+   */
+  uint64_t states = 0;
+  uint64_t input_buffer = 0;
+  uint64_t queues = 0;
+  uint64_t caches = 0;
+  uint64_t scratch = 0;
+
+  /**
+   * Bytes of the dictionary, without the mapped ones
+   */
+  uint64_t dictionary() const;
+
+  uint64_t session() const;
+
+  /**
+   * Write the report to output, as one line of JSON if json and as lines
+   * of text otherwise
+   */
+  void write(FILE *output, bool json) const;
+};
+
+class FSTProcessor;
+
+/**
+ * Compiled dictionary of an FSTProcessor: the transducers, their alphabet
+ * and the character classes read along with them.  It is written while
+ * the processor that loaded it is being initialised and only read after
+ * that, so it can be shared by several processors working on different
+ * streams in different threads.
+ */
+class FSTDictionary
 {
 private:
+  friend class FSTProcessor;
+
   /**
    * Transducers in FSTP
    */
@@ -105,31 +256,76 @@ private:
   std::map<Node *, double> all_finals;
 
   /**
-   * Queue of blanks, used in reading methods
+   * The nodes of all_finals with the classes of the maps above they are
+   * in, for the queries of State
    */
-  std::queue<UString> blankqueue;
+  FinalTable final_table;
 
   /**
-   * Queue of wordbound blanks, used in reading methods
+   * Epsilon closures of the nodes of the transducers, used by
+   * initial_state and the states copied from it
    */
-  std::deque<UString> wblankqueue;
+  EpsilonTable epsilon_table;
 
-  std::deque<std::vector<int32_t>> transliteration_queue;
+  /**
+   * The characters the paths from initial_state can step with at every
+   * position of a token, the last set standing for all the positions
+   * from there on, for analysis() to see a token is unknown without
+   * stepping the state with the character it stops at
+   * @see State::reachableChars()
+   */
+  std::vector<CharSet> reachable_chars;
+
+  /**
+   * Limit on the paths of initial_state and the states copied from it,
+   * shared by the processors since their counter is
+   */
+  State::Beam beam;
+
+  /**
+   * Whether a weight of the transducers may be below 0; initAnalysis()
+   * only rules it out when there is a limit on weight classes
+   */
+  bool negative_weights = true;
+
+  /**
+   * Counters of the processors sharing the dictionary, if they collect
+   * statistics
+   */
+  FSTStats stats;
+
+  /**
+   * Visits to the nodes of transducers, in their order, if the
+   * processors sharing the dictionary count them
+   */
+  State::Profile profile;
 
   /**
    * Set of characters being considered alphabetics
    */
-  std::set<UChar32> alphabetic_chars;
+  CharSet alphabetic_chars;
+
+  /**
+   * Characters isAlphabetic() accepts: the alphabetic_chars and the
+   * letters and decimal digits of Unicode
+   */
+  CharSet word_chars;
 
   /**
    * Set of characters to escape with a backslash
    */
-  std::set<UChar32> escaped_chars;
+  CharSet escaped_chars;
+
+  /**
+   * The escaped_chars one after the other, for writeEscaped() to look
+   * for them a vector at a time
+   */
+  UString escaped_units;
 
   /**
    * Set of characters to ignore
    */
-  std::set<UChar32> ignored_chars;
+  CharSet ignored_chars;
 
   /**
    * Mapping of characters for simplistic diacritic restoration specified in RCX files
@@ -137,24 +333,252 @@ private:
   std::map<int, std::set<int> > rcx_map;
 
   /**
-   * Original char being restored
+   * Equivalence classes of input characters the transducers were
+   * written with instead of having them expanded, see lt-comp
+   * --runtime-acx
    */
-  int rcx_current_char;
+  ACXMap acx_map;
+
+  /**
+   * What analysis() steps with, besides the character itself, at a
+   * character of rcx_map or one acx_map makes equivalent to others
+   */
+  struct RestoreChars
+  {
+    /**
+     * The characters the character is equivalent to, then its
+     * restorations
+     */
+    std::vector<int32_t> exact;
+
+    /**
+     * Those and, for an uppercase letter matched case-insensitively, its
+     * lowercase and the equivalents and restorations of that
+     */
+    std::vector<int32_t> folded;
+
+    /**
+     * How many of exact and of folded are equivalents, which match as
+     * the character itself would, see State::apply()
+     */
+    size_t exact_equivalents = 0;
+    size_t folded_equivalents = 0;
+  };
+
+  /**
+   * rcx_map and acx_map worked out into the alternatives of every
+   * character, so that the analysis loop looks a character up once and
+   * copies nothing
+   */
+  std::map<int, RestoreChars> rcx_alternatives;
+
+  /**
+   * Work out rcx_alternatives from rcx_map and acx_map
+   */
+  void buildAlternatives();
+
+  /**
+   * Dictionary whose input the analyses are composed with, if any, see
+   * FSTProcessor::loadComposition()
+   */
+  std::shared_ptr<FSTDictionary const> composition;
+
+  /**
+   * The symbol in composition->alphabet of every tag of alphabet, at
+   * index -1-tag, or 0 if composition has no such tag
+   */
+  std::vector<int32_t> composition_tags;
 
   /**
    * Alphabet
    */
   Alphabet alphabet;
 
+  /**
+   * Begin of the transducer
+   */
+  Node root;
+
+  /**
+   * The init method the dictionary was last prepared with, for
+   * FSTProcessor::reload() to prepare the next one with
+   */
+  void (FSTProcessor::*init)() = nullptr;
+
+public:
+  FSTDictionary();
+
+  /**
+   * The states and finals point into the transducers, which cannot be
+   * copied along with them
+   */
+  FSTDictionary(FSTDictionary const &) = delete;
+  FSTDictionary & operator =(FSTDictionary const &) = delete;
+
+  /**
+   * Fill in the dictionary part of a memory report
+   */
+  void reportMemory(FSTMemoryReport &report) const;
+};
+
+/**
+ * Class that implements the FST-based modules of the system.
+ *
+ * A processor keeps the state of the stream it is processing and refers
+ * to its dictionary through a shared pointer.  Copying a processor after
+ * load() and the init method of the mode gives a new processor with the
+ * same settings over the same dictionary, so each thread can process its
+ * own stream without loading the dictionary again.  The dictionary
+ * cannot be modified (load, init, ICX/RCX) while it is shared.
+ */
+class FSTProcessor
+{
+private:
+  /**
+   * The dictionary, possibly shared with other processors
+   */
+  std::shared_ptr<FSTDictionary> dict;
+
+  /**
+   * Queue of blanks, used in reading methods
+   */
+  BlankQueue blankqueue;
+
+  /**
+   * Queue of wordbound blanks, used in reading methods
+   */
+  BlankQueue wblankqueue;
+
+  /**
+   * Words read by transliteration() and not yet written, with scratch
+   * for the blank being read, the symbols of a match and the word being
+   * written
+   */
+  SymbolQueue transliteration_queue;
+  UString transliteration_blank;
+  std::vector<int32_t> transliteration_match;
+  UString transliteration_out;
+
+  /**
+   * Original char being restored
+   */
+  int rcx_current_char;
+
   /**
    * Input buffer
    */
-  Buffer<int32_t> input_buffer;
+  SegmentedBuffer<int32_t> input_buffer;
 
   /**
-   * Begin of the transducer
+   * The state and strings analyse() works with, kept from one call to
+   * the next so that their storage is reused
    */
-  Node root;
+  struct AnalysisScratch
+  {
+    State current_state;
+    UString lf;
+    UString sf;
+    UString lf_spcmp;
+  };
+  AnalysisScratch analysis_scratch;
+
+  /**
+   * How analysis() ended a token it could cache
+   */
+  enum CachedKind
+  {
+    ck_word,       // printed a word
+    ck_postblank,  // printed a word from a postblank section, then a space
+    ck_preblank,   // printed a space, then a word from a preblank section
+    ck_unknown     // printed an unknown word, or its compound analysis
+  };
+
+  /**
+   * Outcome of analysis() for a token made of a run of alphabetic
+   * characters and the character that followed it
+   */
+  struct CachedAnalysis
+  {
+    UString lf;
+    uint32_t last_size = 0;  // length of the analysed part of the run
+    uint32_t advance = 0;    // where to go on in input_buffer after printing
+    CachedKind kind = ck_word;
+  };
+
+  /**
+   * Cache of analysis() outcomes, keyed on the character after the run
+   * and the run itself; disabled unless a size is set
+   */
+  ClockCache<CachedAnalysis> analysis_cache;
+
+  /**
+   * Scratch key for analysis_cache
+   */
+  UString cache_key;
+
+  /**
+   * Longest run of alphabetic characters looked up in analysis_cache
+   */
+  static constexpr size_t max_cached_run = 64;
+
+  /**
+   * Which of the biltrans functions a biltrans_cache entry is for
+   */
+  enum BiltransMode
+  {
+    bm_biltrans,
+    bm_full,
+    bm_with_queue,
+    bm_without_queue
+  };
+
+  /**
+   * Cache of the results of the biltrans functions, keyed on the mode,
+   * the delimiter flag and the input; disabled unless a size is set
+   */
+  ClockCache<std::pair<UString, int>> biltrans_cache;
+
+  /**
+   * Scratch key and result for biltrans_cache
+   */
+  UString biltrans_key;
+  std::pair<UString, int> biltrans_result;
+
+  /**
+   * Scratch for the biltrans functions: the state they step, the
+   * analyses it last reached, one after the other with the i-th ending
+   * at biltrans_ends[i], and the symbols read past them
+   */
+  State biltrans_state;
+  UString biltrans_forms;
+  std::vector<size_t> biltrans_ends;
+  UString biltrans_queue;
+
+  /**
+   * Cache of the lookups of lexical units in generation() and
+   * bilingual(), keyed on the function, the mode and the unit; a
+   * generation entry says whether the unit was found and its output, a
+   * bilingual one the whole output for the unit.  Disabled unless a size
+   * is set
+   */
+  ClockCache<std::pair<bool, UString>> lookup_cache;
+
+  /**
+   * Scratch key and result for lookup_cache
+   */
+  UString lookup_key;
+  std::pair<bool, UString> lookup_result;
+
+  /**
+   * The final paths that the composition reaches from an output of the
+   * analyser, keyed on the output in the symbols of the composition
+   */
+  ClockCache<std::vector<State::FinalPath>> composition_cache;
+
+  /**
+   * Size of composition_cache, set by loadComposition()
+   */
+  static constexpr size_t composition_cache_bytes = 16 << 20;
 
   /**
    * true if the position of input stream is out of a word
@@ -194,6 +618,12 @@ private:
    */
   bool nullFlushGeneration = false;
 
+  /**
+   * Write the output of the modes on a thread of their own, see
+   * setThreadedOutput()
+   */
+  bool threadedOutput = false;
+
   /**
    * if true, ignore the provided set of characters
    */
@@ -252,6 +682,34 @@ private:
    */
   int maxWeightClasses = INT_MAX;
 
+  /**
+   * maxAnalyses and maxWeightClasses for the states of analysis
+   * @see bestPaths
+   */
+  State::Best best_paths;
+
+  /**
+   * Counters updated while processing, nullptr unless setStatsOutput()
+   * was called; the tests of this pointer are all it costs otherwise
+   */
+  FSTStats *stats = nullptr;
+
+  /**
+   * Where and how writeStats() writes the counters
+   */
+  FILE *stats_output = nullptr;
+  bool stats_json = false;
+
+  /**
+   * Add a token to the latency histogram of the statistics, and write it
+   * out if it was slow
+   * @param start when its first character was read
+   * @param sf its surface form (or lexical form, when generating)
+   * @param paths most paths alive at once while it was read
+   */
+  void countToken(std::chrono::steady_clock::time_point start, UStringView sf,
+                  size_t paths);
+
   /**
    * Prints an error of input stream and exits
    */
@@ -260,7 +718,7 @@ private:
   /**
    * Write \0 to output and flush if at_null is true
    */
-  void maybeFlush(UFILE* output, bool at_null);
+  void maybeFlush(OutputBuffer& output, bool at_null);
 
   /**
    * Returns true if the character code is identified as alphabetic
@@ -289,7 +747,7 @@ private:
    * @param output the stream to write on
    * @return the next symbol in the stream
    */
-  int readDecomposition(InputFile& input, UFILE *output);
+  int readDecomposition(InputFile& input, OutputBuffer& output);
 
   bool readTransliterationBlank(InputFile& input);
   bool readTransliterationWord(InputFile& input);
@@ -305,7 +763,7 @@ private:
    * Flush all the blanks remaining in the current process
    * @param output stream to write blanks
    */
-  void flushBlanks(UFILE *output);
+  void flushBlanks(OutputBuffer& output);
 
   /**
    * Calculate the initial state of parsing
@@ -317,18 +775,29 @@ private:
    */
   void classifyFinals();
 
+  /**
+   * Fill final_table from all_finals and the classified final maps
+   */
+  void buildFinalTable();
+
   /**
    * Shortcut for filtering on all final states with current settings
    * Assumes that casefrom is non-empty
    */
   UString filterFinals(const State& state, UStringView casefrom);
 
+  /**
+   * filterFinals(), or its SAO version, which writes tags as entities
+   */
+  template <bool sao>
+  UString analysisFinals(const State& state, UStringView casefrom);
+
   /**
    * Write a string to an output stream,
    * @param str the string to write, escaping characters
    * @param output the stream to write in
    */
-  void writeEscaped(UStringView str, UFILE *output);
+  void writeEscaped(UStringView str, OutputBuffer& output);
 
   /**
    * Write a string to an output stream.
@@ -339,7 +808,7 @@ private:
    * @param output the stream to write in
    * @return how many blanks to pop and print after printing lu
    */
-  size_t writeEscapedPopBlanks(UStringView str, UFILE *output);
+  size_t writeEscapedPopBlanks(UStringView str, OutputBuffer& output);
 
   /**
    * Write a string to an output stream, escaping all escapable characters
@@ -347,7 +816,7 @@ private:
    * @param str the string to write, escaping characters
    * @param output the stream to write in
    */
-  void writeEscapedWithTags(UStringView str, UFILE *output);
+  void writeEscapedWithTags(UStringView str, OutputBuffer& output);
 
   /**
    * Prints a word
@@ -355,7 +824,7 @@ private:
    * @param lf lexical form of the word
    * @param output stream where the word is written
    */
-  void printWord(UStringView sf, UStringView lf, UFILE *output);
+  void printWord(UStringView sf, UStringView lf, OutputBuffer& output);
 
   /**
    * Prints a word.
@@ -365,25 +834,48 @@ private:
    * @param lf lexical form of the word
    * @param output stream where the word is written
    */
-  void printWordPopBlank(UStringView sf, UStringView lf, UFILE *output);
+  void printWordPopBlank(UStringView sf, UStringView lf, OutputBuffer& output);
 
   /**
    * Prints a word, SAO version
    * @param lf lexical form
    * @param output stream where the word is written
    */
-  void printSAOWord(UStringView lf, UFILE *output);
+  void printSAOWord(UStringView lf, OutputBuffer& output);
+
+  /**
+   * printWordPopBlank(), or its SAO version, which only writes the first
+   * analysis but pops the blanks in sf the same way
+   */
+  template <bool sao>
+  void printAnalysis(UStringView sf, UStringView lf, OutputBuffer& output);
+
+  /**
+   * printUnknownWord(), or its SAO version, which writes sf in <d> tags
+   */
+  template <bool sao>
+  void printUnknown(UStringView sf, OutputBuffer& output);
 
   /**
    * Prints an unknown word
    * @param sf surface form of the word
    * @param output stream where the word is written
    */
-  void printUnknownWord(UStringView sf, UFILE *output);
+  void printUnknownWord(UStringView sf, OutputBuffer& output);
 
   void initDecompositionSymbols();
 
+  /**
+   * The numbers of the current translation memory match, in order
+   */
   std::vector<UString> numbers;
+
+  /**
+   * The digits of each number read, by its position in input_buffer,
+   * to get them back when the input is read again from there
+   */
+  std::map<size_t, UString> input_numbers;
+
   int readTMAnalysis(InputFile& input);
 
   unsigned int lastBlank(UStringView str);
@@ -394,13 +886,13 @@ private:
    * @param val the space character to use if no blank queue
    * @param output stream where the word is written
    */
-  void printSpace(UChar32 val, UFILE *output);
+  void printSpace(UChar32 val, OutputBuffer& output);
   /**
    * Print one possibly escaped character
    * if it's a space and the blank queue is non-empty,
    * pop the first blank and print that instead
    */
-  void printChar(UChar32 val, UFILE* output);
+  void printChar(UChar32 val, OutputBuffer& output);
 
   static UStringView removeTags(UStringView str);
   UString compoundAnalysis(UString str);
@@ -419,19 +911,166 @@ private:
    */
   Indices firstNotAlpha(UStringView sf);
 
-  void analysis_wrapper_null_flush(InputFile& input, UFILE *output);
-  void generation_wrapper_null_flush(InputFile& input, UFILE *output,
+  void analysis_wrapper_null_flush(InputFile& input, OutputBuffer& output);
+  void generation_wrapper_null_flush(InputFile& input, OutputBuffer& output,
                                      GenerationMode mode);
-  void tm_wrapper_null_flush(InputFile& input, UFILE *output,
+  void tm_wrapper_null_flush(InputFile& input, OutputBuffer& output,
                              TranslationMemoryMode tm_mode);
+
+  /**
+   * The processing modes proper, writing through an OutputBuffer; the
+   * public functions of the same name wrap their UFILE in one
+   */
+  void analysis(InputFile& input, OutputBuffer& output);
+  void tm_analysis(InputFile& input, OutputBuffer& output, TranslationMemoryMode tm_mode);
+  void generation(InputFile& input, OutputBuffer& output, GenerationMode mode);
+  void transliteration(InputFile& input, OutputBuffer& output);
+
+  /**
+   * The transliteration loop, on a State or, when the dictionary has a
+   * single section, a DetState
+   * @param initial_state the state to start every word from
+   */
+  template <class S>
+  void transliterate(InputFile& input, OutputBuffer& output, S const &initial_state);
+
+  /**
+   * The loop of analysis(), with the settings it would otherwise check at
+   * every character fixed for the instantiation
+   * @tparam restore_chars useRestoreChars, or the dictionary has ACX classes
+   * @tparam decomposition do_decomposition
+   * @tparam sao read and write the SAO format instead of the stream
+   *             format
+   */
+  template <bool restore_chars, bool decomposition, bool sao>
+  void analyse(InputFile& input, OutputBuffer& output);
+
+  /**
+   * analyse() for the current settings, up to the next '\0' or the end
+   * of the input
+   */
+  void analyseBlock(InputFile& input, OutputBuffer& output);
+
+  /**
+   * The limits to drop the paths of analysis with, which cannot change
+   * what filterFinals() gives: nullptr with decomposition or composition
+   * @see State::setBest
+   */
+  State::Best * bestPaths();
+  void bilingual(InputFile& input, OutputBuffer& output, GenerationMode mode);
+  void SAO(InputFile& input, OutputBuffer& output);
   UString compose(const std::vector<UString>& lexforms, UStringView queue,
                   bool delim = false, bool mark = false) const;
-  bool step_biltrans(UStringView word, std::vector<UString>& result, UString& queue);
+  /**
+   * Step biltrans_state through word from the initial state, leaving the
+   * analyses in biltrans_forms and biltrans_ends and what was read after
+   * them in biltrans_queue
+   * @return whether the word had any analysis
+   */
+  bool step_biltrans(UStringView word);
+
+  /**
+   * Write into out the analyses in biltrans_forms, each followed by queue
+   */
+  void composeBiltrans(UString &out, UStringView queue, bool delim,
+                       bool mark) const;
+
+  /**
+   * Write into out what the biltrans functions give for an unknown word
+   */
+  static void biltransUnknown(UStringView input_word, bool with_delim,
+                              UString &out);
 
   void procNodeICX();
   void procNodeRCX();
   void initDefaultIgnoredCharacters();
 
+  /**
+   * At the start of a token in analysis(), print it from analysis_cache
+   * if its outcome is known
+   * @return the character that ended the token, or 0 if it was not in
+   *         the cache (input_buffer is then left as it was)
+   */
+  template <bool sao>
+  int32_t readCachedAnalysis(InputFile& input, OutputBuffer& output);
+
+  /**
+   * Store the outcome of a token in analysis_cache, if it only depends
+   * on what the key holds
+   * @param sf the surface form read, which has to be a run of alphabetic
+   *           characters
+   * @param next the character after sf, where the token ended
+   * @param start position in input_buffer where the token started;
+   *              input_buffer has to be where processing resumes
+   */
+  void cacheAnalysis(UStringView sf, int32_t next, CachedKind kind,
+                     UStringView lf, size_t last_size, size_t start);
+
+  /**
+   * Drop the contents of the caches, when something that changes their
+   * results is modified
+   */
+  void clearCaches();
+
+  /**
+   * Fill composition_tags for the alphabet and composition of dict
+   */
+  void mapCompositionTags();
+
+  /**
+   * filterFinals() when there is a composition: the outputs of the final
+   * paths of state run through dict->composition, each of its outputs
+   * weighing as much as the two paths
+   */
+  UString composeFinals(State const &state, UStringView casefrom);
+
+  /**
+   * Look up input_word in biltrans_cache, computing and storing the
+   * result on a miss
+   * @return the result, valid until the next call
+   */
+  std::pair<UString, int> const & memoBiltrans(BiltransMode mode,
+                                               UStringView input_word,
+                                               bool with_delim);
+
+  /**
+   * Look up a lexical unit for generation(), through lookup_cache
+   * unless there are statistics or a profile to keep
+   * @param current_state the state to step, left where the unit led on a
+   *                      miss
+   * @param paths with statistics, raised to the most paths alive at once
+   * @return whether the unit was found and its output, valid until the
+   *         next call
+   */
+  std::pair<bool, UString> const & lookupGeneration(StreamReader::ReadingView const &rd,
+                                                    GenerationMode mode,
+                                                    State &current_state,
+                                                    size_t &paths);
+
+  /**
+   * Look up a lexical unit with symbols for bilingual(), through
+   * lookup_cache unless there is a profile to keep
+   * @return the output for the unit, from the source to the final '$',
+   *         valid until the next call
+   */
+  UString const & lookupBilingual(StreamReader::ReadingView const &rd,
+                                  GenerationMode mode);
+
+  void biltransUncached(UStringView input_word, UString &out,
+                        bool with_delim);
+  void biltransfullUncached(UStringView input_word, UString &out,
+                            bool with_delim);
+  int biltransWithQueueUncached(UStringView input_word, UString &out,
+                                bool with_delim);
+  void biltransWithoutQueueUncached(UStringView input_word, UString &out,
+                                    bool with_delim);
+
+  /**
+   * Called before anything that modifies the dictionary, which is only
+   * allowed while it is not shared with other processors
+   */
+  void modifyDictionary();
+
   bool isLastBlankTM = false;
 
   xmlTextReaderPtr reader;
@@ -445,7 +1084,8 @@ private:
    *
    * @return running with --case-sensitive or state size exceeds max
    */
-  bool beCaseSensitive(const State& state) {
+  template <class S>
+  bool beCaseSensitive(const S& state) {
     if(caseSensitive) {
       return true;
     }
@@ -488,6 +1128,16 @@ public:
   void initDecomposition();
 
   void analysis(InputFile& input, UFILE *output);
+
+  /**
+   * Analyse the next request of a null-flushed stream, that is up to the
+   * next '\0', write its analysis and a '\0' and flush the output.  The
+   * processor keeps the state it works with from one request to the
+   * next, so for short requests serving one costs little more than its
+   * lookups
+   * @return false if there was no request left
+   */
+  bool analysisRequest(InputFile& input, OutputBuffer& output);
   void tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode tm_mode);
   void generation(InputFile& input, UFILE *output, GenerationMode mode = gm_unknown);
   void postgeneration(InputFile& input, UFILE *output);
@@ -498,12 +1148,58 @@ public:
   void bilingual(InputFile& input, UFILE *output, GenerationMode mode = gm_unknown);
   std::pair<UString, int> biltransWithQueue(UStringView input_word, bool with_delim = true);
   UString biltransWithoutQueue(UStringView input_word, bool with_delim = true);
+
+  /**
+   * The biltrans functions above, writing the result into out instead
+   * of returning it.  The processor keeps the storage they work with,
+   * so once out and that storage have grown to fit, a call allocates
+   * nothing.  input_word must not point into out
+   * @return for biltransWithQueue(), the length of the queue
+   */
+  void biltrans(UStringView input_word, UString &out, bool with_delim = true);
+  void biltransfull(UStringView input_word, UString &out, bool with_delim = true);
+  int biltransWithQueue(UStringView input_word, UString &out, bool with_delim = true);
+  void biltransWithoutQueue(UStringView input_word, UString &out, bool with_delim = true);
   void SAO(InputFile& input, UFILE *output);
+
+  /**
+   * Analyse tokens without going through the stream format: each token
+   * is looked up as a whole word, with the case handling of analysis(),
+   * and its analyses are given as unescaped lexical forms, best first.
+   * A token with no analysis gets none.  Needs initAnalysis().
+   * @param tokens the tokens
+   * @param count number of tokens
+   * @param analyses array of count vectors, filled with the analyses of
+   *                 every token
+   * @param weights array of count vectors, filled with the weights of the
+   *                analyses, or nullptr
+   */
+  void analyseBatch(UStringView const *tokens, size_t count,
+                    std::vector<UString> *analyses,
+                    std::vector<double> *weights = nullptr);
   void parseICX(std::string const &file);
   void parseRCX(std::string const &file);
 
+  /**
+   * Read a dictionary.  All its sections are read and decoded here: every
+   * mode runs them all at once from a common root (see calcInitial()),
+   * the section types only deciding which finals count as what, so there
+   * is no section a mode could leave unread.
+   */
   void load(FILE *input);
 
+  /**
+   * Read the dictionary again from input into a new dictionary, and
+   * prepare it as the current one was: the same init method, ICX and
+   * RCX characters, composition and path limit.  Processors sharing the
+   * current dictionary go on with it; the ones copied from this
+   * processor afterwards get the new one.  If reading fails, this
+   * processor keeps the current dictionary and the exception is passed
+   * on; so it does if input has no transducers, as a file cut short
+   * would.  The counters of setStatsOutput() restart from 0.
+   */
+  void reload(FILE *input);
+
   bool valid() const;
 
   void setCaseSensitiveMode(bool value);
@@ -513,11 +1209,119 @@ public:
   void setIgnoredChars(bool value);
   void setRestoreChars(bool value);
   void setNullFlush(bool value);
+
+  /**
+   * Have the modes writing to a UFILE convert and write the output on a
+   * thread of its own, so that processing goes on while the output is
+   * written; the UFILE is not touched from any other thread until the
+   * mode returns
+   */
+  void setThreadedOutput(bool value);
   void setUseDefaultIgnoredChars(bool value);
   void setDisplayWeightsMode(bool value);
   void setMaxAnalysesValue(int value);
   void setMaxWeightClassesValue(int value);
   void setCompoundMaxElements(int value);
+
+  /**
+   * Keep at most paths paths (0 for no limit) after every step, dropping
+   * those of highest accumulated weight, and no more than per_output of
+   * those with the same output (0 for no limit).  This bounds the work
+   * per character on pathological input, at the cost of analyses that
+   * the dropped paths would have led to.
+   */
+  void setMaxActivePaths(size_t paths, size_t per_output = 0);
+
+  /**
+   * Number of steps that dropped paths because of setMaxActivePaths(),
+   * over all the processors sharing the dictionary
+   */
+  uint64_t getActivePathsPruned() const;
+
+  /**
+   * Count characters, tokens, paths and the time spent reading, stepping,
+   * filtering finals and writing, with a histogram of the time taken by
+   * every token in analysis and generation, and write the counters to output (as
+   * JSON lines if json, as text otherwise) at every call to writeStats()
+   * and, with null flushing, after every block.  The counters are those
+   * of all the processors sharing the dictionary.
+   */
+  void setStatsOutput(FILE *output, bool json);
+
+  /**
+   * Write the counters collected since the last time they were written,
+   * if setStatsOutput() was called, and reset them
+   */
+  void writeStats();
+
+  /**
+   * How much memory the dictionary and the session of this processor
+   * take; the session counts the processor itself, not the copies of it
+   * working in other threads
+   */
+  FSTMemoryReport getMemoryReport() const;
+
+  /**
+   * Count how many times the steps of all the processors sharing the
+   * dictionary reach every node and take every transition, for
+   * writeProfile().  Call after the init method.
+   * @param period count only one step in period, in every thread
+   */
+  void startProfile(uint32_t period = 1);
+
+  /**
+   * Write the counts of startProfile() as lines of section name, state
+   * and count separated by tabs, for the states reached at least once
+   * (see Transducer::renumber()), and of section name, state, number of
+   * the transition in the order of its input symbol and count, for the
+   * transitions taken at least once
+   */
+  void writeProfile(FILE *output) const;
+
+  /**
+   * Write every token that takes at least seconds from its first
+   * character to its output to the output of setStatsOutput(), with the
+   * number of paths it kept alive, 0 to write none
+   */
+  void setSlowTokenThreshold(double seconds);
+
+  /**
+   * Cache the analyses of up to entries tokens, or of as many as fit in
+   * about bytes bytes (0 for no limit on either; both 0 disables the
+   * cache, which is the default)
+   */
+  void setAnalysisCacheSize(size_t entries, size_t bytes);
+
+  /**
+   * Compose the analyser with the transducer read from input, as
+   * lt-compose would compose the two, but during analysis: every time
+   * the analyser reaches a final state, the outputs of its paths are
+   * looked up in the second transducer (all of its sections), and only
+   * what that accepts is kept, as its outputs.  The intermediate results
+   * are cached.  Call after load(); only analysis() uses it.
+   */
+  void loadComposition(FILE *input);
+  uint64_t getAnalysisCacheHits() const;
+  uint64_t getAnalysisCacheMisses() const;
+
+  /**
+   * Cache the results of biltrans, biltransfull, biltransWithQueue and
+   * biltransWithoutQueue for up to entries inputs, or for as many as fit
+   * in about bytes bytes (0 for no limit on either; both 0 disables the
+   * cache, which is the default)
+   */
+  void setBiltransCacheSize(size_t entries, size_t bytes);
+  uint64_t getBiltransCacheHits() const;
+  uint64_t getBiltransCacheMisses() const;
+
+  /**
+   * Cache the lookups of up to entries lexical units in generation and
+   * bilingual lookup, or of as many as fit in about bytes bytes (0 for
+   * no limit on either; both 0 disables the cache, which is the default)
+   */
+  void setLookupCacheSize(size_t entries, size_t bytes);
+  uint64_t getLookupCacheHits() const;
+  uint64_t getLookupCacheMisses() const;
   bool getNullFlush();
   bool getDecompoundingMode();
 };
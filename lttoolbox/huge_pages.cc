@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#include <lttoolbox/huge_pages.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+namespace {
+  size_t rounded(size_t bytes)
+  {
+    return (bytes + HugePages::size - 1) & ~(HugePages::size - 1);
+  }
+}
+
+void *
+HugePages::allocate(size_t bytes)
+{
+#ifdef _WIN32
+  void *p = malloc(bytes);
+  if(p == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+  return p;
+#else
+  size_t const length = rounded(bytes);
+#ifdef MAP_HUGETLB
+  // fails at once if no huge pages of the default size were reserved,
+  // or if they are larger than length is a multiple of
+  void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if(p != MAP_FAILED)
+  {
+    return p;
+  }
+#endif
+  // over-allocate by a huge page to align the region to one, then give
+  // back the ends
+  char *region = static_cast<char *>(mmap(nullptr, length + size,
+                                          PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if(region == MAP_FAILED)
+  {
+    throw std::bad_alloc();
+  }
+  char *start = reinterpret_cast<char *>(rounded(reinterpret_cast<uintptr_t>(region)));
+  if(start != region)
+  {
+    munmap(region, start - region);
+  }
+  if(start + length != region + length + size)
+  {
+    munmap(start + length, region + size - start);
+  }
+  advise(start, length);
+  return start;
+#endif
+}
+
+void
+HugePages::deallocate(void *p, size_t bytes)
+{
+#ifdef _WIN32
+  free(p);
+#else
+  munmap(p, rounded(bytes));
+#endif
+}
+
+void
+HugePages::advise(void *p, size_t bytes)
+{
+#ifdef MADV_HUGEPAGE
+  // only a hint: an error just leaves the region in normal pages
+  madvise(p, bytes, MADV_HUGEPAGE);
+#else
+  (void)p;
+  (void)bytes;
+#endif
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _LT_HUGE_PAGES_H_
+#define _LT_HUGE_PAGES_H_
+
+#include <cstddef>
+#include <memory>
+
+/**
+ * Memory in huge pages, for the images of TransExe
+ */
+class HugePages
+{
+public:
+  /**
+   * Size of a huge page, the smallest allocation placed in them
+   */
+  static constexpr size_t size = 2 << 20;
+
+  /**
+   * Allocate bytes (at least size) in huge pages: reserved ones if the
+   * system has any, or else transparent ones, aligned to use them
+   * @throw std::bad_alloc on failure
+   */
+  static void * allocate(size_t bytes);
+
+  /**
+   * Free what allocate() gave for bytes
+   */
+  static void deallocate(void *p, size_t bytes);
+
+  /**
+   * Ask to back a mapped region with huge pages, where the file system
+   * supports it
+   */
+  static void advise(void *p, size_t bytes);
+};
+
+/**
+ * Allocator placing the large blocks of a container in huge pages, so
+ * that walking a transducer scattered over hundreds of megabytes misses
+ * the TLB far less often; small ones are left to std::allocator
+ */
+template <class T>
+struct HugePageAllocator
+{
+  typedef T value_type;
+
+  HugePageAllocator() = default;
+
+  template <class U>
+  HugePageAllocator(HugePageAllocator<U> const &) {}
+
+  T * allocate(size_t n)
+  {
+    if(n * sizeof(T) < HugePages::size)
+    {
+      return std::allocator<T>().allocate(n);
+    }
+    return static_cast<T *>(HugePages::allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T *p, size_t n)
+  {
+    if(n * sizeof(T) < HugePages::size)
+    {
+      std::allocator<T>().deallocate(p, n);
+    }
+    else
+    {
+      HugePages::deallocate(p, n * sizeof(T));
+    }
+  }
+
+  template <class U>
+  bool operator ==(HugePageAllocator<U> const &) const { return true; }
+
+  template <class U>
+  bool operator !=(HugePageAllocator<U> const &) const { return false; }
+};
+
+#endif
@@ -22,9 +22,85 @@
 #include <cstring>
 #include <iostream>
 #include <lttoolbox/my_stdio.h>
+#include <lttoolbox/block_queue.h>
+#include <lttoolbox/simd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <iterator>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace {
+
+// amount of input read at once
+constexpr size_t block_size = 1 << 16;
+
+// blocks read ahead by readAhead()
+constexpr size_t blocks_ahead = 4;
+
+// read up to want bytes of file into to, as soon as there are any
+size_t
+readSome(FILE* file, char* to, size_t want)
+{
+#ifndef _WIN32
+  // read(2) returns whatever is available, so interactive input (such
+  // as NUL-flushed pipes) is not held back waiting for a full block
+  int fd = fileno(file);
+  if (fd >= 0) {
+    ssize_t r;
+    do {
+      r = ::read(fd, to, want);
+    } while (r < 0 && errno == EINTR);
+    return (r > 0 ? r : 0);
+  }
+  return fread_unlocked(to, 1, want, file);
+#else
+  int c = fgetc_unlocked(file);
+  if (c == EOF) {
+    return 0;
+  }
+  *to = static_cast<char>(c);
+  return 1;
+#endif
+}
+
+// length of the UTF-8 sequence starting with byte b
+inline size_t
+sequenceLength(unsigned char b)
+{
+  if ((b & 0xF0) == 0xF0) {
+    return 4;
+  } else if ((b & 0xE0) == 0xE0) {
+    return 3;
+  } else if ((b & 0xC0) == 0xC0) {
+    return 2;
+  }
+  return 1;
+}
+
+}
+
+struct InputFile::ReadAhead
+{
+  FILE* file;
+  BlockQueue<std::vector<char>> queue{blocks_ahead};
+  std::thread thread;
+  std::mutex mutex;
+  // the thread has stopped reading
+  bool done = false;
+  // the thread is to close file once it stops
+  bool close_file = false;
+  // the block being decoded
+  std::vector<char> current;
+};
 
 InputFile::InputFile()
-  : infile(stdin), buffer_size(0)
+  : infile(stdin), buffer_size(0), bytes(block_size), bytes_pos(0),
+    bytes_end(0), source_eof(false), at_eof(false)
 {}
 
 InputFile::~InputFile()
@@ -67,11 +143,17 @@ void
 InputFile::close()
 {
   if (infile != nullptr) {
-    if (infile != stdin) {
+    if (ahead) {
+      stopReadAhead(false);
+    }
+    if (infile != nullptr && infile != stdin) {
       fclose(infile);
     }
     infile = nullptr;
   }
+  buffer_size = 0;
+  bytes_pos = bytes_end = 0;
+  source_eof = at_eof = false;
 }
 
 void
@@ -81,47 +163,168 @@ InputFile::wrap(FILE* newinfile)
   infile = newinfile;
 }
 
+void
+InputFile::readAhead()
+{
+  if (infile == nullptr || ahead) {
+    return;
+  }
+  ahead = std::make_shared<ReadAhead>();
+  ahead->file = infile;
+  // the thread keeps its own reference, in case it outlives this object
+  ahead->thread = std::thread([](std::shared_ptr<ReadAhead> r) {
+    std::vector<char> block;
+    while (true) {
+      block.resize(block_size);
+      size_t got = readSome(r->file, block.data(), block.size());
+      if (got == 0) {
+        break;
+      }
+      block.resize(got);
+      if (!r->queue.push(block)) {
+        break;
+      }
+    }
+    r->queue.close();
+    std::lock_guard<std::mutex> lock(r->mutex);
+    r->done = true;
+    if (r->close_file) {
+      fclose(r->file);
+    }
+  }, ahead);
+}
+
+void
+InputFile::stopReadAhead(bool wait)
+{
+  ahead->queue.close();
+  bool done;
+  {
+    std::lock_guard<std::mutex> lock(ahead->mutex);
+    done = ahead->done;
+    if (!done && !wait) {
+      // it is blocked reading, maybe for good: let it finish on its own
+      ahead->close_file = (infile != stdin);
+    }
+  }
+  if (done || wait) {
+    ahead->thread.join();
+  } else {
+    ahead->thread.detach();
+    infile = nullptr;
+  }
+  ahead.reset();
+}
+
+bool
+InputFile::fill(size_t need)
+{
+  if (bytes_pos > 0) {
+    memmove(bytes.data(), bytes.data() + bytes_pos, bytes_end - bytes_pos);
+    bytes_end -= bytes_pos;
+    bytes_pos = 0;
+  }
+  while (bytes_end < need && !source_eof) {
+    size_t got = 0;
+    if (ahead) {
+      std::vector<char>& block = ahead->current;
+      if (ahead->queue.pop(block)) {
+        if (bytes.size() < bytes_end + block.size()) {
+          bytes.resize(bytes_end + block.size());
+        }
+        memcpy(bytes.data() + bytes_end, block.data(), block.size());
+        got = block.size();
+        ahead->queue.recycle(block);
+      }
+    } else {
+      got = readSome(infile, bytes.data() + bytes_end, bytes.size() - bytes_end);
+    }
+    if (got == 0) {
+      source_eof = true;
+    }
+    bytes_end += got;
+  }
+  return bytes_end >= need;
+}
+
 void
 InputFile::internal_read()
 {
   if (buffer_size) {
     return;
   }
-  if (feof(infile)) {
+  if (at_eof || (bytes_pos == bytes_end && !fill(1))) {
+    at_eof = true;
     ubuffer[buffer_size++] = U_EOF;
     return;
   }
 
-  int first = fgetc_unlocked(infile);
-  if (first == EOF) {
-    ubuffer[buffer_size++] = U_EOF;
-    return;
-  } else if (first == '\0') {
-    ubuffer[buffer_size++] = '\0';
+  unsigned char first = bytes[bytes_pos];
+  if (first < 0x80) {
+    bytes_pos++;
+    ubuffer[buffer_size++] = first;
     return;
   }
 
-  int i = 1;
-  cbuffer[0] = static_cast<char>(first);
-  if ((first & 0xF0) == 0xF0) {
-    i += 3;
-    if (fread_unlocked(cbuffer+1, 1, 3, infile) != 3) {
-      throw std::runtime_error("Could not read 3 expected bytes from stream");
-    }
-  } else if ((first & 0xE0) == 0xE0) {
-    i += 2;
-    if (fread_unlocked(cbuffer+1, 1, 2, infile) != 2) {
-      throw std::runtime_error("Could not read 2 expected bytes from stream");
+  size_t i = sequenceLength(first);
+  if (bytes_end - bytes_pos < i && !fill(i)) {
+    bytes_pos = bytes_end;
+    at_eof = true;
+    throw std::runtime_error("Could not read " + std::to_string(i - 1) +
+                             " expected byte" + (i > 2 ? "s" : "") +
+                             " from stream");
+  }
+  ubuffer[0] = 0;
+  utf8::utf8to32(bytes.data() + bytes_pos, bytes.data() + bytes_pos + i,
+                 ubuffer);
+  bytes_pos += i;
+  buffer_size = 1;
+}
+
+size_t
+InputFile::scanRun(const char* stops, int count) const
+{
+  const char* data = bytes.data();
+  size_t i = bytes_pos + Simd::findByte(data + bytes_pos, bytes_end - bytes_pos,
+                                        stops, count);
+  if (i < bytes_end) {
+    return i;
+  }
+  // don't split a sequence cut short by the end of the buffer
+  size_t lead = i;
+  while (lead > bytes_pos && (data[lead-1] & 0xC0) == 0x80 && i - lead < 3) {
+    lead--;
+  }
+  if (lead > bytes_pos) {
+    unsigned char b = data[lead-1];
+    if (b >= 0x80 && lead - 1 + sequenceLength(b) > i) {
+      return lead - 1;
     }
-  } else if ((first & 0xC0) == 0xC0) {
-    i += 1;
-    if (fread_unlocked(cbuffer+1, 1, 1, infile) != 1) {
-      throw std::runtime_error("Could not read 1 expected byte from stream");
+  }
+  return i;
+}
+
+void
+InputFile::takeRun(UString& str, size_t run_end)
+{
+  const char* data = bytes.data();
+  size_t i = bytes_pos;
+  size_t old_size = str.size();
+  // no character takes more units of UTF-16 than bytes of UTF-8
+  str.resize(old_size + (run_end - i));
+  UChar* out = &str[old_size];
+  while (i < run_end) {
+    size_t ascii = Simd::widenAscii(data + i, run_end - i, out);
+    out += ascii;
+    i += ascii;
+    if (i < run_end) {
+      size_t len = std::min(sequenceLength(data[i]), run_end - i);
+      out = utf8::utf8to16(data + i, data + i + len, out);
+      i += len;
     }
   }
-  memset(ubuffer, 0, 3*sizeof(UChar));
-  utf8::utf8to32(cbuffer, cbuffer+i, ubuffer);
-  buffer_size = 1;
+  str.resize(out - &str[0]);
+  bytes_pos = run_end;
 }
 
 UChar32
@@ -152,18 +355,29 @@ InputFile::unget(UChar32 c)
 bool
 InputFile::eof()
 {
-  return (infile == nullptr) || feof(infile);
+  return (infile == nullptr) || at_eof;
 }
 
 void
 InputFile::rewind()
 {
+  bool read_ahead = bool(ahead);
+  if (read_ahead) {
+    // rewinding only makes sense for files, whose reads do not block
+    stopReadAhead(true);
+  }
   if (infile != nullptr) {
     if (std::fseek(infile, 0, SEEK_SET) != 0) {
       std::cerr << "Error: Unable to rewind file" << std::endl;
       exit(EXIT_FAILURE);
     }
   }
+  buffer_size = 0;
+  bytes_pos = bytes_end = 0;
+  source_eof = at_eof = false;
+  if (read_ahead) {
+    readAhead();
+  }
 }
 
 UString
@@ -172,7 +386,11 @@ InputFile::readBlock(const UChar32 start, const UChar32 end)
   UString ret;
   ret += start;
   UChar32 c = 0;
+  const char stops[] = {'\0', '\\', static_cast<char>(end)};
   while (c != end && !eof()) {
+    if (!buffer_size && end < 0x80) {
+      takeRun(ret, scanRun(stops, 3));
+    }
     c = get();
     if (c == '\0') {
       break;
@@ -193,6 +411,9 @@ InputFile::finishWBlank()
   ret += '[';
   UChar32 c = 0;
   while (!eof()) {
+    if (!buffer_size) {
+      takeRun(ret, scanRun("\0\\]", 3));
+    }
     c = get();
     if (c == '\0') {
       break;
@@ -213,6 +434,9 @@ InputFile::readBlank(bool readwblank)
 {
   UString ret;
   while (!eof()) {
+    if (!buffer_size) {
+      takeRun(ret, scanRun("^\0[\\", 4));
+    }
     UChar32 c = get();
     if (c == '^' || c == '\0' || c == U_EOF) {
       unget(c);
@@ -19,6 +19,8 @@
 #define _LT_INPUT_FILE_H_
 
 #include <cstdio>
+#include <memory>
+#include <vector>
 #include <unicode/uchar.h>
 #include <lttoolbox/ustring.h>
 
@@ -26,10 +28,33 @@ class InputFile
 {
 private:
   FILE* infile;
+  // characters given back with unget(), last one on top
   UChar32 ubuffer[3];
-  char cbuffer[4];
   int buffer_size;
+  // bytes read from infile and not yet decoded, from bytes_pos to bytes_end
+  std::vector<char> bytes;
+  size_t bytes_pos;
+  size_t bytes_end;
+  // a read from infile returned nothing
+  bool source_eof;
+  // get() or peek() went past the end of the input
+  bool at_eof;
+  // read more bytes until at least need of them are buffered, which may
+  // return fewer at the end of the input
+  bool fill(size_t need);
   void internal_read();
+  // end of the longest run of bytes from bytes_pos not containing any of
+  // the count bytes in stops and made of complete UTF-8 sequences; only
+  // valid with an empty ubuffer
+  size_t scanRun(const char* stops, int count) const;
+  // append the UTF-8 bytes from bytes_pos to run_end to str and skip them
+  void takeRun(UString& str, size_t run_end);
+  // with readAhead(), the thread reading infile and what it has read
+  struct ReadAhead;
+  std::shared_ptr<ReadAhead> ahead;
+  // stop the thread of readAhead(), waiting for it if wait, or else
+  // leaving it to close infile once its read returns
+  void stopReadAhead(bool wait);
 public:
   InputFile();
   ~InputFile();
@@ -40,6 +65,10 @@ public:
   void open_or_exit(const char* fname = nullptr);
   void close();
   void wrap(FILE* newinfile);
+  // read the input on a thread of its own from now on, a few blocks
+  // ahead of what is decoded, so that waiting for the input overlaps
+  // with processing it
+  void readAhead();
   UChar32 get();
   UChar32 peek();
   void unget(UChar32 c);
@@ -26,6 +26,7 @@ int main(int argc, char *argv[])
   CLI cli("add sections to a compiled transducer", PACKAGE_VERSION);
   cli.add_bool_arg('k', "keep", "in case of section name conflicts, keep the one from the first transducer");
   cli.add_bool_arg('s', "single", "treat input transducers as one-sided");
+  cli.add_bool_arg('u', "union", "join sections in both transducers into their union, without rebuilding the transducers");
   cli.add_bool_arg('h', "help", "print this message and exit");
   cli.add_file_arg("bin_file1", false);
   cli.add_file_arg("bin_file2");
@@ -34,21 +35,40 @@ int main(int argc, char *argv[])
 
   bool pairs = !cli.get_bools()["single"];
   bool keep = cli.get_bools()["keep"];
+  bool join = cli.get_bools()["union"];
 
   FILE* input1 = openInBinFile(cli.get_files()[0]);
   FILE* input2 = openInBinFile(cli.get_files()[1]);
   FILE* output = openOutBinFile(cli.get_files()[2]);
 
+  if (join) {
+    try {
+      appendTransducerSets(input1, input2, output, pairs, keep);
+    }
+    catch (std::exception& e) {
+      std::cerr << "Error: " << e.what() << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    fclose(input1);
+    fclose(input2);
+    fclose(output);
+    return 0;
+  }
+
   Alphabet alpha1, alpha2;
   std::set<UChar32> chars1, chars2;
   std::map<UString, Transducer> trans1, trans2;
+  ACXMap acx1, acx2;
 
-  readTransducerSet(input1, chars1, alpha1, trans1);
-  readTransducerSet(input2, chars2, alpha2, trans2);
+  readTransducerSet(input1, chars1, alpha1, trans1, &acx1);
+  readTransducerSet(input2, chars2, alpha2, trans2, &acx2);
 
   for (auto& it : chars2) {
     chars1.insert(it);
   }
+  for (auto& it : acx2) {
+    acx1[it.first].insert(it.second.begin(), it.second.end());
+  }
   UString chars(chars1.begin(), chars1.end());
 
   for (auto& it : trans2) {
@@ -63,7 +83,8 @@ int main(int argc, char *argv[])
     trans1[it.first] = it.second;
   }
 
-  writeTransducerSet(output, chars, alpha1, trans1);
+  writeTransducerSet(output, chars, alpha1, trans1, false, nullptr, false,
+                     &acx1);
 
   fclose(input1);
   fclose(input2);
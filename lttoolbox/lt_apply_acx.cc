@@ -25,6 +25,7 @@ int main(int argc, char* argv[])
 {
   LtLocale::tryToSetLocale();
   CLI cli("apply an ACX file to a compiled transducer", PACKAGE_VERSION);
+  cli.add_bool_arg('r', "runtime", "write the classes for lt-proc to apply instead of adding their transitions");
   cli.add_file_arg("input_file", false);
   cli.add_file_arg("acx_file");
   cli.add_file_arg("output_file");
@@ -37,13 +38,21 @@ int main(int argc, char* argv[])
   Alphabet alpha;
   std::set<UChar32> letters;
   std::map<UString, Transducer> trans;
-  readTransducerSet(input, letters, alpha, trans);
+  ACXMap runtime_acx;
+  readTransducerSet(input, letters, alpha, trans, &runtime_acx);
 
-  for (auto& it : trans) {
-    it.second.applyACX(alpha, acx);
+  if (cli.get_bools()["runtime"]) {
+    for (auto& it : acx) {
+      runtime_acx[it.first].insert(it.second.begin(), it.second.end());
+    }
+  } else {
+    for (auto& it : trans) {
+      it.second.applyACX(alpha, acx);
+    }
   }
 
-  writeTransducerSet(output, letters, alpha, trans);
+  writeTransducerSet(output, letters, alpha, trans, false, nullptr, false,
+                     &runtime_acx);
 
   fclose(input);
   fclose(output);
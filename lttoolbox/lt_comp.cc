@@ -20,7 +20,17 @@
 #include <lttoolbox/cli.h>
 #include <lttoolbox/file_utils.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <getopt.h>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 /*
  * Error function that does nothing so that when we fallback from
@@ -32,10 +42,8 @@ void errorFunc(void *ctx, const char *msg, ...)
   return;
 }
 
-int main(int argc, char *argv[])
+void addOptions(CLI &cli)
 {
-  LtLocale::tryToSetLocale();
-  CLI cli("build a letter transducer from a dictionary", PACKAGE_VERSION);
   cli.add_bool_arg('d', "debug", "insert line numbers before each entry");
   cli.add_bool_arg('m', "keep-boundaries", "keep morpheme boundaries");
   cli.add_str_arg('v', "var", "set language variant", "VAR");
@@ -45,20 +53,86 @@ int main(int argc, char *argv[])
   cli.add_bool_arg('H', "hfst", "expect HFST symbols");
   cli.add_bool_arg('S', "no-split", "don't attempt to split into word and punctuation sections");
   cli.add_bool_arg('j', "jobs", "use one cpu core per section when minimising, new section after 50k entries");
+  cli.add_str_arg('I', "incremental", "minimise each section every N entries while compiling it, to use less memory", "N");
+  cli.add_str_arg('C', "cache-dir", "keep the compiled parts of the sections in DIR and reuse those whose entries did not change", "DIR");
+  cli.add_str_arg('L', "memory-limit", "write the parts set aside by -I to temporary files once they take more than N MB", "N");
+  cli.add_bool_arg('M', "mmap", "write a binary that lt-proc can map into memory without decoding");
+  cli.add_bool_arg('D', "directory", "write a directory of the sections that readers can seek through");
+  cli.add_bool_arg('A', "runtime-acx", "write the ACX classes for lt-proc to apply instead of adding their transitions");
+  cli.add_bool_arg('W', "push-weights", "move the weights towards the start of the transducers, so that entries that only differ in weight share their ends");
+  cli.add_str_arg('Q', "weight-quantum", "round the weights to multiples of Q when minimising", "Q");
+  cli.add_str_arg('F', "profile", "lay the states out by the visits lt-proc --profile-out counted in a binary compiled from the same file", "FILE");
+  cli.add_str_arg('R', "report", "write what each paradigm and section cost to build to file as JSON, or as text to stderr if file is -", "file");
+  cli.add_str_arg('B', "batch", "compile the dictionaries of the lines of MANIFEST, each one the arguments of an lt-comp, on all the cpu cores", "MANIFEST");
   cli.add_bool_arg('V', "verbose", "compile verbosely");
   cli.add_bool_arg('h', "help", "print this message and exit");
-  cli.add_file_arg("lr | rl | u", false);
-  cli.add_file_arg("dictionary_file", false);
-  cli.add_file_arg("output_file", false);
+  // only needed without --batch, which is checked after parsing
+  cli.add_file_arg("lr | rl | u", true);
+  cli.add_file_arg("dictionary_file", true);
+  cli.add_file_arg("output_file", true);
   cli.add_file_arg("acx_file", true);
-  cli.parse_args(argc, argv);
+}
 
+/*
+ * Check the arguments of a compilation, before starting it
+ * @return the type of the dictionary file: 'x' for XML or 'a' for AT&T
+ */
+char checkArgs(CLI &cli)
+{
   char ttype = 'x';
+  auto args = cli.get_strs();
+  std::string opc = cli.get_files()[0];
+  std::string infile = cli.get_files()[1];
+
+  xmlTextReaderPtr reader;
+  reader = xmlReaderForFile(infile.c_str(), NULL, 0);
+  xmlGenericErrorFunc handler = (xmlGenericErrorFunc)errorFunc;
+  initGenericErrorDefaultFunc(&handler);
+  if(reader != NULL)
+  {
+    int ret = xmlTextReaderRead(reader);
+    if(ret != 1)
+    {
+      ttype = 'a';
+    }
+    xmlFreeTextReader(reader);
+  }
+  else
+  {
+    std::cerr << "Error: Cannot not open file '" << infile << "'." << std::endl << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  initGenericErrorDefaultFunc(NULL);
+
+  if(opc == "lr")
+  {
+    if (args.find("var-left") != args.end()) {
+      std::cerr << "Error: -l specified, but mode is lr" << std::endl;
+      cli.print_usage();
+    }
+  }
+  else if(opc == "rl")
+  {
+    if (args.find("var-right") != args.end()) {
+      std::cerr << "Error: -r specified, but mode is rl" << std::endl;
+      cli.print_usage();
+    }
+  }
+  else if(opc != "u")
+  {
+    cli.print_usage();
+  }
+  return ttype;
+}
+
+/*
+ * Compile the dictionary that the arguments in cli name, once checked
+ */
+void compile(CLI &cli, char ttype)
+{
   Compiler c;
   AttCompiler a;
 
-  bool have_vl = false;
-  bool have_vr = false;
   auto args = cli.get_strs();
   if (args.find("var") != args.end()) {
     c.setVariantValue(to_ustring(args["var"][0].c_str()));
@@ -67,17 +141,21 @@ int main(int argc, char *argv[])
     c.setAltValue(to_ustring(args["alt"][0].c_str()));
   }
   if (args.find("var-left") != args.end()) {
-    have_vl = true;
     c.setVariantLeftValue(to_ustring(args["var-left"][0].c_str()));
   }
   if (args.find("var-right") != args.end()) {
-    have_vr = true;
     c.setVariantRightValue(to_ustring(args["var-right"][0].c_str()));
   }
 
   c.setEntryDebugging(cli.get_bools()["debug"]);
   c.setKeepBoundaries(cli.get_bools()["keep-boundaries"]);
   c.setVerbose(cli.get_bools()["verbose"]);
+  c.setRuntimeACX(cli.get_bools()["runtime-acx"]);
+  c.setReport(args.find("report") != args.end());
+  c.setPushWeights(cli.get_bools()["push-weights"]);
+  if (args.find("weight-quantum") != args.end()) {
+    c.setWeightQuantum(std::stod(args["weight-quantum"][0]));
+  }
 
   a.setHfstSymbols(cli.get_bools()["hfst"]);
   a.setSplitting(!cli.get_bools()["no-split"]);
@@ -86,6 +164,7 @@ int main(int argc, char *argv[])
   if(cli.get_bools()["jobs"] || (LT_JOBS != NULL && LT_JOBS[0] != 'n')) {
     c.setJobs(true);
     c.setMaxSectionEntries(50000);
+    a.setJobs(true);
   }
   else {
     c.setJobs(false);
@@ -94,40 +173,42 @@ int main(int argc, char *argv[])
   if(const char* max_section_entries = std::getenv("LT_MAX_SECTION_ENTRIES")) {
     c.setMaxSectionEntries(std::stol(max_section_entries));
   }
+  if (args.find("incremental") != args.end()) {
+    c.setPartEntries(std::stol(args["incremental"][0]));
+  }
+  if (args.find("cache-dir") != args.end()) {
+    std::error_code ec;
+    std::filesystem::create_directories(args["cache-dir"][0], ec);
+    if (ec) {
+      std::cerr << "Error: cannot create cache directory '" << args["cache-dir"][0] << "': " << ec.message() << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    c.setCacheDir(args["cache-dir"][0]);
+    if (args.find("incremental") == args.end()) {
+      c.setPartEntries(2000);
+    }
+  }
+  if (args.find("memory-limit") != args.end()) {
+    std::string const &mb = args["memory-limit"][0];
+    char* end = nullptr;
+    unsigned long const n = strtoul(mb.c_str(), &end, 10);
+    if (n == 0 || *end != '\0' || mb[0] == '-') {
+      std::cerr << "Error: Invalid or no argument for memory limit" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    c.setMemoryLimit(n * 1024 * 1024);
+    if (args.find("incremental") == args.end() && args.find("cache-dir") == args.end()) {
+      c.setPartEntries(2000);
+    }
+  }
 
   std::string opc = cli.get_files()[0];
   std::string infile = cli.get_files()[1];
   std::string outfile = cli.get_files()[2];
   std::string acxfile = cli.get_files()[3];
 
-  xmlTextReaderPtr reader;
-  reader = xmlReaderForFile(infile.c_str(), NULL, 0);
-  xmlGenericErrorFunc handler = (xmlGenericErrorFunc)errorFunc;
-  initGenericErrorDefaultFunc(&handler);
-  if(reader != NULL)
-  {
-    int ret = xmlTextReaderRead(reader);
-    if(ret != 1)
-    {
-      ttype = 'a';
-    }
-    xmlFreeTextReader(reader);
-    xmlCleanupParser();
-  }
-  else
-  {
-    std::cerr << "Error: Cannot not open file '" << infile << "'." << std::endl << std::endl;
-    exit(EXIT_FAILURE);
-  }
-  initGenericErrorDefaultFunc(NULL);
-
-
   if(opc == "lr")
   {
-    if (have_vl) {
-      std::cerr << "Error: -l specified, but mode is lr" << std::endl;
-      cli.print_usage();
-    }
     if(ttype == 'a')
     {
       a.parse(infile, false);
@@ -143,10 +224,6 @@ int main(int argc, char *argv[])
   }
   else if(opc == "rl")
   {
-    if (have_vr) {
-      std::cerr << "Error: -r specified, but mode is rl" << std::endl;
-      cli.print_usage();
-    }
     if(ttype == 'a')
     {
       a.parse(infile, true);
@@ -156,26 +233,153 @@ int main(int argc, char *argv[])
       c.parse(infile, Compiler::COMPILER_RESTRICTION_RL_VAL);
     }
   }
-  else if (opc == "u") {
+  else
+  {
     if (ttype == 'a') {
       a.parse(infile, false);
     } else {
       c.parse(infile, Compiler::COMPILER_RESTRICTION_U_VAL);
     }
   }
-  else
-  {
-    cli.print_usage();
-  }
 
+  bool mmap = cli.get_bools()["mmap"];
+  bool directory = cli.get_bools()["directory"];
+  StateVisits visits;
+  if (args.find("profile") != args.end()) {
+    FILE* profile = openInBinFile(args["profile"].back());
+    readStateVisits(profile, visits);
+    fclose(profile);
+  }
+  StateVisits const *layout = (args.find("profile") != args.end() ? &visits : nullptr);
   FILE* output = openOutBinFile(outfile);
   if(ttype == 'a')
   {
-    a.write(output);
+    a.write(output, mmap, layout, directory);
   }
   else
   {
-    c.write(output);
+    c.write(output, mmap, layout, directory);
+    if (args.find("report") != args.end()) {
+      std::string const &name = args["report"].back();
+      FILE* report = (name == "-" ? stderr : openOutBinFile(name));
+      c.getReport().write(report, report != stderr);
+      if (report != stderr) {
+        fclose(report);
+      }
+    }
   }
   fclose(output);
 }
+
+/*
+ * Compile the dictionaries of the lines of a manifest, each one the
+ * arguments of an lt-comp, as many at a time as there are cpu cores.
+ * Every line is checked before any is compiled, so that a mistake in
+ * the last one is not found after compiling all the others.
+ */
+void batch(std::string const &manifest)
+{
+  std::ifstream in(manifest);
+  if(!in)
+  {
+    std::cerr << "Error: Cannot not open file '" << manifest << "'." << std::endl << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  struct Job
+  {
+    std::unique_ptr<CLI> cli;
+    char ttype;
+    std::uintmax_t size;
+  };
+  std::vector<Job> jobs;
+  std::string line;
+  for(size_t number = 1; std::getline(in, line); number++)
+  {
+    std::vector<std::string> words = {"lt-comp"};
+    std::istringstream split(line);
+    for(std::string word; split >> word && word[0] != '#';)
+    {
+      words.push_back(word);
+    }
+    if(words.size() == 1)
+    {
+      continue;
+    }
+    std::vector<char *> argv;
+    for(auto &word : words)
+    {
+      argv.push_back(&word[0]);
+    }
+    argv.push_back(nullptr);
+
+    Job job;
+    job.cli.reset(new CLI("build a letter transducer from a dictionary", PACKAGE_VERSION));
+    addOptions(*job.cli);
+    optind = 1;
+    job.cli->parse_args(static_cast<int>(words.size()), argv.data());
+    if(job.cli->get_strs().count("batch") || job.cli->get_files()[2].empty())
+    {
+      std::cerr << "Error: line " << number << " of '" << manifest << "' is not the arguments of one compilation." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    job.ttype = checkArgs(*job.cli);
+    std::error_code ec;
+    job.size = std::filesystem::file_size(job.cli->get_files()[1], ec);
+    jobs.push_back(std::move(job));
+  }
+
+  // the biggest dictionaries take the longest, so they go first, and the
+  // small ones fill the cores while the last big ones finish
+  std::stable_sort(jobs.begin(), jobs.end(), [](Job const &a, Job const &b) {
+    return a.size > b.size;
+  });
+
+  // the parsers then share what libxml sets up once
+  xmlInitParser();
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for(size_t i = next++; i < jobs.size(); i = next++)
+    {
+      compile(*jobs[i].cli, jobs[i].ttype);
+    }
+  };
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, jobs.size());
+  std::vector<std::thread> pool;
+  for(size_t i = 1; i < threads; i++)
+  {
+    pool.emplace_back(work);
+  }
+  work();
+  for(auto &thread : pool)
+  {
+    thread.join();
+  }
+  xmlCleanupParser();
+}
+
+int main(int argc, char *argv[])
+{
+  LtLocale::tryToSetLocale();
+  CLI cli("build a letter transducer from a dictionary", PACKAGE_VERSION);
+  addOptions(cli);
+  cli.parse_args(argc, argv);
+
+  auto args = cli.get_strs();
+  if (args.find("batch") != args.end()) {
+    if (!cli.get_files()[0].empty()) {
+      std::cerr << "Error: --batch takes the dictionaries from its manifest, not the command line" << std::endl;
+      cli.print_usage();
+    }
+    batch(args["batch"].back());
+    return EXIT_SUCCESS;
+  }
+  if (cli.get_files()[2].empty()) {
+    cli.print_usage();
+  }
+
+  char ttype = checkArgs(cli);
+  compile(cli, ttype);
+  xmlCleanupParser();
+}
@@ -28,7 +28,8 @@ compose(FILE* file_f, FILE* file_g, FILE* file_gf, bool f_inverted, bool g_anywh
   Alphabet alph_f;
   std::set<UChar32> letters_f;
   std::map<UString, Transducer> trans_f;
-  readTransducerSet(file_f, letters_f, alph_f, trans_f);
+  ACXMap acx_f;
+  readTransducerSet(file_f, letters_f, alph_f, trans_f, &acx_f);
   Alphabet alph_g;
   std::set<UChar32> letters_g;
   std::map<UString, Transducer> trans_g;
@@ -56,7 +57,7 @@ compose(FILE* file_f, FILE* file_g, FILE* file_gf, bool f_inverted, bool g_anywh
       compositions.push_back(std::async(
           [](Transducer &f, Transducer &g, Alphabet &alph_f, Alphabet &alph_g,
              bool f_inverted, bool g_anywhere, UString name) {
-            Transducer gf = f.compose(g, alph_f, alph_g, f_inverted, g_anywhere);
+            Transducer gf = f.compose(g, alph_f, alph_g, f_inverted, g_anywhere, 0, true);
             if (gf.hasNoFinals()) {
               std::cerr << "Warning: section " << name
                         << " had no final state after composing! Skipping it..."
@@ -70,7 +71,7 @@ compose(FILE* file_f, FILE* file_g, FILE* file_gf, bool f_inverted, bool g_anywh
           std::ref(it.second), std::ref(union_g), std::ref(alph_f),
           std::ref(alph_g), f_inverted, g_anywhere, it.first));
     } else {
-      Transducer gf = it.second.compose(union_g, alph_f, alph_g, f_inverted, g_anywhere);
+      Transducer gf = it.second.compose(union_g, alph_f, alph_g, f_inverted, g_anywhere, 0, true);
       if (gf.hasNoFinals()) {
         std::cerr << "Warning: section " << it.first
                   << " had no final state after composing! Skipping it..."
@@ -93,7 +94,12 @@ compose(FILE* file_f, FILE* file_g, FILE* file_gf, bool f_inverted, bool g_anywh
     exit(EXIT_FAILURE);
   }
 
-  writeTransducerSet(file_gf, letters_f, alph_f, trans_gf);
+  // the classes of f are of its input, which inverted is composed away
+  if (f_inverted) {
+    acx_f.clear();
+  }
+  writeTransducerSet(file_gf, letters_f, alph_f, trans_gf, false, nullptr,
+                     false, &acx_f);
 }
 
 
@@ -29,12 +29,14 @@ int main(int argc, char *argv[])
   cli.add_str_arg('a', "alt", "set alternative (monodix)", "ALT");
   cli.add_str_arg('l', "var-left", "set left language variant (bidix)", "VAR");
   cli.add_str_arg('r', "var-right", "set right language variant (bidix)", "VAR");
+  cli.add_bool_arg('j', "jobs", "spell out the entries on all cpu cores");
   cli.add_file_arg("dictionary_file", false);
   cli.add_file_arg("output_file");
   cli.parse_args(argc, argv);
 
   Expander e;
   e.setKeepBoundaries(cli.get_bools()["keep-boundaries"]);
+  e.setJobs(cli.get_bools()["jobs"]);
   auto args = cli.get_strs();
   if (args.find("var") != args.end()) {
     e.setVariantValue(to_ustring(args["var"][0].c_str()));
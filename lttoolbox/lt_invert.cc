@@ -18,6 +18,7 @@
 #include <lttoolbox/file_utils.h>
 #include <lttoolbox/lt_locale.h>
 #include <lttoolbox/cli.h>
+#include <iostream>
 
 int main(int argc, char* argv[])
 {
@@ -32,16 +33,19 @@ int main(int argc, char* argv[])
   FILE* input = openInBinFile(cli.get_files()[0]);
   FILE* output = openOutBinFile(cli.get_files()[1]);
 
-  Alphabet alphabet;
-  std::set<UChar32> alphabetic_chars;
-  std::map<UString, Transducer> transducers;
-  readTransducerSet(input, alphabetic_chars, alphabet, transducers);
-
-  for (auto& it : transducers) {
-    it.second.invert(alphabet);
+  // each symbol becomes the pair the other way round, as in
+  // Transducer::invert(), without decoding the transducers into maps
+  auto invert = [](Alphabet& alphabet, int32_t tag) {
+    auto pr = alphabet.decode(tag);
+    return alphabet(pr.second, pr.first);
+  };
+  try {
+    relabelTransducerSet(input, output, invert, false);
+  }
+  catch (std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
   }
-
-  writeTransducerSet(output, alphabetic_chars, alphabet, transducers);
 
   fclose(input);
   fclose(output);
@@ -15,9 +15,140 @@
  * along with this program; if not, see <https://www.gnu.org/licenses/>.
  */
 #include <lttoolbox/transducer.h>
+#include <lttoolbox/trans_exe.h>
 #include <lttoolbox/file_utils.h>
+#include <lttoolbox/compression.h>
 #include <lttoolbox/cli.h>
 #include <lttoolbox/lt_locale.h>
+#include <cstdlib>
+#include <deque>
+#include <thread>
+
+namespace {
+
+// Print the section at input as it is read, unless it is in the mapped
+// format, which is unpacked first; with no output it is just skipped
+void printSection(FILE* input, Alphabet& alphabet, UFILE* output, bool hfst)
+{
+  if (TransExe::isMapped(input)) {
+    TransExe te;
+    te.read(input, alphabet);
+    if (output) {
+      Transducer t;
+      te.unpack(t, alphabet);
+      t.joinFinals();
+      t.show(alphabet, output, 0, hfst);
+    }
+  } else {
+    Transducer::show(input, alphabet, output, 0, hfst);
+  }
+}
+
+// A section being printed on a thread of its own into a buffer, from
+// its bytes
+struct Job
+{
+  std::vector<char> bytes;
+  char* text = nullptr;
+  size_t size = 0;
+  std::string error;
+  std::thread thread;
+};
+
+class Printer
+{
+  Alphabet& alphabet;
+  UFILE* output;
+  bool hfst;
+  size_t max_running;
+  std::deque<Job> running;
+  bool first = true;
+
+  void separate()
+  {
+    if (!first) {
+      u_fprintf(output, "--\n");
+    }
+    first = false;
+  }
+
+  void finishFirst()
+  {
+    Job& job = running.front();
+    job.thread.join();
+    if (!job.error.empty()) {
+      std::cerr << "Error: " << job.error << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    u_fflush(output);
+    fwrite(job.text, 1, job.size, u_fgetfile(output));
+    free(job.text);
+    running.pop_front();
+  }
+
+public:
+  Printer(Alphabet& alphabet, UFILE* output, bool hfst, bool jobs)
+    : alphabet(alphabet), output(output), hfst(hfst),
+      max_running(jobs ? std::max(1u, std::thread::hardware_concurrency()) : 0)
+  {
+#if !(HAVE_DECL_FMEMOPEN && HAVE_DECL_OPEN_MEMSTREAM)
+    max_running = 0;
+#endif
+  }
+
+  bool threaded() const
+  {
+    return max_running > 0;
+  }
+
+  // Print the section at input, after those already given
+  void print(FILE* input)
+  {
+    finish();
+    separate();
+    printSection(input, alphabet, output, hfst);
+  }
+
+  // Print the section in bytes on a thread of its own, after those
+  // already given
+  void print(std::vector<char>&& bytes)
+  {
+    if (running.size() >= max_running) {
+      finishFirst();
+    }
+    separate();
+    running.emplace_back();
+    Job& job = running.back();
+    job.bytes = std::move(bytes);
+    job.thread = std::thread([this](Job& job) {
+#if HAVE_DECL_FMEMOPEN && HAVE_DECL_OPEN_MEMSTREAM
+      FILE* in = fmemopen(job.bytes.data(), job.bytes.size(), "rb");
+      FILE* out = open_memstream(&job.text, &job.size);
+      UFILE* text = u_finit(out, NULL, NULL);
+      try {
+        Transducer::show(in, alphabet, text, 0, hfst);
+      }
+      catch (std::exception& e) {
+        job.error = e.what();
+      }
+      u_fclose(text);
+      fclose(out);
+      fclose(in);
+#endif
+      std::vector<char>().swap(job.bytes);
+    }, std::ref(job));
+  }
+
+  // Write out the sections still being printed
+  void finish()
+  {
+    while (!running.empty()) {
+      finishFirst();
+    }
+  }
+};
+
+} // namespace
 
 int main(int argc, char *argv[])
 {
@@ -25,6 +156,8 @@ int main(int argc, char *argv[])
   CLI cli("dump a transducer to text in ATT format", PACKAGE_VERSION);
   cli.add_bool_arg('a', "alpha", "print transducer alphabet");
   cli.add_bool_arg('H', "hfst", "use HFST-compatible character escapes");
+  cli.add_str_arg('s', "section", "print only the section with this name (id@type); may be used multiple times", "section_name");
+  cli.add_bool_arg('j', "jobs", "print the sections on all the cpu cores");
   cli.add_bool_arg('h', "help", "print this message and exit");
   cli.add_file_arg("bin_file");
   cli.add_file_arg("output_file");
@@ -32,15 +165,83 @@ int main(int argc, char *argv[])
 
   bool alpha = cli.get_bools()["alpha"];
   bool hfst = cli.get_bools()["hfst"];
+  auto LT_JOBS = std::getenv("LT_JOBS");
+  bool jobs = cli.get_bools()["jobs"] || (LT_JOBS != NULL && LT_JOBS[0] != 'n');
+  std::set<UString> sections;
+  auto strs = cli.get_strs();
+  if (strs.find("section") != strs.end()) {
+    for (auto& it : strs["section"]) {
+      sections.insert(to_ustring(it.c_str()));
+    }
+  }
 
   FILE* input = openInBinFile(cli.get_files()[0]);
   UFILE* output = openOutTextFile(cli.get_files()[1]);
 
   Alphabet alphabet;
   std::set<UChar32> alphabetic_chars;
-  std::map<UString, Transducer> transducers;
+  std::set<UString> found;
 
-  readTransducerSet(input, alphabetic_chars, alphabet, transducers);
+  // The sections are printed one by one as they are read, in the order
+  // they were written, without building the transducers
+  Printer printer(alphabet, output, hfst, jobs);
+  SectionDirectory directory;
+  if (alpha) {
+    readTransducerSetHeader(input, alphabetic_chars, alphabet);
+  } else if ((!sections.empty() || printer.threaded()) &&
+             readSectionDirectory(input, alphabetic_chars, alphabet, directory)) {
+    // seek straight to the sections asked for, or read each one for a
+    // thread to print
+    for (auto& it : directory) {
+      if (!sections.empty() && !sections.count(it.name)) {
+        continue;
+      }
+      found.insert(it.name);
+      std::vector<char> bytes;
+      readSectionBytes(input, it, bytes);
+      if (printer.threaded() && !(it.features & TDF_MMAP)) {
+        printer.print(std::move(bytes));
+      } else {
+        fseek(input, static_cast<long>(it.offset), SEEK_SET);
+        printer.print(input);
+      }
+    }
+  } else {
+    for (int len = readTransducerSetHeader(input, alphabetic_chars, alphabet);
+         len > 0; len--) {
+      UString name = Compression::string_read(input);
+      bool wanted = sections.empty() || sections.count(name);
+      if (wanted) {
+        found.insert(name);
+      }
+      long start = (wanted && printer.threaded() && !TransExe::isMapped(input)
+                    ? ftell(input) : -1);
+      if (!wanted || start < 0) {
+        if (wanted) {
+          printer.print(input);
+        } else {
+          printSection(input, alphabet, nullptr, hfst);
+        }
+        continue;
+      }
+      // go past the section to find its bytes
+      Transducer::show(input, alphabet, nullptr);
+      long end = ftell(input);
+      std::vector<char> bytes(end - start);
+      fseek(input, start, SEEK_SET);
+      if (fread_unlocked(bytes.data(), 1, bytes.size(), input) != bytes.size()) {
+        std::cerr << "Error: Failed to read section " << name << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      printer.print(std::move(bytes));
+    }
+  }
+  printer.finish();
+  for (auto& it : sections) {
+    if (!found.count(it)) {
+      std::cerr << "Warning: section " << it << " was not found." << std::endl;
+    }
+  }
 
   /////////////////////
 
@@ -52,16 +253,6 @@ int main(int argc, char *argv[])
       alphabet.writeSymbol(-i, output);
       u_fprintf(output, "\n");
     }
-  } else {
-    bool first = true;
-    for (auto& it : transducers) {
-      if (!first) {
-        u_fprintf(output, "--\n");
-      }
-      it.second.joinFinals();
-      it.second.show(alphabet, output, 0, hfst);
-      first = false;
-    }
   }
 
   fclose(input);
@@ -19,6 +19,23 @@
 #include <lttoolbox/cli.h>
 #include <lttoolbox/lt_locale.h>
 
+#include <condition_variable>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
 void checkValidity(FSTProcessor const &fstp)
 {
   if(!fstp.valid())
@@ -27,6 +44,559 @@ void checkValidity(FSTProcessor const &fstp)
   }
 }
 
+void reportActivePaths(FSTProcessor const &fstp)
+{
+  if(fstp.getActivePathsPruned() != 0)
+  {
+    std::cerr << "Warning: --max-active-paths dropped paths at "
+              << fstp.getActivePathsPruned() << " steps" << std::endl;
+  }
+}
+
+// Report what is left to report once all the input has been processed;
+// with null flushing the statistics were written after every block
+void finish(FSTProcessor &fstp, bool null_flush, FILE *stats, FILE *profile,
+            FILE *memory)
+{
+  reportActivePaths(fstp);
+  if(memory != nullptr)
+  {
+    fstp.getMemoryReport().write(memory, memory != stderr);
+    if(memory != stderr)
+    {
+      fclose(memory);
+    }
+  }
+  if(profile != nullptr)
+  {
+    fstp.writeProfile(profile);
+    fclose(profile);
+  }
+  if(stats != nullptr)
+  {
+    if(!null_flush)
+    {
+      fstp.writeStats();
+    }
+    if(stats != stderr)
+    {
+      fclose(stats);
+    }
+  }
+}
+
+void process(FSTProcessor &fstp, char cmd, GenerationMode bilmode,
+             InputFile &input, UFILE *output)
+{
+  switch(cmd)
+  {
+    case 'g':
+      fstp.generation(input, output, bilmode);
+      break;
+
+    case 'p':
+      fstp.postgeneration(input, output);
+      break;
+
+    case 's':
+      fstp.SAO(input, output);
+      break;
+
+    case 't':
+      fstp.transliteration(input, output);
+      break;
+
+    case 'b':
+      fstp.bilingual(input, output, bilmode);
+      break;
+
+    case 'e':
+    case 'a':
+    default:
+      fstp.analysis(input, output);
+      break;
+  }
+}
+
+void init(FSTProcessor &fstp, char cmd)
+{
+  switch(cmd)
+  {
+    case 'g':
+      fstp.initGeneration();
+      break;
+
+    case 'p':
+    case 't':
+      fstp.initPostgeneration();
+      break;
+
+    case 'b':
+      fstp.initBiltrans();
+      break;
+
+    case 'e':
+      fstp.initDecomposition();
+      break;
+
+    case 's':
+    case 'a':
+    default:
+      fstp.initAnalysis();
+      break;
+  }
+  checkValidity(fstp);
+}
+
+// One of the processors the input goes through, the first one given as
+// fst_file and the others with --stage
+struct Stage
+{
+  FSTProcessor *fstp;
+  char cmd;
+  GenerationMode mode;
+};
+
+// The mode of a --stage: the lt-proc option that selects it
+bool parseStageMode(char letter, char &cmd, GenerationMode &mode)
+{
+  mode = gm_unknown;
+  switch(letter)
+  {
+    case 'a': cmd = 'a'; break;
+    case 'e': cmd = 'e'; break;
+    case 'b': cmd = 'b'; break;
+    case 'g': cmd = 'g'; break;
+    case 'd': cmd = 'g'; mode = gm_all; break;
+    case 'l': cmd = 'g'; mode = gm_tagged; break;
+    case 'm': cmd = 'g'; mode = gm_tagged_nm; break;
+    case 'n': cmd = 'g'; mode = gm_clean; break;
+    case 'C': cmd = 'g'; mode = gm_carefulcase; break;
+    case 'p': cmd = 'p'; break;
+    case 't': case 'x': cmd = 't'; break;
+    default: return false;
+  }
+  return true;
+}
+
+#if HAVE_DECL_FMEMOPEN && HAVE_DECL_OPEN_MEMSTREAM
+
+// Input is cut into chunks that are processed independently by the
+// workers, each with its own copy of the processor (sharing the
+// dictionary), and written back in input order.
+struct Chunk
+{
+  std::string input;
+  std::string output;
+  std::string error;
+  bool done = false;
+};
+
+// Below this size a chunk is not cut at line breaks
+constexpr size_t min_chunk_size = 1 << 16;
+
+// Blocks are read ahead up to this many chunks per worker
+constexpr size_t chunks_per_thread = 4;
+
+/**
+ * Read the next chunk of input.  With null flushing a chunk is
+ * everything up to the next NUL, which is consumed, and what follows the
+ * last NUL is a chunk even if empty, as serial mode flushes it too.
+ * Otherwise it ends
+ * at a line break outside superblanks and lexical units, once it is big
+ * enough; for the modes reading plain text the line also has to end a
+ * sentence (or be followed by an empty line) so that no multiword can
+ * match across the cut.
+ */
+bool readChunk(FILE *input, bool null_flush, bool text, std::string &chunk)
+{
+  chunk.clear();
+  if(null_flush && feof(input))
+  {
+    return false;
+  }
+  int depth = 0;
+  bool in_lu = false;
+  bool escaped = false;
+  char last = '\n';
+  int c;
+  while((c = fgetc_unlocked(input)) != EOF)
+  {
+    if(null_flush)
+    {
+      if(c == '\0')
+      {
+        return true;
+      }
+      chunk += static_cast<char>(c);
+      continue;
+    }
+    chunk += static_cast<char>(c);
+    if(escaped)
+    {
+      escaped = false;
+    }
+    else if(c == '\\')
+    {
+      escaped = true;
+    }
+    else if(c == '^' && depth == 0)
+    {
+      in_lu = true;
+    }
+    else if(c == '$' && depth == 0)
+    {
+      in_lu = false;
+    }
+    else if(c == '[' && !in_lu)
+    {
+      depth++;
+    }
+    else if(c == ']' && !in_lu && depth > 0)
+    {
+      depth--;
+    }
+    else if(c == '\n' && depth == 0 && !in_lu &&
+            chunk.size() >= min_chunk_size &&
+            (!text || last == '\n' || strchr(".!?", last) != nullptr))
+    {
+      return true;
+    }
+    if(!escaped && c != ' ' && c != '\t' && c != '\r')
+    {
+      last = static_cast<char>(c);
+    }
+  }
+  return null_flush || !chunk.empty();
+}
+
+// Run the chunk through every stage in turn, the output of one being the
+// input of the next
+void processChunk(std::vector<Stage> const &stages, Chunk &chunk)
+{
+  chunk.output = chunk.input;
+  for(auto &stage : stages)
+  {
+    if(chunk.output.empty())
+    {
+      return;
+    }
+    FSTProcessor session(*stage.fstp);
+    session.setNullFlush(false);
+
+    char *buffer = nullptr;
+    size_t size = 0;
+    FILE *out = open_memstream(&buffer, &size);
+    UFILE *output = u_finit(out, NULL, NULL);
+    try
+    {
+      InputFile input;
+      input.wrap(fmemopen(&chunk.output[0], chunk.output.size(), "rb"));
+      process(session, stage.cmd, stage.mode, input, output);
+    }
+    catch(std::exception& e)
+    {
+      chunk.error = e.what();
+    }
+    u_fclose(output);
+    fclose(out);
+    chunk.output.assign(buffer, size);
+    free(buffer);
+    if(!chunk.error.empty())
+    {
+      return;
+    }
+  }
+}
+
+void processParallel(std::vector<Stage> const &stages, bool null_flush,
+                     FILE *input, UFILE *output, size_t threads)
+{
+  bool text = (stages[0].cmd != 'g' && stages[0].cmd != 'b');
+  size_t max_chunks = threads * chunks_per_thread;
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::shared_ptr<Chunk>> pending;   // not started yet
+  std::deque<std::shared_ptr<Chunk>> in_order;  // not written yet
+  bool end_of_input = false;
+  bool stop = false;
+
+  std::vector<std::thread> workers;
+  for(size_t i = 0; i < threads; i++)
+  {
+    workers.emplace_back([&]() {
+      while(true)
+      {
+        std::shared_ptr<Chunk> chunk;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          changed.wait(lock, [&]() {
+            return stop || end_of_input || !pending.empty();
+          });
+          if(stop || pending.empty())
+          {
+            return;
+          }
+          chunk = pending.front();
+          pending.pop_front();
+        }
+        processChunk(stages, *chunk);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          chunk->done = true;
+        }
+        changed.notify_all();
+      }
+    });
+  }
+
+  // the reader runs on its own so that a chunk is written as soon as it
+  // is done, even if the next one has not been sent yet
+  std::thread reader([&]() {
+    std::string data;
+    while(readChunk(input, null_flush, text, data))
+    {
+      auto chunk = std::make_shared<Chunk>();
+      chunk->input.swap(data);
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [&]() { return stop || in_order.size() < max_chunks; });
+      if(stop)
+      {
+        return;
+      }
+      pending.push_back(chunk);
+      in_order.push_back(chunk);
+      lock.unlock();
+      changed.notify_all();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    end_of_input = true;
+    changed.notify_all();
+  });
+
+  u_fflush(output);
+  FILE *out = u_fgetfile(output);
+  bool error = false;
+  while(!error)
+  {
+    std::shared_ptr<Chunk> chunk;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [&]() {
+        return (!in_order.empty() && in_order.front()->done) ||
+               (in_order.empty() && end_of_input);
+      });
+      if(in_order.empty())
+      {
+        break;
+      }
+      chunk = in_order.front();
+      in_order.pop_front();
+    }
+    changed.notify_all();
+
+    fwrite_unlocked(chunk->output.data(), 1, chunk->output.size(), out);
+    if(!chunk->error.empty())
+    {
+      std::cerr << chunk->error;
+      error = true;
+    }
+    if(null_flush)
+    {
+      fputc_unlocked('\0', out);
+      fflush(out);
+    }
+  }
+  fflush(out);
+
+  if(error)
+  {
+    // the reader may be blocked on input, so don't wait for it
+    exit(1);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  changed.notify_all();
+  reader.join();
+  for(auto& it : workers)
+  {
+    it.join();
+  }
+}
+
+#endif
+
+#ifndef _WIN32
+
+// Every connection to the socket is a null-flushed stream, served by its
+// own copy of the processor (sharing the dictionary) until the client
+// closes it.
+void serveConnection(std::shared_ptr<FSTProcessor const> fstp, char cmd,
+                     GenerationMode bilmode, int fd)
+{
+  FSTProcessor session(*fstp);
+  fstp.reset();
+  session.setNullFlush(true);
+
+  int out_fd = dup(fd);
+  FILE *out = (out_fd < 0 ? nullptr : fdopen(out_fd, "wb"));
+  FILE *in = fdopen(fd, "rb");
+  if(out == nullptr || in == nullptr)
+  {
+    std::cerr << "Error: cannot open connection: " << strerror(errno) << std::endl;
+    if(out != nullptr) fclose(out);
+    else if(out_fd >= 0) close(out_fd);
+    if(in != nullptr) fclose(in);
+    else close(fd);
+    return;
+  }
+
+  UFILE *output = u_finit(out, NULL, NULL);
+  try
+  {
+    InputFile input;
+    input.wrap(in);
+    process(session, cmd, bilmode, input, output);
+  }
+  catch(std::exception& e)
+  {
+    std::cerr << e.what();
+    u_fputc('\0', output);
+  }
+  u_fclose(output);
+  fclose(out);
+}
+
+// The processor new connections are served with a copy of
+std::mutex serving_mutex;
+std::shared_ptr<FSTProcessor const> serving;
+
+// Read fst_file again at every signal of signals and serve the new
+// connections with it; the connections already open go on with the
+// dictionary they started with, which is freed when the last of them
+// is closed.
+void reloadOnSignal(std::string const &fst_file, sigset_t signals)
+{
+  while(true)
+  {
+    int sig;
+    if(sigwait(&signals, &sig) != 0)
+    {
+      continue;
+    }
+    FILE *input = fopen(fst_file.c_str(), "rb");
+    if(input == nullptr)
+    {
+      std::cerr << "Error: cannot reload " << fst_file << ": " << strerror(errno) << std::endl;
+      continue;
+    }
+    try
+    {
+      std::shared_ptr<FSTProcessor> next;
+      {
+        std::lock_guard<std::mutex> lock(serving_mutex);
+        next = std::make_shared<FSTProcessor>(*serving);
+      }
+      next->reload(input);
+      if(!next->valid())
+      {
+        std::cerr << "Error: cannot reload " << fst_file << ": invalid dictionary" << std::endl;
+      }
+      else
+      {
+        std::lock_guard<std::mutex> lock(serving_mutex);
+        serving = next;
+      }
+    }
+    catch(std::exception& e)
+    {
+      std::cerr << e.what() << std::endl;
+    }
+    fclose(input);
+  }
+}
+
+/**
+ * Listen on a Unix socket and serve every connection on its own thread,
+ * reading fst_file again on SIGHUP; only returns if the socket cannot be
+ * set up or accept() fails
+ */
+void serve(FSTProcessor &&fstp, std::string const &fst_file, char cmd,
+           GenerationMode bilmode, std::string const &path)
+{
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if(path.size() >= sizeof(addr.sun_path))
+  {
+    std::cerr << "Error: socket path too long: " << path << std::endl;
+    return;
+  }
+  strcpy(addr.sun_path, path.c_str());
+
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(sock < 0)
+  {
+    std::cerr << "Error: cannot create socket: " << strerror(errno) << std::endl;
+    return;
+  }
+  // a socket left by a server before is replaced, but nothing else
+  struct stat st;
+  if(lstat(path.c_str(), &st) == 0)
+  {
+    if(!S_ISSOCK(st.st_mode))
+    {
+      std::cerr << "Error: " << path << " exists and is not a socket" << std::endl;
+      close(sock);
+      return;
+    }
+    unlink(path.c_str());
+  }
+  if(bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+     listen(sock, SOMAXCONN) < 0)
+  {
+    std::cerr << "Error: cannot listen on " << path << ": " << strerror(errno) << std::endl;
+    close(sock);
+    return;
+  }
+
+  // a client that goes away must not take the server with it
+  signal(SIGPIPE, SIG_IGN);
+
+  // SIGHUP is blocked in every thread and taken by the one reloading
+  serving = std::make_shared<FSTProcessor const>(std::move(fstp));
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  std::thread(reloadOnSignal, fst_file, signals).detach();
+
+  while(true)
+  {
+    int fd = accept(sock, nullptr, nullptr);
+    if(fd < 0)
+    {
+      if(errno == EINTR || errno == ECONNABORTED)
+      {
+        continue;
+      }
+      std::cerr << "Error: accept failed: " << strerror(errno) << std::endl;
+      break;
+    }
+    std::shared_ptr<FSTProcessor const> current;
+    {
+      std::lock_guard<std::mutex> lock(serving_mutex);
+      current = serving;
+    }
+    std::thread(serveConnection, std::move(current), cmd, bilmode, fd).detach();
+  }
+  close(sock);
+}
+
+#endif
+
 int main(int argc, char *argv[])
 {
   LtLocale::tryToSetLocale();
@@ -61,6 +631,20 @@ int main(int argc, char *argv[])
   cli.add_str_arg('N', "analyses", "Output no more than N analyses (if the transducer is weighted, the N best analyses)", "N");
   cli.add_str_arg('L', "weight-classes", "Output no more than N best weight classes (where analyses with equal weight constitute a class)", "N");
   cli.add_str_arg('M', "compound-max-elements", "Set compound max elements", "N");
+  cli.add_bool_arg('j', "io-threads", "read the input and write the output on threads of their own, overlapping them with the processing");
+  cli.add_str_arg('T', "threads", "process the input in chunks on N threads, sharing the dictionary", "N");
+  cli.add_str_arg('f', "compose", "in analysis, compose the transducer with the one in fst_file as lt-compose would, but at lookup time", "fst_file");
+  cli.add_str_arg('y', "stage", "then pass the output through fst_file in MODE, the letter of its option (a, e, b, g, d, l, m, n, C, p or t), in the same process; can be repeated", "MODE:fst_file");
+  cli.add_str_arg('P', "max-active-paths", "keep at most N paths after every character, the lightest ones, and at most P of those with the same output", "N[,P]");
+  cli.add_str_arg('u', "stats", "write statistics of the processing to file as JSON, or as text to stderr if file is -; with -z, after every block", "file");
+  cli.add_str_arg('k', "slow-token", "with --stats (to stderr by default), also write every token taking at least MS milliseconds", "MS");
+  cli.add_str_arg('F', "profile-out", "count how often every state and transition of fst_file is reached and write the counts to file, for lt-comp --profile and lt-renumber", "file");
+  cli.add_str_arg('G', "profile-sample", "with --profile-out, count only one step in N", "N");
+  cli.add_str_arg('R', "mem-report", "once the input is processed, write how much memory the dictionary and the session take to file as JSON, or as text to stderr if file is -", "file");
+  cli.add_str_arg('A', "analysis-cache", "cache the analyses, generations or translations of N words, or of N megabytes worth with a suffix M", "N[M]");
+#ifndef _WIN32
+  cli.add_str_arg('S', "serve", "load the dictionary once and serve null-flushed streams on a Unix socket, each connection as a separate session", "socket");
+#endif
   cli.add_bool_arg('h', "help", "show this help");
   cli.parse_args(argc, argv);
 
@@ -172,64 +756,193 @@ int main(int argc, char *argv[])
     }
     fstp.setCompoundMaxElements(n);
   }
+  if (strs.find("analysis-cache") != strs.end()) {
+    std::string arg = strs["analysis-cache"].back();
+    char* end = nullptr;
+    long n = strtol(arg.c_str(), &end, 10);
+    std::string suffix = end ? end : "";
+    if (n < 1 || (suffix != "" && suffix != "M" && suffix != "MB")) {
+      std::cerr << "Invalid or no argument for analysis cache size" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (suffix.empty()) {
+      fstp.setAnalysisCacheSize(n, 0);
+      fstp.setLookupCacheSize(n, 0);
+    } else {
+      fstp.setAnalysisCacheSize(0, static_cast<size_t>(n) << 20);
+      fstp.setLookupCacheSize(0, static_cast<size_t>(n) << 20);
+    }
+  }
+  if (strs.find("max-active-paths") != strs.end()) {
+    std::string arg = strs["max-active-paths"].back();
+    char* end = nullptr;
+    long n = strtol(arg.c_str(), &end, 10);
+    long p = 0;
+    if (end && *end == ',') {
+      p = strtol(end + 1, &end, 10);
+      if (p < 1) {
+        n = 0;
+      }
+    }
+    if (n < 1 || (end && *end != '\0')) {
+      std::cerr << "Invalid or no argument for max active paths" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    fstp.setMaxActivePaths(n, p);
+  }
+  FILE* stats = nullptr;
+  if (strs.find("stats") != strs.end() || strs.find("slow-token") != strs.end()) {
+    std::string file = "-";
+    if (strs.find("stats") != strs.end()) {
+      file = strs["stats"].back();
+    }
+    stats = (file == "-" ? stderr : openOutBinFile(file));
+    fstp.setStatsOutput(stats, stats != stderr);
+  }
+  if (strs.find("slow-token") != strs.end()) {
+    char* end = nullptr;
+    double ms = strtod(strs["slow-token"].back().c_str(), &end);
+    if (!(ms > 0) || (end && *end != '\0')) {
+      std::cerr << "Invalid or no argument for slow token time" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    fstp.setSlowTokenThreshold(ms / 1000);
+  }
+  FILE* memory = nullptr;
+  if (strs.find("mem-report") != strs.end()) {
+    std::string file = strs["mem-report"].back();
+    memory = (file == "-" ? stderr : openOutBinFile(file));
+  }
+  bool const null_flush = fstp.getNullFlush();
+  size_t threads = 1;
+  if (strs.find("threads") != strs.end()) {
+    int n = atoi(strs["threads"].back().c_str());
+    if (n < 1) {
+      std::cerr << "Invalid or no argument for thread count" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+#if !(HAVE_DECL_FMEMOPEN && HAVE_DECL_OPEN_MEMSTREAM)
+    if (n > 1) {
+      std::cerr << "Warning: --threads is not supported on this platform" << std::endl;
+      n = 1;
+    }
+#endif
+    threads = n;
+  }
 
   FILE* in = openInBinFile(cli.get_files()[0]);
   fstp.load(in);
   fclose(in);
 
-  InputFile input;
-  if (!cli.get_files()[1].empty()) {
-    input.open_or_exit(cli.get_files()[1].c_str());
+  if (strs.find("compose") != strs.end()) {
+    if (cmd != 0 && cmd != 'a') {
+      std::cerr << "Error: --compose only works in analysis" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    FILE* compose_in = openInBinFile(strs["compose"].back());
+    fstp.loadComposition(compose_in);
+    fclose(compose_in);
+  }
+
+  // the processors of the --stage options get the settings of fstp that
+  // apply to any mode
+  std::vector<std::pair<char, GenerationMode>> stage_modes;
+  std::vector<FSTProcessor> extra;
+  if (strs.find("stage") != strs.end()) {
+#if !(HAVE_DECL_FMEMOPEN && HAVE_DECL_OPEN_MEMSTREAM)
+    std::cerr << "Error: --stage is not supported on this platform" << std::endl;
+    exit(EXIT_FAILURE);
+#endif
+    extra.resize(strs["stage"].size());
+    for (size_t i = 0; i < strs["stage"].size(); i++) {
+      std::string const &arg = strs["stage"][i];
+      std::pair<char, GenerationMode> mode;
+      if (arg.size() < 3 || arg[1] != ':' ||
+          !parseStageMode(arg[0], mode.first, mode.second)) {
+        std::cerr << "Invalid argument for stage: " << arg << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      stage_modes.push_back(mode);
+      FSTProcessor &stage = extra[i];
+      stage.setCaseSensitiveMode(args["case-sensitive"]);
+      stage.setDictionaryCaseMode(args["dictionary-case"]);
+      stage.setDisplayWeightsMode(args["show-weights"]);
+      if (strs.find("analyses") != strs.end()) {
+        stage.setMaxAnalysesValue(atoi(strs["analyses"].back().c_str()));
+      }
+      if (strs.find("weight-classes") != strs.end()) {
+        stage.setMaxWeightClassesValue(atoi(strs["weight-classes"].back().c_str()));
+      }
+      FILE* stage_in = openInBinFile(arg.substr(2));
+      stage.load(stage_in);
+      fclose(stage_in);
+    }
   }
+
   UFILE* output = openOutTextFile(cli.get_files()[2]);
 
+  FILE* profile = nullptr;
   try
   {
-    switch(cmd)
-    {
-      case 'g':
-        fstp.initGeneration();
-        checkValidity(fstp);
-        fstp.generation(input, output, bilmode);
-        break;
-
-      case 'p':
-        fstp.initPostgeneration();
-        checkValidity(fstp);
-        fstp.postgeneration(input, output);
-        break;
-
-      case 's':
-        fstp.initAnalysis();
-        checkValidity(fstp);
-        fstp.SAO(input, output);
-        break;
-
-      case 't':
-        fstp.initPostgeneration();
-        checkValidity(fstp);
-        fstp.transliteration(input, output);
-        break;
+    init(fstp, cmd);
+    if (strs.find("profile-out") != strs.end()) {
+      int period = 1;
+      if (strs.find("profile-sample") != strs.end()) {
+        period = atoi(strs["profile-sample"].back().c_str());
+        if (period < 1) {
+          std::cerr << "Invalid or no argument for profile sampling" << std::endl;
+          exit(EXIT_FAILURE);
+        }
+      }
+      fstp.startProfile(period);
+      profile = openOutBinFile(strs["profile-out"].back());
+    }
+    std::vector<Stage> stages = {{&fstp, cmd, bilmode}};
+    for (size_t i = 0; i < extra.size(); i++) {
+      init(extra[i], stage_modes[i].first);
+      stages.push_back({&extra[i], stage_modes[i].first, stage_modes[i].second});
+    }
 
-      case 'b':
-        fstp.initBiltrans();
-        checkValidity(fstp);
-        fstp.bilingual(input, output, bilmode);
-        break;
+#ifndef _WIN32
+    if (strs.find("serve") != strs.end()) {
+      if (stages.size() > 1) {
+        std::cerr << "Error: --stage cannot be used with --serve" << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      if (profile != nullptr) {
+        std::cerr << "Error: --profile-out cannot be used with --serve" << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      serve(std::move(fstp), cli.get_files()[0], cmd, bilmode, strs["serve"].back());
+      exit(EXIT_FAILURE);
+    }
+#endif
 
-      case 'e':
-        fstp.initDecomposition();
-        checkValidity(fstp);
-        fstp.analysis(input, output);
-        break;
+#if HAVE_DECL_FMEMOPEN && HAVE_DECL_OPEN_MEMSTREAM
+    if (threads > 1 || stages.size() > 1) {
+      FILE* in = stdin;
+      if (!cli.get_files()[1].empty()) {
+        in = openInBinFile(cli.get_files()[1]);
+      }
+      processParallel(stages, fstp.getNullFlush(), in, output, threads);
+      if (in != stdin) {
+        fclose(in);
+      }
+      u_fclose(output);
+      finish(fstp, null_flush, stats, profile, memory);
+      return EXIT_SUCCESS;
+    }
+#endif
 
-      case 'a':
-      default:
-        fstp.initAnalysis();
-        checkValidity(fstp);
-        fstp.analysis(input, output);
-        break;
+    InputFile input;
+    if (!cli.get_files()[1].empty()) {
+      input.open_or_exit(cli.get_files()[1].c_str());
+    }
+    if (args["io-threads"]) {
+      input.readAhead();
+      fstp.setThreadedOutput(true);
     }
+    process(fstp, cmd, bilmode, input, output);
   }
   catch (std::exception& e)
   {
@@ -242,5 +955,6 @@ int main(int argc, char *argv[])
   }
 
   u_fclose(output);
+  finish(fstp, null_flush, stats, profile, memory);
   return EXIT_SUCCESS;
 }
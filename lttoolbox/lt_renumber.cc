@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#include <lttoolbox/transducer.h>
+#include <lttoolbox/file_utils.h>
+#include <lttoolbox/cli.h>
+#include <lttoolbox/lt_locale.h>
+#include <iostream>
+
+int main(int argc, char *argv[])
+{
+  LtLocale::tryToSetLocale();
+  CLI cli("lay out the states of a transducer in the order they are used", PACKAGE_VERSION);
+  cli.add_str_arg('p', "profile", "visits to the states written by lt-proc --profile-out with this transducer", "FILE");
+  cli.add_bool_arg('M', "mmap", "write a binary that lt-proc can map into memory without decoding");
+  cli.add_bool_arg('h', "help", "print this message and exit");
+  cli.add_file_arg("input_bin_file", false);
+  cli.add_file_arg("output_bin_file");
+  cli.parse_args(argc, argv);
+
+  auto strs = cli.get_strs();
+  StateVisits visits;
+  if (strs.find("profile") != strs.end()) {
+    FILE* profile = openInBinFile(strs["profile"].back());
+    readStateVisits(profile, visits);
+    fclose(profile);
+  }
+
+  FILE* input = openInBinFile(cli.get_files()[0]);
+  std::set<UChar32> letters;
+  Alphabet alpha;
+  std::map<UString, Transducer> trans;
+  ACXMap acx;
+  readTransducerSet(input, letters, alpha, trans, &acx);
+  fclose(input);
+
+  for (auto& it : visits) {
+    if (trans.find(it.first) == trans.end()) {
+      std::cerr << "Warning: section " << it.first << " of the profile is not in the transducer" << std::endl;
+    }
+  }
+  // Sections nobody visited are still laid out breadth-first
+  for (auto& it : trans) {
+    visits[it.first];
+  }
+
+  FILE* output = openOutBinFile(cli.get_files()[1]);
+  writeTransducerSet(output, letters, alpha, trans, cli.get_bools()["mmap"], &visits,
+                     false, &acx);
+  fclose(output);
+
+  return 0;
+}
@@ -19,6 +19,7 @@
 #include <lttoolbox/cli.h>
 #include <lttoolbox/lt_locale.h>
 #include <lttoolbox/string_utils.h>
+#include <iostream>
 
 void get_symbol(const std::string& s, Alphabet& alpha, const char* prefix,
                 sorted_vector<int32_t>& vec)
@@ -34,33 +35,14 @@ void get_symbol(const std::string& s, Alphabet& alpha, const char* prefix,
   }
 }
 
-int main(int argc, char* argv[])
+/**
+ * Find the restriction symbols of alpha whose transitions are kept, as
+ * epsilons, and those whose transitions are dropped
+ */
+void find_restrictions(Alphabet& alpha, const std::string& dir, CLI& cli,
+                       sorted_vector<int32_t>& keep,
+                       sorted_vector<int32_t>& drop)
 {
-  LtLocale::tryToSetLocale();
-  CLI cli("remove paths from a transducer", PACKAGE_VERSION);
-  cli.add_bool_arg('m', "minimise", "minimise transducers after deleting paths");
-  cli.add_str_arg('v', "var", "set language variant", "VAR");
-  cli.add_str_arg('a', "alt", "set alternative (monodix)", "ALT");
-  cli.add_str_arg('l', "var-left", "set left language variant (bidix)", "VAR");
-  cli.add_str_arg('r', "var-right", "set right language variant (bidix)", "VAR");
-  cli.add_file_arg("lr | rl", false);
-  cli.add_file_arg("input_file");
-  cli.add_file_arg("output_file");
-  cli.parse_args(argc, argv);
-
-  std::string dir = cli.get_files()[0];
-  if (dir == "lr") dir = "LR";
-  else if (dir == "rl") dir = "RL";
-  FILE* input = openInBinFile(cli.get_files()[1]);
-  FILE* output = openOutBinFile(cli.get_files()[2]);
-
-  Alphabet alpha;
-  std::set<UChar32> letters;
-  std::map<UString, Transducer> trans;
-  readTransducerSet(input, letters, alpha, trans);
-
-  sorted_vector<int32_t> keep;
-  sorted_vector<int32_t> drop;
   bool has_var = false;
   get_symbol(dir, alpha, "r", keep);
   for (auto& it : cli.get_strs()["var"]) {
@@ -93,6 +75,27 @@ int main(int argc, char* argv[])
       keep.insert(alpha(-i, -i));
     }
   }
+}
+
+int main(int argc, char* argv[])
+{
+  LtLocale::tryToSetLocale();
+  CLI cli("remove paths from a transducer", PACKAGE_VERSION);
+  cli.add_bool_arg('m', "minimise", "minimise transducers after deleting paths");
+  cli.add_str_arg('v', "var", "set language variant", "VAR");
+  cli.add_str_arg('a', "alt", "set alternative (monodix)", "ALT");
+  cli.add_str_arg('l', "var-left", "set left language variant (bidix)", "VAR");
+  cli.add_str_arg('r', "var-right", "set right language variant (bidix)", "VAR");
+  cli.add_file_arg("lr | rl", false);
+  cli.add_file_arg("input_file");
+  cli.add_file_arg("output_file");
+  cli.parse_args(argc, argv);
+
+  std::string dir = cli.get_files()[0];
+  if (dir == "lr") dir = "LR";
+  else if (dir == "rl") dir = "RL";
+  FILE* input = openInBinFile(cli.get_files()[1]);
+  FILE* output = openOutBinFile(cli.get_files()[2]);
 
   bool min = cli.get_bools()["minimise"];
   if (!min) {
@@ -100,18 +103,60 @@ int main(int argc, char* argv[])
     min = (LT_RELEASE != NULL && LT_RELEASE[0] != 'n');
   }
 
+  sorted_vector<int32_t> keep;
+  sorted_vector<int32_t> drop;
+
+  if (!min) {
+    // without minimising, each symbol just becomes another, or nothing,
+    // which can be done on the encoded transducers
+    bool found = false;
+    auto relabel = [&](Alphabet& alpha, int32_t tag) -> int32_t {
+      if (!found) {
+        find_restrictions(alpha, dir, cli, keep, drop);
+        found = true;
+      }
+      if (drop.count(tag)) {
+        return -1;
+      }
+      if (keep.count(tag)) {
+        tag = 0;
+      }
+      if (dir == "RL") {
+        auto pr = alpha.decode(tag);
+        tag = alpha(pr.second, pr.first);
+      }
+      return tag;
+    };
+    try {
+      relabelTransducerSet(input, output, relabel, true);
+    }
+    catch (std::exception& e) {
+      std::cerr << "Error: " << e.what() << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    fclose(input);
+    fclose(output);
+    return 0;
+  }
+
+  Alphabet alpha;
+  std::set<UChar32> letters;
+  std::map<UString, Transducer> trans;
+  ACXMap acx;
+  readTransducerSet(input, letters, alpha, trans, &acx);
+  find_restrictions(alpha, dir, cli, keep, drop);
+
   for (auto& it : trans) {
     it.second.deleteSymbols(drop);
     it.second.epsilonizeSymbols(keep);
     if (dir == "RL") {
       it.second.invert(alpha);
     }
-    if (min) {
-      it.second.minimize();
-    }
+    it.second.minimize();
   }
 
-  writeTransducerSet(output, letters, alpha, trans);
+  writeTransducerSet(output, letters, alpha, trans, false, nullptr, false,
+                     &acx);
 
   fclose(input);
   fclose(output);
@@ -36,9 +36,11 @@ void endProgram(char *name)
 #if HAVE_GETOPT_LONG
     std::cout << "  -o, --origin-code code   the language code to be taken as lang1" << std::endl;
     std::cout << "  -m, --meta-code code     the language code to be taken as lang2" << std::endl;
+    std::cout << "  -j, --jobs               align the translation units on all the cpu cores" << std::endl;
 #else
     std::cout << "  -o code   the language code to be taken as lang1" << std::endl;
     std::cout << "  -m code   the language code to be taken as lang2" << std::endl;
+    std::cout << "  -j        align the translation units on all the cpu cores" << std::endl;
 #endif
   }
   exit(EXIT_FAILURE);
@@ -49,12 +51,9 @@ int main(int argc, char *argv[])
 {
   LtLocale::tryToSetLocale();
 
-  if(argc != 4)
-  {
-    endProgram(argv[0]);
-  }
-
   TMXCompiler c;
+  auto LT_JOBS = std::getenv("LT_JOBS");
+  c.setJobs(LT_JOBS != NULL && LT_JOBS[0] != 'n');
 
 #if HAVE_GETOPT_LONG
   int option_index = 0;
@@ -66,12 +65,13 @@ int main(int argc, char *argv[])
     {
       {"origin-code", required_argument, 0, 'o'},
       {"meta-code", required_argument, 0, 'm'},
+      {"jobs", no_argument, 0, 'j'},
       {0, 0, 0, 0}
     };
 
-    int c_t = getopt_long(argc, argv, "o:m:", long_options, &option_index);
+    int c_t = getopt_long(argc, argv, "o:m:j", long_options, &option_index);
 #else
-    int c_t = getopt(argc, argv, "o:m:");
+    int c_t = getopt(argc, argv, "o:m:j");
 #endif
     if(c_t == -1)
     {
@@ -88,12 +88,21 @@ int main(int argc, char *argv[])
         c.setMetaLanguageCode(to_ustring(optarg));
         break;
 
+      case 'j':
+        c.setJobs(true);
+        break;
+
       default:
         endProgram(argv[0]);
         break;
     }
   }
 
+  if(argc - optind != 3)
+  {
+    endProgram(argv[0]);
+  }
+
   UString opc = to_ustring(argv[argc-3]);
   UString lo = opc.substr(0, opc.find('-'));
   UString lm = opc.substr(opc.find('-')+1);
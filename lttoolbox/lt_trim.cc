@@ -18,15 +18,22 @@
 #include <lttoolbox/file_utils.h>
 #include <lttoolbox/cli.h>
 #include <lttoolbox/lt_locale.h>
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 void
-trim(FILE* file_mono, FILE* file_bi, FILE* file_out, std::set<UString> match_sections)
+trim(FILE* file_mono, FILE* file_bi, FILE* file_out, std::set<UString> match_sections,
+     bool jobs, bool directory)
 {
   Alphabet alph_mono;
   std::set<UChar32> letters_mono;
   std::map<UString, Transducer> trans_mono;
-  readTransducerSet(file_mono, letters_mono, alph_mono, trans_mono);
+  ACXMap acx_mono;
+  readTransducerSet(file_mono, letters_mono, alph_mono, trans_mono, &acx_mono);
   Alphabet alph_bi;
   std::set<UChar32> letters_bi;
   std::map<UString, Transducer> trans_bi;
@@ -64,9 +71,16 @@ trim(FILE* file_mono, FILE* file_bi, FILE* file_out, std::set<UString> match_sec
   std::map<UString, Transducer> trans_trim;
   std::set<UString> sections_unmatched = match_sections; // just used to warn if user asked for a match that never happened
 
+  // The sections are trimmed independently of each other, against
+  // transducers that are only read from now on, so with jobs each one
+  // gets its own thread; the warnings are given afterwards, in order
+  std::vector<Transducer> trimmed_sections(trans_mono.size());
+  std::deque<std::thread> running;
+  unsigned max_running = jobs ? std::max(1u, std::thread::hardware_concurrency()) : 0;
+  size_t i = 0;
   for (auto& it : trans_mono) {
+    Transducer& trimmed = trimmed_sections[i++];
     if (it.second.numberOfTransitions() == 0) {
-      std::cerr << "Warning: section " << it.first << " is empty! Skipping it..." << std::endl;
       continue;
     }
     if (moved_bi_transducers.count(it.first)) {
@@ -75,15 +89,39 @@ trim(FILE* file_mono, FILE* file_bi, FILE* file_out, std::set<UString> match_sec
     Transducer& moved_transducer = moved_bi_transducers.count(it.first)
                                  ? moved_bi_transducers[it.first]
                                  : moved_bi_transducers[union_name];
-    Transducer trimmed = it.second.trim(moved_transducer,
-                                        alph_mono,
-                                        alph_prefix);
+    Transducer& mono = it.second;
+    auto trimSection = [&mono, &trimmed, &moved_transducer, &alph_mono, &alph_prefix]() {
+      trimmed = mono.trim(moved_transducer, alph_mono, alph_prefix);
+      if (!trimmed.hasNoFinals()) {
+        trimmed.minimize();
+      }
+    };
+    if (max_running == 0) {
+      trimSection();
+      continue;
+    }
+    if (running.size() >= max_running) {
+      running.front().join();
+      running.pop_front();
+    }
+    running.emplace_back(trimSection);
+  }
+  for (auto& thread : running) {
+    thread.join();
+  }
+
+  i = 0;
+  for (auto& it : trans_mono) {
+    Transducer& trimmed = trimmed_sections[i++];
+    if (it.second.numberOfTransitions() == 0) {
+      std::cerr << "Warning: section " << it.first << " is empty! Skipping it..." << std::endl;
+      continue;
+    }
     if (trimmed.hasNoFinals()) {
       std::cerr << "Warning: section " << it.first << " had no final state after trimming! Skipping it..." << std::endl;
       continue;
     }
-    trimmed.minimize();
-    trans_trim[it.first] = trimmed;
+    trans_trim[it.first] = std::move(trimmed);
   }
   for (const auto &name : sections_unmatched) {
     std::cerr << "Warning: section " << name << " was not found in both transducers! Skipping if in just one..." << std::endl;
@@ -96,7 +134,8 @@ trim(FILE* file_mono, FILE* file_bi, FILE* file_out, std::set<UString> match_sec
     exit(EXIT_FAILURE);
   }
 
-  writeTransducerSet(file_out, letters_mono, alph_mono, trans_trim);
+  writeTransducerSet(file_out, letters_mono, alph_mono, trans_trim, false,
+                     nullptr, directory, &acx_mono);
 }
 
 
@@ -108,6 +147,8 @@ int main(int argc, char *argv[])
   cli.add_file_arg("bidix_bin_file");
   cli.add_file_arg("trimmed_bin_file");
   cli.add_str_arg('s', "match-section", "A section with this name (id@type) will only be trimmed against a section with the same name. This argument may be used multiple times.", "section_name");
+  cli.add_bool_arg('j', "jobs", "trim the sections on all the cpu cores");
+  cli.add_bool_arg('D', "directory", "write a directory of the sections that readers can seek through");
   cli.parse_args(argc, argv);
 
   auto strs = cli.get_strs();
@@ -121,7 +162,11 @@ int main(int argc, char *argv[])
   FILE* bidix = openInBinFile(cli.get_files()[1]);
   FILE* output = openOutBinFile(cli.get_files()[2]);
 
-  trim(analyser, bidix, output, match_sections);
+  auto LT_JOBS = std::getenv("LT_JOBS");
+  bool jobs = cli.get_bools()["jobs"] || (LT_JOBS != NULL && LT_JOBS[0] != 'n');
+
+  trim(analyser, bidix, output, match_sections, jobs,
+       cli.get_bools()["directory"]);
 
   fclose(analyser);
   fclose(bidix);
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lttoolbox/match_table.h>
+
+#include <algorithm>
+
+MatchTable::MatchTable(Transducer const &t, std::map<int, int> const &final_type) :
+columns(0)
+{
+  int const node_count = t.transitions.empty() ? 1 : std::max(t.transitions.rbegin()->first, t.initial) + 1;
+  first.push_back(0);
+  int max_char = -1;
+  int max_tag = 0;
+  for(int node = 0; node < node_count; node++)
+  {
+    auto it = t.transitions.find(node);
+    if(it != t.transitions.end())
+    {
+      for(auto &it2 : it->second)
+      {
+        arcs.push_back({it2.first, it2.second.first});
+        max_char = std::max(max_char, it2.first);
+        max_tag = std::max(max_tag, -it2.first);
+      }
+    }
+    first.push_back(arcs.size());
+  }
+
+  char_column.assign(max_char + 1, -1);
+  tag_column.assign(max_tag + 1, -1);
+  for(auto &it : arcs)
+  {
+    int &col = (it.first >= 0 ? char_column[it.first] : tag_column[-it.first]);
+    if(col == -1)
+    {
+      col = columns++;
+    }
+  }
+
+  node_class.assign(node_count, -1);
+  for(auto &it : final_type)
+  {
+    node_class[it.first] = it.second;
+  }
+
+  classes_first.push_back(0);
+  number(std::vector<int>());
+  number(std::vector<int>(1, t.initial));
+}
+
+int
+MatchTable::column(int const symbol) const
+{
+  if(symbol >= 0)
+  {
+    return symbol < static_cast<int>(char_column.size()) ? char_column[symbol] : -1;
+  }
+  return -symbol < static_cast<int>(tag_column.size()) ? tag_column[-symbol] : -1;
+}
+
+int
+MatchTable::number(std::vector<int> &&state_nodes)
+{
+  auto it = numbers.find(state_nodes);
+  if(it != numbers.end())
+  {
+    return it->second;
+  }
+  int const state = nodes.size();
+  for(auto node : state_nodes)
+  {
+    if(node_class[node] != -1)
+    {
+      classes.push_back(node_class[node]);
+    }
+  }
+  std::sort(classes.begin() + classes_first.back(), classes.end());
+  classes.erase(std::unique(classes.begin() + classes_first.back(), classes.end()),
+                classes.end());
+  classes_first.push_back(classes.size());
+  table.resize(table.size() + columns, -1);
+  numbers.insert({state_nodes, state});
+  nodes.push_back(std::move(state_nodes));
+  return state;
+}
+
+int
+MatchTable::getInitial() const
+{
+  return 1;
+}
+
+int
+MatchTable::size(int const state) const
+{
+  return nodes[state].size();
+}
+
+int
+MatchTable::step(int const state, int const input)
+{
+  int const col = column(input);
+  if(col == -1)
+  {
+    return dead;
+  }
+  int &next = table[state * columns + col];
+  if(next == -1)
+  {
+    std::vector<int> targets;
+    for(auto node : nodes[state])
+    {
+      auto begin = arcs.begin() + first[node];
+      auto end = arcs.begin() + first[node + 1];
+      for(auto it = std::lower_bound(begin, end, std::make_pair(input, -1));
+          it != end && it->first == input; it++)
+      {
+        targets.push_back(it->second);
+      }
+    }
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+    // numbering may grow the table, so next can't be written through
+    int const reached = number(std::move(targets));
+    table[state * columns + col] = reached;
+    return reached;
+  }
+  return next;
+}
+
+int
+MatchTable::step(int const state, int const input, int const alt)
+{
+  int const a = step(state, input);
+  int const b = step(state, alt);
+  if(a == b || b == dead)
+  {
+    return a;
+  }
+  if(a == dead)
+  {
+    return b;
+  }
+  auto key = std::make_pair(std::min(a, b), std::max(a, b));
+  auto it = unions.find(key);
+  if(it != unions.end())
+  {
+    return it->second;
+  }
+  std::vector<int> both;
+  std::set_union(nodes[a].begin(), nodes[a].end(),
+                 nodes[b].begin(), nodes[b].end(), std::back_inserter(both));
+  int const reached = number(std::move(both));
+  unions[key] = reached;
+  return reached;
+}
+
+int
+MatchTable::classifyFinals(int const state) const
+{
+  return classes_first[state] == classes_first[state + 1] ? -1 : classes[classes_first[state]];
+}
+
+int
+MatchTable::classifyFinals(int const state, std::set<int> const &banned_rules) const
+{
+  for(unsigned int i = classes_first[state]; i < classes_first[state + 1]; i++)
+  {
+    if(banned_rules.find(classes[i]) == banned_rules.end())
+    {
+      return classes[i];
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MATCHTABLE_
+#define _MATCHTABLE_
+
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <lttoolbox/transducer.h>
+
+/**
+ * Matcher compiled from the transducer of a PatternList, for matching
+ * with no MatchState: the sets of nodes a MatchState can be in are
+ * numbered as they are reached, each with a row of transitions in a
+ * dense table over the symbols of the transducer and the final class
+ * it classifies as.  A state is one of these numbers, and a step is a
+ * lookup in the table once its row has been filled in
+ */
+class MatchTable
+{
+private:
+  /**
+   * The transitions of the nodes of the transducer, sorted by symbol,
+   * those of node n from first[n] to first[n+1]
+   */
+  std::vector<unsigned int> first;
+  std::vector<std::pair<int, int>> arcs;
+
+  /**
+   * The final class of each node, -1 if it is not final
+   */
+  std::vector<int> node_class;
+
+  /**
+   * The columns of the table for the symbols of the transducer, the
+   * non-negative ones and the negative ones (tags), -1 for those it
+   * doesn't have
+   */
+  std::vector<int> char_column;
+  std::vector<int> tag_column;
+  int columns;
+
+  /**
+   * The nodes of each state, sorted, and the states by their nodes
+   */
+  std::vector<std::vector<int>> nodes;
+  std::map<std::vector<int>, int> numbers;
+
+  /**
+   * The state reached from each state by each column, -1 until the
+   * first time it is asked for
+   */
+  std::vector<int> table;
+
+  /**
+   * The classes of the final nodes of each state, sorted, those of
+   * state s from classes_first[s] to classes_first[s+1]
+   */
+  std::vector<unsigned int> classes_first;
+  std::vector<int> classes;
+
+  /**
+   * The states made of the nodes of two others, by those two
+   */
+  std::map<std::pair<int, int>, int> unions;
+
+  int column(int const symbol) const;
+
+  /**
+   * The number of the state with these nodes, numbering it if it is new
+   */
+  int number(std::vector<int> &&state_nodes);
+
+public:
+  /**
+   * The state with no nodes, which every step leads back to
+   */
+  static int const dead = 0;
+
+  /**
+   * From transducer constructor
+   * @param t the transducer
+   * @param final_type the final types
+   */
+  MatchTable(Transducer const &t, std::map<int, int> const &final_type);
+
+  /**
+   * The state with just the initial node
+   */
+  int getInitial() const;
+
+  /**
+   * Number of alive nodes in a state, as MatchState::size() but
+   * counting each one once
+   */
+  int size(int const state) const;
+
+  /**
+   * The state reached from state with input, as MatchState::step()
+   */
+  int step(int const state, int const input);
+
+  /**
+   * The state reached from state with input or alt, as
+   * MatchState::step()
+   */
+  int step(int const state, int const input, int const alt);
+
+  /**
+   * The lowest final class of the nodes of state, -1 if there is none,
+   * as MatchState::classifyFinals()
+   */
+  int classifyFinals(int const state) const;
+
+  int classifyFinals(int const state, std::set<int> const &banned_rules) const;
+};
+
+#endif
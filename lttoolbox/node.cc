@@ -16,7 +16,15 @@
  */
 #include <lttoolbox/node.h>
 
+#include <algorithm>
+#include <unicode/uchar.h>
+
 Node::Node()
+: offset(0),
+  size(0),
+  owned(0),
+  indexed(0),
+  caseless(0)
 {
 }
 
@@ -26,6 +34,11 @@ Node::~Node()
 }
 
 Node::Node(Node const &n)
+: offset(0),
+  size(0),
+  owned(0),
+  indexed(0),
+  caseless(0)
 {
   copy(n);
 }
@@ -35,8 +48,15 @@ Node::operator =(Node const &n)
 {
   if(this != &n)
   {
+    std::vector<Transition> trans;
+    n.getTransitions(trans);
     destroy();
-    copy(n);
+    if(!trans.empty())
+    {
+      char *block = new char[blockSize(trans)];
+      build(trans, block);
+      owned = 1;
+    }
   }
   return *this;
 }
@@ -44,41 +64,142 @@ Node::operator =(Node const &n)
 void
 Node::copy(Node const &n)
 {
-  transitions = n.transitions;
+  std::vector<Transition> trans;
+  n.getTransitions(trans);
+  if(!trans.empty())
+  {
+    char *block = new char[blockSize(trans)];
+    build(trans, block);
+    owned = 1;
+  }
 }
 
 void
 Node::destroy()
 {
+  if(owned)
+  {
+    delete[] reinterpret_cast<char *>(const_cast<int32_t *>(inputs()));
+    owned = 0;
+  }
+  offset = 0;
+  size = 0;
+  indexed = 0;
+  caseless = 0;
 }
 
-void
-Node::addTransition(int const i, int const o, Node * const d, double const wt)
+Node::Index
+Node::indexRange(std::vector<Transition> const &trans)
 {
-  Dest &aux = transitions[i];
-  aux.size++;
-  int *out_tag = new int[aux.size];
-  Node **dest = new Node*[aux.size];
-  double *out_weight = new double[aux.size];
+  Index best{0, 0};
+  if(trans.size() < index_min_chars)
+  {
+    return best;
+  }
+  std::vector<int32_t> chars;
+  for(auto const &it : trans)
+  {
+    if(it.input > 0)
+    {
+      chars.push_back(it.input);
+    }
+  }
+  std::sort(chars.begin(), chars.end());
+  chars.erase(std::unique(chars.begin(), chars.end()), chars.end());
+  if(chars.size() < index_min_chars)
+  {
+    return best;
+  }
+  // every window of characters no wider than the spread allows, keeping
+  // the one covering the most
+  uint32_t const max_chars = index_max_spread * chars.size();
+  size_t covered = 0;
+  for(size_t i = 0, j = 0; i < chars.size(); i++)
+  {
+    while(j < chars.size() &&
+          static_cast<uint32_t>(chars[j] - chars[i]) < max_chars)
+    {
+      j++;
+    }
+    if(j - i > covered)
+    {
+      covered = j - i;
+      best = {chars[i], static_cast<uint32_t>(chars[j - 1] - chars[i] + 1)};
+    }
+  }
+  if(covered < index_min_chars)
+  {
+    best = {0, 0};
+  }
+  return best;
+}
 
-  for(int i = 0; i<aux.size-1; i++)
+void
+Node::build(std::vector<Transition> &trans, char *block)
+{
+  std::stable_sort(trans.begin(), trans.end(),
+                   [](Transition const &a, Transition const &b) {
+                     return a.input < b.input;
+                   });
+  size = trans.size();
+  caseless = 1;
+  offset = reinterpret_cast<intptr_t>(block) - reinterpret_cast<intptr_t>(this);
+  int32_t *in = reinterpret_cast<int32_t *>(block);
+  Dest *out = reinterpret_cast<Dest *>(block + inputsSize(size));
+  for(uint32_t i = 0; i < size; i++)
+  {
+    in[i] = trans[i].input;
+    if(in[i] > 0 && static_cast<int32_t>(u_tolower(in[i])) != in[i])
+    {
+      caseless = 0;
+    }
+    out[i].dest = reinterpret_cast<intptr_t>(trans[i].dest) - reinterpret_cast<intptr_t>(this);
+    out[i].out_weight = trans[i].weight;
+    out[i].out_tag = trans[i].output;
+  }
+  for(uint32_t i = size; i * sizeof(int32_t) < inputsSize(size); i++)
+  {
+    in[i] = 0;
+  }
+  Index const range = indexRange(trans);
+  indexed = (range.chars != 0);
+  if(indexed)
   {
-    out_tag[i] = aux.out_tag[i];
-    dest[i] = aux.dest[i];
-    out_weight[i] = aux.out_weight[i];
+    Index *index = reinterpret_cast<Index *>(out + size);
+    *index = range;
+    uint32_t *entries = reinterpret_cast<uint32_t *>(index + 1);
+    std::fill(entries, entries + inputsSize(range.chars) / sizeof(uint32_t), 0);
+    for(uint32_t i = size; i-- > 0;)
+    {
+      uint32_t const c = static_cast<uint32_t>(in[i]) - static_cast<uint32_t>(range.first_char);
+      if(in[i] > 0 && c < range.chars)
+      {
+        entries[c] = i + 1;
+      }
+    }
   }
+}
 
-  if(aux.size > 1)
+void
+Node::getTransitions(std::vector<Transition> &trans) const
+{
+  trans.clear();
+  int32_t const *in = inputs();
+  Dest const *out = dests();
+  for(uint32_t i = 0; i < size; i++)
   {
-    delete[] aux.out_tag;
-    delete[] aux.dest;
-    delete[] aux.out_weight;
+    trans.push_back({in[i], out[i].out_tag, target(out[i]), out[i].out_weight});
   }
+}
 
-  out_tag[aux.size-1] = o;
-  dest[aux.size-1] = d;
-  out_weight[aux.size-1] = wt;
-  aux.out_tag = out_tag;
-  aux.dest = dest;
-  aux.out_weight = out_weight;
+void
+Node::addTransition(int const i, int const o, Node * const d, double const wt)
+{
+  std::vector<Transition> trans;
+  getTransitions(trans);
+  trans.push_back({i, o, d, wt});
+  destroy();
+  char *block = new char[blockSize(trans)];
+  build(trans, block);
+  owned = 1;
 }
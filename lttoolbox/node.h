@@ -18,106 +18,282 @@
 #ifndef _NODE_
 #define _NODE_
 
-#include <cstdlib>
-#include <list>
-#include <map>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 class State;
 class Node;
+class TransExe;
 
+/**
+ * Output side of a transition in the flat runtime layout. The
+ * destination is stored as a byte offset relative to the source node,
+ * so that a block of nodes and transitions can be copied or mapped
+ * anywhere in memory without fixing up pointers.
+ */
+struct Dest
+{
+  int64_t dest;
+  double out_weight;
+  int32_t out_tag;
+};
 
-class Dest
+/**
+ * Node of a TransExe. A node only stores where its transitions are:
+ * the sorted input symbols of all of them (repeated once per
+ * transition), padded to 8 bytes and followed by one Dest per input
+ * symbol, in the same order.  A node with many transitions on
+ * characters is also followed by an Index of them.
+ */
+class Node
 {
 private:
-  int size;
-  int *out_tag;
-  Node **dest;
-  double *out_weight;
-
+  friend class DetState;
+  friend class EpsilonTable;
   friend class State;
-  friend class Node;
+  friend class TransExe;
+
+  /**
+   * Byte offset from this node to the first input symbol
+   */
+  int64_t offset;
+
+  /**
+   * Number of outgoing transitions
+   */
+  uint32_t size;
+
+  /**
+   * True if the transitions were allocated by addTransition() and have
+   * to be freed with the node
+   */
+  uint8_t owned;
+
+  /**
+   * True if the Dests are followed by an Index.  Images written before
+   * there were indexes have 0 here, as the high byte of owned.
+   */
+  uint8_t indexed;
 
-  void copy(Dest const &d)
+  /**
+   * True if no transition is on a symbol that has a lowercase, so that
+   * looking an uppercase letter up case insensitively only has to find
+   * its lowercase.  False when unknown, as in images written before the
+   * flag was set.
+   */
+  uint16_t caseless;
+
+  struct Transition
   {
-    destroy();
-    size = d.size;
-    out_tag = new int[size];
-    dest = new Node*[size];
-    out_weight = new double[size];
-  }
+    int32_t input;
+    int32_t output;
+    Node *dest;
+    double weight;
+  };
 
-  void destroy()
+  /**
+   * Table giving, for every character of a range, the first transition
+   * on it, so that the nodes most transitions leave from (the initial
+   * ones, those looping on any character) look a character up in one
+   * step instead of a binary search over all of their inputs.  The
+   * header is followed by chars entries, one more than the index of the
+   * transition, 0 for characters with none, padded to 8 bytes.
+   */
+  struct Index
   {
-    if(size != 0)
+    int32_t first_char;
+    uint32_t chars;
+  };
+
+  /**
+   * Fewest distinct characters a node is indexed for
+   */
+  static constexpr uint32_t index_min_chars = 24;
+
+  /**
+   * Most entries of an index per distinct character it covers
+   */
+  static constexpr uint32_t index_max_spread = 4;
+
+  /**
+   * Fewest and most transitions of a node whose inputs are searched by
+   * comparing the input with all of them, a vector of them at a time,
+   * rather than by a binary search: up to a hundred or so inputs, the
+   * mispredicted branches of the search cost more than the comparisons
+   */
+  static constexpr uint32_t scan_min_inputs = 4;
+  static constexpr uint32_t scan_max_inputs = 128;
+
+  /**
+   * Number of the n sorted keys that are less than input
+   */
+  static uint32_t countLess(int32_t const *keys, uint32_t n, int32_t input)
+  {
+    uint32_t i = 0;
+    uint32_t less = 0;
+#if defined(__SSE2__)
+    __m128i const needle = _mm_set1_epi32(input);
+    __m128i sum = _mm_setzero_si128();
+    for(; i + 4 <= n; i += 4)
     {
-      size = 0;
-      if(out_tag)
-      {
-        delete[] out_tag;
-      }
-      if(dest)
-      {
-        delete[] dest;
-      }
-      if(out_weight)
-      {
-        delete[] out_weight;
-      }
+      __m128i const k = _mm_loadu_si128(reinterpret_cast<__m128i const *>(keys + i));
+      sum = _mm_sub_epi32(sum, _mm_cmplt_epi32(k, needle));
     }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    less = _mm_cvtsi128_si32(sum);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    int32x4_t const needle = vdupq_n_s32(input);
+    uint32x4_t sum = vdupq_n_u32(0);
+    for(; i + 4 <= n; i += 4)
+    {
+      sum = vsubq_u32(sum, vcltq_s32(vld1q_s32(keys + i), needle));
+    }
+    less = vaddvq_u32(sum);
+#endif
+    for(; i < n; i++)
+    {
+      less += (keys[i] < input);
+    }
+    return less;
   }
 
-  void init()
+  static size_t inputsSize(uint32_t n)
   {
-    size = 0;
-    out_tag = NULL;
-    dest = NULL;
-    out_weight = NULL;
+    return (n * sizeof(int32_t) + 7) & ~static_cast<size_t>(7);
   }
 
-public:
-  Dest()
+  static size_t indexSize(uint32_t chars)
+  {
+    return chars == 0 ? 0 : sizeof(Index) + inputsSize(chars);
+  }
+
+  /**
+   * The range of characters to index for the transitions trans, chars
+   * being 0 if they are not worth an index: the one with the most
+   * characters of trans among those spread little enough
+   */
+  static Index indexRange(std::vector<Transition> const &trans);
+
+  /**
+   * Size in bytes of the transition block of a node with the
+   * transitions trans
+   */
+  static size_t blockSize(std::vector<Transition> const &trans)
+  {
+    return inputsSize(trans.size()) + trans.size() * sizeof(Dest) +
+           indexSize(indexRange(trans).chars);
+  }
+
+  int32_t const * inputs() const
   {
-    init();
+    return reinterpret_cast<int32_t const *>(reinterpret_cast<intptr_t>(this) + offset);
   }
 
-  ~Dest()
+  Dest const * dests() const
   {
-    destroy();
+    return reinterpret_cast<Dest const *>(reinterpret_cast<intptr_t>(inputs()) + inputsSize(size));
   }
 
-  Dest(Dest const &d)
+  Node * target(Dest const &d) const
   {
-    init();
-    copy(d);
+    return reinterpret_cast<Node *>(reinterpret_cast<intptr_t>(this) + d.dest);
   }
 
-  Dest & operator=(Dest const &d)
+  /**
+   * Locate the transitions on an input symbol
+   * @param input the input symbol
+   * @param count number of transitions found
+   * @return index of the first transition found
+   */
+  uint32_t find(int32_t input, uint32_t &count) const
   {
-    if(this != &d)
+    int32_t const *base = inputs();
+    if(indexed)
+    {
+      Index const *index = reinterpret_cast<Index const *>(dests() + size);
+      uint32_t const c = static_cast<uint32_t>(input) - static_cast<uint32_t>(index->first_char);
+      if(c < index->chars)
+      {
+        uint32_t const entry = reinterpret_cast<uint32_t const *>(index + 1)[c];
+        if(entry == 0)
+        {
+          count = 0;
+          return 0;
+        }
+        int32_t const *last = base + entry;
+        int32_t const *end = base + size;
+        while(last != end && *last == input)
+        {
+          last++;
+        }
+        count = last - (base + entry - 1);
+        return entry - 1;
+      }
+    }
+    int32_t const *first = base;
+    uint32_t n = size;
+    if(n == 0)
     {
-      destroy();
-      copy(d);
+      count = 0;
+      return 0;
     }
-    return *this;
+    if(n >= scan_min_inputs && n <= scan_max_inputs)
+    {
+      first += countLess(base, n, input);
+    }
+    else
+    {
+      while(n > 1)
+      {
+        uint32_t half = n / 2;
+        first = (first[half - 1] < input) ? first + half : first;
+        n -= half;
+      }
+      first += (*first < input);
+    }
+    int32_t const *last = first;
+    int32_t const *end = base + size;
+    while(last != end && *last == input)
+    {
+      last++;
+    }
+    count = last - first;
+    return first - base;
   }
-};
-
 
+  /**
+   * Locate the transitions on an uppercase letter that is looked up
+   * together with its lowercase, as find() does
+   */
+  uint32_t findUpper(int32_t input, uint32_t &count) const
+  {
+    if(caseless)
+    {
+      count = 0;
+      return 0;
+    }
+    return find(input, count);
+  }
 
-/**
- * Node class of TransExe.  State is a friend class since the
- * algorithms are implemented in State
- */
-class Node
-{
-private:
-  friend class State;
+  /**
+   * Lay out the transitions of this node in a block of memory, sorting
+   * them by input symbol but keeping the order of transitions with the
+   * same input. The block must be blockSize(trans) bytes long.
+   */
+  void build(std::vector<Transition> &trans, char *block);
 
   /**
-   * The outgoing transitions of this node.
-   * Schema: (input symbol, (output symbol, destination, weight))
+   * All the transitions of this node
    */
-  std::map<int, Dest> transitions;
+  void getTransitions(std::vector<Transition> &trans) const;
 
   /**
    * Copy method
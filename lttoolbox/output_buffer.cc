@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lttoolbox/output_buffer.h>
+#include <lttoolbox/block_queue.h>
+
+#include <unicode/ucnv.h>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+// pieces written ahead of the writer thread
+constexpr size_t pieces_ahead = 4;
+
+bool
+writesUtf8(UFILE* output)
+{
+  const char* codepage = u_fgetcodepage(output);
+  return codepage != nullptr && ucnv_compareNames(codepage, "UTF-8") == 0;
+}
+
+// append the UTF-8 encoding of text to bytes, writing U+FFFD for a lone
+// surrogate as ICU's converter does
+void
+appendUtf8(std::string& bytes, UString const &text)
+{
+  size_t n = bytes.size();
+  // at most three bytes for each code unit
+  bytes.resize(n + 3 * text.size());
+  char* out = &bytes[0];
+  const UChar* p = text.data();
+  const UChar* end = p + text.size();
+  while (p < end) {
+    // eight code units at a time while they are all ASCII
+    while (end - p >= 8) {
+      uint64_t a, b;
+      memcpy(&a, p, 8);
+      memcpy(&b, p + 4, 8);
+      if (((a | b) & 0xFF80FF80FF80FF80ULL) != 0) {
+        break;
+      }
+      for (int i = 0; i < 8; i++) {
+        out[n++] = static_cast<char>(p[i]);
+      }
+      p += 8;
+    }
+    if (p == end) {
+      break;
+    }
+    UChar32 c = *p++;
+    if (c < 0x80) {
+      out[n++] = static_cast<char>(c);
+      continue;
+    }
+    if (U16_IS_SURROGATE(c)) {
+      if (U16_IS_SURROGATE_LEAD(c) && p < end && U16_IS_TRAIL(*p)) {
+        c = U16_GET_SUPPLEMENTARY(c, *p++);
+      } else {
+        c = 0xFFFD;
+      }
+    }
+    if (c < 0x800) {
+      out[n++] = static_cast<char>(0xC0 | (c >> 6));
+    } else {
+      if (c < 0x10000) {
+        out[n++] = static_cast<char>(0xE0 | (c >> 12));
+      } else {
+        out[n++] = static_cast<char>(0xF0 | (c >> 18));
+        out[n++] = static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+      }
+      out[n++] = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+    }
+    out[n++] = static_cast<char>(0x80 | (c & 0x3F));
+  }
+  bytes.resize(n);
+}
+
+}
+
+struct OutputBuffer::Writer
+{
+  struct Piece
+  {
+    UString text;
+    bool flush = false;
+
+    void clear()
+    {
+      text.clear();
+      flush = false;
+    }
+  };
+
+  BlockQueue<Piece> queue{pieces_ahead};
+  std::thread thread;
+  // the next piece to send, filled by swapping it with buffer
+  Piece piece;
+};
+
+OutputBuffer::OutputBuffer(UFILE* output, bool threaded)
+  : output(output)
+{
+  buffer.reserve(buffer_size);
+  if (writesUtf8(output)) {
+    utf8_file = u_fgetfile(output);
+  }
+  if (threaded) {
+    writer.reset(new Writer);
+    writer->thread = std::thread([output](Writer* w, FILE* utf8_file) {
+      Writer::Piece piece;
+      std::string bytes;
+      while (w->queue.pop(piece)) {
+        if (!piece.text.empty()) {
+          writeText(output, utf8_file, piece.text, bytes);
+        }
+        if (piece.flush) {
+          u_fflush(output);
+        }
+        w->queue.recycle(piece);
+      }
+    }, writer.get(), utf8_file);
+  }
+}
+
+OutputBuffer::~OutputBuffer()
+{
+  drain(false, true);
+  if (writer) {
+    writer->queue.close();
+    writer->thread.join();
+  }
+}
+
+void
+OutputBuffer::drain(bool flush, bool last)
+{
+  // put() may have ended the buffer half way through a surrogate pair
+  UChar lead = 0;
+  if (utf8_file != nullptr && !flush && !last && !buffer.empty() &&
+      U16_IS_LEAD(buffer.back())) {
+    lead = buffer.back();
+    buffer.pop_back();
+  }
+  if (writer) {
+    if (buffer.empty() && !flush) {
+      return;
+    }
+    Writer::Piece& piece = writer->piece;
+    piece.text.swap(buffer);
+    piece.flush = flush;
+    writer->queue.push(piece);
+    // push() left a spare piece in its place, whose storage is reused
+    buffer.swap(piece.text);
+    buffer.clear();
+    buffer.reserve(buffer_size);
+  } else if (!buffer.empty()) {
+    writeText(output, utf8_file, buffer, bytes);
+    buffer.clear();
+  }
+  if (lead != 0) {
+    buffer += lead;
+  }
+  if (flush && !writer) {
+    u_fflush(output);
+  }
+}
+
+void
+OutputBuffer::writeText(UFILE* output, FILE* utf8_file, UString const &text,
+                        std::string &bytes)
+{
+  if (utf8_file == nullptr) {
+    u_file_write(text.data(), text.size(), output);
+    return;
+  }
+  // whatever else went to output has to come out first
+  u_fflush(output);
+  bytes.clear();
+  appendUtf8(bytes, text);
+  fwrite(bytes.data(), 1, bytes.size(), utf8_file);
+}
+
+void
+OutputBuffer::flush()
+{
+  drain(true);
+}
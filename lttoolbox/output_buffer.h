@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LT_OUTPUT_BUFFER_H_
+#define _LT_OUTPUT_BUFFER_H_
+
+#include <lttoolbox/ustring.h>
+#include <unicode/ustdio.h>
+#include <unicode/utf16.h>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+/**
+ * Collects UTF-16 output and hands it to a UFILE in large pieces, so it
+ * is converted to the output encoding once per piece instead of once per
+ * character.  When the UFILE writes UTF-8, the pieces are encoded here
+ * and written to its FILE directly, without going through its converter.
+ * Whatever is buffered is written when the object is destroyed; flush()
+ * also flushes the UFILE.  Optionally the pieces are converted and written
+ * by a thread of its own, so that the processing does not wait for the
+ * output.
+ */
+class OutputBuffer
+{
+private:
+  UFILE* output;
+  UString buffer;
+
+  /**
+   * The FILE of output if it writes UTF-8, or else nullptr
+   */
+  FILE* utf8_file = nullptr;
+
+  /**
+   * Scratch space for the UTF-8 encoding of buffer
+   */
+  std::string bytes;
+
+  /**
+   * Number of code units collected before they are written
+   */
+  static constexpr size_t buffer_size = 1 << 15;
+
+  /**
+   * The thread writing the pieces, if any, and the queue of those on
+   * their way to it
+   */
+  struct Writer;
+  std::unique_ptr<Writer> writer;
+
+  /**
+   * Write the buffered output to the UFILE, or hand it to the writer.
+   * When encoding UTF-8 here, a lead surrogate at the end is kept for
+   * the next piece, unless the output is flushed or finished.
+   * @param flush flush the UFILE afterwards
+   * @param last nothing is written after this
+   */
+  void drain(bool flush = false, bool last = false);
+
+  /**
+   * Convert text and write it, encoding it here when output is UTF-8
+   * @param bytes scratch space for the encoded text
+   */
+  static void writeText(UFILE* output, FILE* utf8_file,
+                        UString const &text, std::string &bytes);
+public:
+  /**
+   * @param output where to write
+   * @param threaded convert and write the output on a thread of its own;
+   *                 the UFILE must not be used otherwise until this
+   *                 object is destroyed
+   */
+  OutputBuffer(UFILE* output, bool threaded = false);
+  ~OutputBuffer();
+  OutputBuffer(OutputBuffer const &) = delete;
+  OutputBuffer & operator =(OutputBuffer const &) = delete;
+
+  /**
+   * Write a character; negative values, the symbols of tags, are dropped
+   * as u_fputc drops them
+   */
+  void put(UChar32 c)
+  {
+    if (c < 0) {
+      return;
+    }
+    if (c <= 0xFFFF) {
+      buffer += static_cast<UChar>(c);
+    } else {
+      buffer += U16_LEAD(c);
+      buffer += U16_TRAIL(c);
+    }
+    if (buffer.size() >= buffer_size) {
+      drain();
+    }
+  }
+
+  void write(UStringView str)
+  {
+    buffer.append(str);
+    if (buffer.size() >= buffer_size) {
+      drain();
+    }
+  }
+
+  /**
+   * Write the buffered output and flush the UFILE
+   */
+  void flush();
+};
+
+#endif
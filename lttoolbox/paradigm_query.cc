@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#include <lttoolbox/paradigm_query.h>
+#include <lttoolbox/file_utils.h>
+#include <lttoolbox/string_utils.h>
+#include <lttoolbox/symbol_iter.h>
+
+#include <algorithm>
+#include <iterator>
+
+void
+ParadigmQuery::read(FILE* input, bool analyser, std::set<UString> const &exclude)
+{
+  readTransducerSet(input, letters, alphabet, sections);
+
+  alphabet.includeSymbol(u"<*>");
+  for(int32_t i = 1; i <= alphabet.size(); i++)
+  {
+    if(!exclude.empty())
+    {
+      UString t;
+      alphabet.getSymbol(t, -i);
+      if(exclude.find(t) != exclude.end())
+      {
+        continue;
+      }
+    }
+    tags.insert(-i);
+  }
+
+  if(!analyser)
+  {
+    for(auto &it : sections)
+    {
+      it.second.invert(alphabet);
+    }
+  }
+}
+
+sorted_vector<int32_t>
+ParadigmQuery::splitTags(UStringView sym, int prefix, UChar32 sep)
+{
+  sorted_vector<int32_t> ret;
+  auto names = StringUtils::split_escaped(sym.substr(prefix+1, sym.size()-prefix-2), sep);
+  for(auto &tg : names)
+  {
+    UString tag;
+    tag += '<';
+    tag += tg;
+    tag += '>';
+    if(alphabet.isSymbolDefined(tag))
+    {
+      ret.insert(alphabet(tag));
+    }
+  }
+  return ret;
+}
+
+Transducer
+ParadigmQuery::compile(UStringView pattern)
+{
+  int32_t any_char = static_cast<int32_t>('*');
+  int32_t any_tag = alphabet(u"<*>");
+  Transducer other;
+  int state = other.getInitial();
+  for(auto sym : symbol_iter(pattern))
+  {
+    int32_t it = (sym.size() == 1 ? sym[0] : alphabet(sym));
+    if(it == any_char)
+    {
+      state = other.insertNewSingleTransduction(0, state);
+      for(auto &c : letters)
+      {
+        other.linkStates(state, state, alphabet(c, c));
+      }
+    }
+    else if(it == any_tag)
+    {
+      state = other.insertNewSingleTransduction(0, state);
+      for(auto &t : tags)
+      {
+        other.linkStates(state, state, alphabet(t, t));
+      }
+    }
+    else if(it == 0 && StringUtils::startswith(sym, "<*|"_u))
+    {
+      auto or_tags = splitTags(sym, 2, '|');
+      state = other.insertNewSingleTransduction(0, state);
+      for(auto &t : or_tags)
+      {
+        other.linkStates(state, state, alphabet(t, t));
+      }
+    }
+    else if(it == 0 && StringUtils::startswith(sym, "<*"_u))
+    {
+      auto del_tags = splitTags(sym, 1, '-');
+      state = other.insertNewSingleTransduction(0, state);
+      for(auto &t : tags)
+      {
+        if(del_tags.find(t) == del_tags.end())
+        {
+          other.linkStates(state, state, alphabet(t, t));
+        }
+      }
+    }
+    else if(it == 0 && StringUtils::startswith(sym, "<|"_u))
+    {
+      auto or_tags = splitTags(sym, 1, '|');
+      auto old_state = state;
+      for(auto &t : or_tags)
+      {
+        if(old_state == state)
+        {
+          state = other.insertNewSingleTransduction(alphabet(t, t), state);
+        }
+        else
+        {
+          other.linkStates(old_state, state, alphabet(t, t));
+        }
+      }
+    }
+    else
+    {
+      state = other.insertNewSingleTransduction(alphabet(it, it), state);
+    }
+  }
+  other.setFinal(state);
+  return other;
+}
+
+ParadigmQuery::Paths
+ParadigmQuery::query(UStringView pattern, size_t limit)
+{
+  return Paths(*this, compile(pattern), 0, sections.size(), limit);
+}
+
+ParadigmQuery::Paths::Paths(ParadigmQuery &query, Transducer const &pattern,
+                            size_t first, size_t last, size_t limit) :
+alphabet(&query.alphabet),
+pattern(pattern),
+section(std::next(query.sections.begin(), first)),
+last(std::next(query.sections.begin(), last)),
+limit(limit)
+{
+}
+
+bool
+ParadigmQuery::Paths::enter(int state, size_t l_size, size_t r_size, bool marked)
+{
+  auto &arcs = matched->getTransitions()[state];
+  path.push_back({state, arcs.begin(), arcs.end(), l_size, r_size, marked});
+  return matched->isFinal(state) && !l.empty() && !r.empty();
+}
+
+bool
+ParadigmQuery::Paths::next()
+{
+  if(limit != 0 && found == limit)
+  {
+    return false;
+  }
+  Alphabet const &alpha = *alphabet;
+  while(true)
+  {
+    if(path.empty())
+    {
+      if(section == last)
+      {
+        return false;
+      }
+      matched.reset(new Transducer(section->second.trim(pattern, alpha, alpha)));
+      section++;
+      if(matched->getFinals().empty())
+      {
+        continue;
+      }
+      l.clear();
+      r.clear();
+      on_path.clear();
+      if(enter(matched->getInitial(), 0, 0, false))
+      {
+        found++;
+        return true;
+      }
+      continue;
+    }
+
+    Step &top = path.back();
+    if(top.next == top.end)
+    {
+      l.resize(top.l_size);
+      r.resize(top.r_size);
+      if(top.marked)
+      {
+        on_path[path[path.size() - 2].state] = false;
+      }
+      path.pop_back();
+      continue;
+    }
+    int tag = top.next->first;
+    int target = top.next->second.first;
+    top.next++;
+    size_t needed = std::max(top.state, target) + 1;
+    if(on_path.size() < needed)
+    {
+      on_path.resize(needed);
+    }
+    if(on_path[target])
+    {
+      continue;
+    }
+    bool marked = !on_path[top.state];
+    on_path[top.state] = true;
+    size_t l_size = l.size();
+    size_t r_size = r.size();
+    auto pr = alpha.decode(tag);
+    alpha.getSymbol(l, pr.first);
+    alpha.getSymbol(r, pr.second);
+    if(enter(target, l_size, r_size, marked))
+    {
+      found++;
+      return true;
+    }
+  }
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _LT_PARADIGM_QUERY_H_
+#define _LT_PARADIGM_QUERY_H_
+
+#include <lttoolbox/alphabet.h>
+#include <lttoolbox/sorted_vector.h>
+#include <lttoolbox/transducer.h>
+#include <lttoolbox/ustring.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+/**
+ * A compiled dictionary kept in memory to list its paths matching
+ * patterns, as lt-paradigm does: "lemma<n><*>" gives every form of a
+ * noun, "*<vblex><*-pres>" those of every verb but the present ones, and
+ * "re<vblex><|pres|pret>" those with either tag.  In a pattern, * stands
+ * for any letters of the alphabet, <*> for any tags, <*|a|b> for any of
+ * the tags a and b, <*-a-b> for any but them, and <|a|b> for one of them.
+ *
+ * The pattern is compiled into a transducer that is intersected with
+ * each section in turn, whose paths are then given one at a time, so
+ * that the first ones come without expanding the rest.  Compiling a
+ * pattern changes the alphabet, so that two may not be compiled at the
+ * same time, but Paths over different sections may be read in
+ * different threads.
+ */
+class ParadigmQuery
+{
+private:
+  std::set<UChar32> letters;
+  Alphabet alphabet;
+  std::map<UString, Transducer> sections;
+
+  /**
+   * The tags that <*> stands for, all those of the alphabet but the
+   * excluded ones
+   */
+  sorted_vector<int32_t> tags;
+
+  sorted_vector<int32_t> splitTags(UStringView sym, int prefix, UChar32 sep);
+
+public:
+  class Paths;
+
+  /**
+   * Read a compiled dictionary
+   * @param input the file, at its start
+   * @param analyser whether the analyses are the output side, as they
+   *                 are in an analyser, rather than the input side, as in
+   *                 a generator
+   * @param exclude tags that no path matched by <*> or <*-...> has
+   */
+  void read(FILE* input, bool analyser,
+            std::set<UString> const &exclude = std::set<UString>());
+
+  /**
+   * Number of sections of the dictionary
+   */
+  size_t size() const
+  {
+    return sections.size();
+  }
+
+  /**
+   * Compile a pattern, for Paths over some of the sections
+   */
+  Transducer compile(UStringView pattern);
+
+  /**
+   * The paths matching a pattern
+   * @param limit the most paths to give, or 0 for all of them
+   */
+  Paths query(UStringView pattern, size_t limit = 0);
+};
+
+/**
+ * The paths of a dictionary matching a pattern, expanded as they are
+ * asked for, each one taking no state twice but for a loop on the last
+ * one, taken once.  A path is given by its analysis and its surface
+ * form, which are valid until the next call to next().
+ */
+class ParadigmQuery::Paths
+{
+private:
+  /**
+   * A state on the path being expanded: the transitions still to be
+   * taken from it and how long the strings were before the arc into it
+   */
+  struct Step
+  {
+    int state;
+    std::multimap<int, std::pair<int, double>>::const_iterator next, end;
+    size_t l_size, r_size;
+    bool marked; // whether the arc into it put the state before on the path
+  };
+
+  Alphabet const *alphabet;
+  Transducer pattern;
+  std::map<UString, Transducer>::iterator section, last;
+  size_t limit, found = 0;
+
+  /**
+   * The intersection of the section being expanded and the pattern
+   */
+  std::unique_ptr<Transducer> matched;
+  std::vector<bool> on_path;
+  std::vector<Step> path;
+  UString l, r;
+
+  /**
+   * Put state on the path
+   * @return whether a path ends there
+   */
+  bool enter(int state, size_t l_size, size_t r_size, bool marked);
+
+public:
+  /**
+   * The paths of the sections first..last-1 of query matching the
+   * compiled pattern
+   * @param limit the most paths to give, or 0 for all of them
+   */
+  Paths(ParadigmQuery &query, Transducer const &pattern, size_t first,
+        size_t last, size_t limit = 0);
+
+  /**
+   * Go on to the next path
+   * @return whether there was one
+   */
+  bool next();
+
+  UString const & analysis() const
+  {
+    return r;
+  }
+
+  UString const & surface() const
+  {
+    return l;
+  }
+};
+
+#endif
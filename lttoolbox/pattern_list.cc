@@ -389,11 +389,12 @@ PatternList::read(FILE *input)
     UString mystr = Compression::string_read(input);
     transducer.read(input, alphabet.size());
 
-    int finalsize = Compression::multibyte_read(input);
+    MultibyteReader in(input);
+    int finalsize = in.read();
     for(; finalsize != 0; finalsize--)
     {
-      int key = Compression::multibyte_read(input);
-      final_type[key] = Compression::multibyte_read(input);
+      int key = in.read();
+      final_type[key] = in.read();
     }
   }
 }
@@ -420,6 +421,12 @@ PatternList::newMatchExe() const
   return new MatchExe(transducer, final_type);
 }
 
+MatchTable *
+PatternList::newMatchTable() const
+{
+  return new MatchTable(transducer, final_type);
+}
+
 Alphabet &
 PatternList::getAlphabet()
 {
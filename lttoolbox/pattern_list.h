@@ -19,6 +19,7 @@
 
 #include <lttoolbox/alphabet.h>
 #include <lttoolbox/match_exe.h>
+#include <lttoolbox/match_table.h>
 #include <lttoolbox/transducer.h>
 
 #include <list>
@@ -143,6 +144,12 @@ public:
    */
   MatchExe * newMatchExe() const;
 
+  /**
+   * Create a new MatchTable from PatternList, must be freed with 'delete'
+   * @return the new MatchTable object
+   */
+  MatchTable * newMatchTable() const;
+
   /**
    * Get the alphabet of this PatternList object
    * @return the alphabet
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LT_SEGMENTED_BUFFER_H_
+#define _LT_SEGMENTED_BUFFER_H_
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+/**
+ * Input buffer with the interface of Buffer that grows by fixed-size
+ * segments instead of wrapping around, so going back never depends on
+ * how much has been read since.  Positions are absolute.  The reader
+ * commits the position it will never go back before, and the segments
+ * more than one segment behind it are recycled, so memory follows the
+ * longest token rather than the length of the input.
+ */
+template <class T>
+class SegmentedBuffer
+{
+private:
+  static constexpr size_t segment_size = 1024;
+
+  std::deque<std::vector<T>> segments;
+  std::vector<std::vector<T>> spare;
+
+  /**
+   * Position of the first element of the first segment
+   */
+  size_t base = 0;
+
+  size_t currentpos = 0;
+  size_t lastpos = 0;
+  size_t committed = 0;
+
+  /**
+   * What last() gives before anything has been added
+   */
+  T none = T();
+
+  T & at(size_t const pos)
+    {
+      size_t const offset = pos - base;
+      return segments[offset / segment_size][offset % segment_size];
+    }
+
+  void grow()
+    {
+      while(segments.size() > 1 && base + 2 * segment_size <= committed)
+      {
+        spare.push_back(std::move(segments.front()));
+        segments.pop_front();
+        base += segment_size;
+      }
+      if(lastpos - base == segments.size() * segment_size)
+      {
+        if(spare.empty())
+        {
+          segments.emplace_back(segment_size);
+        }
+        else
+        {
+          segments.push_back(std::move(spare.back()));
+          spare.pop_back();
+        }
+      }
+    }
+
+public:
+  /**
+   * Add an element to the buffer.
+   * @param value the value.
+   * @return reference to the stored object.
+   */
+  T & add(T const &value)
+    {
+      grow();
+      T &stored = at(lastpos++);
+      stored = value;
+      currentpos = lastpos;
+      return stored;
+    }
+
+  /**
+   * Consume the buffer's current value.
+   * @return the current value.
+   */
+  T & next()
+    {
+      if(currentpos != lastpos)
+      {
+        return at(currentpos++);
+      }
+      return last();
+    }
+
+  /**
+   * Look at the current element of the buffer without advancing.
+   * @return current element.
+   */
+  T & peek()
+    {
+      if(currentpos != lastpos)
+      {
+        return at(currentpos);
+      }
+      return last();
+    }
+
+  /**
+   * Get the last element of the buffer.
+   * @return last element.
+   */
+  T & last()
+    {
+      return lastpos == 0 ? none : at(lastpos - 1);
+    }
+
+  /**
+   * Get the current buffer position.
+   * @return the position.
+   */
+  size_t getPos() const
+    {
+      return currentpos;
+    }
+
+  /**
+   * Set the buffer to a new position, not before one segment behind the
+   * committed position.
+   * @param newpos the new position.
+   */
+  void setPos(size_t const newpos)
+    {
+      currentpos = newpos;
+    }
+
+  /**
+   * Return the range size between the buffer current position and a
+   * previous position.
+   * @param prevpos the given position.
+   * @return the range size.
+   */
+  size_t diffPrevPos(size_t const prevpos) const
+    {
+      return currentpos - prevpos;
+    }
+
+  /**
+   * Checks the buffer for emptyness.
+   * @return true if there is nothing left to consume.
+   */
+  bool isEmpty() const
+    {
+      return currentpos == lastpos;
+    }
+
+  /**
+   * Gets back 'posback' positions in the buffer.
+   * @param posback the amount of position to get back.
+   */
+  void back(size_t const posback)
+    {
+      currentpos -= posback;
+    }
+
+  /**
+   * Drop whatever is left to consume, never to go back to it or before.
+   */
+  void skip()
+    {
+      currentpos = lastpos;
+      committed = lastpos;
+    }
+
+  /**
+   * Promise not to go back before pos, letting the segments behind it be
+   * reused.
+   * @param pos the position.
+   */
+  void commit(size_t const pos)
+    {
+      committed = pos;
+    }
+
+  /**
+   * Bytes taken by the segments, in use or spare, which are as many as
+   * the longest stretch the buffer had to keep.
+   * @return the size in bytes.
+   */
+  size_t memoryUsage() const
+    {
+      return (segments.size() + spare.size()) * segment_size * sizeof(T);
+    }
+};
+
+#endif
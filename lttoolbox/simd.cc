@@ -0,0 +1,476 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#include <lttoolbox/simd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define LT_SIMD_X86 1
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__ARM_NEON) && defined(__aarch64__)
+#define LT_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+struct Kernels
+{
+  char const *name;
+  size_t (*findByte)(char const *data, size_t n, char const *stops, size_t count);
+  size_t (*widenAscii)(char const *data, size_t n, UChar *out);
+  size_t (*findUnit)(UChar const *s, size_t n, UChar const *units, size_t count);
+};
+
+// The vector kernels go a vector at a time and leave the last bytes or
+// units, fewer than a vector, to these, which start at i
+
+size_t findByteFrom(char const *data, size_t n, char const *stops,
+                    size_t count, size_t i)
+{
+  for(; i < n; i++)
+  {
+    if(memchr(stops, data[i], count) != nullptr)
+    {
+      return i;
+    }
+  }
+  return n;
+}
+
+size_t widenAsciiFrom(char const *data, size_t n, UChar *out, size_t i)
+{
+  for(; i < n && static_cast<unsigned char>(data[i]) < 0x80; i++)
+  {
+    out[i] = static_cast<UChar>(data[i]);
+  }
+  return i;
+}
+
+size_t findUnitFrom(UChar const *s, size_t n, UChar const *units,
+                    size_t count, size_t i)
+{
+  for(; i < n; i++)
+  {
+    for(size_t j = 0; j < count; j++)
+    {
+      if(s[i] == units[j])
+      {
+        return i;
+      }
+    }
+  }
+  return n;
+}
+
+// Without vector instructions, the bytes go eight at a time in a word
+
+constexpr uint64_t ones = 0x0101010101010101ULL;
+constexpr uint64_t highs = 0x8080808080808080ULL;
+
+// whether any of the bytes in word is b
+inline bool hasByte(uint64_t word, unsigned char b)
+{
+  uint64_t x = word ^ (ones * b);
+  return ((x - ones) & ~x & highs) != 0;
+}
+
+size_t findByteScalar(char const *data, size_t n, char const *stops, size_t count)
+{
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+  {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    bool found = false;
+    for(size_t j = 0; j < count; j++)
+    {
+      found |= hasByte(word, static_cast<unsigned char>(stops[j]));
+    }
+    if(found)
+    {
+      break;
+    }
+  }
+  return findByteFrom(data, n, stops, count, i);
+}
+
+size_t widenAsciiScalar(char const *data, size_t n, UChar *out)
+{
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+  {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    if(word & highs)
+    {
+      break;
+    }
+    for(size_t j = 0; j < 8; j++)
+    {
+      out[i + j] = static_cast<UChar>(data[i + j]);
+    }
+  }
+  return widenAsciiFrom(data, n, out, i);
+}
+
+size_t findUnitScalar(UChar const *s, size_t n, UChar const *units, size_t count)
+{
+  return findUnitFrom(s, n, units, count, 0);
+}
+
+Kernels const scalar = {"scalar", findByteScalar, widenAsciiScalar, findUnitScalar};
+
+#if LT_SIMD_X86
+
+// The stops past count are copies of the last one, so that the bytes are
+// always compared with four of them
+
+size_t findByteSse2(char const *data, size_t n, char const *stops, size_t count)
+{
+  __m128i const s0 = _mm_set1_epi8(stops[0]);
+  __m128i const s1 = _mm_set1_epi8(stops[count > 1 ? 1 : count - 1]);
+  __m128i const s2 = _mm_set1_epi8(stops[count > 2 ? 2 : count - 1]);
+  __m128i const s3 = _mm_set1_epi8(stops[count - 1]);
+  size_t i = 0;
+  for(; i + 16 <= n; i += 16)
+  {
+    __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data + i));
+    __m128i const hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, s0), _mm_cmpeq_epi8(v, s1)),
+                                     _mm_or_si128(_mm_cmpeq_epi8(v, s2), _mm_cmpeq_epi8(v, s3)));
+    unsigned const bits = _mm_movemask_epi8(hit);
+    if(bits != 0)
+    {
+      return i + __builtin_ctz(bits);
+    }
+  }
+  return findByteFrom(data, n, stops, count, i);
+}
+
+size_t widenAsciiSse2(char const *data, size_t n, UChar *out)
+{
+  __m128i const zero = _mm_setzero_si128();
+  size_t i = 0;
+  for(; i + 16 <= n; i += 16)
+  {
+    __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data + i));
+    if(_mm_movemask_epi8(v) != 0)
+    {
+      break;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_unpacklo_epi8(v, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 8), _mm_unpackhi_epi8(v, zero));
+  }
+  return widenAsciiFrom(data, n, out, i);
+}
+
+size_t findUnitSse2(UChar const *s, size_t n, UChar const *units, size_t count)
+{
+  __m128i needles[Simd::max_units];
+  for(size_t j = 0; j < count; j++)
+  {
+    needles[j] = _mm_set1_epi16(static_cast<short>(units[j]));
+  }
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+  {
+    __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i));
+    __m128i hit = _mm_cmpeq_epi16(v, needles[0]);
+    for(size_t j = 1; j < count; j++)
+    {
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi16(v, needles[j]));
+    }
+    unsigned const bits = _mm_movemask_epi8(hit);
+    if(bits != 0)
+    {
+      return i + __builtin_ctz(bits) / 2;
+    }
+  }
+  return findUnitFrom(s, n, units, count, i);
+}
+
+__attribute__((target("avx2")))
+size_t findByteAvx2(char const *data, size_t n, char const *stops, size_t count)
+{
+  __m256i const s0 = _mm256_set1_epi8(stops[0]);
+  __m256i const s1 = _mm256_set1_epi8(stops[count > 1 ? 1 : count - 1]);
+  __m256i const s2 = _mm256_set1_epi8(stops[count > 2 ? 2 : count - 1]);
+  __m256i const s3 = _mm256_set1_epi8(stops[count - 1]);
+  size_t i = 0;
+  for(; i + 32 <= n; i += 32)
+  {
+    __m256i const v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + i));
+    __m256i const hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, s0), _mm256_cmpeq_epi8(v, s1)),
+                                        _mm256_or_si256(_mm256_cmpeq_epi8(v, s2), _mm256_cmpeq_epi8(v, s3)));
+    unsigned const bits = _mm256_movemask_epi8(hit);
+    if(bits != 0)
+    {
+      return i + __builtin_ctz(bits);
+    }
+  }
+  return findByteFrom(data, n, stops, count, i);
+}
+
+__attribute__((target("avx2")))
+size_t widenAsciiAvx2(char const *data, size_t n, UChar *out)
+{
+  size_t i = 0;
+  for(; i + 32 <= n; i += 32)
+  {
+    __m256i const v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + i));
+    if(_mm256_movemask_epi8(v) != 0)
+    {
+      break;
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                        _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i + 16),
+                        _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+  }
+  return widenAsciiFrom(data, n, out, i);
+}
+
+__attribute__((target("avx2")))
+size_t findUnitAvx2(UChar const *s, size_t n, UChar const *units, size_t count)
+{
+  __m256i needles[Simd::max_units];
+  for(size_t j = 0; j < count; j++)
+  {
+    needles[j] = _mm256_set1_epi16(static_cast<short>(units[j]));
+  }
+  size_t i = 0;
+  for(; i + 16 <= n; i += 16)
+  {
+    __m256i const v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(s + i));
+    __m256i hit = _mm256_cmpeq_epi16(v, needles[0]);
+    for(size_t j = 1; j < count; j++)
+    {
+      hit = _mm256_or_si256(hit, _mm256_cmpeq_epi16(v, needles[j]));
+    }
+    unsigned const bits = _mm256_movemask_epi8(hit);
+    if(bits != 0)
+    {
+      return i + __builtin_ctz(bits) / 2;
+    }
+  }
+  return findUnitFrom(s, n, units, count, i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+size_t findByteAvx512(char const *data, size_t n, char const *stops, size_t count)
+{
+  __m512i const s0 = _mm512_set1_epi8(stops[0]);
+  __m512i const s1 = _mm512_set1_epi8(stops[count > 1 ? 1 : count - 1]);
+  __m512i const s2 = _mm512_set1_epi8(stops[count > 2 ? 2 : count - 1]);
+  __m512i const s3 = _mm512_set1_epi8(stops[count - 1]);
+  size_t i = 0;
+  for(; i + 64 <= n; i += 64)
+  {
+    __m512i const v = _mm512_loadu_si512(data + i);
+    uint64_t const bits = _mm512_cmpeq_epi8_mask(v, s0) | _mm512_cmpeq_epi8_mask(v, s1) |
+                          _mm512_cmpeq_epi8_mask(v, s2) | _mm512_cmpeq_epi8_mask(v, s3);
+    if(bits != 0)
+    {
+      return i + __builtin_ctzll(bits);
+    }
+  }
+  return findByteFrom(data, n, stops, count, i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+size_t widenAsciiAvx512(char const *data, size_t n, UChar *out)
+{
+  size_t i = 0;
+  for(; i + 64 <= n; i += 64)
+  {
+    __m512i const v = _mm512_loadu_si512(data + i);
+    if(_mm512_movepi8_mask(v) != 0)
+    {
+      break;
+    }
+    __m256i const low = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + i));
+    __m256i const high = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + i + 32));
+    _mm512_storeu_si512(out + i, _mm512_cvtepu8_epi16(low));
+    _mm512_storeu_si512(out + i + 32, _mm512_cvtepu8_epi16(high));
+  }
+  return widenAsciiFrom(data, n, out, i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+size_t findUnitAvx512(UChar const *s, size_t n, UChar const *units, size_t count)
+{
+  __m512i needles[Simd::max_units];
+  for(size_t j = 0; j < count; j++)
+  {
+    needles[j] = _mm512_set1_epi16(static_cast<short>(units[j]));
+  }
+  size_t i = 0;
+  for(; i + 32 <= n; i += 32)
+  {
+    __m512i const v = _mm512_loadu_si512(s + i);
+    uint32_t bits = 0;
+    for(size_t j = 0; j < count; j++)
+    {
+      bits |= _mm512_cmpeq_epi16_mask(v, needles[j]);
+    }
+    if(bits != 0)
+    {
+      return i + __builtin_ctz(bits);
+    }
+  }
+  return findUnitFrom(s, n, units, count, i);
+}
+
+Kernels const sse2 = {"sse2", findByteSse2, widenAsciiSse2, findUnitSse2};
+Kernels const avx2 = {"avx2", findByteAvx2, widenAsciiAvx2, findUnitAvx2};
+Kernels const avx512 = {"avx512bw", findByteAvx512, widenAsciiAvx512, findUnitAvx512};
+
+#elif LT_SIMD_NEON
+
+// A vector with a hit is searched again byte by byte: there is no
+// movemask, and hits are few
+
+size_t findByteNeon(char const *data, size_t n, char const *stops, size_t count)
+{
+  uint8x16_t const s0 = vdupq_n_u8(stops[0]);
+  uint8x16_t const s1 = vdupq_n_u8(stops[count > 1 ? 1 : count - 1]);
+  uint8x16_t const s2 = vdupq_n_u8(stops[count > 2 ? 2 : count - 1]);
+  uint8x16_t const s3 = vdupq_n_u8(stops[count - 1]);
+  size_t i = 0;
+  for(; i + 16 <= n; i += 16)
+  {
+    uint8x16_t const v = vld1q_u8(reinterpret_cast<uint8_t const *>(data + i));
+    uint8x16_t const hit = vorrq_u8(vorrq_u8(vceqq_u8(v, s0), vceqq_u8(v, s1)),
+                                    vorrq_u8(vceqq_u8(v, s2), vceqq_u8(v, s3)));
+    if(vmaxvq_u8(hit) != 0)
+    {
+      break;
+    }
+  }
+  return findByteFrom(data, n, stops, count, i);
+}
+
+size_t widenAsciiNeon(char const *data, size_t n, UChar *out)
+{
+  size_t i = 0;
+  for(; i + 16 <= n; i += 16)
+  {
+    uint8x16_t const v = vld1q_u8(reinterpret_cast<uint8_t const *>(data + i));
+    if(vmaxvq_u8(v) >= 0x80)
+    {
+      break;
+    }
+    vst1q_u16(reinterpret_cast<uint16_t *>(out + i), vmovl_u8(vget_low_u8(v)));
+    vst1q_u16(reinterpret_cast<uint16_t *>(out + i + 8), vmovl_u8(vget_high_u8(v)));
+  }
+  return widenAsciiFrom(data, n, out, i);
+}
+
+size_t findUnitNeon(UChar const *s, size_t n, UChar const *units, size_t count)
+{
+  uint16x8_t needles[Simd::max_units];
+  for(size_t j = 0; j < count; j++)
+  {
+    needles[j] = vdupq_n_u16(units[j]);
+  }
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+  {
+    uint16x8_t const v = vld1q_u16(reinterpret_cast<uint16_t const *>(s + i));
+    uint16x8_t hit = vceqq_u16(v, needles[0]);
+    for(size_t j = 1; j < count; j++)
+    {
+      hit = vorrq_u16(hit, vceqq_u16(v, needles[j]));
+    }
+    if(vmaxvq_u16(hit) != 0)
+    {
+      break;
+    }
+  }
+  return findUnitFrom(s, n, units, count, i);
+}
+
+Kernels const neon = {"neon", findByteNeon, widenAsciiNeon, findUnitNeon};
+
+#endif
+
+Kernels choose()
+{
+  // from the least to the best
+  std::vector<Kernels> usable = {scalar};
+#if LT_SIMD_X86
+  usable.push_back(sse2);
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+  {
+    usable.push_back(avx2);
+    if(__builtin_cpu_supports("avx512bw"))
+    {
+      usable.push_back(avx512);
+    }
+  }
+#elif LT_SIMD_NEON
+  usable.push_back(neon);
+#endif
+  char const *wanted = getenv("LT_SIMD");
+  if(wanted != nullptr)
+  {
+    for(auto &k : usable)
+    {
+      if(strcmp(k.name, wanted) == 0)
+      {
+        return k;
+      }
+    }
+  }
+  return usable.back();
+}
+
+Kernels const & kernels()
+{
+  static Kernels const chosen = choose();
+  return chosen;
+}
+
+}
+
+char const *
+Simd::level()
+{
+  return kernels().name;
+}
+
+size_t
+Simd::findByte(char const *data, size_t n, char const *stops, size_t count)
+{
+  return kernels().findByte(data, n, stops, count);
+}
+
+size_t
+Simd::widenAscii(char const *data, size_t n, UChar *out)
+{
+  return kernels().widenAscii(data, n, out);
+}
+
+size_t
+Simd::findUnit(UChar const *s, size_t n, UChar const *units, size_t count)
+{
+  return kernels().findUnit(s, n, units, count);
+}
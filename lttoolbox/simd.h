@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _LT_SIMD_H_
+#define _LT_SIMD_H_
+
+#include <lttoolbox/ustring.h>
+
+#include <cstddef>
+
+/**
+ * Scanning and widening of text a vector at a time.  The instruction
+ * set is chosen when first used, the best one of the machine that the
+ * library was built for: AVX-512BW, AVX2 or SSE2 on x86, NEON on 64-bit
+ * ARM, or plain code elsewhere, so that one build is fast on every
+ * machine.  The environment variable LT_SIMD set to the name of one the
+ * machine has (avx512bw, avx2, sse2, neon or scalar) chooses it instead,
+ * to compare them.
+ */
+class Simd
+{
+public:
+  /**
+   * Most bytes findByte() looks for
+   */
+  static constexpr size_t max_stops = 4;
+
+  /**
+   * Most units findUnit() looks for
+   */
+  static constexpr size_t max_units = 16;
+
+  /**
+   * Name of the instruction set chosen
+   */
+  static char const * level();
+
+  /**
+   * Index of the first of the n bytes of data that is one of stops,
+   * or n if none is
+   * @param count how many stops there are, from 1 to max_stops
+   */
+  static size_t findByte(char const *data, size_t n, char const *stops,
+                         size_t count);
+
+  /**
+   * Copy the ASCII bytes at the start of data to out as UTF-16
+   * @param n how many bytes data has, and out has room for
+   * @return how many there were, n if all of them were ASCII
+   */
+  static size_t widenAscii(char const *data, size_t n, UChar *out);
+
+  /**
+   * Index of the first of the n units of s that is one of units, or n
+   * if none is
+   * @param count how many units there are, from 1 to max_units
+   */
+  static size_t findUnit(UChar const *s, size_t n, UChar const *units,
+                         size_t count);
+};
+
+#endif
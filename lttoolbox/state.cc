@@ -19,7 +19,11 @@
 
 #include <cstring>
 #include <climits>
+#include <cstdint>
 #include <algorithm>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 
 //debug//
 //#include <iostream>
@@ -54,31 +58,27 @@ State::operator =(State const &s)
 void
 State::destroy()
 {
-  for(size_t i = 0, limit = state.size(); i != limit; i++)
-  {
-    delete state[i].sequence;
-  }
-
   state.clear();
+  outputs.clear();
+  output_weights.clear();
+  output_costs.clear();
+  outputs_counted = 0;
 }
 
 void
 State::copy(State const &s)
 {
-  // release references
-  for(size_t i = 0, limit = state.size(); i != limit; i++)
-  {
-    delete state[i].sequence;
-  }
-
   state = s.state;
-
-  for(size_t i = 0, limit = state.size(); i != limit; i++)
-  {
-    std::vector<std::pair<int, double>> *tmp = new std::vector<std::pair<int, double>>();
-    *tmp = *(state[i].sequence);
-    state[i].sequence = tmp;
-  }
+  outputs = s.outputs;
+  output_weights = s.output_weights;
+  output_costs = s.output_costs;
+  epsilons = s.epsilons;
+  beam = s.beam;
+  best = s.best;
+  stats = s.stats;
+  profile = s.profile;
+  sampled = profile != nullptr && profile->sample();
+  outputs_counted = s.outputs_counted;
 }
 
 size_t
@@ -87,64 +87,164 @@ State::size() const
   return state.size();
 }
 
+size_t
+State::memoryUsage() const
+{
+  return outputs.capacity() * sizeof(TOutput) +
+         (output_weights.capacity() + output_costs.capacity()) * sizeof(double) +
+         (state.capacity() + spare.capacity()) * sizeof(TNodeState);
+}
+
 void
-State::init(Node *initial)
+State::clear()
 {
   state.clear();
-  state.push_back(TNodeState(initial, new std::vector<std::pair<int, double>>(), false));
-  state[0].sequence->clear();
-  epsilonClosure();
 }
 
-bool
-State::apply_into(std::vector<TNodeState>* new_state, int const input, int index, bool dirty)
+void
+State::reachableChars(std::vector<CharSet> &chars, size_t depth) const
 {
-  std::map<int, Dest>::const_iterator it;
-  it = state[index].where->transitions.find(input);
-  if(it != state[index].where->transitions.end())
+  chars.assign(depth + 1, CharSet());
+  std::vector<Node *> level;
+  std::unordered_set<Node *> in_level;
+  for(auto const &it : state)
   {
-    for(int j = 0; j != it->second.size; j++)
+    if(in_level.insert(it.where).second)
     {
-      std::vector<std::pair<int, double>> *new_v = new std::vector<std::pair<int, double>>();
-      *new_v = *(state[index].sequence);
-      if(it->first != 0)
-      {
-        new_v->push_back({it->second.out_tag[j], it->second.out_weight[j]});
-      }
-      new_state->push_back(TNodeState(it->second.dest[j], new_v, state[index].dirty||dirty));
+      level.push_back(it.where);
     }
-    return true;
   }
-  return false;
-}
-
-bool
-State::apply_into_override(std::vector<TNodeState>* new_state, int const input, int const old_sym, int const new_sym, int index, bool dirty)
-{
-  std::map<int, Dest>::const_iterator it;
-  it = state[index].where->transitions.find(input);
-  if(it != state[index].where->transitions.end())
+  for(size_t d = 0; !level.empty(); d++)
   {
-    for(int j = 0; j != it->second.size; j++)
+    // from depth on, every node reached counts as at depth itself
+    std::vector<Node *> next;
+    std::unordered_set<Node *> in_next;
+    for(size_t i = 0; i < level.size(); i++)
     {
-      std::vector<std::pair<int, double>> *new_v = new std::vector<std::pair<int, double>>();
-      *new_v = *(state[index].sequence);
-      if(it->first != 0)
+      Node *node = level[i];
+      int32_t const *inputs = node->inputs();
+      Dest const *dests = node->dests();
+      for(uint32_t j = 0; j < node->size; j++)
       {
-        if(it->second.out_tag[j] == old_sym)
+        Node *dest = node->target(dests[j]);
+        if(inputs[j] > 0)
         {
-          new_v->push_back({new_sym, it->second.out_weight[j]});
+          chars[d].insert(inputs[j]);
         }
-        else
+        if(inputs[j] == 0 || d == depth)
         {
-          new_v->push_back({it->second.out_tag[j], it->second.out_weight[j]});
+          if(in_level.insert(dest).second)
+          {
+            level.push_back(dest);
+          }
+        }
+        else if(in_next.insert(dest).second)
+        {
+          next.push_back(dest);
         }
       }
-      new_state->push_back(TNodeState(it->second.dest[j], new_v, state[index].dirty||dirty));
     }
-    return true;
+    level.swap(next);
+    in_level.swap(in_next);
   }
-  return false;
+}
+
+void
+State::init(Node *initial)
+{
+  destroy();
+  state.push_back(TNodeState(initial, -1, false));
+  epsilonClosure();
+}
+
+void
+State::init(Node *where, std::vector<std::pair<int32_t, double>> const &sequence,
+            bool dirty)
+{
+  destroy();
+  int32_t seq = -1;
+  for(auto& it : sequence)
+  {
+    seq = pushOutput(seq, it.first, it.second);
+  }
+  state.push_back(TNodeState(where, seq, dirty));
+  epsilonClosure();
+}
+
+int32_t
+State::pushOutput(int32_t parent, int32_t symbol, double weight)
+{
+  outputs.push_back({parent, symbol});
+  if(weight != 0.0 || !output_weights.empty())
+  {
+    // the entries before the first weighted one get a weight of 0
+    output_weights.resize(outputs.size() - 1);
+    output_weights.push_back(weight);
+    if(best != nullptr)
+    {
+      output_costs.resize(outputs.size() - 1);
+      output_costs.push_back(weight + (parent == -1 ? 0.0 : output_costs[parent]));
+    }
+  }
+  return static_cast<int32_t>(outputs.size()) - 1;
+}
+
+void
+State::getSequence(int32_t seq, std::vector<std::pair<int, double>> &result) const
+{
+  result.clear();
+  for(; seq != -1; seq = outputs[seq].parent)
+  {
+    result.push_back({outputs[seq].symbol, outputWeight(seq)});
+  }
+  std::reverse(result.begin(), result.end());
+}
+
+bool
+State::apply_into(std::vector<TNodeState>* new_state, int const input, int index, bool dirty, bool upper)
+{
+  Node *where = state[index].where;
+  uint32_t count;
+  Dest const *d = where->dests() + (upper ? where->findUpper(input, count)
+                                          : where->find(input, count));
+  if(sampled)
+  {
+    countArcs(where, d, count);
+  }
+  for(uint32_t j = 0; j != count; j++)
+  {
+    int32_t seq = state[index].sequence;
+    if(input != 0)
+    {
+      seq = pushOutput(seq, d[j].out_tag, d[j].out_weight);
+    }
+    new_state->push_back(TNodeState(where->target(d[j]), seq, state[index].dirty||dirty));
+  }
+  return count != 0;
+}
+
+bool
+State::apply_into_override(std::vector<TNodeState>* new_state, int const input, int const old_sym, int const new_sym, int index, bool dirty, bool upper)
+{
+  Node *where = state[index].where;
+  uint32_t count;
+  Dest const *d = where->dests() + (upper ? where->findUpper(input, count)
+                                          : where->find(input, count));
+  if(sampled)
+  {
+    countArcs(where, d, count);
+  }
+  for(uint32_t j = 0; j != count; j++)
+  {
+    int32_t seq = state[index].sequence;
+    if(input != 0)
+    {
+      int32_t sym = (d[j].out_tag == old_sym) ? new_sym : d[j].out_tag;
+      seq = pushOutput(seq, sym, d[j].out_weight);
+    }
+    new_state->push_back(TNodeState(where->target(d[j]), seq, state[index].dirty||dirty));
+  }
+  return count != 0;
 }
 
 void
@@ -156,14 +256,14 @@ State::apply(int const input)
     return;
   }
 
-  std::vector<TNodeState> new_state;
+  std::vector<TNodeState> &new_state = spare;
+  new_state.clear();
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
     apply_into(&new_state, input, i, false);
-    delete state[i].sequence;
   }
 
-  state = new_state;
+  state.swap(new_state);
 }
 
 void
@@ -175,19 +275,19 @@ State::apply_override(int const input, int const old_sym, int const new_sym)
     return;
   }
 
-  std::vector<TNodeState> new_state;
+  std::vector<TNodeState> &new_state = spare;
+  new_state.clear();
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
     apply_into_override(&new_state, input, old_sym, new_sym, i, false);
     apply_into_override(&new_state, old_sym, old_sym, new_sym, i, true);
-    delete state[i].sequence;
   }
 
-  state = new_state;
+  state.swap(new_state);
 }
 
 void
-State::apply_override(int const input, int const alt, int const old_sym, int const new_sym)
+State::apply_override(int const input, int const alt, int const old_sym, int const new_sym, bool const upper)
 {
   if(input == alt)
   {
@@ -201,16 +301,16 @@ State::apply_override(int const input, int const alt, int const old_sym, int con
     return;
   }
 
-  std::vector<TNodeState> new_state;
+  std::vector<TNodeState> &new_state = spare;
+  new_state.clear();
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
-    apply_into_override(&new_state, input, old_sym, new_sym, i, false);
+    apply_into_override(&new_state, input, old_sym, new_sym, i, false, upper);
     apply_into_override(&new_state, alt, old_sym, new_sym, i, true);
     apply_into_override(&new_state, old_sym, old_sym, new_sym, i, true);
-    delete state[i].sequence;
   }
 
-  state = new_state;
+  state.swap(new_state);
 }
 
 void
@@ -222,7 +322,8 @@ State::apply(int const input, int const alt)
     return;
   }
 
-  std::vector<TNodeState> new_state;
+  std::vector<TNodeState> &new_state = spare;
+  new_state.clear();
   if(input == alt)
   {
     apply(input);
@@ -233,10 +334,9 @@ State::apply(int const input, int const alt)
   {
     apply_into(&new_state, input, i, false);
     apply_into(&new_state, alt, i, true);
-    delete state[i].sequence;
   }
 
-  state = new_state;
+  state.swap(new_state);
 }
 
 void
@@ -248,45 +348,450 @@ State::apply_careful(int const input, int const alt)
     return;
   }
 
-  std::vector<TNodeState> new_state;
+  std::vector<TNodeState> &new_state = spare;
+  new_state.clear();
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
     if(!apply_into(&new_state, input, i, false))
     {
       apply_into(&new_state, alt, i, true);
     }
-    delete state[i].sequence;
   }
 
-  state = new_state;
+  state.swap(new_state);
+}
+
+void
+State::apply_case(int const input, int const lower, bool const careful)
+{
+  if(input == 0 || lower == 0)
+  {
+    destroy();
+    return;
+  }
+
+  if(input == lower)
+  {
+    apply(input);
+    return;
+  }
+
+  std::vector<TNodeState> &new_state = spare;
+  new_state.clear();
+  for(size_t i = 0, limit = state.size(); i != limit; i++)
+  {
+    if(!apply_into(&new_state, input, i, false, true) || !careful)
+    {
+      apply_into(&new_state, lower, i, true);
+    }
+  }
+
+  state.swap(new_state);
+}
+
+bool
+State::tableClosure()
+{
+  struct Pending
+  {
+    EpsilonTable::Entry const *begin;
+    EpsilonTable::Entry const *next;
+    EpsilonTable::Entry const *end;
+    size_t seqs;
+  };
+
+  // most nodes have no epsilon transitions, which the node itself tells
+  // faster than the table
+  size_t const n = state.size();
+  size_t first = 0;
+  uint32_t count = 0;
+  for(; first != n; first++)
+  {
+    state[first].where->find(0, count);
+    if(count != 0)
+    {
+      break;
+    }
+  }
+  if(first == n)
+  {
+    return true;
+  }
+
+  thread_local std::vector<Pending> pending;
+  thread_local std::vector<int32_t> seqs;
+  size_t total = 0;
+  pending.assign(first, {nullptr, nullptr, nullptr, 0});
+  for(size_t i = first; i != n; i++)
+  {
+    if(i != first)
+    {
+      state[i].where->find(0, count);
+    }
+    if(count == 0)
+    {
+      pending.push_back({nullptr, nullptr, nullptr, total});
+      continue;
+    }
+    EpsilonTable::Entry const *begin;
+    EpsilonTable::Entry const *end;
+    if(!epsilons->find(state[i].where, begin, end))
+    {
+      return false;
+    }
+    pending.push_back({begin, begin, end, total});
+    total += end - begin;
+  }
+  if(total == 0)
+  {
+    return true;
+  }
+
+  // adding the closures depth by depth puts the paths in the order of a
+  // breadth first search over the whole state, as epsilonClosure() does
+  seqs.resize(total);
+  for(uint32_t depth = 1; ; depth++)
+  {
+    bool more = false;
+    for(size_t i = 0; i != n; i++)
+    {
+      Pending &p = pending[i];
+      for(; p.next != p.end && p.next->depth == depth; p.next++)
+      {
+        int32_t seq = state[i].sequence;
+        if(p.next->parent >= 0)
+        {
+          seq = seqs[p.seqs + p.next->parent];
+        }
+        if(p.next->out_tag != 0)
+        {
+          seq = pushOutput(seq, p.next->out_tag, p.next->out_weight);
+        }
+        seqs[p.seqs + (p.next - p.begin)] = seq;
+        state.push_back(TNodeState(p.next->target, seq, state[i].dirty));
+      }
+      more = more || p.next != p.end;
+    }
+    if(!more)
+    {
+      return true;
+    }
+  }
+}
+
+void
+State::setEpsilonTable(EpsilonTable const *table)
+{
+  epsilons = table;
+}
+
+void
+State::setBeam(Beam *b)
+{
+  beam = b;
+}
+
+void
+State::setBest(Best *b)
+{
+  best = b;
+  output_costs.clear();
+  if(best != nullptr && !output_weights.empty())
+  {
+    // a parent always comes before its children
+    output_costs.resize(outputs.size());
+    for(size_t n = 0; n < outputs.size(); n++)
+    {
+      int32_t const parent = outputs[n].parent;
+      output_costs[n] = output_weights[n] + (parent == -1 ? 0.0 : output_costs[parent]);
+    }
+  }
+}
+
+void
+State::setStats(Stats *s)
+{
+  stats = s;
+}
+
+void
+State::setProfile(Profile *p)
+{
+  profile = p;
+  sampled = false;
+}
+
+void
+State::Profile::add(Node const *nodes, size_t size)
+{
+  transducers.push_back({nodes, size});
+  visits.emplace_back(size);
+  std::vector<size_t> first(size + 1, 0);
+  for(size_t i = 0; i < size; i++)
+  {
+    first[i + 1] = first[i] + nodes[i].size;
+  }
+  arcs.emplace_back(first.back());
+  first_arc.push_back(std::move(first));
+}
+
+void
+State::Profile::count(Node const *node)
+{
+  for(size_t i = 0; i < transducers.size(); i++)
+  {
+    uintptr_t const offset = reinterpret_cast<uintptr_t>(node) -
+                             reinterpret_cast<uintptr_t>(transducers[i].first);
+    if(offset < transducers[i].second * sizeof(Node))
+    {
+      visits[i][offset / sizeof(Node)].fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+}
+
+void
+State::Profile::countArc(Node const *node, uint32_t arc)
+{
+  for(size_t i = 0; i < transducers.size(); i++)
+  {
+    uintptr_t const offset = reinterpret_cast<uintptr_t>(node) -
+                             reinterpret_cast<uintptr_t>(transducers[i].first);
+    if(offset < transducers[i].second * sizeof(Node))
+    {
+      arcs[i][first_arc[i][offset / sizeof(Node)] + arc].fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+}
+
+bool
+State::Profile::sample()
+{
+  // per thread, so that threads sharing the profile do not contend for
+  // a counter on every step
+  static thread_local uint64_t steps = 0;
+  return ++steps % period == 0;
+}
+
+void
+State::countArcs(Node const *where, Dest const *d, uint32_t count)
+{
+  uint32_t const first = d - where->dests();
+  for(uint32_t j = 0; j != count; j++)
+  {
+    profile->countArc(where, first + j);
+  }
 }
 
 void
 State::epsilonClosure()
 {
-  for(size_t i = 0; i != state.size(); i++)
+  size_t const before = state.size();
+  if(epsilons == nullptr || sampled || !tableClosure())
   {
-    auto it2 = state[i].where->transitions.find(0);
-    if(it2 != state[i].where->transitions.end())
+    for(size_t i = 0; i != state.size(); i++)
     {
-      for(int j = 0 ; j != it2->second.size; j++)
+      Node *where = state[i].where;
+      uint32_t count;
+      Dest const *d = where->dests() + where->find(0, count);
+      if(sampled)
+      {
+        countArcs(where, d, count);
+      }
+      for(uint32_t j = 0; j != count; j++)
       {
-        std::vector<std::pair<int, double>> *tmp = new std::vector<std::pair<int, double>>();
-        *tmp = *(state[i].sequence);
-        if(it2->second.out_tag[j] != 0)
+        int32_t seq = state[i].sequence;
+        if(d[j].out_tag != 0)
         {
-          tmp->push_back({it2->second.out_tag[j], it2->second.out_weight[j]});
+          seq = pushOutput(seq, d[j].out_tag, d[j].out_weight);
         }
-        state.push_back(TNodeState(it2->second.dest[j], tmp, state[i].dirty));
+        state.push_back(TNodeState(where->target(d[j]), seq, state[i].dirty));
+      }
+    }
+  }
+  if(stats != nullptr)
+  {
+    stats->epsilon_paths.fetch_add(state.size() - before, std::memory_order_relaxed);
+  }
+}
+
+void
+State::limitPaths()
+{
+  if(stats != nullptr)
+  {
+    uint64_t const paths = state.size();
+    stats->steps.fetch_add(1, std::memory_order_relaxed);
+    stats->paths.fetch_add(paths, std::memory_order_relaxed);
+    uint64_t max = stats->max_paths.load(std::memory_order_relaxed);
+    while(paths > max &&
+          !stats->max_paths.compare_exchange_weak(max, paths, std::memory_order_relaxed))
+    {
+    }
+    size_t const entry = sizeof(TOutput) + (output_weights.empty() ? 0 : sizeof(double));
+    stats->output_bytes.fetch_add((outputs.size() - outputs_counted) * entry,
+                                  std::memory_order_relaxed);
+    outputs_counted = outputs.size();
+  }
+  if(beam != nullptr && beam->max_paths != 0 && state.size() > beam->max_paths)
+  {
+    applyBeam();
+  }
+  if(best != nullptr && !output_costs.empty())
+  {
+    applyBest();
+  }
+  if(profile != nullptr)
+  {
+    if(sampled)
+    {
+      for(auto const &it : state)
+      {
+        profile->count(it.where);
+      }
+    }
+    sampled = profile->sample();
+  }
+}
+
+void
+State::applyBeam()
+{
+  // accumulated weight of the sequence ending at every entry of outputs,
+  // worked out once per entry from its parent
+  std::vector<double> weights(outputs.size());
+  std::vector<bool> known(outputs.size(), false);
+  std::vector<int32_t> pending;
+  std::vector<std::pair<double, size_t>> costs;
+  costs.reserve(state.size());
+  for(size_t i = 0; i < state.size(); i++)
+  {
+    int32_t seq = state[i].sequence;
+    for(int32_t n = seq; n != -1 && !known[n]; n = outputs[n].parent)
+    {
+      pending.push_back(n);
+    }
+    while(!pending.empty())
+    {
+      int32_t n = pending.back();
+      pending.pop_back();
+      int32_t parent = outputs[n].parent;
+      weights[n] = outputWeight(n) + (parent == -1 ? 0.0 : weights[parent]);
+      known[n] = true;
+    }
+    costs.push_back({seq == -1 ? 0.0 : weights[seq], i});
+  }
+  std::sort(costs.begin(), costs.end());
+
+  std::vector<bool> keep(state.size(), false);
+  std::unordered_map<int32_t, size_t> per_output;
+  size_t kept = 0;
+  for(auto& it : costs)
+  {
+    if(kept == beam->max_paths)
+    {
+      break;
+    }
+    if(beam->max_per_output != 0 &&
+       ++per_output[state[it.second].sequence] > beam->max_per_output)
+    {
+      continue;
+    }
+    keep[it.second] = true;
+    kept++;
+  }
+
+  size_t j = 0;
+  for(size_t i = 0; i < state.size(); i++)
+  {
+    if(keep[i])
+    {
+      state[j++] = state[i];
+    }
+  }
+  state.erase(state.begin() + j, state.end());
+  beam->triggered++;
+}
+
+void
+State::applyBest()
+{
+  // a path is only dropped for that many lighter ones at its node
+  size_t least = SIZE_MAX;
+  if(best->max_analyses != 0)
+  {
+    least = best->max_analyses;
+  }
+  if(best->max_weight_classes != 0)
+  {
+    least = std::min(least, best->max_weight_classes);
+  }
+  if(state.size() <= least)
+  {
+    return;
+  }
+  // the paths by node, lightest first
+  thread_local std::vector<std::tuple<Node *, double, size_t>> paths;
+  paths.clear();
+  for(size_t i = 0; i < state.size(); i++)
+  {
+    int32_t const seq = state[i].sequence;
+    paths.emplace_back(state[i].where, seq == -1 ? 0.0 : output_costs[seq], i);
+  }
+  std::sort(paths.begin(), paths.end());
+
+  thread_local std::vector<bool> keep;
+  keep.assign(state.size(), true);
+  bool dropped = false;
+  for(size_t from = 0; from < paths.size();)
+  {
+    Node *const where = std::get<0>(paths[from]);
+    size_t lighter = 0;          // paths of the node lighter than the current one
+    size_t lighter_weighted = 0; // and of those, the ones heavier than 0
+    size_t weighted = 0;
+    size_t i = from;
+    for(; i < paths.size() && std::get<0>(paths[i]) == where; i++)
+    {
+      double const cost = std::get<1>(paths[i]);
+      if(i > from && cost != std::get<1>(paths[i - 1]))
+      {
+        lighter = i - from;
+        lighter_weighted = weighted;
+      }
+      if(cost > 0.0)
+      {
+        weighted++;
+      }
+      if((best->max_analyses != 0 && lighter >= best->max_analyses) ||
+         (best->max_weight_classes != 0 && lighter_weighted >= best->max_weight_classes))
+      {
+        keep[std::get<2>(paths[i])] = false;
+        dropped = true;
+      }
+    }
+    from = i;
+  }
+
+  if(dropped)
+  {
+    size_t j = 0;
+    for(size_t i = 0; i < state.size(); i++)
+    {
+      if(keep[i])
+      {
+        state[j++] = state[i];
       }
     }
+    state.erase(state.begin() + j, state.end());
   }
 }
 
 void
 State::apply(int const input, int const alt1, int const alt2)
 {
-  std::vector<TNodeState> new_state;
+  std::vector<TNodeState> &new_state = spare;
+  new_state.clear();
   if(input == 0 || alt1 == 0 || alt2 == 0)
   {
     state = new_state;
@@ -309,43 +814,35 @@ State::apply(int const input, int const alt1, int const alt2)
     apply_into(&new_state, input, i, false);
     apply_into(&new_state, alt1, i, true);
     apply_into(&new_state, alt2, i, true);
-    delete state[i].sequence;
   }
 
-  state = new_state;
+  state.swap(new_state);
 }
 
 void
-State::apply(int const input, std::set<int> const alts)
+State::apply(int const input, std::vector<int32_t> const &alts,
+             size_t equivalents)
 {
-  std::vector<TNodeState> new_state;
-  bool has_null = false;
-  for(auto sit = alts.begin(); sit != alts.end(); sit++)
+  std::vector<TNodeState> &new_state = spare;
+  new_state.clear();
+  if(input == 0 || (!alts.empty() && alts.front() == 0))
   {
-    if(*sit == 0)
-    {
-      has_null = true;
-    }
-  }
-  if(input == 0 || has_null)
-  {
-    state = new_state;
+    state.clear();
     return;
   }
 
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
     apply_into(&new_state, input, i, false);
-    for(auto sit = alts.begin(); sit != alts.end(); sit++)
+    for(size_t j = 0; j != alts.size(); j++)
     {
-      if(*sit == input) continue;
-      apply_into(&new_state, *sit, i, true);
+      if(alts[j] == input) continue;
+      apply_into(&new_state, alts[j], i, j >= equivalents);
     }
 
-    delete state[i].sequence;
   }
 
-  state = new_state;
+  state.swap(new_state);
 }
 
 void
@@ -353,6 +850,7 @@ State::step(int const input)
 {
   apply(input);
   epsilonClosure();
+  limitPaths();
 }
 
 void
@@ -360,6 +858,7 @@ State::step(int const input, int const alt)
 {
   apply(input, alt);
   epsilonClosure();
+  limitPaths();
 }
 
 void
@@ -367,6 +866,7 @@ State::step_override(int const input, int const old_sym, int const new_sym)
 {
   apply_override(input, old_sym, new_sym);
   epsilonClosure();
+  limitPaths();
 }
 
 void
@@ -374,6 +874,7 @@ State::step_override(int const input, int const alt, int const old_sym, int cons
 {
   apply_override(input, alt, old_sym, new_sym);
   epsilonClosure();
+  limitPaths();
 }
 
 void
@@ -381,6 +882,7 @@ State::step_careful(int const input, int const alt)
 {
   apply_careful(input, alt);
   epsilonClosure();
+  limitPaths();
 }
 
 void
@@ -388,13 +890,16 @@ State::step(int const input, int const alt1, int const alt2)
 {
   apply(input, alt1, alt2);
   epsilonClosure();
+  limitPaths();
 }
 
 void
-State::step(int const input, std::set<int> const alts)
+State::step(int const input, std::vector<int32_t> const &alts,
+            size_t equivalents)
 {
-  apply(input, alts);
+  apply(input, alts, equivalents);
   epsilonClosure();
+  limitPaths();
 }
 
 void
@@ -416,7 +921,21 @@ State::step_case(UChar32 val, bool caseSensitive)
   if (!u_isupper(val) || caseSensitive) {
     step(val);
   } else {
-    step(val, u_tolower(val));
+    apply_case(val, u_tolower(val), false);
+    epsilonClosure();
+    limitPaths();
+  }
+}
+
+void
+State::step_case_careful(UChar32 val, bool caseSensitive)
+{
+  if (!u_isupper(val) || caseSensitive) {
+    step(val);
+  } else {
+    apply_case(val, u_tolower(val), true);
+    epsilonClosure();
+    limitPaths();
   }
 }
 
@@ -427,7 +946,10 @@ State::step_case_override(UChar32 val, bool caseSensitive)
   if (!u_isupper(val) || caseSensitive) {
     step(val);
   } else {
-    step_override(val, u_tolower(val), u_tolower(val), val);
+    UChar32 lower = u_tolower(val);
+    apply_override(val, lower, lower, val, true);
+    epsilonClosure();
+    limitPaths();
   }
 }
 
@@ -435,7 +957,8 @@ void
 State::step_optional(UChar32 val)
 {
   if (val == 0) return;
-  std::vector<TNodeState> new_state;
+  std::vector<TNodeState> &new_state = spare;
+  new_state.clear();
   for (size_t i = 0; i < state.size(); i++) {
     apply_into(&new_state, val, i, false);
   }
@@ -443,14 +966,15 @@ State::step_optional(UChar32 val)
   epsilonClosure();
   new_state.swap(state);
   state.insert(state.end(), new_state.begin(), new_state.end());
+  limitPaths();
 }
 
 bool
-State::isFinal(std::map<Node *, double> const &finals) const
+State::isFinal(FinalTable const &finals) const
 {
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
-    if(finals.find(state[i].where) != finals.end())
+    if(finals.isFinal(state[i].where))
     {
       return true;
     }
@@ -459,82 +983,247 @@ State::isFinal(std::map<Node *, double> const &finals) const
   return false;
 }
 
+unsigned int
+State::finalClasses(FinalTable const &finals) const
+{
+  unsigned int classes = 0;
+  bool final = false;
+  for(size_t i = 0, limit = state.size(); i != limit; i++)
+  {
+    auto fin = finals.find(state[i].where);
+    if(fin != nullptr)
+    {
+      final = true;
+      classes |= fin->classes;
+    }
+  }
 
-std::vector<std::pair< UString, double >>
-State::NFinals(std::vector<std::pair<UString, double>> lf, int maxAnalyses, int maxWeightClasses) const
+  return final ? (classes | final_any) : 0;
+}
+
+
+void
+State::selectNFinals(std::vector<std::pair<double, size_t>> &costs,
+                     int maxAnalyses, int maxWeightClasses)
 {
-  std::vector<std::pair<UString, double>> result;
+  if(maxAnalyses <= 0 || maxWeightClasses <= 0)
+  {
+    costs.clear();
+    return;
+  }
 
-  sort(lf.begin(), lf.end(), sort_weights<UString, double>());
+  // the position breaks ties, so equal costs keep their order
+  size_t keep = std::min(costs.size(), static_cast<size_t>(maxAnalyses));
+  if(keep < costs.size())
+  {
+    std::nth_element(costs.begin(), costs.begin() + keep, costs.end());
+    costs.resize(keep);
+  }
+  std::sort(costs.begin(), costs.end());
 
-  for(auto it = lf.begin(); it != lf.end(); it++)
+  // every analysis with a weight other than 0 counts as a weight class
+  size_t i = 0;
+  for(; i < costs.size() && maxWeightClasses > 0; i++)
   {
-    double last_weight = 0.0000;
-    if(maxAnalyses > 0 && maxWeightClasses > 0)
+    if(costs[i].first != 0.0)
     {
-      result.push_back({it->first, it->second});
-      maxAnalyses--;
-      if(last_weight!=it->second)
-      {
-        maxWeightClasses--;
-      }
+      maxWeightClasses--;
     }
-    else break;
+  }
+  costs.resize(i);
+}
+
+std::vector<std::pair< UString, double >>
+State::NFinals(std::vector<std::pair<UString, double>> const &lf, int maxAnalyses, int maxWeightClasses) const
+{
+  std::vector<std::pair<double, size_t>> costs;
+  for(size_t i = 0; i < lf.size(); i++)
+  {
+    costs.push_back({lf[i].second, i});
+  }
+  selectNFinals(costs, maxAnalyses, maxWeightClasses);
+
+  std::vector<std::pair<UString, double>> result;
+  for(auto &it : costs)
+  {
+    result.push_back(lf[it.second]);
   }
   return result;
 }
 
+void
+State::finalPaths(FinalTable const &finals, std::vector<FinalPath> &result) const
+{
+  result.clear();
+  std::vector<std::pair<int, double>> seq;
+  for (auto& path : state) {
+    auto fin = finals.find(path.where);
+    if (fin == nullptr) continue;
+    result.push_back({{}, fin->weight, path.dirty});
+    getSequence(path.sequence, seq);
+    for (auto& step : seq) {
+      result.back().weight += step.second;
+      if (step.first != 0) {
+        result.back().symbols.push_back(step.first);
+      }
+    }
+  }
+}
+
 void
 State::filterFinalsArray(std::vector<UString>& result,
-                         std::map<Node *, double> const &finals,
+                         std::vector<double>& weights,
+                         FinalTable const &finals,
                          Alphabet const &alphabet,
-                         std::set<UChar32> const &escaped_chars,
-                         bool display_weights,
+                         CharSet const &escaped_chars,
                          int max_analyses, int max_weight_classes,
                          bool uppercase, bool firstupper, int firstchar) const
 {
-  std::vector<std::pair< UString, double >> response;
-  UString temp;
-  double cost = 0.0000;
+  // this runs at every final state reached, so the scratch space is kept
+  thread_local std::vector<std::pair<double, size_t>> costs;
+  thread_local std::vector<std::pair<int, double>> seq;
+  costs.clear();
 
-  for (auto& it : state) {
-    auto fin = finals.find(it.where);
-    if (fin == finals.end()) continue;
+  for (size_t i = 0; i < state.size(); i++) {
+    auto fin = finals.find(state[i].where);
+    if (fin == nullptr) continue;
+    double cost = fin->weight;
+    if (!output_weights.empty()) {
+      getSequence(state[i].sequence, seq);
+      for (auto& step : seq) {
+        cost += step.second;
+      }
+    }
+    costs.push_back({cost, i});
+  }
+
+  selectNFinals(costs, max_analyses, max_weight_classes);
+
+  result.clear();
+  weights.clear();
+  UString temp;
+  for (auto& it : costs) {
+    auto& path = state[it.second];
     temp.clear();
-    cost = fin->second;
-    for (auto& step : *(it.sequence)) {
-      if (escaped_chars.find(step.first) != escaped_chars.end()) temp += '\\';
-      alphabet.getSymbol(temp, step.first, it.dirty && uppercase);
-      cost += step.second;
+    getSequence(path.sequence, seq);
+    for (auto& step : seq) {
+      if (escaped_chars.contains(step.first)) temp += '\\';
+      alphabet.getSymbol(temp, step.first, path.dirty && uppercase);
     }
-    if (it.dirty && firstupper) {
+    if (path.dirty && firstupper) {
       int loc = firstchar;
       if (temp[loc] == '~') loc++; // skip post-generation mark
       temp[loc] = u_toupper(temp[loc]);
     }
-    response.push_back({temp, cost});
+    // there are few analyses, fewer than it takes a set to pay off
+    if (std::find(result.begin(), result.end(), temp) != result.end()) continue;
+    result.push_back(temp);
+    weights.push_back(it.first);
   }
+}
 
-  response = NFinals(response, max_analyses, max_weight_classes);
+void
+State::filterFinalsArray(std::vector<UString>& result,
+                         FinalTable const &finals,
+                         Alphabet const &alphabet,
+                         CharSet const &escaped_chars,
+                         bool display_weights,
+                         int max_analyses, int max_weight_classes,
+                         bool uppercase, bool firstupper, int firstchar) const
+{
+  thread_local std::vector<double> weights;
+  filterFinalsArray(result, weights, finals, alphabet, escaped_chars,
+                    max_analyses, max_weight_classes, uppercase, firstupper,
+                    firstchar);
+  if (display_weights) {
+    for (size_t i = 0; i < result.size(); i++) {
+      UChar w[16]{};
+      // if anyone wants a weight of 10000, this will not be enough
+      u_sprintf(w, "<W:%f>", weights[i]);
+      result[i] += w;
+    }
+  }
+}
+
+void
+State::filterFinalsInto(UString& result,
+                        std::vector<size_t>& ends,
+                        FinalTable const &finals,
+                        Alphabet const &alphabet,
+                        CharSet const &escaped_chars,
+                        bool display_weights,
+                        int max_analyses, int max_weight_classes,
+                        bool uppercase, bool firstupper, int firstchar) const
+{
+  thread_local std::vector<std::pair<double, size_t>> costs;
+  thread_local std::vector<std::pair<int, double>> seq;
+  // the results without weights, which is what tells them apart
+  thread_local UString texts;
+  thread_local std::vector<size_t> text_ends;
+  thread_local std::vector<double> weights;
+  costs.clear();
+
+  for (size_t i = 0; i < state.size(); i++) {
+    auto fin = finals.find(state[i].where);
+    if (fin == nullptr) continue;
+    double cost = fin->weight;
+    if (!output_weights.empty()) {
+      getSequence(state[i].sequence, seq);
+      for (auto& step : seq) {
+        cost += step.second;
+      }
+    }
+    costs.push_back({cost, i});
+  }
+
+  selectNFinals(costs, max_analyses, max_weight_classes);
+
+  texts.clear();
+  text_ends.clear();
+  weights.clear();
+  for (auto& it : costs) {
+    auto& path = state[it.second];
+    size_t const start = texts.size();
+    getSequence(path.sequence, seq);
+    for (auto& step : seq) {
+      if (escaped_chars.contains(step.first)) texts += '\\';
+      alphabet.getSymbol(texts, step.first, path.dirty && uppercase);
+    }
+    if (path.dirty && firstupper) {
+      size_t loc = start + firstchar;
+      if (texts[loc] == '~') loc++; // skip post-generation mark
+      texts[loc] = u_toupper(texts[loc]);
+    }
+    UStringView text = UStringView(texts).substr(start);
+    bool seen = false;
+    for (size_t i = 0, from = 0; i < text_ends.size() && !seen; from = text_ends[i++]) {
+      seen = UStringView(texts).substr(from, text_ends[i] - from) == text;
+    }
+    if (seen) {
+      texts.resize(start);
+      continue;
+    }
+    text_ends.push_back(texts.size());
+    weights.push_back(it.first);
+  }
 
   result.clear();
-  sorted_vector<UString> seen;
-  for (auto& it : response) {
-    if (!seen.insert(it.first).second) continue;
-    result.push_back(it.first);
+  ends.clear();
+  for (size_t i = 0, from = 0; i < text_ends.size(); from = text_ends[i++]) {
+    result.append(texts, from, text_ends[i] - from);
     if (display_weights) {
       UChar w[16]{};
-      // if anyone wants a weight of 10000, this will not be enough
-      u_sprintf(w, "<W:%f>", it.second);
-      result.back() += w;
+      u_sprintf(w, "<W:%f>", weights[i]);
+      result += w;
     }
+    ends.push_back(result.size());
   }
 }
 
 UString
-State::filterFinals(std::map<Node *, double> const &finals,
+State::filterFinals(FinalTable const &finals,
                     Alphabet const &alphabet,
-                    std::set<UChar32> const &escaped_chars,
+                    CharSet const &escaped_chars,
                     bool display_weights, int max_analyses, int max_weight_classes,
                     bool uppercase, bool firstupper, int firstchar) const
 {
@@ -554,31 +1243,33 @@ State::filterFinals(std::map<Node *, double> const &finals,
 
 
 std::set<std::pair<UString, std::vector<UString> > >
-State::filterFinalsLRX(std::map<Node *, double> const &finals,
+State::filterFinalsLRX(FinalTable const &finals,
                        Alphabet const &alphabet,
-                       std::set<UChar32> const &escaped_chars,
+                       CharSet const &escaped_chars,
                        bool uppercase, bool firstupper, int firstchar) const
 {
   std::set<std::pair<UString, std::vector<UString> > > results;
 
   std::vector<UString> current_result;
+  std::vector<std::pair<int, double>> seq;
   UString rule_id;
 
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
-    if(finals.find(state[i].where) != finals.end())
+    if(finals.isFinal(state[i].where))
     {
       current_result.clear();
       rule_id.clear();
       UString current_word;
-      for(size_t j = 0, limit2 = state[i].sequence->size(); j != limit2; j++)
+      getSequence(state[i].sequence, seq);
+      for(size_t j = 0, limit2 = seq.size(); j != limit2; j++)
       {
-        if(escaped_chars.find(((*(state[i].sequence))[j]).first) != escaped_chars.end())
+        if(escaped_chars.contains(seq[j].first))
         {
           current_word += '\\';
         }
         UString sym;
-        alphabet.getSymbol(sym, ((*(state[i].sequence))[j]).first, uppercase);
+        alphabet.getSymbol(sym, seq[j].first, uppercase);
         if(sym == u"<$>"_uv)
         {
           if(!current_word.empty())
@@ -602,37 +1293,39 @@ State::filterFinalsLRX(std::map<Node *, double> const &finals,
 
 
 UString
-State::filterFinalsSAO(std::map<Node *, double> const &finals,
+State::filterFinalsSAO(FinalTable const &finals,
                        Alphabet const &alphabet,
-                       std::set<UChar32> const &escaped_chars,
+                       CharSet const &escaped_chars,
                        bool uppercase, bool firstupper, int firstchar) const
 {
   UString result;
   UString annot;
+  std::vector<std::pair<int, double>> seq;
 
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
-    if(finals.find(state[i].where) != finals.end())
+    if(finals.isFinal(state[i].where))
     {
       result += '/';
       unsigned int const first_char = result.size() + firstchar;
-      for(size_t j = 0, limit2 = state[i].sequence->size(); j != limit2; j++)
+      getSequence(state[i].sequence, seq);
+      for(size_t j = 0, limit2 = seq.size(); j != limit2; j++)
       {
-        if(escaped_chars.find(((*(state[i].sequence))[j]).first) != escaped_chars.end())
+        if(escaped_chars.contains(seq[j].first))
         {
           result += '\\';
         }
-        if(alphabet.isTag(((*(state[i].sequence))[j]).first))
+        if(alphabet.isTag(seq[j].first))
         {
           annot.clear();
-          alphabet.getSymbol(annot, ((*(state[i].sequence))[j]).first);
+          alphabet.getSymbol(annot, seq[j].first);
           result += '&';
           result += annot.substr(1,annot.length()-2);
           result += ';';
         }
         else
         {
-          alphabet.getSymbol(result, ((*(state[i].sequence))[j]).first, uppercase);
+          alphabet.getSymbol(result, seq[j].first, uppercase);
         }
       }
       if(firstupper)
@@ -654,110 +1347,92 @@ State::filterFinalsSAO(std::map<Node *, double> const &finals,
 }
 
 UString
-State::filterFinalsTM(std::map<Node *, double> const &finals,
+State::filterFinalsTM(FinalTable const &finals,
                       Alphabet const &alphabet,
-                      std::set<UChar32> const &escaped_chars,
-                      std::queue<UString> &blankqueue, std::vector<UString> &numbers) const
+                      CharSet const &escaped_chars,
+                      BlankQueue &blankqueue, std::vector<UString> &numbers) const
 {
   UString result;
+  std::vector<std::pair<int, double>> seq;
 
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
-    if(finals.find(state[i].where) != finals.end())
+    if(finals.isFinal(state[i].where))
     {
       result += '/';
-      for(size_t j = 0, limit2 = state[i].sequence->size(); j != limit2; j++)
+      getSequence(state[i].sequence, seq);
+      for(size_t j = 0, limit2 = seq.size(); j != limit2; j++)
       {
-        if(escaped_chars.find((*(state[i].sequence))[j].first) != escaped_chars.end())
+        if(escaped_chars.contains(seq[j].first))
         {
           result += '\\';
         }
-        alphabet.getSymbol(result, (*(state[i].sequence))[j].first);
+        alphabet.getSymbol(result, seq[j].first);
       }
     }
   }
 
 
-  UString result2;
-  std::vector<UString> fragment;
-  fragment.push_back(""_u);
-
-  for(unsigned int i = 0, limit = result.size(); i != limit ; i++)
+  // every ')' closes a placeholder: "(#)" for the next blank of the
+  // input, "\@(N)" for its Nth number, and otherwise it stays; one pass
+  // writes the result with them replaced
+  UString out;
+  out.reserve(result.size());
+  size_t fragment = 0;
+  for(size_t i = 0, limit = result.size(); i != limit; i++)
   {
-    if(result[i] == ')')
-    {
-      fragment.push_back(""_u);
-    }
-    else
+    if(result[i] != ')')
     {
-      fragment[fragment.size()-1] += result[i];
+      out += result[i];
+      continue;
     }
-  }
 
-  for(unsigned int i = 0, limit = fragment.size(); i != limit; i++)
-  {
-    if(i != limit -1)
+    size_t const size = out.size();
+    if(size - fragment >= 2 && out[size-2] == '(' && out[size-1] == '#')
     {
-      if(fragment[i].size() >=2 && StringUtils::endswith(fragment[i], u"(#"))
+      out.resize(size - 2);
+      if(blankqueue.empty())
       {
-        UString whitespace = " "_u;
-        if(blankqueue.size() != 0)
-        {
-          whitespace = blankqueue.front().substr(1);
-          blankqueue.pop();
-          whitespace = whitespace.substr(0, whitespace.size() - 1);
-        }
-        fragment[i] = fragment[i].substr(0, fragment[i].size()-2) +
-                        whitespace;
+        out += ' ';
       }
       else
       {
-        bool substitute = false;
-        for(int j = fragment[i].size() - 1; j >= 0; j--)
+        UStringView blank = blankqueue.front();
+        if(blank.size() >= 2)
         {
-          if(fragment[i].size()-j > 3 && fragment[i][j] == '\\' &&
-             fragment[i][j+1] == '@' && fragment[i][j+2] == '(')
-          {
-            int num = 0;
-            bool correct = true;
-            for(unsigned int k = (unsigned int) j+3, limit2 = fragment[i].size();
-                k != limit2; k++)
-            {
-              if(u_isdigit(fragment[i][k]))
-              {
-                num = num * 10;
-                num += (int) fragment[i][k] - 48;
-              }
-              else
-              {
-                correct = false;
-                break;
-              }
-            }
-            if(correct)
-            {
-              fragment[i] = fragment[i].substr(0, j) + numbers[num - 1];
-              substitute = true;
-              break;
-            }
-          }
-        }
-        if(substitute == false)
-        {
-          fragment[i] += ')';
+          out.append(blank.substr(1, blank.size() - 2));
         }
+        blankqueue.pop();
       }
+      fragment = out.size();
+      continue;
     }
-  }
-
-  result.clear();
 
-  for(unsigned int i = 0, limit = fragment.size(); i != limit; i++)
-  {
-    result += fragment[i];
+    size_t digits = size;
+    size_t num = 0;
+    while(digits > fragment && u_isdigit(out[digits-1]))
+    {
+      digits--;
+    }
+    for(size_t k = digits; k != size && num <= numbers.size(); k++)
+    {
+      num = num * 10 + (out[k] - '0');
+    }
+    if(digits != size && digits - fragment >= 3 && out[digits-3] == '\\' &&
+       out[digits-2] == '@' && out[digits-1] == '(' &&
+       num >= 1 && num <= numbers.size())
+    {
+      out.resize(digits - 3);
+      out += numbers[num - 1];
+    }
+    else
+    {
+      out += ')';
+    }
+    fragment = out.size();
   }
 
-  return result;
+  return out;
 }
 
 
@@ -767,12 +1442,13 @@ State::pruneCompounds(int requiredSymbol, int separationSymbol, int compound_max
 {
   int minNoOfCompoundElements = compound_max_elements;
   int *noOfCompoundElements = new int[state.size()];
+  std::vector<std::pair<int, double>> seq;
 
   for(unsigned int i = 0; i<state.size(); i++)
   {
-    std::vector<std::pair<int, double>> seq = *state.at(i).sequence;
+    getSequence(state.at(i).sequence, seq);
 
-    if(lastPartHasRequiredSymbol(seq, requiredSymbol, separationSymbol))
+    if(lastPartHasRequiredSymbol(state.at(i).sequence, requiredSymbol, separationSymbol))
     {
       int this_noOfCompoundElements = 0;
       for (int j = seq.size()-2; j>0; j--) if ((seq.at(j)).first==separationSymbol) this_noOfCompoundElements++;
@@ -793,7 +1469,6 @@ State::pruneCompounds(int requiredSymbol, int separationSymbol, int compound_max
   {
     if(noOfCompoundElements[i] > minNoOfCompoundElements)
     {
-      delete (*it).sequence;
       it = state.erase(it);
     }
     else
@@ -814,19 +1489,20 @@ State::pruneStatesWithForbiddenSymbol(int forbiddenSymbol)
   auto it = state.begin();
   while(it != state.end())
   {
-    std::vector<std::pair<int, double>> *seq = (*it).sequence;
     bool found = false;
-    for(int i = seq->size()-1; i>=0; i--)
+    for(int32_t i = (*it).sequence; i != -1; i = outputs[i].parent)
     {
-      if((seq->at(i)).first == forbiddenSymbol)
+      if(outputs[i].symbol == forbiddenSymbol)
       {
-        i=-1;
-        delete (*it).sequence;
-        it = state.erase(it);
         found = true;
+        break;
       }
     }
-    if(!found)
+    if(found)
+    {
+      it = state.erase(it);
+    }
+    else
     {
       it++;
     }
@@ -840,11 +1516,9 @@ State::hasSymbol(int requiredSymbol)
   for(size_t i = 0; i<state.size(); i++)
   {
     // loop through sequence – we can't just check that the last tag is cp-L, there may be other tags after it:
-    std::vector<std::pair<int, double>>* seq = state.at(i).sequence;
-    if(seq != NULL) for (unsigned int j=0; j<seq->size(); j++)
+    for(int32_t j = state[i].sequence; j != -1; j = outputs[j].parent)
     {
-      int symbol=(seq->at(j)).first;
-      if(symbol == requiredSymbol)
+      if(outputs[j].symbol == requiredSymbol)
       {
         return true;
       }
@@ -854,14 +1528,86 @@ State::hasSymbol(int requiredSymbol)
 }
 
 
+void
+State::pruneDominatedCompounds(int requiredLSymbol, int requiredRSymbol,
+                               int separationSymbol)
+{
+  // number of parts and the required symbols in the last part of the
+  // sequence ending at every entry of outputs, worked out once per entry
+  // from its parent; the first output of a sequence does not count as a
+  // separation, as in pruneCompounds()
+  enum { part_known = 1, part_has_l = 2, part_has_r = 4 };
+  struct Part
+  {
+    int32_t elements;
+    uint32_t flags;
+  };
+  std::vector<Part> parts(outputs.size(), {0, 0});
+  std::vector<int32_t> pending;
+  auto partOf = [&](int32_t seq) {
+    for(int32_t n = seq; n != -1 && parts[n].flags == 0; n = outputs[n].parent)
+    {
+      pending.push_back(n);
+    }
+    while(!pending.empty())
+    {
+      int32_t n = pending.back();
+      pending.pop_back();
+      int32_t parent = outputs[n].parent;
+      Part base = (parent == -1) ? Part{0, part_known} : parts[parent];
+      int symbol = outputs[n].symbol;
+      if(symbol == separationSymbol)
+      {
+        parts[n] = {base.elements + (parent != -1 ? 1 : 0), part_known};
+      }
+      else
+      {
+        parts[n] = {base.elements, base.flags |
+                                   (symbol == requiredLSymbol ? part_has_l : 0) |
+                                   (symbol == requiredRSymbol ? part_has_r : 0)};
+      }
+    }
+    return seq == -1 ? Part{0, part_known} : parts[seq];
+  };
+
+  // nodes are aligned, which leaves the low bits of their address for
+  // the flags and the case
+  std::vector<std::pair<uintptr_t, int32_t>> keys;
+  std::unordered_map<uintptr_t, int32_t> fewest;
+  keys.reserve(state.size());
+  for(auto& it : state)
+  {
+    Part part = partOf(it.sequence);
+    uintptr_t key = reinterpret_cast<uintptr_t>(it.where) |
+                    ((part.flags & (part_has_l | part_has_r)) >> 1) |
+                    (it.dirty ? 4 : 0);
+    keys.push_back({key, part.elements});
+    auto ins = fewest.insert({key, part.elements});
+    if(!ins.second && part.elements < ins.first->second)
+    {
+      ins.first->second = part.elements;
+    }
+  }
+
+  size_t kept = 0;
+  for(size_t i = 0; i < state.size(); i++)
+  {
+    if(keys[i].second == fewest[keys[i].first])
+    {
+      state[kept++] = state[i];
+    }
+  }
+  state.erase(state.begin() + kept, state.end());
+}
+
 bool
-State::lastPartHasRequiredSymbol(const std::vector<std::pair<int, double>> &seq, int requiredSymbol, int separationSymbol)
+State::lastPartHasRequiredSymbol(int32_t seq, int requiredSymbol, int separationSymbol) const
 {
   // state is final - it should be restarted it with all elements in stateset restart_state, with old symbols conserved
   bool restart=false;
-  for(int n=seq.size()-1; n>=0; n--)
+  for(int32_t n = seq; n != -1; n = outputs[n].parent)
   {
-    int symbol=(seq.at(n)).first;
+    int symbol=outputs[n].symbol;
     if(symbol==requiredSymbol)
     {
       restart=true;
@@ -877,7 +1623,7 @@ State::lastPartHasRequiredSymbol(const std::vector<std::pair<int, double>> &seq,
 
 
 void
-State::restartFinals(const std::map<Node *, double> &finals, int requiredSymbol, State *restart_state, int separationSymbol)
+State::restartFinals(FinalTable const &finals, int requiredSymbol, State *restart_state, int separationSymbol)
 {
 
   for(unsigned int i=0;  i<state.size(); i++)
@@ -885,25 +1631,19 @@ State::restartFinals(const std::map<Node *, double> &finals, int requiredSymbol,
     TNodeState state_i = state.at(i);
     // A state can be a possible final state and still have transitions
 
-    if(finals.count(state_i.where) > 0)
+    if(finals.isFinal(state_i.where))
     {
-      bool restart = lastPartHasRequiredSymbol(*(state_i.sequence), requiredSymbol, separationSymbol);
+      bool restart = lastPartHasRequiredSymbol(state_i.sequence, requiredSymbol, separationSymbol);
       if(restart)
       {
         if(restart_state != NULL)
         {
+          // all the restarted paths share the same sequence
+          int32_t seq = pushOutput(state_i.sequence, separationSymbol, 0.0);
           for(unsigned int j=0; j<restart_state->state.size(); j++)
           {
             TNodeState initst = restart_state->state.at(j);
-            std::vector<std::pair<int, double>> *tnvec = new std::vector<std::pair<int, double>>;
-
-            for(unsigned int k=0; k < state_i.sequence->size(); k++)
-            {
-              tnvec->push_back(state_i.sequence->at(k));
-            }
-            TNodeState tn(initst.where, tnvec, state_i.dirty);
-            tn.sequence->push_back({separationSymbol, 0.0});
-            state.push_back(tn);
+            state.push_back(TNodeState(initst.where, seq, state_i.dirty));
           }
         }
       }
@@ -917,15 +1657,16 @@ UString
 State::getReadableString(const Alphabet &a)
 {
   UString retval;
+  std::vector<std::pair<int, double>> seq;
   retval += '[';
 
   for(unsigned int i=0; i<state.size(); i++)
   {
-    std::vector<std::pair<int, double>>* seq = state.at(i).sequence;
-    if(seq != NULL) for (unsigned int j=0; j<seq->size(); j++)
+    getSequence(state.at(i).sequence, seq);
+    for (unsigned int j=0; j<seq.size(); j++)
     {
       UString ws;
-      a.getSymbol(ws, (seq->at(j)).first);
+      a.getSymbol(ws, seq[j].first);
       retval.append(ws);
     }
 
@@ -942,10 +1683,20 @@ State::getReadableString(const Alphabet &a)
 void
 State::merge(const State& other)
 {
+  if (this == &other) {
+    State tmp(other);
+    merge(tmp);
+    return;
+  }
+  int32_t offset = outputs.size();
+  for (size_t i = 0; i < other.outputs.size(); i++) {
+    auto& it = other.outputs[i];
+    pushOutput((it.parent == -1 ? -1 : it.parent + offset), it.symbol,
+               other.outputWeight(i));
+  }
   for (auto& it : other.state) {
-    std::vector<std::pair<int, double>>* tmp = new std::vector<std::pair<int, double>>();
-    *tmp = *(it.sequence);
-    TNodeState ns(it.where, tmp, it.dirty);
+    TNodeState ns(it.where, (it.sequence == -1 ? -1 : it.sequence + offset),
+                  it.dirty);
     this->state.push_back(std::move(ns));
   }
 }
@@ -21,10 +21,15 @@
 #include <set>
 #include <string>
 #include <vector>
-#include <queue>
+#include <atomic>
 #include <climits>
+#include <cstdint>
 
 #include <lttoolbox/alphabet.h>
+#include <lttoolbox/blank_queue.h>
+#include <lttoolbox/char_set.h>
+#include <lttoolbox/epsilon_table.h>
+#include <lttoolbox/final_table.h>
 #include <lttoolbox/node.h>
 #include <lttoolbox/match_exe.h>
 #include <lttoolbox/match_state.h>
@@ -39,35 +44,239 @@
 class State
 {
 private:
+  /**
+   * One entry of the output trie: the output symbol of a transition and
+   * the index of the entry that precedes it (or -1)
+   */
+  struct TOutput
+  {
+    int32_t parent;
+    int32_t symbol;
+  };
+
   /**
    * The current state of transducer processing
    */
   struct TNodeState
   {
     Node *where;
-    std::vector<std::pair<int, double>> *sequence;
+    /**
+     * Index in outputs of the last output symbol of this path, -1 if empty
+     */
+    int32_t sequence;
     // a state is "dirty" if it was introduced at runtime (case variants, etc.)
     bool dirty;
 
-    TNodeState(Node * const &w, std::vector<std::pair<int, double>> * const &s, bool const &d): where(w), sequence(s), dirty(d){}
-
-    TNodeState(const TNodeState& other)
-      : where(other.where)
-      , sequence(other.sequence)
-      , dirty(other.dirty)
-    {}
-
-    TNodeState & operator=(TNodeState const &other)
-    {
-      where = other.where;
-      sequence = other.sequence;
-      dirty = other.dirty;
-      return *this;
-    }
+    TNodeState(Node * const &w, int32_t const s, bool const &d): where(w), sequence(s), dirty(d){}
   };
 
+  /**
+   * Output trie shared by all the paths of this state, so that a new
+   * path only appends one entry instead of copying the whole sequence.
+   * Entries are never removed individually: the trie is released in bulk
+   * when the state is reinitialised or assigned.
+   */
+  std::vector<TOutput> outputs;
+
+  /**
+   * Weights of the entries of outputs, empty for as long as they are all
+   * 0, which in unweighted transducers is always; once an entry has a
+   * weight it has one for every entry
+   * @see outputWeight
+   */
+  std::vector<double> output_weights;
+
+  /**
+   * Accumulated weights of the sequences ending at the entries of
+   * outputs, kept alongside output_weights while there is a best bound
+   * @see setBest
+   */
+  std::vector<double> output_costs;
+
   std::vector<TNodeState> state;
 
+  /**
+   * The paths of the last state but one, kept for their storage: the
+   * apply()s build the new paths here and swap them in, so that once the
+   * vectors have grown, neither stepping nor assigning initial states
+   * allocates anything
+   */
+  std::vector<TNodeState> spare;
+
+  /**
+   * Precomputed epsilon closures, if any; nodes it does not cover have
+   * their epsilon transitions searched at every step
+   */
+  EpsilonTable const *epsilons = nullptr;
+
+public:
+  /**
+   * Limit on the number of paths kept after every step, see setBeam()
+   */
+  struct Beam
+  {
+    /**
+     * Most paths to keep, 0 for no limit
+     */
+    size_t max_paths = 0;
+
+    /**
+     * Most of the kept paths with the same output so far, 0 for no limit
+     */
+    size_t max_per_output = 0;
+
+    /**
+     * Number of steps that had to drop paths
+     */
+    std::atomic<uint64_t> triggered{0};
+  };
+
+  /**
+   * The analyses the finals of the paths will be filtered to, see
+   * setBest()
+   */
+  struct Best
+  {
+    /**
+     * Most analyses, 0 for no limit
+     */
+    size_t max_analyses = 0;
+
+    /**
+     * Most weight classes, 0 for no limit; only valid if no weight of
+     * the transducers is negative
+     */
+    size_t max_weight_classes = 0;
+  };
+
+  /**
+   * Counters of the work done by the steps, see setStats()
+   */
+  struct Stats
+  {
+    /**
+     * Number of steps
+     */
+    std::atomic<uint64_t> steps{0};
+
+    /**
+     * Paths alive after every step, summed over the steps
+     */
+    std::atomic<uint64_t> paths{0};
+
+    /**
+     * Most paths alive after a step
+     */
+    std::atomic<uint64_t> max_paths{0};
+
+    /**
+     * Paths added by following epsilon transitions
+     */
+    std::atomic<uint64_t> epsilon_paths{0};
+
+    /**
+     * Bytes of output trie added by the steps
+     */
+    std::atomic<uint64_t> output_bytes{0};
+  };
+
+  /**
+   * Number of times the steps reached every node of some transducers,
+   * and took every transition of them, see setProfile()
+   */
+  struct Profile
+  {
+    /**
+     * Only one step in period is counted, in every thread
+     */
+    uint32_t period = 1;
+
+    /**
+     * The nodes of every transducer counted
+     */
+    std::vector<std::pair<Node const *, size_t>> transducers;
+
+    /**
+     * The counts of the nodes of every transducer
+     */
+    std::vector<std::vector<std::atomic<uint64_t>>> visits;
+
+    /**
+     * For every transducer, the index in arcs of the first transition
+     * of every node, and of the end after the last node
+     */
+    std::vector<std::vector<size_t>> first_arc;
+
+    /**
+     * The counts of the transitions of every transducer, those of every
+     * node in the order they are looked up in, by input symbol
+     */
+    std::vector<std::vector<std::atomic<uint64_t>>> arcs;
+
+    /**
+     * Count the nodes of a transducer as well
+     * @param nodes the first node
+     * @param size number of nodes
+     */
+    void add(Node const *nodes, size_t size);
+
+    /**
+     * Count a visit to node, if it is one of a transducer added
+     */
+    void count(Node const *node);
+
+    /**
+     * Count the transition number arc of node, if it is one of a
+     * transducer added
+     */
+    void countArc(Node const *node, uint32_t arc);
+
+    /**
+     * Whether the next step of this thread is to be counted
+     */
+    bool sample();
+  };
+
+private:
+  Beam *beam = nullptr;
+
+  Best *best = nullptr;
+
+  Stats *stats = nullptr;
+
+  Profile *profile = nullptr;
+
+  /**
+   * True if the step being taken is counted in profile
+   */
+  bool sampled = false;
+
+  /**
+   * Entries of outputs already added to stats->output_bytes
+   */
+  size_t outputs_counted = 0;
+
+  /**
+   * Update the statistics and apply the beam, if any, at the end of a step
+   */
+  void limitPaths();
+
+  /**
+   * Keep the beam->max_paths paths of least accumulated weight, taking
+   * no more than beam->max_per_output of those that share their output
+   */
+  void applyBeam();
+
+  /**
+   * Drop the paths that cannot be among the best analyses, see setBest()
+   */
+  void applyBest();
+
+  /**
+   * Count in profile the count transitions of where starting at d
+   */
+  void countArcs(Node const *where, Dest const *d, uint32_t count);
+
   /**
    * Destroy function
    */
@@ -75,11 +284,14 @@ private:
 
   /**
    * Helper functions for the various apply()s to reduce code duplication
+   * @param upper input is an uppercase letter whose lowercase is looked
+   *              up as well, so nodes without uppercase transitions can be
+   *              skipped
    * @return whether any transitions were made
    */
-  bool apply_into(std::vector<TNodeState>* new_state, int const input, int index, bool dirty);
+  bool apply_into(std::vector<TNodeState>* new_state, int const input, int index, bool dirty, bool upper = false);
 
-  bool apply_into_override(std::vector<TNodeState>* new_state, int const input, int const old_sym, int const new_sym, int index, bool dirty);
+  bool apply_into_override(std::vector<TNodeState>* new_state, int const input, int const old_sym, int const new_sym, int index, bool dirty, bool upper = false);
 
   /**
    * Make a transition, version for lowercase letters and symbols
@@ -99,9 +311,12 @@ private:
   /**
    * Make a transition, with multiple possibilities
    * @param input the input symbol
-   * @param alts set of alternative input symbols
+   * @param alts alternative input symbols, each once
+   * @param equivalents how many of alts, at their start, are taken as
+   *        the input itself rather than marking the paths dirty
    */
-  void apply(int const input, std::set<int> const alts);
+  void apply(int const input, std::vector<int32_t> const &alts,
+             size_t equivalents = 0);
 
   /**
    * Make a transition, only applying lowercase version if
@@ -111,6 +326,16 @@ private:
    */
   void apply_careful(int const input, int const alt);
 
+  /**
+   * Make a transition on an uppercase letter and, as case variants, on
+   * its lowercase, searching only once the nodes that have no uppercase
+   * transitions
+   * @param input the uppercase letter
+   * @param lower its lowercase
+   * @param careful only follow the lowercase if the uppercase is absent
+   */
+  void apply_case(int const input, int const lower, bool const careful);
+
   /**
    * Make a transition, but overriding the output symbol
    * @param input symbol
@@ -119,7 +344,7 @@ private:
    */
   void apply_override(int const input, int const old_sym, int const new_sym);
 
-  void apply_override(int const input, int const alt, int const old_sym, int const new_sym);
+  void apply_override(int const input, int const alt, int const old_sym, int const new_sym, bool const upper = false);
 
   /**
    * Calculate the epsilon closure over the current state, replacing
@@ -127,7 +352,35 @@ private:
    */
   void epsilonClosure();
 
-  bool lastPartHasRequiredSymbol(const std::vector<std::pair<int, double>> &seq, int requiredSymbol, int separationSymbol);
+  /**
+   * epsilonClosure() from the closures in epsilons
+   * @return false, leaving the state as it was, if a path is at a node
+   *         whose closure is not in the table
+   */
+  bool tableClosure();
+
+  /**
+   * Add an output symbol after the sequence ending at parent
+   * @return the index of the new sequence
+   */
+  int32_t pushOutput(int32_t parent, int32_t symbol, double weight);
+
+  /**
+   * Weight of the entry n of outputs
+   */
+  double outputWeight(int32_t n) const
+  {
+    return output_weights.empty() ? 0.0 : output_weights[n];
+  }
+
+  /**
+   * Read the output sequence ending at seq, first symbol first
+   * @param seq index in outputs of the last symbol of the sequence
+   * @param result vector to fill, previous contents are discarded
+   */
+  void getSequence(int32_t seq, std::vector<std::pair<int, double>> &result) const;
+
+  bool lastPartHasRequiredSymbol(int32_t seq, int requiredSymbol, int separationSymbol) const;
 
 public:
 
@@ -167,6 +420,28 @@ public:
    */
   size_t size() const;
 
+  /**
+   * Bytes taken by the paths and the output trie, which keep the size
+   * of the most paths and outputs the state had at once
+   */
+  size_t memoryUsage() const;
+
+  /**
+   * Drop every path, as a step on a symbol no path can take would
+   */
+  void clear();
+
+  /**
+   * Work out which characters the paths of the state can be stepped with
+   * at each of the next positions, so that a step that would drop every
+   * path can be told from the character alone.  chars[i] gets the
+   * characters of the transitions taken after i steps, for i < depth;
+   * chars[depth] those taken after depth steps or more.
+   * @param chars the sets, depth + 1 of them
+   * @param depth positions told apart
+   */
+  void reachableChars(std::vector<CharSet> &chars, size_t depth) const;
+
   /**
    * step = apply + epsilonClosure
    * @param input the input symbol
@@ -185,9 +460,11 @@ public:
   /**
    * step = apply + epsilonClosure
    * @param input the input symbol
-   * @param alt the alternative input symbols
+   * @param alts the alternative input symbols, each once
+   * @param equivalents see apply()
    */
-  void step(int const input, std::set<int> const alts);
+  void step(int const input, std::vector<int32_t> const &alts,
+            size_t equivalents = 0);
 
   void step_case(UChar32 val, bool caseSensitive);
 
@@ -195,6 +472,12 @@ public:
 
   void step_careful(int const input, int const alt);
 
+  /**
+   * step_case(), but only following the lowercase of val on the paths
+   * that have no transition on val itself
+   */
+  void step_case_careful(UChar32 val, bool caseSensitive);
+
   void step_override(int const input, int const old_sym, int const new_sym);
 
   void step_override(int const input, int const alt, int const old_sym, int const new_sym);
@@ -211,6 +494,61 @@ public:
    */
   void init(Node *initial);
 
+  /**
+   * Init the state with a single path and its epsilon closure
+   * @param where the node the path is at
+   * @param sequence the output symbols of the path, with their weights
+   * @param dirty whether the path went through a case variant
+   */
+  void init(Node *where, std::vector<std::pair<int32_t, double>> const &sequence,
+            bool dirty);
+
+  /**
+   * Use precomputed epsilon closures from now on, also in the copies of
+   * this state
+   * @param table the closures, which have to outlive the state and its
+   *              copies, or nullptr to search every node
+   */
+  void setEpsilonTable(EpsilonTable const *table);
+
+  /**
+   * Bound the paths of this state and of its copies after every step,
+   * dropping the heaviest ones.  The paths dropped could have led to
+   * analyses, so this trades completeness for a bound on the work done
+   * per character.
+   * @param b the limits, which have to outlive the state and its copies,
+   *          or nullptr for no limit
+   */
+  void setBeam(Beam *b);
+
+  /**
+   * Drop after every step, in this state and its copies, the paths that
+   * cannot end up among the analyses filterFinals() keeps with the limits
+   * in b.  Whatever follows, a path has the same continuations as the
+   * other paths at its node, with the same weights: if b->max_analyses
+   * of them are lighter, or b->max_weight_classes of them are lighter
+   * and heavier than 0, all of its analyses are left out.  Unlike
+   * setBeam(), the analyses filtered are the same, as long as nothing
+   * but their weights tells the paths apart: not with the compound or
+   * symbol pruning functions, nor with other ways of filtering finals.
+   * @param b the limits, which have to outlive the state and its copies,
+   *          or nullptr for none
+   */
+  void setBest(Best *b);
+
+  /**
+   * Count the work of the steps of this state, and of the states copied
+   * from it, in s (nullptr to stop counting).  The counters are atomic so
+   * that states in different threads can share them.
+   */
+  void setStats(Stats *s);
+
+  /**
+   * Count the nodes the steps of this state, and of the states copied
+   * from it, reach in p (nullptr to stop counting)
+   */
+  void setProfile(Profile *p);
+
   /**
     * Remove states not containing a specific symbol in their last 'part', and states
     * with more than a number of 'parts'
@@ -220,6 +558,19 @@ public:
     */
   void pruneCompounds(int requiredSymbol, int separationSymbol, int compound_max_elements);
 
+  /**
+   * Remove the paths that cannot end up among those pruneCompounds()
+   * keeps, being at the same node as another path with fewer parts and
+   * the same case and required symbols in their last part: whatever
+   * follows, the other path will still have fewer parts.  Only valid
+   * while more input is to come.
+   * @param requiredLSymbol the symbol that lets a part be followed by another
+   * @param requiredRSymbol the symbol required in the last part
+   * @param separationSymbol the symbol that represent the separation between two parts
+   */
+  void pruneDominatedCompounds(int requiredLSymbol, int requiredRSymbol,
+                               int separationSymbol);
+
   /**
     * Remove states containing a forbidden symbol
     * @param forbiddenSymbol the symbol forbidden
@@ -255,10 +606,23 @@ public:
       }
   };
 
-  std::vector<std::pair< UString, double >> NFinals(std::vector<std::pair<UString, double>> lf,
+  std::vector<std::pair< UString, double >> NFinals(std::vector<std::pair<UString, double>> const &lf,
                                           int maxAnalyses,
                                           int maxWeightClasses) const;
 
+  /**
+   * The selection of NFinals on the costs of the candidates alone, so
+   * that only the surviving ones need to be rendered.  Candidates of
+   * equal cost keep their order, and only those that may survive are
+   * sorted.
+   * @param costs cost and position of every candidate, replaced by the
+   *              surviving ones from best to worst
+   * @param the max number of printable analyses
+   * @param the max number of printable weight classes
+   */
+  static void selectNFinals(std::vector<std::pair<double, size_t>> &costs,
+                            int maxAnalyses, int maxWeightClasses);
+
   /**
    * Print all outputs of current parsing, preceded by a bar '/',
    * from the final nodes of the state
@@ -271,9 +635,9 @@ public:
    * @param firstchar first character of the word
    * @return the result of the transduction
    */
-  UString filterFinals(std::map<Node *, double> const &finals,
+  UString filterFinals(FinalTable const &finals,
                        Alphabet const &a,
-                       std::set<UChar32> const &escaped_chars,
+                       CharSet const &escaped_chars,
                        bool display_weights = false,
                        int max_analyses = INT_MAX,
                        int max_weight_classes = INT_MAX,
@@ -281,13 +645,75 @@ public:
                        bool firstupper = false,
                        int firstchar = 0) const;
 
+  /**
+   * A path at a final node, as finalPaths() gives it
+   */
+  struct FinalPath
+  {
+    /**
+     * The output symbols, without epsilons
+     */
+    std::vector<int32_t> symbols;
+
+    /**
+     * Weight of the output and of the final node
+     */
+    double weight;
+
+    /**
+     * Whether the path was introduced at runtime (case variants, etc.)
+     */
+    bool dirty;
+  };
+
+  /**
+   * The paths at final nodes, unrendered, for the callers that carry on
+   * from their output
+   * @param finals the final nodes
+   * @param result vector to fill, previous contents are discarded
+   */
+  void finalPaths(FinalTable const &finals, std::vector<FinalPath> &result) const;
+
+  /**
+   * filterFinals(), but write the results into `result` and their
+   * weights into `weights`, in the same order
+   */
+  void filterFinalsArray(std::vector<UString>& result,
+                         std::vector<double>& weights,
+                         FinalTable const &finals,
+                         Alphabet const &a,
+                         CharSet const &escaped_chars,
+                         int max_analyses = INT_MAX,
+                         int max_weight_classes = INT_MAX,
+                         bool uppercase = false,
+                         bool firstupper = false,
+                         int firstchar = 0) const;
+
+  /**
+   * filterFinalsArray(), but write the results one after the other into
+   * `result`, the i-th ending at ends[i], so that storage kept from call
+   * to call is reused instead of allocating a string per result;
+   * previous contents of both are discarded
+   */
+  void filterFinalsInto(UString& result,
+                        std::vector<size_t>& ends,
+                        FinalTable const &finals,
+                        Alphabet const &a,
+                        CharSet const &escaped_chars,
+                        bool display_weights = false,
+                        int max_analyses = INT_MAX,
+                        int max_weight_classes = INT_MAX,
+                        bool uppercase = false,
+                        bool firstupper = false,
+                        int firstchar = 0) const;
+
   /**
    * filterFinals(), but write the results into `result`
    */
   void filterFinalsArray(std::vector<UString>& result,
-                         std::map<Node *, double> const &finals,
+                         FinalTable const &finals,
                          Alphabet const &a,
-                         std::set<UChar32> const &escaped_chars,
+                         CharSet const &escaped_chars,
                          bool display_weights = false,
                          int max_analyses = INT_MAX,
                          int max_weight_classes = INT_MAX,
@@ -306,9 +732,9 @@ public:
    * @param firstchar first character of the word
    * @return the result of the transduction
    */
-  UString filterFinalsSAO(std::map<Node *, double> const &finals,
+  UString filterFinalsSAO(FinalTable const &finals,
                           Alphabet const &a,
-                          std::set<UChar32> const &escaped_chars,
+                          CharSet const &escaped_chars,
                           bool uppercase = false,
                           bool firstupper = false,
                           int firstchar = 0) const;
@@ -326,9 +752,9 @@ public:
    * @return the result of the transduction
    */
 
-  std::set<std::pair<UString, std::vector<UString> > > filterFinalsLRX(std::map<Node *, double> const &finals,
+  std::set<std::pair<UString, std::vector<UString> > > filterFinalsLRX(FinalTable const &finals,
                                                         Alphabet const &a,
-                                                        std::set<UChar32> const &escaped_chars,
+                                                        CharSet const &escaped_chars,
                                                         bool uppercase = false,
                                                         bool firstupper = false,
                                                         int firstchar = 0) const;
@@ -345,7 +771,7 @@ public:
    * @param restart_state
    * @param separationSymbol
    */
-    void restartFinals(const std::map<Node *, double> &finals, int requiredSymbol, State *restart_state, int separationSymbol);
+    void restartFinals(FinalTable const &finals, int requiredSymbol, State *restart_state, int separationSymbol);
 
 
   /**
@@ -354,17 +780,32 @@ public:
    * @param finals set of final nodes @return
    * @true if the state is final
    */
-  bool isFinal(std::map<Node *, double> const &finals) const;
+  bool isFinal(FinalTable const &finals) const;
+
+  /**
+   * Bit set in the result of finalClasses() whenever the state is final,
+   * whatever the classes of its final nodes
+   */
+  static constexpr unsigned int final_any = 1u << 31;
+
+  /**
+   * Classes of the final nodes the records of the state reference, in
+   * one pass over the records
+   * @param finals the final nodes
+   * @return the union of their FinalTable::Class values, plus final_any
+   *         if there are any; 0 if the state is not final
+   */
+  unsigned int finalClasses(FinalTable const &finals) const;
 
   /**
    * Return the full states string (to allow debuging...) using a Java ArrayList.toString style
    */
   UString getReadableString(const Alphabet &a);
 
-  UString filterFinalsTM(std::map<Node *, double> const &finals,
+  UString filterFinalsTM(FinalTable const &finals,
                          Alphabet const &alphabet,
-                         std::set<UChar32> const &escaped_chars,
-                         std::queue<UString> &blanks,
+                         CharSet const &escaped_chars,
+                         BlankQueue &blanks,
                          std::vector<UString> &numbers) const;
 
   /**
@@ -25,26 +25,30 @@ void StreamReader::next() {
   blank.clear();
   wblank.clear();
   readings.clear();
+  reading_views.clear();
+  contents.clear();
+  symbol_buffer.clear();
+  starts.clear();
   chunk.clear();
 
   if (at_eof) return;
 
   at_null = false;
 
-  blank = in->readBlank(false);
-
-  UChar32 c = in->get();
-
-  if (c == '[') {
+  UChar32 c;
+  while (true) {
+    blank += in->readBlank(false);
+    c = in->get();
+    if (c != '[') break;
     in->get();
     wblank = in->finishWBlank();
-    if (in->peek() != '^') {
-      UString temp = blank + wblank;
-      next();
-      blank = temp + blank;
-      return;
+    if (in->peek() == '^') {
+      c = in->get();
+      break;
     }
-    c = in->get();
+    // a wordbound blank not followed by a unit is just blank
+    blank += wblank;
+    wblank.clear();
   }
 
   if (c == '\0') {
@@ -58,41 +62,61 @@ void StreamReader::next() {
   }
 
   while (c != '$' && c != '\0' && !in->eof()) {
-    readings.resize(readings.size()+1);
-    auto& cur = readings.back();
+    UChar32 mark = '\0';
     c = in->peek();
     if (c == '*' || c == '@' || c == '#' || c == '=' || c == '%') {
       in->get();
-      cur.mark = c;
+      mark = c;
+    }
+    UString* content = &contents;
+    std::vector<int32_t>* symbols = &symbol_buffer;
+    if (views) {
+      starts.push_back({contents.size(), symbol_buffer.size()});
+      reading_views.resize(reading_views.size()+1);
+      reading_views.back().mark = mark;
+    } else {
+      readings.resize(readings.size()+1);
+      readings.back().mark = mark;
+      content = &readings.back().content;
+      symbols = &readings.back().symbols;
     }
     c = in->get();
     while (c != '/' && c != '$' && c != '\0' && !in->eof()) {
       if (c == '<') {
         UString tag = in->readBlock('<', '>');
-        cur.content += tag;
+        *content += tag;
         if (alpha) {
           if (add_unknowns) alpha->includeSymbol(tag);
-          cur.symbols.push_back((*alpha)(tag));
+          symbols->push_back((*alpha)(tag));
         }
       }
       else if (c == '{') {
         chunk += in->readBlock('{', '}');
       }
       else {
-        cur.content += c;
+        *content += c;
         if (c == '\\') {
           UChar32 c2 = in->get();
-          if (alpha) cur.symbols.push_back(static_cast<int32_t>(c2));
-          cur.content += c2;
+          if (alpha) symbols->push_back(static_cast<int32_t>(c2));
+          *content += c2;
         }
         else if (alpha) {
-          cur.symbols.push_back(static_cast<int32_t>(c));
+          symbols->push_back(static_cast<int32_t>(c));
         }
       }
       c = in->get();
     }
   }
 
+  // the buffers are done growing, so the views can point into them
+  for (size_t i = 0; i < reading_views.size(); i++) {
+    size_t content_end = (i+1 < starts.size() ? starts[i+1].first : contents.size());
+    size_t symbols_end = (i+1 < starts.size() ? starts[i+1].second : symbol_buffer.size());
+    reading_views[i].content = UStringView(contents).substr(starts[i].first, content_end - starts[i].first);
+    reading_views[i].symbols.first = symbol_buffer.data() + starts[i].second;
+    reading_views[i].symbols.count = symbols_end - starts[i].second;
+  }
+
   if (c == '\0') at_null = true;
   else if (c == U_EOF || in->eof()) at_eof = true;
 }
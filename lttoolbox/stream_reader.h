@@ -25,12 +25,31 @@
 class StreamReader {
 private:
   InputFile* in;
+  // with views, the contents and symbols of all the readings of a unit,
+  // and where each reading starts in them
+  UString contents;
+  std::vector<int32_t> symbol_buffer;
+  std::vector<std::pair<size_t, size_t>> starts;
 public:
   struct Reading {
     UChar32 mark = '\0';
     UString content;
     std::vector<int32_t> symbols;
   };
+  struct Symbols {
+    const int32_t* first = nullptr;
+    size_t count = 0;
+    const int32_t* begin() const { return first; }
+    const int32_t* end() const { return first + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    int32_t operator[](size_t i) const { return first[i]; }
+  };
+  struct ReadingView {
+    UChar32 mark = '\0';
+    UStringView content;
+    Symbols symbols;
+  };
   bool at_null = false;
   bool at_eof = false;
   UString blank;
@@ -38,6 +57,12 @@ public:
   std::vector<Reading> readings;
   UString chunk;
 
+  // if set, next() fills reading_views instead of readings, slicing
+  // buffers which keep their capacity from one unit to the next,
+  // valid until the next call
+  bool views = false;
+  std::vector<ReadingView> reading_views;
+
   Alphabet* alpha = nullptr;
   bool add_unknowns = false;
 
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LT_SYMBOL_QUEUE_H_
+#define _LT_SYMBOL_QUEUE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Queue of words of symbols kept one after the other in one buffer,
+ * each followed by a space, so that joining the first two words is
+ * forgetting where the first one ended.  The buffer keeps its capacity
+ * when the queue empties, so queueing the words of a stream doesn't
+ * allocate once it has warmed up.  A pointer into a word is valid until
+ * the next change to the queue.
+ */
+class SymbolQueue
+{
+private:
+  std::vector<int32_t> symbols;
+
+  /**
+   * Where each word ends in symbols, those still queued from head on
+   */
+  std::vector<size_t> ends;
+  size_t head = 0;
+
+  /**
+   * Where the first queued word starts in symbols
+   */
+  size_t start = 0;
+
+  /**
+   * Drop the symbols and ends of the popped words
+   */
+  void compact()
+  {
+    symbols.erase(symbols.begin(), symbols.begin() + start);
+    ends.erase(ends.begin(), ends.begin() + head);
+    for(auto &end : ends)
+    {
+      end -= start;
+    }
+    head = 0;
+    start = 0;
+  }
+
+  size_t wordStart(size_t i) const
+  {
+    return i == 0 ? start : ends[head + i - 1] + 1;
+  }
+
+public:
+  bool empty() const
+  {
+    return head == ends.size();
+  }
+
+  /**
+   * Number of words queued
+   */
+  size_t size() const
+  {
+    return ends.size() - head;
+  }
+
+  /**
+   * Length of the i-th word
+   */
+  size_t length(size_t i) const
+  {
+    return ends[head + i] - wordStart(i);
+  }
+
+  /**
+   * Symbols of the i-th word, which has length(i) of them
+   */
+  int32_t const * word(size_t i) const
+  {
+    return symbols.data() + wordStart(i);
+  }
+
+  int32_t * word(size_t i)
+  {
+    return symbols.data() + wordStart(i);
+  }
+
+  /**
+   * Add a symbol to the word after the last one queued, which is queued
+   * by finish()
+   */
+  void add(int32_t symbol)
+  {
+    symbols.push_back(symbol);
+  }
+
+  /**
+   * Queue the word built by add(), if it has any symbols
+   * @return whether there was a word to queue
+   */
+  bool finish()
+  {
+    size_t const open = empty() ? start : ends.back() + 1;
+    if(symbols.size() == open)
+    {
+      return false;
+    }
+    ends.push_back(symbols.size());
+    symbols.push_back(static_cast<int32_t>(' '));
+    return true;
+  }
+
+  /**
+   * Join the first two words with a space
+   */
+  void joinFront()
+  {
+    head++;
+  }
+
+  /**
+   * Replace the symbols from..to of the first word by those of with
+   */
+  void replaceFront(size_t from, size_t to, std::vector<int32_t> const &with)
+  {
+    auto const pos = symbols.begin() + start + from;
+    size_t const old_size = to - from;
+    size_t const common = std::min(old_size, with.size());
+    std::copy(with.begin(), with.begin() + common, pos);
+    if(old_size > with.size())
+    {
+      symbols.erase(pos + common, pos + old_size);
+      for(size_t i = head; i < ends.size(); i++)
+      {
+        ends[i] -= old_size - with.size();
+      }
+    }
+    else if(old_size < with.size())
+    {
+      symbols.insert(pos + common, with.begin() + common, with.end());
+      for(size_t i = head; i < ends.size(); i++)
+      {
+        ends[i] += with.size() - old_size;
+      }
+    }
+  }
+
+  /**
+   * Bytes taken by the buffers, which keep the size of the most words
+   * queued at once
+   */
+  size_t memoryUsage() const
+  {
+    return symbols.capacity() * sizeof(int32_t) +
+           ends.capacity() * sizeof(size_t);
+  }
+
+  void pop()
+  {
+    start = ends[head] + 1;
+    head++;
+    if(head == ends.size())
+    {
+      symbols.clear();
+      ends.clear();
+      head = 0;
+      start = 0;
+    }
+    else if(head >= 64 && head * 2 >= ends.size())
+    {
+      compact();
+    }
+  }
+};
+
+#endif
@@ -20,6 +20,7 @@
 #include <lttoolbox/lt_locale.h>
 #include <lttoolbox/xml_parse_util.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <libxml/encoding.h>
@@ -67,8 +68,14 @@ TMXCompiler::parse(std::string const &file, UStringView lo, UStringView lm)
   xmlFreeTextReader(reader);
   xmlCleanupParser();
 
-  // Minimize transducer
-  transducer.minimize();
+  if(jobs)
+  {
+    // one round to align the last units read, one to insert them
+    nextRound();
+    nextRound();
+  }
+
+  graph.build(transducer, default_weight);
 }
 
 void
@@ -187,7 +194,7 @@ TMXCompiler::insertTU(std::vector<int> const &origin, std::vector<int> const &me
 
   if(origin.size() != 0 && meta.size() != 0)
   {
-    int source = transducer.getInitial();
+    std::vector<int> labels;
     for(size_t i = 0 ;; i++)
     {
       int s1 = 0, s2 = 0;
@@ -203,9 +210,9 @@ TMXCompiler::insertTU(std::vector<int> const &origin, std::vector<int> const &me
       {
         break;
       }
-      source = transducer.insertSingleTransduction(alphabet(s1, s2), source, default_weight);
+      labels.push_back(alphabet(s1, s2));
     }
-    transducer.setFinal(source, default_weight);
+    graph.add(labels);
   }
 }
 
@@ -361,12 +368,61 @@ TMXCompiler::procTU()
     type = xmlTextReaderNodeType(reader);
   }
 
+  if(!jobs)
+  {
+    alignTU(origin, meta);
+    insertTU(origin, meta);
+    return;
+  }
+
+  units.push_back(Unit());
+  units.back().origin.swap(origin);
+  units.back().meta.swap(meta);
+  if(units.size() >= 1024 * std::max(1u, std::thread::hardware_concurrency()))
+  {
+    nextRound();
+  }
+}
+
+void
+TMXCompiler::alignTU(std::vector<int> &origin, std::vector<int> &meta)
+{
   trim(origin);
   trim(meta);
 
   align(origin, meta);
   align_blanks(origin, meta);
-  insertTU(origin, meta);
+}
+
+void
+TMXCompiler::nextRound()
+{
+  for(auto &aligner : aligners)
+  {
+    aligner.join();
+  }
+  aligners.clear();
+
+  // the units go in in the order they were read
+  for(auto &unit : aligning)
+  {
+    insertTU(unit.origin, unit.meta);
+  }
+  aligning.clear();
+  aligning.swap(units);
+
+  size_t const threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t const slice = (aligning.size() + threads - 1) / threads;
+  for(size_t begin = 0; begin < aligning.size(); begin += slice)
+  {
+    size_t const end = std::min(begin + slice, aligning.size());
+    aligners.emplace_back([this, begin, end]() {
+      for(size_t i = begin; i != end; i++)
+      {
+        alignTU(aligning[i].origin, aligning[i].meta);
+      }
+    });
+  }
 }
 
 void
@@ -609,3 +665,9 @@ TMXCompiler::setMetaLanguageCode(UStringView code)
 {
   // nada
 }
+
+void
+TMXCompiler::setJobs(bool jobs)
+{
+  this->jobs = jobs;
+}
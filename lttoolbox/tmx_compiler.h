@@ -21,10 +21,13 @@
 #include <lttoolbox/regexp_compiler.h>
 #include <lttoolbox/entry_token.h>
 #include <lttoolbox/transducer.h>
+#include <lttoolbox/word_graph.h>
 
 #include <map>
 #include <string>
 #include <set>
+#include <thread>
+#include <vector>
 #include <libxml/xmlreader.h>
 #include <iostream>
 
@@ -55,6 +58,11 @@ private:
    */
   Transducer transducer;
 
+  /**
+   * The translation units, kept minimal as they are read
+   */
+  WordGraph graph;
+
   /**
    * Origin language
    */
@@ -78,6 +86,31 @@ private:
   int32_t number_tag;
   int32_t blank_tag;
 
+  /**
+   * A translation unit as read, before it is aligned
+   */
+  struct Unit
+  {
+    std::vector<int> origin;
+    std::vector<int> meta;
+  };
+
+  /**
+   * Align the translation units on threads while the next ones are read
+   */
+  bool jobs = false;
+
+  /**
+   * Units read since the last round started
+   */
+  std::vector<Unit> units;
+
+  /**
+   * Units of the round being aligned, a slice per thread in aligners
+   */
+  std::vector<Unit> aligning;
+  std::vector<std::thread> aligners;
+
 
   /**
    * Method to parse an XML Node
@@ -96,6 +129,18 @@ private:
    */
   void insertTU(std::vector<int> const &origin, std::vector<int> const &meta);
 
+  /**
+   * Trim and align the parts of a tu for insertTU; it only reads the
+   * compiler, so with jobs it runs on several threads at once
+   */
+  void alignTU(std::vector<int> &origin, std::vector<int> &meta);
+
+  /**
+   * Wait for the round being aligned and insert its units, then start
+   * aligning the units read since
+   */
+  void nextRound();
+
   /**
    * Gets an attribute value with their name and the current context
    * @param name the name of the attribute
@@ -203,6 +248,11 @@ public:
    */
   void setMetaLanguageCode(UStringView code);
 
+  /**
+   * Set whether to align the translation units on all the cpu cores
+   */
+  void setJobs(bool jobs);
+
 };
 
 #endif
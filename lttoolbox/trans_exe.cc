@@ -16,13 +16,32 @@
  */
 
 #include <lttoolbox/trans_exe.h>
+#include <lttoolbox/transducer.h>
 #include <lttoolbox/compression.h>
 #include <lttoolbox/my_stdio.h>
 #include <cstring>
+#include <new>
+
+#include <unicode/uchar.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Written in native byte order at the start of a TDF_MMAP transducer, so
+// that an image from a machine with a different layout is rejected
+constexpr uint64_t MMAP_LAYOUT = 0x4c544d4d00000000ull |
+                                 (sizeof(Node) << 8) | sizeof(Dest);
 
 TransExe::TransExe():
 initial_id(0),
-default_weight(0.0000)
+default_weight(0.0000),
+number_of_nodes(0),
+node_list(nullptr),
+image_size(0),
+deterministic(false)
 {
 }
 
@@ -52,16 +71,135 @@ TransExe::copy(TransExe const &te)
 {
   initial_id = te.initial_id;
   default_weight = te.default_weight;
-  node_list = te.node_list;
-  finals = te.finals;
+  number_of_nodes = te.number_of_nodes;
+  image_size = te.image_size;
+  deterministic = te.deterministic;
+  mapping = te.mapping;
+  if(mapping)
+  {
+    node_list = te.node_list;
+  }
+  else
+  {
+    // all offsets in the image are relative, so it can just be copied
+    image = te.image;
+    node_list = reinterpret_cast<Node *>(image.data());
+  }
+  finals.clear();
+  for(auto& it : te.finals)
+  {
+    finals.insert({node_list + (it.first - te.node_list), it.second});
+  }
 }
 
 void
 TransExe::destroy()
 {
+  image.clear();
+  mapping.reset();
+  number_of_nodes = 0;
+  image_size = 0;
+  node_list = nullptr;
+  deterministic = false;
+  finals.clear();
+}
+
+void
+TransExe::build(int nodes, std::vector<uint32_t> const &first,
+                std::vector<Arc> const &arcs,
+                std::map<int, double> const &final_ids)
+{
+  std::vector<Node::Transition> trans;
+  // the size of a block only depends on the inputs, so the destinations
+  // are left out until there are nodes to point to
+  auto transitions = [&](int i, bool dests) {
+    trans.clear();
+    for(uint32_t j = first[i]; j < first[i+1]; j++)
+    {
+      trans.push_back({arcs[j].input, arcs[j].output,
+                       dests ? node_list + arcs[j].target : nullptr,
+                       arcs[j].weight});
+    }
+  };
+  size_t bytes = nodes * sizeof(Node);
+  for(int i = 0; i < nodes; i++)
+  {
+    transitions(i, false);
+    bytes += Node::blockSize(trans);
+  }
+
+  mapping.reset();
+  image.assign((bytes + sizeof(int64_t) - 1) / sizeof(int64_t), 0);
+  image_size = image.size() * sizeof(int64_t);
+  number_of_nodes = nodes;
+  node_list = reinterpret_cast<Node *>(image.data());
+
+  char *block = reinterpret_cast<char *>(image.data()) + nodes * sizeof(Node);
+  for(int i = 0; i < nodes; i++)
+  {
+    Node *node = new (node_list + i) Node();
+    transitions(i, true);
+    node->build(trans, block);
+    block += Node::blockSize(trans);
+  }
+
+  finals.clear();
+  for(auto& it : final_ids)
+  {
+    finals.insert({node_list + it.first, it.second});
+  }
+  deterministic = detectDeterministic();
 }
 
-#include <iostream>
+bool
+TransExe::detectDeterministic() const
+{
+  for(int i = 0; i < number_of_nodes; i++)
+  {
+    Node const &node = node_list[i];
+    int32_t const *inputs = node.inputs();
+    for(uint32_t j = 0; j < node.size; j++)
+    {
+      if(inputs[j] == 0 || (j > 0 && inputs[j] == inputs[j-1]))
+      {
+        return false;
+      }
+      if(inputs[j] > 0 && u_isupper(inputs[j]))
+      {
+        uint32_t count;
+        UChar32 lower = u_tolower(inputs[j]);
+        if(lower != inputs[j])
+        {
+          node.find(lower, count);
+          if(count != 0)
+          {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+void
+TransExe::extract(std::vector<uint32_t> &first, std::vector<Arc> &arcs) const
+{
+  first.clear();
+  arcs.clear();
+  std::vector<Node::Transition> trans;
+  for(int i = 0; i < number_of_nodes; i++)
+  {
+    first.push_back(arcs.size());
+    node_list[i].getTransitions(trans);
+    for(auto& it : trans)
+    {
+      arcs.push_back({it.input, it.output,
+                      static_cast<int>(it.dest - node_list), it.weight});
+    }
+  }
+  first.push_back(arcs.size());
+}
 
 void
 TransExe::read(FILE *input, Alphabet const &alphabet)
@@ -78,6 +216,11 @@ TransExe::read(FILE *input, Alphabet const &alphabet)
               throw std::runtime_error("Transducer has features that are unknown to this version of lttoolbox - upgrade!");
           }
           read_weights = (features & TDF_WEIGHTS);
+          if (features & TDF_MMAP) {
+              readMapped(input);
+              deterministic = (features & TDF_DETERMINISTIC);
+              return;
+          }
       }
       else {
           // Old binary format
@@ -85,10 +228,37 @@ TransExe::read(FILE *input, Alphabet const &alphabet)
       }
   }
 
+  MultibyteReader in(input);
+  decode(in, alphabet, read_weights);
+}
+
+void
+TransExe::read(unsigned char const *data, size_t length, Alphabet const &alphabet)
+{
+  bool read_weights = false;
+  if (length >= 12 && memcmp(data, HEADER_TRANSDUCER, 4) == 0) {
+    auto features = read_le(data + 4);
+    if (features >= TDF_UNKNOWN) {
+      throw std::runtime_error("Transducer has features that are unknown to this version of lttoolbox - upgrade!");
+    }
+    if (features & TDF_MMAP) {
+      throw std::runtime_error("Transducer is in the memory mapped format, which cannot be read here");
+    }
+    read_weights = (features & TDF_WEIGHTS);
+    data += 12;
+    length -= 12;
+  }
+  MultibyteReader in(data, length);
+  decode(in, alphabet, read_weights);
+}
+
+void
+TransExe::decode(MultibyteReader &in, Alphabet const &alphabet, bool read_weights)
+{
   TransExe &new_t = *this;
   new_t.destroy();
-  new_t.initial_id = Compression::multibyte_read(input);
-  int finals_size = Compression::multibyte_read(input);
+  new_t.initial_id = in.read();
+  int finals_size = in.read();
 
   int base = 0;
   double base_weight = default_weight;
@@ -99,66 +269,270 @@ TransExe::read(FILE *input, Alphabet const &alphabet)
   {
     finals_size--;
 
-    base += Compression::multibyte_read(input);
+    base += in.read();
     if(read_weights)
     {
-      base_weight = Compression::long_multibyte_read(input);
+      base_weight = in.readDouble();
     }
     myfinals.insert({base, base_weight});
   }
 
 
-  base = Compression::multibyte_read(input);
+  base = in.read();
 
   int number_of_states = base;
   int current_state = 0;
-  new_t.node_list.resize(number_of_states);
-
-  for(auto it = myfinals.begin(), limit = myfinals.end();
-      it != limit; it++)
-  {
-    new_t.finals.insert({&new_t.node_list[it->first], it->second});
-  }
+  std::vector<uint32_t> first;
+  std::vector<Arc> arcs;
+  int const batch = 256;
+  std::vector<unsigned int> values(2 * batch);
+  first.reserve(number_of_states + 1);
 
   while(number_of_states > 0)
   {
-    int number_of_local_transitions = Compression::multibyte_read(input);
+    int number_of_local_transitions = in.read();
     int tagbase = 0;
-    Node &mynode = new_t.node_list[current_state];
+    first.push_back(arcs.size());
 
-    while(number_of_local_transitions > 0)
+    for(int i = 0; i < number_of_local_transitions; i++)
     {
-      number_of_local_transitions--;
-      tagbase += Compression::multibyte_read(input);
-      int state = (current_state + Compression::multibyte_read(input)) % base;
+      if(!read_weights && i % batch == 0)
+      {
+        // the symbols and targets of the next transitions of the state
+        size_t count = std::min<size_t>(batch, number_of_local_transitions - i);
+        in.read(values.data(), 2 * count);
+      }
+      int state;
       if(read_weights)
       {
-        base_weight = Compression::long_multibyte_read(input);
+        tagbase += in.read();
+        state = (current_state + in.read()) % base;
+        base_weight = in.readDouble();
+      }
+      else
+      {
+        tagbase += values[2 * (i % batch)];
+        state = (current_state + values[2 * (i % batch) + 1]) % base;
       }
       int i_symbol = alphabet.decode(tagbase).first;
       int o_symbol = alphabet.decode(tagbase).second;
 
-      mynode.addTransition(i_symbol, o_symbol, &new_t.node_list[state], base_weight);
+      arcs.push_back({i_symbol, o_symbol, state, base_weight});
     }
     number_of_states--;
     current_state++;
   }
+  first.push_back(arcs.size());
+
+  new_t.build(base, first, arcs, myfinals);
 }
 
 void
-TransExe::unifyFinals()
+TransExe::readMapped(FILE *input)
+{
+  destroy();
+  if(read_u64(input) != MMAP_LAYOUT)
+  {
+    throw std::runtime_error("Transducer was written for a different architecture - recompile it without --mmap");
+  }
+  initial_id = read_le<uint64_t>(input);
+  number_of_nodes = read_le<uint64_t>(input);
+  uint64_t finals_size = read_le<uint64_t>(input);
+  image_size = read_le<uint64_t>(input);
+  for(uint64_t padding = read_le<uint64_t>(input); padding > 0; padding--)
+  {
+    fgetc_unlocked(input);
+  }
+
+  char *data = nullptr;
+#ifndef _WIN32
+  // The image can be used in place if it is in a regular file at an
+  // offset with the alignment of its members
+  struct stat st;
+  int fd = fileno(input);
+  off_t here = ftello(input);
+  if(image_size > 0 && here >= 0 && here % sizeof(int64_t) == 0 &&
+     fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+     static_cast<uint64_t>(st.st_size) >= here + image_size)
+  {
+    off_t start = here - here % sysconf(_SC_PAGESIZE);
+    size_t length = here - start + image_size;
+    void *region = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, start);
+    if(region != MAP_FAILED && fseeko(input, here + image_size, SEEK_SET) == 0)
+    {
+      HugePages::advise(region, length);
+      mapping.reset(region, [length](void *r) { munmap(r, length); });
+      data = static_cast<char *>(region) + (here - start);
+    }
+    else if(region != MAP_FAILED)
+    {
+      munmap(region, length);
+    }
+  }
+#endif
+  if(data == nullptr)
+  {
+    image.resize(image_size / sizeof(int64_t));
+    if(fread_unlocked(image.data(), 1, image_size, input) != image_size)
+    {
+      throw std::runtime_error("Failed to read transducer image");
+    }
+    data = reinterpret_cast<char *>(image.data());
+  }
+  node_list = reinterpret_cast<Node *>(data);
+
+  while(finals_size > 0)
+  {
+    finals_size--;
+    uint64_t id = read_le<uint64_t>(input);
+    uint64_t bits = read_le<uint64_t>(input);
+    double weight;
+    memcpy(&weight, &bits, sizeof(weight));
+    finals.insert({node_list + id, weight});
+  }
+}
+
+void
+TransExe::write(FILE *output) const
 {
-  node_list.resize(node_list.size()+1);
+  fwrite_unlocked(HEADER_TRANSDUCER, 1, 4, output);
+  write_le(output, deterministic ? (TDF_MMAP | TDF_DETERMINISTIC) : TDF_MMAP);
+  write_u64(output, MMAP_LAYOUT);
+  write_le(output, initial_id);
+  write_le(output, number_of_nodes);
+  write_le(output, finals.size());
+  write_le(output, image_size);
 
-  Node *newfinal = &node_list[node_list.size()-1];
+  // align the image in the file so that it can be mapped as is; if the
+  // output is not seekable, read() will copy it instead
+  long here = ftell(output);
+  uint64_t padding = 0;
+  if(here >= 0)
+  {
+    padding = (sizeof(int64_t) - (here + sizeof(uint64_t)) % sizeof(int64_t)) % sizeof(int64_t);
+  }
+  write_le(output, padding);
+  for(uint64_t i = 0; i < padding; i++)
+  {
+    fputc_unlocked(0, output);
+  }
+  if(fwrite_unlocked(node_list, 1, image_size, output) != image_size)
+  {
+    throw std::runtime_error("Failed to write transducer image");
+  }
 
   for(auto& it : finals)
   {
-    it.first->addTransition(0, 0, newfinal, it.second);
+    uint64_t bits;
+    memcpy(&bits, &it.second, sizeof(bits));
+    write_le(output, it.first - node_list);
+    write_le(output, bits);
   }
+}
 
-  finals.clear();
-  finals.insert({newfinal, default_weight});
+void
+TransExe::build(Transducer const &t, Alphabet const &alphabet)
+{
+  destroy();
+  default_weight = 0.0000;
+
+  std::map<int, int> index;
+  for(auto& it : t.transitions)
+  {
+    index.insert({it.first, static_cast<int>(index.size())});
+  }
+
+  std::vector<uint32_t> first;
+  std::vector<Arc> arcs;
+  for(auto& it : t.transitions)
+  {
+    first.push_back(arcs.size());
+    for(auto& it2 : it.second)
+    {
+      auto const &pair = alphabet.decode(it2.first);
+      arcs.push_back({pair.first, pair.second, index[it2.second.first],
+                      it2.second.second});
+    }
+  }
+  first.push_back(arcs.size());
+
+  std::map<int, double> final_ids;
+  for(auto& it : t.finals)
+  {
+    final_ids.insert({index[it.first], it.second});
+  }
+  initial_id = index[t.initial];
+  build(index.size(), first, arcs, final_ids);
+}
+
+void
+TransExe::unpack(Transducer &t, Alphabet &alphabet) const
+{
+  std::vector<uint32_t> first;
+  std::vector<Arc> arcs;
+  extract(first, arcs);
+
+  t.transitions.clear();
+  t.finals.clear();
+  for(int i = 0; i < number_of_nodes; i++)
+  {
+    auto &trans = t.transitions[i];
+    for(uint32_t j = first[i]; j < first[i+1]; j++)
+    {
+      trans.insert({alphabet(arcs[j].input, arcs[j].output),
+                    std::make_pair(arcs[j].target, arcs[j].weight)});
+    }
+  }
+  for(auto& it : finals)
+  {
+    t.finals.insert({static_cast<int>(it.first - node_list), it.second});
+  }
+  t.initial = initial_id;
+}
+
+bool
+TransExe::isMapped(FILE *input)
+{
+  bool mapped = false;
+  fpos_t pos;
+  if (fgetpos(input, &pos) == 0) {
+    char header[4]{};
+    if (fread_unlocked(header, 1, 4, input) == 4 &&
+        strncmp(header, HEADER_TRANSDUCER, 4) == 0) {
+      mapped = (read_le<uint64_t>(input) & TDF_MMAP);
+    }
+    fsetpos(input, &pos);
+  }
+  return mapped;
+}
+
+void
+TransExe::unifyFinals()
+{
+  std::vector<uint32_t> first;
+  std::vector<Arc> arcs;
+  extract(first, arcs);
+
+  int newfinal = number_of_nodes;
+  std::vector<uint32_t> new_first;
+  std::vector<Arc> new_arcs;
+  for(int i = 0; i < number_of_nodes; i++)
+  {
+    new_first.push_back(new_arcs.size());
+    new_arcs.insert(new_arcs.end(), arcs.begin() + first[i],
+                    arcs.begin() + first[i+1]);
+    auto it = finals.find(node_list + i);
+    if(it != finals.end())
+    {
+      new_arcs.push_back({0, 0, newfinal, it->second});
+    }
+  }
+  new_first.push_back(new_arcs.size());
+  new_first.push_back(new_arcs.size());
+
+  std::map<int, double> final_ids;
+  final_ids[newfinal] = default_weight;
+  build(number_of_nodes + 1, new_first, new_arcs, final_ids);
 }
 
 Node *
@@ -172,3 +546,60 @@ TransExe::getFinals()
 {
   return finals;
 }
+
+Node *
+TransExe::getNodeList()
+{
+  return node_list;
+}
+
+int
+TransExe::getNumberOfNodes() const
+{
+  return number_of_nodes;
+}
+
+size_t
+TransExe::memoryUsage() const
+{
+  // a node of a std::map holds the value, three pointers and the colour
+  return image.capacity() * sizeof(int64_t) +
+         finals.size() * (sizeof(*finals.begin()) + 4 * sizeof(void *));
+}
+
+size_t
+TransExe::mappedSize() const
+{
+  return mapping ? image_size : 0;
+}
+
+bool
+TransExe::isDeterministic() const
+{
+  return deterministic;
+}
+
+bool
+TransExe::hasNegativeWeights() const
+{
+  for(auto const &it : finals)
+  {
+    if(it.second < 0)
+    {
+      return true;
+    }
+  }
+  for(int i = 0; i < number_of_nodes; i++)
+  {
+    Node const &node = node_list[i];
+    Dest const *d = node.dests();
+    for(uint32_t j = 0; j < node.size; j++)
+    {
+      if(d[j].out_weight < 0)
+      {
+        return true;
+      }
+    }
+  }
+  return false;
+}
@@ -21,12 +21,18 @@
 #include <cstdio>
 #include <cstdlib>
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
+#include <cstdint>
 
 #include <lttoolbox/alphabet.h>
+#include <lttoolbox/huge_pages.h>
 #include <lttoolbox/node.h>
 
+class MultibyteReader;
+class Transducer;
+
 
 /**
  * Transducer class for execution of lexical processing algorithms
@@ -45,9 +51,39 @@ private:
   double default_weight;
 
   /**
-   * Node list
+   * Flat image of the transducer: number_of_nodes Node records
+   * followed by the transition blocks they point to, in huge pages
+   * when it is large enough
+   */
+  std::vector<int64_t, HugePageAllocator<int64_t>> image;
+
+  /**
+   * Number of nodes in the image
+   */
+  int number_of_nodes;
+
+  /**
+   * Node list, the start of the image, or of the mapped file region when
+   * the transducer was read in the TDF_MMAP format
+   */
+  Node *node_list;
+
+  /**
+   * Memory mapped file region holding the nodes, if any; it is shared
+   * by the copies of this transducer
    */
-  std::vector<Node> node_list;
+  std::shared_ptr<void> mapping;
+
+  /**
+   * Size in bytes of the nodes and their transition blocks
+   */
+  uint64_t image_size;
+
+  /**
+   * Whether the transducer can be run by DetState
+   * @see isDeterministic
+   */
+  bool deterministic;
 
   /**
    * Final node set mapped to its weight walues
@@ -65,6 +101,54 @@ private:
    */
   void destroy();
 
+  /**
+   * Transition of a node, with the destination as a node index
+   */
+  struct Arc
+  {
+    int input;
+    int output;
+    int target;
+    double weight;
+  };
+
+  /**
+   * Builds the flat image from a list of transitions
+   * @param nodes number of nodes
+   * @param first index in arcs of the first transition of every node,
+   *              plus one past the last transition at the end
+   * @param arcs transitions of all the nodes, grouped by source node
+   * @param final_ids final nodes with their weights
+   */
+  void build(int nodes, std::vector<uint32_t> const &first,
+             std::vector<Arc> const &arcs,
+             std::map<int, double> const &final_ids);
+
+  /**
+   * Extracts the transitions of the image in the form used by build()
+   */
+  void extract(std::vector<uint32_t> &first, std::vector<Arc> &arcs) const;
+
+  /**
+   * Read the body of a transducer in the TDF_MMAP format, mapping the
+   * image from the file when possible
+   * @param input the stream, just after the transducer header
+   */
+  void readMapped(FILE *input);
+
+  /**
+   * Read the body of a transducer in the default format
+   * @param in the numbers, just after the transducer header
+   * @param read_weights whether the header has TDF_WEIGHTS
+   */
+  void decode(MultibyteReader &in, Alphabet const &alphabet, bool read_weights);
+
+  /**
+   * Work out whether the nodes are deterministic as isDeterministic()
+   * describes it
+   */
+  bool detectDeterministic() const;
+
 public:
 
   /**
@@ -97,6 +181,46 @@ public:
    */
   void read(FILE *input, Alphabet const &alphabet);
 
+  /**
+   * Read a transducer in the default format from memory, which is safe
+   * to do on several threads at once with the same alphabet
+   * @param data the bytes of the transducer, as Transducer::write() wrote them
+   * @param length how many there are
+   * @param alphabet the alphabet object to decode the symbols
+   */
+  void read(unsigned char const *data, size_t length, Alphabet const &alphabet);
+
+  /**
+   * Write method, in the TDF_MMAP format.  The nodes are written as they
+   * are laid out in memory so read() can map them from the file without
+   * decoding anything.  The layout is native to the machine, so the
+   * file is only readable where it was written (or on an identical
+   * architecture)
+   * @param output the stream
+   */
+  void write(FILE *output) const;
+
+  /**
+   * Initialise from a compiled transducer
+   * @param t the transducer
+   * @param alphabet the alphabet of t
+   */
+  void build(Transducer const &t, Alphabet const &alphabet);
+
+  /**
+   * Convert back to a transducer that can be modified
+   * @param t the transducer to fill
+   * @param alphabet the alphabet used to encode the symbol pairs
+   */
+  void unpack(Transducer &t, Alphabet &alphabet) const;
+
+  /**
+   * Check whether the next transducer in a stream is in the TDF_MMAP
+   * format, without consuming any input
+   * @param input the stream
+   */
+  static bool isMapped(FILE *input);
+
   /**
    * Reduces all the final states to one
    */
@@ -113,6 +237,44 @@ public:
    * @return the set of final nodes
    */
   std::map<Node *, double> & getFinals();
+
+  /**
+   * Gets the nodes of the transducer, numbered from 0 to
+   * getNumberOfNodes()-1
+   * @return the first node
+   */
+  Node * getNodeList();
+
+  /**
+   * Gets the number of nodes
+   */
+  int getNumberOfNodes() const;
+
+  /**
+   * Bytes of memory this copy of the transducer owns: its image, unless
+   * it is mapped from the file, and its finals
+   */
+  size_t memoryUsage() const;
+
+  /**
+   * Bytes of the image mapped from the file, shared by the copies of the
+   * transducer and by the processes mapping the same file; 0 if the image
+   * was read into memory
+   */
+  size_t mappedSize() const;
+
+  /**
+   * Whether no node has epsilon transitions, more than one transition on
+   * the same input symbol, or transitions on both an uppercase letter and
+   * its lowercase, so that stepping through it with case folding never
+   * follows more than one path
+   */
+  bool isDeterministic() const;
+
+  /**
+   * Whether a transition or final node weighs less than 0
+   */
+  bool hasNegativeWeights() const;
 };
 
 #endif
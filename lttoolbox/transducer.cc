@@ -21,8 +21,15 @@
 #include <lttoolbox/deserialiser.h>
 #include <lttoolbox/serialiser.h>
 
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <iostream>
+#include <limits>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <cstring>
 
@@ -243,36 +250,163 @@ Transducer::closure(int const state, std::set<int> const &epsilon_tags) const
   return result;
 }
 
+namespace {
+  /**
+   * The epsilon closures of all the states of a transducer.  The
+   * strongly connected components of the epsilon transitions are found
+   * with Tarjan's algorithm, which finishes a component after all those
+   * it reaches, so the closure of each is worked out once from those
+   * closures; the states of a component share its closure
+   */
+  class EpsilonClosures
+  {
+  private:
+    /**
+     * The closures of the components one after another, each sorted
+     */
+    std::vector<int> states;
+    std::vector<uint32_t> first{0};
+    std::vector<int> component;
+
+  public:
+    /**
+     * @param edges where the epsilon transitions of each state start in
+     *        targets, with one more for where the last ones end
+     * @param targets the states the epsilon transitions lead to
+     */
+    EpsilonClosures(std::vector<uint32_t> const &edges,
+                    std::vector<int> const &targets)
+    {
+      size_t const n = edges.size() - 1;
+      component.assign(n, -1);
+      std::vector<int> index(n, -1);
+      std::vector<int> low(n, 0);
+      std::vector<int> stack;
+      std::vector<bool> on_stack(n, false);
+      // the state last added to each closure and the last component
+      // whose closure was added to each, to add every one once
+      std::vector<int> seen(n, -1);
+      std::vector<int> joined(n, -1);
+      std::vector<std::pair<int, uint32_t>> calls;
+      int next_index = 0;
+      int components = 0;
+
+      for(size_t root = 0; root < n; root++)
+      {
+        if(index[root] != -1)
+        {
+          continue;
+        }
+        index[root] = low[root] = next_index++;
+        stack.push_back(root);
+        on_stack[root] = true;
+        calls.push_back({static_cast<int>(root), edges[root]});
+        while(!calls.empty())
+        {
+          int const v = calls.back().first;
+          if(calls.back().second < edges[v + 1])
+          {
+            int const w = targets[calls.back().second++];
+            if(index[w] == -1)
+            {
+              index[w] = low[w] = next_index++;
+              stack.push_back(w);
+              on_stack[w] = true;
+              calls.push_back({w, edges[w]});
+            }
+            else if(on_stack[w])
+            {
+              low[v] = std::min(low[v], index[w]);
+            }
+            continue;
+          }
+          calls.pop_back();
+          if(!calls.empty())
+          {
+            int const u = calls.back().first;
+            low[u] = std::min(low[u], low[v]);
+          }
+          if(low[v] != index[v])
+          {
+            continue;
+          }
+
+          int const c = components++;
+          size_t const start = states.size();
+          int w;
+          do
+          {
+            w = stack.back();
+            stack.pop_back();
+            on_stack[w] = false;
+            component[w] = c;
+            seen[w] = c;
+            states.push_back(w);
+          } while(w != v);
+          size_t const members = states.size();
+          for(size_t i = start; i < members; i++)
+          {
+            int const m = states[i];
+            for(uint32_t j = edges[m]; j < edges[m + 1]; j++)
+            {
+              int const d = component[targets[j]];
+              if(d == c || joined[d] == c)
+              {
+                continue;
+              }
+              joined[d] = c;
+              for(uint32_t k = first[d]; k < first[d + 1]; k++)
+              {
+                int const s = states[k];
+                if(seen[s] != c)
+                {
+                  seen[s] = c;
+                  states.push_back(s);
+                }
+              }
+            }
+          }
+          std::sort(states.begin() + start, states.end());
+          first.push_back(states.size());
+        }
+      }
+    }
+
+    int const * begin(int state) const
+    {
+      return states.data() + first[component[state]];
+    }
+
+    int const * end(int state) const
+    {
+      return states.data() + first[component[state] + 1];
+    }
+
+    size_t size(int state) const
+    {
+      return first[component[state] + 1] - first[component[state]];
+    }
+  };
+}
+
 std::vector<sorted_vector<int>>
 Transducer::closure_all(const int epsilon_tag) const
 {
-  std::vector<sorted_vector<int>> ret;
-  ret.reserve(transitions.size());
-  std::vector<std::vector<int>> reversed;
-  reversed.resize(transitions.size());
-  sorted_vector<int> todo;
-  for (size_t i = 0; i < transitions.size(); i++) {
-    sorted_vector<int> c;
-    c.insert(i);
+  size_t const states = transitions.size();
+  std::vector<uint32_t> edges(states + 1, 0);
+  std::vector<int> targets;
+  for (size_t i = 0; i < states; i++) {
     auto range = transitions.at(i).equal_range(epsilon_tag);
     for (; range.first != range.second; range.first++) {
-      c.insert(range.first->second.first);
-      reversed[range.first->second.first].push_back(i);
+      targets.push_back(range.first->second.first);
     }
-    if (c.size() > 1) todo.insert(i);
-    ret.push_back(c);
+    edges[i + 1] = targets.size();
   }
-  while (!todo.empty()) {
-    sorted_vector<int> new_todo;
-    for (auto& it : todo) {
-      sorted_vector<int> temp = ret[it];
-      for (auto& it2 : temp) {
-        ret[it].insert(ret[it2].begin(), ret[it2].end());
-      }
-      if (ret[it].size() > temp.size())
-        new_todo.insert(reversed[it].begin(), reversed[it].end());
-    }
-    todo.swap(new_todo);
+  EpsilonClosures closures(edges, targets);
+
+  std::vector<sorted_vector<int>> ret(states);
+  for (size_t i = 0; i < states; i++) {
+    ret[i].insert(closures.begin(i), closures.end(i));
   }
   return ret;
 }
@@ -302,22 +436,153 @@ Transducer::joinFinals(int const epsilon_tag)
 void
 Transducer::determinize(int const epsilon_tag)
 {
-  std::vector<sorted_vector<int>> R(2);
-  std::vector<sorted_vector<int>> Q_prime;
-  std::map<sorted_vector<int>, int> Q_prime_inv;
+  Arcs flat;
+  flatten(flat);
+  determinize(flat, epsilon_tag);
+  unflatten(flat);
+}
 
-  std::map<int, std::multimap<int, std::pair<int, double> > > transitions_prime;
+namespace {
+  /**
+   * The sets of old states the states of a determinized transducer
+   * stand for, stored one after another in a single array and found by
+   * their hash
+   */
+  class SubsetTable
+  {
+  private:
+    std::vector<int> states;
+    std::vector<uint32_t> first{0};
+    std::vector<uint64_t> hashes;
+    /**
+     * Open addressing table of the numbers of the sets plus one, 0 for
+     * free slots
+     */
+    std::vector<uint32_t> slots = std::vector<uint32_t>(64, 0);
+
+    void grow()
+    {
+      std::vector<uint32_t> bigger(slots.size() * 2, 0);
+      size_t const mask = bigger.size() - 1;
+      for(uint32_t i = 0; i < hashes.size(); i++)
+      {
+        size_t slot = hashes[i] & mask;
+        while(bigger[slot] != 0)
+        {
+          slot = (slot + 1) & mask;
+        }
+        bigger[slot] = i + 1;
+      }
+      slots.swap(bigger);
+    }
+
+  public:
+    static uint64_t step(uint64_t hash, int state)
+    {
+      return (hash ^ static_cast<uint32_t>(state)) * 0x100000001b3ull;
+    }
+
+    static constexpr uint64_t empty_hash = 0xcbf29ce484222325ull;
+
+    size_t size() const
+    {
+      return hashes.size();
+    }
+
+    int const * begin(size_t set) const
+    {
+      return states.data() + first[set];
+    }
+
+    int const * end(size_t set) const
+    {
+      return states.data() + first[set + 1];
+    }
+
+    /**
+     * The number of the set of the n states at set with the given hash,
+     * adding it unless it is there
+     * @param added set to whether it was added
+     */
+    int intern(int const *set, size_t n, uint64_t hash, bool &added)
+    {
+      if(2 * (hashes.size() + 1) > slots.size())
+      {
+        grow();
+      }
+      size_t const mask = slots.size() - 1;
+      size_t slot = hash & mask;
+      for(; slots[slot] != 0; slot = (slot + 1) & mask)
+      {
+        uint32_t const other = slots[slot] - 1;
+        if(hashes[other] == hash && first[other + 1] - first[other] == n &&
+           std::equal(set, set + n, begin(other)))
+        {
+          added = false;
+          return other;
+        }
+      }
+      added = true;
+      slots[slot] = hashes.size() + 1;
+      hashes.push_back(hash);
+      states.insert(states.end(), set, set + n);
+      first.push_back(states.size());
+      return hashes.size() - 1;
+    }
+  };
+
+  /**
+   * A transition of a set of old states, on the way to the set it leads
+   * to
+   */
+  struct Successor
+  {
+    int tag;
+    double weight;
+    int state;
+
+    bool operator<(Successor const &o) const
+    {
+      if(tag != o.tag) return tag < o.tag;
+      if(weight < o.weight) return true;
+      if(o.weight < weight) return false;
+      return state < o.state;
+    }
+  };
+}
+
+void
+Transducer::determinize(Arcs &flat, int const epsilon_tag)
+{
+  size_t const states = flat.first.size() - 1;
+  SubsetTable Q_prime;
+
+  Arcs flat_prime;
 
   // We're almost certainly going to need the closure of (nearly) every
   // state, and we're often going to need the closure several times,
   // so it's faster to precompute.
-  std::vector<sorted_vector<int>> all_closures = closure_all(epsilon_tag);
-
-  unsigned int size_Q_prime = 0;
-  Q_prime.push_back(all_closures[initial]);
+  std::vector<uint32_t> edges(states + 1, 0);
+  std::vector<int> targets;
+  for (size_t i = 0; i < states; i++) {
+    for (uint32_t j = flat.first[i]; j < flat.first[i+1]; j++) {
+      if (flat.arcs[j].tag == epsilon_tag) {
+        targets.push_back(flat.arcs[j].target);
+      }
+    }
+    edges[i + 1] = targets.size();
+  }
+  EpsilonClosures const all_closures(edges, targets);
+  edges.clear();
+  targets.clear();
 
-  Q_prime_inv[Q_prime[0]] = 0;
-  R[0].insert(0);
+  bool added;
+  uint64_t hash = SubsetTable::empty_hash;
+  for(auto c = all_closures.begin(initial); c != all_closures.end(initial); c++)
+  {
+    hash = SubsetTable::step(hash, *c);
+  }
+  Q_prime.intern(all_closures.begin(initial), all_closures.size(initial), hash, added);
 
   int initial_prime = 0;
   std::map<int, double> finals_prime;
@@ -327,79 +592,844 @@ Transducer::determinize(int const epsilon_tag)
     finals_prime.insert({0, default_weight});
   }
 
-  int t = 0;
-
-  sorted_vector<int> finals_state;
+  std::vector<bool> is_final(states, false);
   for(auto& it : finals) {
-    finals_state.insert(it.first);
+    is_final[it.first] = true;
   }
 
-  while(size_Q_prime != Q_prime.size())
+  // The new states are numbered as they are found, and each is done in
+  // that order (what going round by round through those found in the
+  // previous round comes down to), so their transitions can just be
+  // appended.  The transitions of a state are sorted by tag, weight and
+  // the state they reach after the closure, which gives the sets they
+  // lead to, in the order of their tag and weight, without a map
+  std::vector<Successor> successors;
+  std::vector<int> set;
+  flat_prime.first.push_back(0);
+  for(size_t it = 0; it < Q_prime.size(); it++)
   {
-    size_Q_prime = Q_prime.size();
-    R[(t+1)%2].clear();
-
-    for(auto& it : R[t])
+    successors.clear();
+    bool final = false;
+    for(auto q = Q_prime.begin(it); q != Q_prime.end(it); q++)
     {
-      if (Q_prime[it].intersects(finals_state)) {
-        double w = default_weight;
-        auto it3 = finals.find(it);
-        if (it3 != finals.end()) {
-          w = it3->second;
-        }
-        finals_prime.insert({it, w});
-      }
-
-      std::map<std::pair<int, double>, sorted_vector<int> > mymap;
-
-      for(auto& it2 : Q_prime[it])
+      final = final || is_final[*q];
+      for(uint32_t j = flat.first[*q]; j < flat.first[*q+1]; j++)
       {
-        for(auto& it3 : transitions[it2])
+        Arc const &arc = flat.arcs[j];
+        if(arc.tag != epsilon_tag)
         {
-          if(it3.first != epsilon_tag)
+          for(auto c = all_closures.begin(arc.target);
+              c != all_closures.end(arc.target); c++)
           {
-            auto& it4 = all_closures[it3.second.first];
-            mymap[std::make_pair(it3.first, it3.second.second)].insert(it4.begin(), it4.end());
+            successors.push_back({arc.tag, arc.weight, *c});
           }
         }
       }
+    }
+    if (final) {
+      double w = default_weight;
+      auto it3 = finals.find(it);
+      if (it3 != finals.end()) {
+        w = it3->second;
+      }
+      finals_prime.insert({static_cast<int>(it), w});
+    }
 
-      // adding new states
-      auto& state_prime = transitions_prime[it];
-      for(auto& it2 : mymap)
-      {
-        int tag;
-        auto loc = Q_prime_inv.find(it2.second);
-        if(loc == Q_prime_inv.end()) {
-          tag = Q_prime.size();
-          Q_prime.push_back(it2.second);
-          Q_prime_inv[it2.second] = tag;
-          R[(t+1)%2].insert(tag);
-          transitions_prime[tag].clear();
-        } else {
-          tag = loc->second;
+    std::sort(successors.begin(), successors.end());
+    for(size_t i = 0; i < successors.size();)
+    {
+      Successor const &label = successors[i];
+      set.clear();
+      hash = SubsetTable::empty_hash;
+      for(; i < successors.size() && successors[i].tag == label.tag &&
+            !(label.weight < successors[i].weight); i++)
+      {
+        if(set.empty() || set.back() != successors[i].state)
+        {
+          set.push_back(successors[i].state);
+          hash = SubsetTable::step(hash, successors[i].state);
         }
-        state_prime.insert({it2.first.first, std::make_pair(tag, it2.first.second)});
       }
+      int tag = Q_prime.intern(set.data(), set.size(), hash, added);
+      flat_prime.arcs.push_back({label.tag, tag, label.weight});
     }
-
-    t = (t+1)%2;
+    flat_prime.first.push_back(flat_prime.arcs.size());
   }
 
-  transitions.swap(transitions_prime);
+  std::swap(flat, flat_prime);
   finals.swap(finals_prime);
   initial = initial_prime;
 }
 
 
 void
-Transducer::minimize(int const epsilon_tag)
+Transducer::minimize(int const epsilon_tag, unsigned const jobs,
+                     bool const push_weights, double const weight_quantum)
 {
   if (finals.empty()) return;
-  reverse(epsilon_tag);
-  determinize(epsilon_tag);
-  reverse(epsilon_tag);
-  determinize(epsilon_tag);
+  Arcs flat;
+  flatten(flat);
+  if (!mergeEquivalent(flat, epsilon_tag) &&
+      !(jobs > 1 && minimizeParts(flat, epsilon_tag, jobs))) {
+    brzozowski(flat, epsilon_tag);
+  }
+  // the weights are pushed once the transducer is deterministic and has
+  // no epsilons left, whose weights determinizing would drop
+  if (reweight(flat, push_weights, weight_quantum) &&
+      !mergeEquivalent(flat, epsilon_tag)) {
+    brzozowski(flat, epsilon_tag);
+  }
+  unflatten(flat);
+}
+
+bool
+Transducer::reweight(Arcs &flat, bool push, double const quantum)
+{
+  size_t const states = flat.first.size() - 1;
+  bool weighted = false;
+  for(auto const &arc : flat.arcs)
+  {
+    if(arc.weight < 0)
+    {
+      push = false;
+      break;
+    }
+    weighted = weighted || arc.weight != default_weight;
+  }
+  push = push && weighted;
+  for(auto const &it : finals)
+  {
+    push = push && it.second == default_weight;
+  }
+
+  bool changed = false;
+  if(push)
+  {
+    // the lightest way from each state to a final one, by Dijkstra's
+    // algorithm going back along the transitions from the final states
+    std::vector<uint32_t> first(states + 1, 0);
+    for(auto const &arc : flat.arcs)
+    {
+      first[arc.target + 1]++;
+    }
+    for(size_t i = 0; i < states; i++)
+    {
+      first[i + 1] += first[i];
+    }
+    std::vector<std::pair<int, double>> into(flat.arcs.size());
+    std::vector<uint32_t> next(first.begin(), first.end() - 1);
+    for(size_t i = 0; i < states; i++)
+    {
+      for(uint32_t j = flat.first[i]; j < flat.first[i+1]; j++)
+      {
+        into[next[flat.arcs[j].target]++] = {static_cast<int>(i), flat.arcs[j].weight};
+      }
+    }
+    next.clear();
+
+    double const unreached = std::numeric_limits<double>::infinity();
+    std::vector<double> lightest(states, unreached);
+    typedef std::pair<double, int> Reached;
+    std::priority_queue<Reached, std::vector<Reached>, std::greater<Reached>> queue;
+    for(auto const &it : finals)
+    {
+      lightest[it.first] = default_weight;
+      queue.push({default_weight, it.first});
+    }
+    while(!queue.empty())
+    {
+      Reached const reached = queue.top();
+      queue.pop();
+      if(lightest[reached.second] < reached.first)
+      {
+        continue;
+      }
+      for(uint32_t j = first[reached.second]; j < first[reached.second + 1]; j++)
+      {
+        double const weight = reached.first + into[j].second;
+        if(weight < lightest[into[j].first])
+        {
+          lightest[into[j].first] = weight;
+          queue.push({weight, into[j].first});
+        }
+      }
+    }
+
+    // what is left of the initial state has nowhere to go, so it keeps
+    // a potential of 0, which leaves the weight of every path as it was
+    auto const potential = [&](int state) {
+      return (state == initial || lightest[state] == unreached) ? 0.0 : lightest[state];
+    };
+    for(size_t i = 0; i < states; i++)
+    {
+      double const from = potential(i);
+      for(uint32_t j = flat.first[i]; j < flat.first[i+1]; j++)
+      {
+        Arc &arc = flat.arcs[j];
+        double const weight = arc.weight + potential(arc.target) - from;
+        changed = changed || weight != arc.weight;
+        arc.weight = weight;
+      }
+    }
+  }
+
+  if(quantum > 0)
+  {
+    for(auto &arc : flat.arcs)
+    {
+      double const weight = std::round(arc.weight / quantum) * quantum;
+      changed = changed || weight != arc.weight;
+      arc.weight = weight;
+    }
+  }
+  return changed;
+}
+
+void
+Transducer::brzozowski(Arcs &flat, int const epsilon_tag)
+{
+  // determinizing forwards the lexicons with an epsilon from the initial
+  // state to every entry costs far more than this
+  reverse(flat, epsilon_tag);
+  determinize(flat, epsilon_tag);
+  reverse(flat, epsilon_tag);
+  determinize(flat, epsilon_tag);
+}
+
+bool
+Transducer::minimizeParts(Arcs &flat, int const epsilon_tag, unsigned const jobs)
+{
+  int const states = flat.first.size() - 1;
+
+  // the states that are left without reading anything, and the symbols
+  // that can be read first
+  std::vector<int> start{initial};
+  std::vector<bool> owned(states, false);
+  owned[initial] = true;
+  std::vector<int> tags;
+  for(size_t i = 0; i < start.size(); i++)
+  {
+    for(uint32_t j = flat.first[start[i]]; j < flat.first[start[i]+1]; j++)
+    {
+      Arc const &arc = flat.arcs[j];
+      if(arc.tag != epsilon_tag)
+      {
+        tags.push_back(arc.tag);
+      }
+      else if(!owned[arc.target])
+      {
+        owned[arc.target] = true;
+        start.push_back(arc.target);
+      }
+    }
+  }
+  std::sort(tags.begin(), tags.end());
+  tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+  if(tags.size() < 2)
+  {
+    return false;
+  }
+
+  // weigh every first symbol by the states first reached through it, and
+  // give the heaviest symbols out first, each to the lightest part
+  std::vector<size_t> size(tags.size(), 0);
+  std::vector<int> todo;
+  for(int q : start)
+  {
+    for(uint32_t j = flat.first[q]; j < flat.first[q+1]; j++)
+    {
+      if(flat.arcs[j].tag == epsilon_tag)
+      {
+        continue;
+      }
+      size_t const k = std::lower_bound(tags.begin(), tags.end(), flat.arcs[j].tag) - tags.begin();
+      todo.push_back(flat.arcs[j].target);
+      while(!todo.empty())
+      {
+        int const s = todo.back();
+        todo.pop_back();
+        if(owned[s])
+        {
+          continue;
+        }
+        owned[s] = true;
+        size[k]++;
+        for(uint32_t t = flat.first[s]; t < flat.first[s+1]; t++)
+        {
+          todo.push_back(flat.arcs[t].target);
+        }
+      }
+    }
+  }
+  owned.clear();
+  std::vector<size_t> by_size(tags.size());
+  for(size_t k = 0; k < tags.size(); k++)
+  {
+    by_size[k] = k;
+  }
+  std::stable_sort(by_size.begin(), by_size.end(),
+                   [&](size_t a, size_t b) { return size[a] > size[b]; });
+  size_t const parts = std::min<size_t>(jobs, tags.size());
+  std::vector<size_t> load(parts, 0);
+  std::vector<size_t> part_of(tags.size());
+  for(size_t k : by_size)
+  {
+    size_t const p = std::min_element(load.begin(), load.end()) - load.begin();
+    part_of[k] = p;
+    load[p] += size[k] + 1;
+  }
+
+  // every part starts at a state of its own with the first transitions
+  // on its symbols, and keeps only the states they lead to
+  std::vector<Transducer> part(parts);
+  std::vector<Arcs> part_flat(parts);
+  auto const build = [&](size_t const p) {
+    Arcs &pf = part_flat[p];
+    std::vector<int> number(states, -1);
+    std::vector<int> order;
+    auto const renumber = [&](int q) {
+      if(number[q] < 0)
+      {
+        number[q] = order.size() + 1;
+        order.push_back(q);
+      }
+      return number[q];
+    };
+    pf.first.push_back(0);
+    for(int q : start)
+    {
+      for(uint32_t j = flat.first[q]; j < flat.first[q+1]; j++)
+      {
+        Arc const &arc = flat.arcs[j];
+        if(arc.tag != epsilon_tag &&
+           part_of[std::lower_bound(tags.begin(), tags.end(), arc.tag) - tags.begin()] == p)
+        {
+          pf.arcs.push_back({arc.tag, renumber(arc.target), arc.weight});
+        }
+      }
+      if(p == 0 && isFinal(q))
+      {
+        part[p].finals.insert({0, default_weight});
+      }
+    }
+    pf.first.push_back(pf.arcs.size());
+    for(size_t i = 0; i < order.size(); i++)
+    {
+      for(uint32_t j = flat.first[order[i]]; j < flat.first[order[i]+1]; j++)
+      {
+        Arc const &arc = flat.arcs[j];
+        pf.arcs.push_back({arc.tag, renumber(arc.target), arc.weight});
+      }
+      pf.first.push_back(pf.arcs.size());
+    }
+    for(auto const &it : finals)
+    {
+      if(it.first < states && number[it.first] >= 0)
+      {
+        part[p].finals.insert({number[it.first], it.second});
+      }
+    }
+    part[p].initial = 0;
+    if(!part[p].finals.empty())
+    {
+      part[p].brzozowski(pf, epsilon_tag);
+    }
+  };
+  std::vector<std::thread> threads;
+  for(size_t p = 1; p < parts; p++)
+  {
+    threads.push_back(std::thread(build, p));
+  }
+  build(0);
+  for(auto &thread : threads)
+  {
+    thread.join();
+  }
+
+  // the parts read different first symbols, so the initial state that
+  // has the first transitions of all of them is still deterministic
+  Arcs joined;
+  std::map<int, double> joined_finals;
+  joined.first.push_back(0);
+  std::vector<int> offset(parts);
+  int next = 1;
+  for(size_t p = 0; p < parts; p++)
+  {
+    offset[p] = next;
+    if(part[p].finals.empty())
+    {
+      continue;
+    }
+    next += part_flat[p].first.size() - 1;
+    Arcs const &pf = part_flat[p];
+    for(uint32_t j = pf.first[part[p].initial]; j < pf.first[part[p].initial+1]; j++)
+    {
+      joined.arcs.push_back({pf.arcs[j].tag, pf.arcs[j].target + offset[p], pf.arcs[j].weight});
+    }
+    if(part[p].isFinal(part[p].initial))
+    {
+      joined_finals.insert({0, default_weight});
+    }
+  }
+  joined.first.push_back(joined.arcs.size());
+  for(size_t p = 0; p < parts; p++)
+  {
+    if(part[p].finals.empty())
+    {
+      continue;
+    }
+    Arcs &pf = part_flat[p];
+    for(size_t q = 0; q + 1 < pf.first.size(); q++)
+    {
+      for(uint32_t j = pf.first[q]; j < pf.first[q+1]; j++)
+      {
+        joined.arcs.push_back({pf.arcs[j].tag, pf.arcs[j].target + offset[p], pf.arcs[j].weight});
+      }
+      joined.first.push_back(joined.arcs.size());
+    }
+    for(auto const &it : part[p].finals)
+    {
+      joined_finals.insert({it.first + offset[p], it.second});
+    }
+    pf = Arcs();
+  }
+
+  std::swap(flat, joined);
+  finals.swap(joined_finals);
+  initial = 0;
+  if(!mergeEquivalent(flat, epsilon_tag))
+  {
+    brzozowski(flat, epsilon_tag);
+  }
+  return true;
+}
+
+namespace {
+  /**
+   * Partition of the numbers 0 to n - 1 into sets that can be split by
+   * the elements marked in them, as in Valmari's "Fast brief practical
+   * DFA minimization" (2012)
+   */
+  class RefinablePartition
+  {
+  public:
+    /**
+     * Number of sets
+     */
+    int sets = 0;
+
+    /**
+     * The elements sorted by set and their location in it
+     */
+    std::vector<int> elems, loc;
+
+    /**
+     * The set of every element
+     */
+    std::vector<int> set;
+
+    /**
+     * Where every set starts and ends in elems
+     */
+    std::vector<int> first, past;
+
+  private:
+    std::vector<int> marked;
+    std::vector<int> touched;
+
+  public:
+    explicit RefinablePartition(int n) :
+      elems(n), loc(n), set(n, 0), first(n + 1, 0), past(n + 1, 0),
+      marked(n + 1, 0)
+    {
+      for(int i = 0; i < n; i++)
+      {
+        elems[i] = loc[i] = i;
+      }
+      sets = (n > 0);
+      past[0] = n;
+    }
+
+    void mark(int e)
+    {
+      int const s = set[e];
+      int const i = loc[e];
+      int const j = first[s] + marked[s];
+      elems[i] = elems[j];
+      loc[elems[i]] = i;
+      elems[j] = e;
+      loc[e] = j;
+      if(marked[s]++ == 0)
+      {
+        touched.push_back(s);
+      }
+    }
+
+    /**
+     * Split the marked elements of every set off into a new set, unless
+     * all of it was marked; the smaller part goes to the new set
+     */
+    void split()
+    {
+      while(!touched.empty())
+      {
+        int const s = touched.back();
+        touched.pop_back();
+        int const j = first[s] + marked[s];
+        if(j == past[s])
+        {
+          marked[s] = 0;
+          continue;
+        }
+        if(marked[s] <= past[s] - j)
+        {
+          first[sets] = first[s];
+          past[sets] = first[s] = j;
+        }
+        else
+        {
+          past[sets] = past[s];
+          first[sets] = past[s] = j;
+        }
+        for(int i = first[sets]; i < past[sets]; i++)
+        {
+          set[elems[i]] = sets;
+        }
+        marked[s] = marked[sets] = 0;
+        sets++;
+      }
+    }
+  };
+}
+
+bool
+Transducer::mergeEquivalent(Arcs &flat, int const epsilon_tag)
+{
+  int const states = flat.first.size() - 1;
+
+  for(auto const &arc : flat.arcs)
+  {
+    if(arc.tag == epsilon_tag)
+    {
+      return false;
+    }
+  }
+  auto const byLabel = [](Arc const &a, Arc const &b) {
+    return a.tag < b.tag || (a.tag == b.tag && a.weight < b.weight);
+  };
+  for(int i = 0; i < states; i++)
+  {
+    auto begin = flat.arcs.begin() + flat.first[i];
+    auto end = flat.arcs.begin() + flat.first[i+1];
+    for(auto it = begin; it + 1 < end; it++)
+    {
+      // the maps keep the transitions sorted by tag
+      for(auto it2 = it + 1; it2 != end && it2->tag == it->tag; it2++)
+      {
+        if(!(it->weight < it2->weight) && !(it2->weight < it->weight))
+        {
+          return false;
+        }
+      }
+    }
+  }
+  for(int i = 0; i < states; i++)
+  {
+    auto begin = flat.arcs.begin() + flat.first[i];
+    auto end = flat.arcs.begin() + flat.first[i+1];
+    if(!std::is_sorted(begin, end, byLabel))
+    {
+      std::sort(begin, end, byLabel);
+    }
+  }
+
+  // the states a final state can be reached from
+  std::vector<uint32_t> in_first(states + 1, 0);
+  for(auto const &arc : flat.arcs)
+  {
+    in_first[arc.target + 1]++;
+  }
+  for(int i = 0; i < states; i++)
+  {
+    in_first[i + 1] += in_first[i];
+  }
+  std::vector<int> in_source(flat.arcs.size());
+  {
+    std::vector<uint32_t> next(in_first.begin(), in_first.end() - 1);
+    for(int i = 0; i < states; i++)
+    {
+      for(uint32_t j = flat.first[i]; j < flat.first[i+1]; j++)
+      {
+        in_source[next[flat.arcs[j].target]++] = i;
+      }
+    }
+  }
+  std::vector<int> live(states, -1);
+  std::vector<int> todo;
+  int live_states = 0;
+  for(auto const &it : finals)
+  {
+    if(it.first < states && live[it.first] < 0)
+    {
+      live[it.first] = 0;
+      todo.push_back(it.first);
+    }
+  }
+  while(!todo.empty())
+  {
+    int const q = todo.back();
+    todo.pop_back();
+    for(uint32_t j = in_first[q]; j < in_first[q+1]; j++)
+    {
+      if(live[in_source[j]] < 0)
+      {
+        live[in_source[j]] = 0;
+        todo.push_back(in_source[j]);
+      }
+    }
+  }
+  if(initial >= states || live[initial] < 0)
+  {
+    return false;
+  }
+  for(int i = 0; i < states; i++)
+  {
+    if(live[i] == 0)
+    {
+      live[i] = live_states++;
+    }
+  }
+  in_first.clear();
+  in_source.clear();
+
+  // the live states and their transitions, with the pairs of tag and
+  // weight numbered in their order
+  std::vector<std::pair<int, double>> labels;
+  for(auto const &arc : flat.arcs)
+  {
+    labels.push_back({arc.tag, arc.weight});
+  }
+  std::sort(labels.begin(), labels.end());
+  labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+  std::vector<int> tail, label, head;
+  std::vector<uint32_t> out_first(live_states + 1, 0);
+  std::vector<bool> final(live_states, false);
+  for(int i = 0; i < states; i++)
+  {
+    if(live[i] < 0)
+    {
+      continue;
+    }
+    final[live[i]] = isFinal(i);
+    for(uint32_t j = flat.first[i]; j < flat.first[i+1]; j++)
+    {
+      Arc const &arc = flat.arcs[j];
+      if(live[arc.target] >= 0)
+      {
+        tail.push_back(live[i]);
+        label.push_back(std::lower_bound(labels.begin(), labels.end(),
+                                         std::make_pair(arc.tag, arc.weight)) - labels.begin());
+        head.push_back(live[arc.target]);
+      }
+    }
+    out_first[live[i] + 1] = tail.size();
+  }
+  int const transitions_live = tail.size();
+
+  // acyclic if every state can be put after those reaching it
+  std::vector<int> order;
+  {
+    std::vector<int> degree(live_states, 0);
+    for(int t = 0; t < transitions_live; t++)
+    {
+      degree[head[t]]++;
+    }
+    for(int q = 0; q < live_states; q++)
+    {
+      if(degree[q] == 0)
+      {
+        order.push_back(q);
+      }
+    }
+    for(size_t i = 0; i < order.size(); i++)
+    {
+      for(uint32_t t = out_first[order[i]]; t < out_first[order[i] + 1]; t++)
+      {
+        if(--degree[head[t]] == 0)
+        {
+          order.push_back(head[t]);
+        }
+      }
+    }
+  }
+
+  std::vector<int> cls(live_states);
+  int classes = 0;
+  if(static_cast<int>(order.size()) == live_states)
+  {
+    // Revuz: the states of one height (longest path to the end) can
+    // only be equivalent to each other, and those they lead to are lower
+    // and already merged
+    std::vector<int> height(live_states, 0);
+    int max_height = 0;
+    for(size_t i = order.size(); i-- > 0;)
+    {
+      int const q = order[i];
+      for(uint32_t t = out_first[q]; t < out_first[q + 1]; t++)
+      {
+        height[q] = std::max(height[q], height[head[t]] + 1);
+      }
+      max_height = std::max(max_height, height[q]);
+    }
+    std::vector<std::vector<int>> levels(max_height + 1);
+    for(int q = 0; q < live_states; q++)
+    {
+      levels[height[q]].push_back(q);
+    }
+    auto const compare = [&](int a, int b) {
+      if(final[a] != final[b]) return final[a] < final[b];
+      uint32_t i = out_first[a], j = out_first[b];
+      for(; i < out_first[a + 1] && j < out_first[b + 1]; i++, j++)
+      {
+        if(label[i] != label[j]) return label[i] < label[j];
+        if(cls[head[i]] != cls[head[j]]) return cls[head[i]] < cls[head[j]];
+      }
+      return i == out_first[a + 1] && j != out_first[b + 1];
+    };
+    for(auto &level : levels)
+    {
+      std::sort(level.begin(), level.end(), compare);
+      for(size_t i = 0; i < level.size(); i++)
+      {
+        if(i == 0 || compare(level[i - 1], level[i]))
+        {
+          classes++;
+        }
+        cls[level[i]] = classes - 1;
+      }
+    }
+  }
+  else
+  {
+    // Hopcroft: split the final from the other states, then split the
+    // blocks by the transitions of every label into every block
+    RefinablePartition blocks(live_states);
+    for(int q = 0; q < live_states; q++)
+    {
+      if(final[q])
+      {
+        blocks.mark(q);
+      }
+    }
+    blocks.split();
+
+    RefinablePartition cords(transitions_live);
+    std::sort(cords.elems.begin(), cords.elems.end(),
+              [&](int a, int b) { return label[a] < label[b]; });
+    if(transitions_live > 0)
+    {
+      cords.sets = 0;
+      cords.first[0] = 0;
+      for(int i = 0; i < transitions_live; i++)
+      {
+        int const t = cords.elems[i];
+        if(i > 0 && label[t] != label[cords.elems[i - 1]])
+        {
+          cords.past[cords.sets++] = i;
+          cords.first[cords.sets] = i;
+        }
+        cords.set[t] = cords.sets;
+        cords.loc[t] = i;
+      }
+      cords.past[cords.sets++] = transitions_live;
+    }
+
+    std::vector<uint32_t> in_head(live_states + 1, 0);
+    for(int t = 0; t < transitions_live; t++)
+    {
+      in_head[head[t] + 1]++;
+    }
+    for(int q = 0; q < live_states; q++)
+    {
+      in_head[q + 1] += in_head[q];
+    }
+    std::vector<int> incoming(transitions_live);
+    {
+      std::vector<uint32_t> next(in_head.begin(), in_head.end() - 1);
+      for(int t = 0; t < transitions_live; t++)
+      {
+        incoming[next[head[t]]++] = t;
+      }
+    }
+
+    int b = 1;
+    for(int c = 0; c < cords.sets; c++)
+    {
+      for(int i = cords.first[c]; i < cords.past[c]; i++)
+      {
+        blocks.mark(tail[cords.elems[i]]);
+      }
+      blocks.split();
+      for(; b < blocks.sets; b++)
+      {
+        for(int i = blocks.first[b]; i < blocks.past[b]; i++)
+        {
+          int const q = blocks.elems[i];
+          for(uint32_t j = in_head[q]; j < in_head[q + 1]; j++)
+          {
+            cords.mark(incoming[j]);
+          }
+        }
+        cords.split();
+      }
+    }
+    classes = blocks.sets;
+    cls = blocks.set;
+  }
+
+  // number the classes in the order determinize() finds them: from the
+  // initial one, through the transitions in the order of their labels,
+  // which every state already has them in
+  std::vector<int> representative(classes, -1);
+  for(int q = 0; q < live_states; q++)
+  {
+    if(representative[cls[q]] < 0)
+    {
+      representative[cls[q]] = q;
+    }
+  }
+  std::vector<int> number(classes, -1);
+  std::vector<int> numbered;
+  number[cls[live[initial]]] = 0;
+  numbered.push_back(cls[live[initial]]);
+  Arcs merged;
+  merged.first.push_back(0);
+  std::map<int, double> finals_merged;
+  for(size_t i = 0; i < numbered.size(); i++)
+  {
+    int const q = representative[numbered[i]];
+    if(final[q])
+    {
+      finals_merged.insert({static_cast<int>(i), default_weight});
+    }
+    for(uint32_t t = out_first[q]; t < out_first[q + 1]; t++)
+    {
+      int const target = cls[head[t]];
+      if(number[target] < 0)
+      {
+        number[target] = numbered.size();
+        numbered.push_back(target);
+      }
+      merged.arcs.push_back({labels[label[t]].first, number[target],
+                             labels[label[t]].second});
+    }
+    merged.first.push_back(merged.arcs.size());
+  }
+
+  std::swap(flat, merged);
+  finals.swap(finals_merged);
+  initial = 0;
+  return true;
 }
 
 void
@@ -594,6 +1624,9 @@ Transducer::read(FILE *input, int const decalage)
               throw std::runtime_error("Transducer has features that are unknown to this version of lttoolbox - upgrade!");
           }
           read_weights = (features & TDF_WEIGHTS);
+          if (features & TDF_MMAP) {
+              throw std::runtime_error("Transducer is in the memory mapped format, which cannot be read here");
+          }
       }
       else {
           // Old binary format
@@ -601,8 +1634,9 @@ Transducer::read(FILE *input, int const decalage)
       }
   }
 
-  new_t.initial = Compression::multibyte_read(input);
-  int finals_size = Compression::multibyte_read(input);
+  MultibyteReader in(input);
+  new_t.initial = in.read();
+  int finals_size = in.read();
 
   int base = 0;
   double base_weight = default_weight;
@@ -610,32 +1644,45 @@ Transducer::read(FILE *input, int const decalage)
   {
     finals_size--;
 
-    base += Compression::multibyte_read(input);
+    base += in.read();
     if(read_weights)
     {
-      base_weight = Compression::long_multibyte_read(input);
+      base_weight = in.readDouble();
     }
     new_t.finals.insert({base, base_weight});
   }
 
-  base = Compression::multibyte_read(input);
+  base = in.read();
   int number_of_states = base;
   int current_state = 0;
+  int const batch = 256;
+  std::vector<unsigned int> values(2 * batch);
   while(number_of_states > 0)
   {
-    int number_of_local_transitions = Compression::multibyte_read(input);
+    int number_of_local_transitions = in.read();
     int tagbase = 0;
     if (new_t.transitions.find(current_state) == new_t.transitions.end()) {
       new_t.transitions[current_state].clear(); // force create
     }
-    while(number_of_local_transitions > 0)
+    for(int i = 0; i < number_of_local_transitions; i++)
     {
-      number_of_local_transitions--;
-      tagbase += Compression::multibyte_read(input) - decalage;
-      int state = (current_state + Compression::multibyte_read(input)) % base;
+      if(!read_weights && i % batch == 0)
+      {
+        // the symbols and targets of the next transitions of the state
+        size_t count = std::min<size_t>(batch, number_of_local_transitions - i);
+        in.read(values.data(), 2 * count);
+      }
+      int state;
       if(read_weights)
       {
-        base_weight = Compression::long_multibyte_read(input);
+        tagbase += in.read() - decalage;
+        state = (current_state + in.read()) % base;
+        base_weight = in.readDouble();
+      }
+      else
+      {
+        tagbase += values[2 * (i % batch)] - decalage;
+        state = (current_state + values[2 * (i % batch) + 1]) % base;
       }
       if(new_t.transitions.find(state) == new_t.transitions.end())
       {
@@ -646,6 +1693,7 @@ Transducer::read(FILE *input, int const decalage)
     number_of_states--;
     current_state++;
   }
+  in.finish();
 
   *this = new_t;
 }
@@ -675,57 +1723,152 @@ Transducer::copy(Transducer const &t)
 }
 
 void
-Transducer::destroy()
+Transducer::destroy()
+{
+}
+
+void
+Transducer::reverse(int const epsilon_tag)
 {
+  Arcs flat;
+  flatten(flat);
+  reverse(flat, epsilon_tag);
+  unflatten(flat);
 }
 
 void
-Transducer::reverse(int const epsilon_tag)
+Transducer::reverse(Arcs &flat, int const epsilon_tag)
 {
-  joinFinals(epsilon_tag);
+  if(finals.size() == 0)
+  {
+    std::cerr << "Error: empty set of final states" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  // as joinFinals() would, link several finals to a new one
+  size_t const states = flat.first.size() - 1;
+  bool const join = finals.size() > 1;
 
-  std::map<int, std::multimap<int, std::pair<int, double> > > tmp_transitions;
+  Arcs reversed;
+  reversed.first.assign(states + join + 1, 0);
+  for(auto const &it : flat.arcs)
+  {
+    reversed.first[it.target + 1]++;
+  }
+  if(join)
+  {
+    reversed.first[states + 1] = finals.size();
+  }
+  for(size_t i = 0; i < states + join; i++)
+  {
+    reversed.first[i + 1] += reversed.first[i];
+  }
+  reversed.arcs.resize(reversed.first.back());
 
-  for(std::map<int, std::multimap<int, std::pair<int, double> > >::reverse_iterator it = transitions.rbegin(); it != transitions.rend(); it++)
+  // The transitions of a state come in the order the maps used to get
+  // them in: its loops, then those from the other states from the last
+  // to the first, stably sorted by tag
+  std::vector<uint32_t> next(reversed.first.begin(), reversed.first.end() - 1);
+  for(size_t i = 0; i < states; i++)
   {
-    auto aux = it->second;
-    it->second.clear();
-    for(auto& it2 : aux)
+    for(uint32_t j = flat.first[i]; j < flat.first[i+1]; j++)
     {
-      if(it2.second.first >= it->first)
+      Arc const &arc = flat.arcs[j];
+      if(arc.target == static_cast<int>(i))
       {
-        transitions[it2.second.first].insert({it2.first, std::make_pair(it->first, it2.second.second)});
+        reversed.arcs[next[i]++] = arc;
       }
-      else
+    }
+  }
+  for(size_t i = states; i-- > 0;)
+  {
+    for(uint32_t j = flat.first[i]; j < flat.first[i+1]; j++)
+    {
+      Arc const &arc = flat.arcs[j];
+      if(arc.target != static_cast<int>(i))
       {
-        tmp_transitions[it2.second.first].insert({it2.first, std::make_pair(it->first, it2.second.second)});
+        reversed.arcs[next[arc.target]++] = {arc.tag, static_cast<int>(i), arc.weight};
       }
     }
-    if(tmp_transitions.find(it->first) != tmp_transitions.end())
+  }
+  if(join)
+  {
+    for(auto it = finals.rbegin(); it != finals.rend(); it++)
     {
-      it->second.insert(tmp_transitions[it->first].begin(), tmp_transitions[it->first].end());
-      tmp_transitions.erase(it->first);
+      reversed.arcs[next[states]++] = {epsilon_tag, it->first, it->second};
     }
   }
+  flat.first.clear();
+  flat.arcs.clear();
 
-  for(std::map<int, std::multimap<int, std::pair<int, double> > >::reverse_iterator it = tmp_transitions.rbegin(),
-                                                                  limit = tmp_transitions.rend();
-      it != limit; it++)
+  auto const byTag = [](Arc const &a, Arc const &b) { return a.tag < b.tag; };
+  for(size_t i = 0; i < states + join; i++)
   {
-    for(auto& it2 : it->second)
+    auto begin = reversed.arcs.begin() + reversed.first[i];
+    auto end = reversed.arcs.begin() + reversed.first[i+1];
+    if(!std::is_sorted(begin, end, byTag))
     {
-      transitions[it->first].insert({it2.first, it2.second});
+      std::stable_sort(begin, end, byTag);
     }
   }
+  std::swap(flat, reversed);
 
   int tmp = initial;
-  initial = finals.begin()->first;
+  initial = join ? states : finals.begin()->first;
   finals.clear();
   finals.insert({tmp, default_weight});
 }
 
 void
-Transducer::escapeSymbol(UString& symbol, bool hfst) const
+Transducer::flatten(Arcs &flat)
+{
+  // states missing from the maps are given no transitions
+  size_t states = transitions.empty() ? 0 : transitions.rbegin()->first + 1;
+  flat.first.assign(states + 1, 0);
+  flat.arcs.clear();
+  for(auto& it : transitions)
+  {
+    flat.first[it.first + 1] = it.second.size();
+  }
+  for(size_t i = 0; i < states; i++)
+  {
+    flat.first[i + 1] += flat.first[i];
+  }
+  flat.arcs.reserve(flat.first.back());
+  for(auto& it : transitions)
+  {
+    for(auto& it2 : it.second)
+    {
+      flat.arcs.push_back({it2.first, it2.second.first, it2.second.second});
+      if(it2.second.first >= static_cast<int>(states))
+      {
+        states = it2.second.first + 1;
+      }
+    }
+  }
+  flat.first.resize(states + 1, flat.first.back());
+  transitions.clear();
+}
+
+void
+Transducer::unflatten(Arcs &flat)
+{
+  transitions.clear();
+  for(size_t i = 0; i + 1 < flat.first.size(); i++)
+  {
+    auto& state = transitions.emplace_hint(transitions.end(), i,
+                                           std::multimap<int, std::pair<int, double> >())->second;
+    for(uint32_t j = flat.first[i]; j < flat.first[i+1]; j++)
+    {
+      Arc const &arc = flat.arcs[j];
+      state.emplace_hint(state.end(), arc.tag, std::make_pair(arc.target, arc.weight));
+    }
+  }
+  flat.first.clear();
+  flat.arcs.clear();
+}
+
+void
+Transducer::escapeSymbol(UString& symbol, bool hfst)
 {
   if(symbol.empty()) // If it's an epsilon
   {
@@ -775,6 +1918,167 @@ Transducer::show(Alphabet const &alphabet, UFILE *output, int const epsilon_tag,
   }
 }
 
+void
+Transducer::show(FILE *input, Alphabet const &alphabet, UFILE *output,
+                 int const epsilon_tag, bool hfst)
+{
+  bool read_weights = false;
+
+  fpos_t pos;
+  if (fgetpos(input, &pos) == 0) {
+      char header[4]{};
+      fread_unlocked(header, 1, 4, input);
+      if (strncmp(header, HEADER_TRANSDUCER, 4) == 0) {
+          auto features = read_le<uint64_t>(input);
+          if (features >= TDF_UNKNOWN) {
+              throw std::runtime_error("Transducer has features that are unknown to this version of lttoolbox - upgrade!");
+          }
+          read_weights = (features & TDF_WEIGHTS);
+          if (features & TDF_MMAP) {
+              throw std::runtime_error("Transducer is in the memory mapped format, which cannot be read here");
+          }
+      }
+      else {
+          // Old binary format
+          fsetpos(input, &pos);
+      }
+  }
+
+  MultibyteReader in(input);
+  in.read(); // the initial state isn't printed
+  int finals_size = in.read();
+
+  // in order, as read() would put them in the map
+  std::vector<std::pair<int, double>> finals;
+  int base = 0;
+  double base_weight = default_weight;
+  while(finals_size > 0)
+  {
+    finals_size--;
+
+    base += in.read();
+    if(read_weights)
+    {
+      base_weight = in.readDouble();
+    }
+    if(finals.empty() || finals.back().first < base)
+    {
+      finals.push_back({base, base_weight});
+    }
+    else if(finals.back().first != base)
+    {
+      auto it = std::lower_bound(finals.begin(), finals.end(), std::make_pair(base, 0.0),
+                                 [](std::pair<int, double> const &a, std::pair<int, double> const &b) {
+                                   return a.first < b.first;
+                                 });
+      if(it->first != base)
+      {
+        finals.insert(it, {base, base_weight});
+      }
+    }
+  }
+
+  base = in.read();
+  int number_of_states = base;
+  int current_state = 0;
+
+  // with several finals joinFinals() links them to a new state
+  bool const join = finals.size() > 1;
+  int const joined = number_of_states;
+  if(output != nullptr)
+  {
+    if(finals.empty())
+    {
+      std::cerr << "Error: empty set of final states" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    for(auto const &it : finals)
+    {
+      if(join && (it.first < 0 || it.first > joined))
+      {
+        std::cerr << "Error: Trying to link nonexistent states (" << it.first;
+        std::cerr << ", " << joined << ", " << epsilon_tag << ")" << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+
+  auto const print = [&](int source, Arc const &arc) {
+    auto t = alphabet.decode(arc.tag);
+    u_fprintf(output, "%d\t%d\t", source, arc.target);
+    UString l;
+    alphabet.getSymbol(l, t.first);
+    escapeSymbol(l, hfst);
+    u_fprintf(output, "%S\t", l.c_str());
+    UString r;
+    alphabet.getSymbol(r, t.second);
+    escapeSymbol(r, hfst);
+    u_fprintf(output, "%S\t", r.c_str());
+    u_fprintf(output, "%f\t\n", arc.weight);
+  };
+
+  auto const byTag = [](Arc const &a, Arc const &b) { return a.tag < b.tag; };
+  auto next_final = finals.begin();
+  std::vector<Arc> arcs;
+  while(number_of_states > 0)
+  {
+    int number_of_local_transitions = in.read();
+    int tagbase = 0;
+    arcs.clear();
+    for(int i = 0; i < number_of_local_transitions; i++)
+    {
+      tagbase += in.read();
+      int state = (current_state + in.read()) % base;
+      if(read_weights)
+      {
+        base_weight = in.readDouble();
+      }
+      if(output != nullptr)
+      {
+        arcs.push_back({tagbase, state, base_weight});
+      }
+    }
+
+    if(output != nullptr)
+    {
+      if(!std::is_sorted(arcs.begin(), arcs.end(), byTag))
+      {
+        std::stable_sort(arcs.begin(), arcs.end(), byTag);
+      }
+      if(join && next_final != finals.end() && next_final->first == current_state)
+      {
+        Arc const arc = {epsilon_tag, joined, next_final->second};
+        arcs.insert(std::upper_bound(arcs.begin(), arcs.end(), arc, byTag), arc);
+        next_final++;
+      }
+      for(auto const &arc : arcs)
+      {
+        print(current_state, arc);
+      }
+    }
+    number_of_states--;
+    current_state++;
+  }
+  in.finish();
+
+  if(output != nullptr)
+  {
+    if(join && next_final != finals.end())
+    {
+      // a final that is the new state itself
+      print(joined, {epsilon_tag, joined, next_final->second});
+    }
+    if(join)
+    {
+      u_fprintf(output, "%d\t%f\n", joined, default_weight);
+    }
+    else
+    {
+      u_fprintf(output, "%d\t%f\n", finals[0].first, finals[0].second);
+    }
+  }
+}
+
 int
 Transducer::getStateSize(int const state)
 {
@@ -1038,6 +2342,34 @@ Transducer::moveLemqsLast(Alphabet const &alphabet,
 }
 
 
+namespace {
+  /**
+   * Hash of the tuples of state numbers that trim() and compose() keep
+   * their product states in
+   */
+  struct ProductStateHash
+  {
+    static size_t mix(uint64_t h)
+    {
+      h ^= h >> 31;
+      h *= 0xBF58476D1CE4E5B9ULL;
+      return static_cast<size_t>(h ^ (h >> 29));
+    }
+
+    size_t operator()(std::pair<int, int> const &s) const
+    {
+      return mix((static_cast<uint64_t>(static_cast<uint32_t>(s.first)) << 32) |
+                 static_cast<uint32_t>(s.second));
+    }
+
+    size_t operator()(std::pair<int, std::pair<int, int> > const &s) const
+    {
+      return mix((*this)(s.second) * 0x9E3779B97F4A7C15ULL +
+                 static_cast<uint32_t>(s.first));
+    }
+  };
+}
+
 Transducer
 Transducer::trim(Transducer &trimmer,
                       Alphabet const &this_a,
@@ -1060,10 +2392,13 @@ Transducer::trim(Transducer &trimmer,
 
   // State numbers will differ in thisXtrimmer transducers and the trimmed:
   Transducer trimmed;
-  std::map<SearchState, int> states_this_trimmed;
+  std::unordered_map<SearchState, int, ProductStateHash> states_this_trimmed;
 
+  // Worklist of product states still to expand; a state may be queued
+  // again before it is first expanded, which is harmless since
+  // linkStates ignores arcs it already has
   std::vector<SearchState> todo;
-  std::set<SearchState> seen;
+  std::unordered_set<SearchState, ProductStateHash> seen;
   SearchState current;
   SearchState next{initial, {trimmer.initial, trimmer.initial}};
   todo.push_back(next);
@@ -1087,6 +2422,46 @@ Transducer::trim(Transducer &trimmer,
     sym_cmp_or_eps.insert(0); // epsilon
   }
 
+  // The trimmer is only read here (several sections may be trimmed
+  // against it at once), so look its states up without operator[]
+  std::multimap<int, std::pair<int, double> > const no_arcs;
+  auto trimmer_arcs = [&](int const state) -> std::multimap<int, std::pair<int, double> > const & {
+    auto it = trimmer.transitions.find(state);
+    return it == trimmer.transitions.end() ? no_arcs : it->second;
+  };
+
+  // Comparing tags across alphabets goes by their names, so remember
+  // each answer rather than asking sameSymbol for every pair of arcs
+  std::unordered_map<uint64_t, bool> same_symbol;
+  auto matches = [&](int32_t const this_sym, int32_t const trimmer_sym) {
+    if(this_sym >= 0 && trimmer_sym >= 0 && this_sym == trimmer_sym) {
+      return true;
+    }
+    if(this_sym >= 0 && trimmer_sym >= 0) {
+      return false;
+    }
+    uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(this_sym)) << 32) |
+                   static_cast<uint32_t>(trimmer_sym);
+    auto it = same_symbol.find(key);
+    if(it == same_symbol.end()) {
+      it = same_symbol.insert({key, this_a.sameSymbol(this_sym, trimmer_a, trimmer_sym, true)}).first;
+    }
+    return it->second;
+  };
+
+  // Gives the trimmed state for a product state, queueing it first if
+  // it has not been expanded yet
+  auto reach = [&](SearchState const &state) {
+    if(seen.find(state) == seen.end()) {
+      todo.push_back(state);
+    }
+    auto it = states_this_trimmed.find(state);
+    if(it == states_this_trimmed.end()) {
+      it = states_this_trimmed.insert({state, trimmed.newState()}).first;
+    }
+    return it->second;
+  };
+
   while(!todo.empty()) {
     current = todo.back();
     todo.pop_back();
@@ -1096,14 +2471,15 @@ Transducer::trim(Transducer &trimmer,
         trimmer_preplus = current.second.second,
         trimmer_preplus_next = trimmer_preplus;
 
-    if(states_this_trimmed.find(current) == states_this_trimmed.end()) {
+    auto found = states_this_trimmed.find(current);
+    if(found == states_this_trimmed.end()) {
       std::cerr <<"Error: couldn't find "<<this_src<<","<<trimmer_src<<" in state map"<< std::endl;
       exit(EXIT_FAILURE);
     }
-    int trimmed_src = states_this_trimmed[current];
+    int trimmed_src = found->second;
 
     // First loop through _epsilon_ transitions of trimmer
-    for(auto& trimmer_trans_it : trimmer.transitions[trimmer_src]) {
+    for(auto& trimmer_trans_it : trimmer_arcs(trimmer_src)) {
       int trimmer_label = trimmer_trans_it.first,
           trimmer_trg   = trimmer_trans_it.second.first;
       double trimmer_wt = trimmer_trans_it.second.second;
@@ -1122,7 +2498,7 @@ Transducer::trim(Transducer &trimmer,
           todo.push_back(next);
           states_this_trimmed.insert({next, trimmed.newState()});
         }
-        int trimmed_trg = states_this_trimmed[next];
+        int trimmed_trg = states_this_trimmed.at(next);
         trimmed.linkStates(trimmed_src,
                            trimmed_trg,
                            epsilon_tag,
@@ -1132,7 +2508,11 @@ Transducer::trim(Transducer &trimmer,
 
     // Loop through arcs from this_src; when our arc matches an arc
     // from live_trimmer_states, add that to (the front of) todo:
-    for(auto& trans_it : transitions[this_src])
+    auto this_arcs = transitions.find(this_src);
+    if(this_arcs == transitions.end()) {
+      continue;
+    }
+    for(auto& trans_it : this_arcs->second)
     {
       int this_label = trans_it.first,
           this_trg   = trans_it.second.first;
@@ -1149,15 +2529,7 @@ Transducer::trim(Transducer &trimmer,
         }
         // Go to the start in trimmer, but record where we restarted from in case we later see a #:
         next = std::make_pair(this_trg, std::make_pair(trimmer.initial, trimmer_preplus_next));
-        if(seen.find(next) == seen.end())
-        {
-          todo.push_back(next);
-        }
-        if(states_this_trimmed.find(next) == states_this_trimmed.end())
-        {
-          states_this_trimmed.insert({next, trimmed.newState()});
-        }
-        int trimmed_trg = states_this_trimmed[next];
+        int trimmed_trg = reach(next);
         trimmed.linkStates(trimmed_src, // fromState
                            trimmed_trg, // toState
                            this_label, // symbol-pair, using this alphabet
@@ -1177,15 +2549,7 @@ Transducer::trim(Transducer &trimmer,
         }
 
         next = std::make_pair(this_trg, std::make_pair(trimmer_trg, trimmer_preplus_next));
-        if(seen.find(next) == seen.end())
-        {
-          todo.push_back(next);
-        }
-        if(states_this_trimmed.find(next) == states_this_trimmed.end())
-        {
-          states_this_trimmed.insert({next, trimmed.newState()});
-        }
-        int trimmed_trg = states_this_trimmed[next];
+        int trimmed_trg = reach(next);
         trimmed.linkStates(trimmed_src, // fromState
                            trimmed_trg, // toState
                            this_label, // symbol-pair, using this alphabet
@@ -1204,7 +2568,7 @@ Transducer::trim(Transducer &trimmer,
           trimmer_src = trimmer_preplus;
         }
 
-        for(auto& trimmer_trans_it : trimmer.transitions.at(trimmer_src))
+        for(auto& trimmer_trans_it : trimmer_arcs(trimmer_src))
         {
           int trimmer_label = trimmer_trans_it.first,
               trimmer_trg   = trimmer_trans_it.second.first;
@@ -1216,17 +2580,9 @@ Transducer::trim(Transducer &trimmer,
           }
 
           if (trimmer_left != 0 && // we've already dealt with trimmer epsilons
-              this_a.sameSymbol(this_right, trimmer_a, trimmer_left, true)) {
+              matches(this_right, trimmer_left)) {
             next = std::make_pair(this_trg, std::make_pair(trimmer_trg, trimmer_preplus_next));
-            if(seen.find(next) == seen.end())
-            {
-              todo.push_back(next);
-            }
-            if(states_this_trimmed.find(next) == states_this_trimmed.end())
-            {
-              states_this_trimmed.insert(std::make_pair(next, trimmed.newState()));
-            }
-            int trimmed_trg = states_this_trimmed[next];
+            int trimmed_trg = reach(next);
             trimmed.linkStates(trimmed_src, // fromState
                                trimmed_trg, // toState
                                this_label, // symbol-pair, using this alphabet
@@ -1244,7 +2600,7 @@ Transducer::trim(Transducer &trimmer,
     int s_trimmed = it.second;
     if(isFinal(s_this) && trimmer.isFinal(s_trimmer))
     {
-      trimmed.finals.insert(std::make_pair(s_trimmed, finals[s_this]));
+      trimmed.finals.insert(std::make_pair(s_trimmed, finals.at(s_this)));
     }
   }
 
@@ -1312,18 +2668,87 @@ void
 Transducer::invert(Alphabet& alpha)
 {
   std::map<int, std::multimap<int, std::pair<int, double>>> tmp_trans;
+  std::unordered_map<int, int> inverted;
   for (auto& it : transitions) {
     std::multimap<int, std::pair<int, double>> tmp_state;
     for (auto& it2 : it.second) {
-      auto pr = alpha.decode(it2.first);
-      int new_sym = alpha(pr.second, pr.first);
-      tmp_state.insert({new_sym, it2.second});
+      auto found = inverted.find(it2.first);
+      if (found == inverted.end()) {
+        auto pr = alpha.decode(it2.first);
+        found = inverted.insert({it2.first, alpha(pr.second, pr.first)}).first;
+      }
+      tmp_state.insert({found->second, it2.second});
     }
     tmp_trans.insert({it.first, tmp_state});
   }
   transitions.swap(tmp_trans);
 }
 
+void
+Transducer::renumber(std::vector<uint64_t> const &visits)
+{
+  std::map<int, uint64_t> count;
+  size_t position = 0;
+  for(auto& it : transitions)
+  {
+    count[it.first] = (position < visits.size() ? visits[position] : 0);
+    position++;
+  }
+
+  std::vector<int> order;
+  std::set<int> seen;
+  order.push_back(initial);
+  seen.insert(initial);
+  for(size_t i = 0; i < order.size(); i++)
+  {
+    auto trans = transitions.find(order[i]);
+    if(trans == transitions.end())
+    {
+      continue;
+    }
+    for(auto& it : trans->second)
+    {
+      if(seen.insert(it.second.first).second)
+      {
+        order.push_back(it.second.first);
+      }
+    }
+  }
+  for(auto& it : transitions)
+  {
+    if(seen.insert(it.first).second)
+    {
+      order.push_back(it.first);
+    }
+  }
+  std::stable_sort(order.begin() + 1, order.end(), [&](int a, int b) {
+    return count[a] > count[b];
+  });
+
+  std::map<int, int> number;
+  for(size_t i = 0; i < order.size(); i++)
+  {
+    number[order[i]] = i;
+  }
+  std::map<int, std::multimap<int, std::pair<int, double> > > new_transitions;
+  for(auto& it : transitions)
+  {
+    auto& trans = new_transitions[number[it.first]];
+    for(auto& it2 : it.second)
+    {
+      trans.insert({it2.first, {number[it2.second.first], it2.second.second}});
+    }
+  }
+  std::map<int, double> new_finals;
+  for(auto& it : finals)
+  {
+    new_finals[number[it.first]] = it.second;
+  }
+  transitions.swap(new_transitions);
+  finals.swap(new_finals);
+  initial = 0;
+}
+
 void
 Transducer::deleteSymbols(const sorted_vector<int32_t>& syms)
 {
@@ -1369,6 +2794,49 @@ Transducer::applyACX(Alphabet& alpha,
   }
 }
 
+std::vector<bool>
+Transducer::coaccessible(bool initial_too) const
+{
+  int states = 0;
+  for(auto const &it : transitions) {
+    states = std::max(states, it.first + 1);
+    for(auto const &arc : it.second) {
+      states = std::max(states, arc.second.first + 1);
+    }
+  }
+  for(auto const &it : finals) {
+    states = std::max(states, it.first + 1);
+  }
+  states = std::max(states, initial + 1);
+
+  std::vector<std::vector<int>> sources(states);
+  for(auto const &it : transitions) {
+    for(auto const &arc : it.second) {
+      sources[arc.second.first].push_back(it.first);
+    }
+  }
+  std::vector<bool> live(states, false);
+  std::vector<int> todo;
+  for(auto const &it : finals) {
+    live[it.first] = true;
+    todo.push_back(it.first);
+  }
+  if(initial_too && !live[initial]) {
+    live[initial] = true;
+    todo.push_back(initial);
+  }
+  while(!todo.empty()) {
+    int state = todo.back();
+    todo.pop_back();
+    for(int source : sources[state]) {
+      if(!live[source]) {
+        live[source] = true;
+        todo.push_back(source);
+      }
+    }
+  }
+  return live;
+}
 
 Transducer
 Transducer::compose(Transducer const &g,
@@ -1376,7 +2844,8 @@ Transducer::compose(Transducer const &g,
                     Alphabet const &g_a, // alphabet of g
                     bool f_inverted,
                     bool g_anywhere,
-                    int const epsilon_tag)
+                    int const epsilon_tag,
+                    bool prune)
 {
   /**
    * g ∘ f = composed
@@ -1418,17 +2887,112 @@ Transducer::compose(Transducer const &g,
   // (f_state, g_state)
   typedef std::pair<int, int> SearchState;
 
+  // The labels of g as f_a numbers them, looked up once here rather
+  // than by name for every pair of arcs: the input side for matching
+  // (0 for tags f_a lacks, which match nothing), the output side for
+  // the label of gf (0 for tags f_a lacks, as composeLabel gives)
+  struct JoinedLabel
+  {
+    int32_t left = 0, left_in_f = 0, right_in_f = 0;
+    bool any_char = false, any_tag = false;
+  };
+  auto in_f = [&](int32_t const g_sym) -> int32_t {
+    if(g_sym >= 0) { // non-symbols are equal across alphabets
+      return g_sym;
+    }
+    UString tag;
+    g_a.getSymbol(tag, g_sym);
+    return f_a.isSymbolDefined(tag) ? f_a(tag) : 0;
+  };
+  auto defined = [](Alphabet const &a, UStringView tag) -> int32_t {
+    return a.isSymbolDefined(tag) ? a(tag) : 0;
+  };
+  int32_t const g_any_char = defined(g_a, u"<ANY_CHAR>"_uv),
+                g_any_tag = defined(g_a, u"<ANY_TAG>"_uv),
+                f_any_char = defined(f_a, u"<ANY_CHAR>"_uv),
+                f_any_tag = defined(f_a, u"<ANY_TAG>"_uv);
+  std::vector<JoinedLabel> g_labels;
+  for(auto const &state : g.transitions) {
+    for(auto const &arc : state.second) {
+      if(static_cast<size_t>(arc.first) >= g_labels.size()) {
+        g_labels.resize(arc.first + 1);
+      }
+    }
+  }
+  std::vector<bool> g_label_done(g_labels.size(), false);
+  for(auto const &state : g.transitions) {
+    for(auto const &arc : state.second) {
+      if(g_label_done[arc.first]) {
+        continue;
+      }
+      g_label_done[arc.first] = true;
+      auto leftright = g_a.decode(arc.first);
+      JoinedLabel &label = g_labels[arc.first];
+      label.left = leftright.first;
+      label.left_in_f = in_f(leftright.first);
+      label.right_in_f = in_f(leftright.second);
+      label.any_char = label.left < 0 && label.left == g_any_char;
+      label.any_tag = label.left < 0 && label.left == g_any_tag;
+    }
+  }
+  // Alphabet::sameSymbol(f_output, g_a, g_left, true) on the table
+  auto matches = [&](int32_t const f_output, JoinedLabel const &label) {
+    if(f_output > 0) {
+      return f_output == label.left || label.any_char;
+    }
+    if(f_output < 0) {
+      return f_output == label.left_in_f || label.any_tag ||
+             (f_output == f_any_char && label.left > 0) ||
+             (f_output == f_any_tag && label.left < 0);
+    }
+    return false;
+  };
+  auto join = [&](int32_t const f_input, JoinedLabel const &label) {
+    return f_inverted ? f_a(label.right_in_f, f_input)
+                      : f_a(f_input, label.right_in_f);
+  };
+
+  // When pruning, pairs from which f or g can no longer reach a final
+  // state are never made, as they could not give a final state in gf
+  std::vector<bool> f_live, g_live;
+  if(prune) {
+    f_live = coaccessible(false);
+    g_live = g.coaccessible(g_anywhere);
+  }
+  auto live = [&](SearchState const &state) {
+    return !prune || (f_live[state.first] && g_live[state.second]);
+  };
+
   // State numbers will differ in fXg transducers and gf:
   Transducer gf;
-  std::map<SearchState, int> states_f_g_gf;
+  std::unordered_map<SearchState, int, ProductStateHash> states_f_g_gf;
 
+  // Worklist of the pairs still to expand; a pair reached again before
+  // it was expanded is queued again, which keeps the order gf and f_a
+  // get their states and labels in what it always was
   std::vector<SearchState> todo;
-  std::set<SearchState> seen;
+  std::unordered_set<SearchState, ProductStateHash> seen;
   SearchState current;
   SearchState next{initial, g.initial};
   todo.push_back(next);
   states_f_g_gf.insert({next, gf.initial});
 
+  // Links gf_src to the state of a pair, making it the first time it
+  // is reached and queueing it until it is expanded
+  auto link = [&](int gf_src, SearchState const &state, int32_t label, double wt) {
+    if(!live(state)) {
+      return;
+    }
+    if(seen.find(state) == seen.end()) {
+      todo.push_back(state);
+    }
+    auto it = states_f_g_gf.find(state);
+    if(it == states_f_g_gf.end()) {
+      it = states_f_g_gf.insert({state, gf.newState()}).first;
+    }
+    gf.linkStates(gf_src, it->second, label, wt);
+  };
+
   while(!todo.empty()) {
     current = todo.back();
     todo.pop_back();
@@ -1436,42 +3000,31 @@ Transducer::compose(Transducer const &g,
     int f_src  = current.first,
         g_src     = current.second;
 
-    if(states_f_g_gf.find(current) == states_f_g_gf.end()) {
+    auto found = states_f_g_gf.find(current);
+    if(found == states_f_g_gf.end()) {
       std::cerr <<"Error: couldn't find "<<f_src<<","<<g_src<<" in state map"<< std::endl;
       exit(EXIT_FAILURE);
     }
-    int gf_src = states_f_g_gf[current];
+    int gf_src = found->second;
+    auto const &g_arcs = g.transitions.at(g_src);
 
     // First loop through _epsilon_ transitions of g (input side)
-    for(const auto &g_trans_it : g.transitions.at(g_src)) {
-      int g_label = g_trans_it.first,
-          g_trg   = g_trans_it.second.first;
-      double g_wt = g_trans_it.second.second;
-      std::pair<int32_t, int32_t> g_leftright = g_a.decode(g_label);
-      int32_t g_left = g_leftright.first,
-              g_right = g_leftright.second;
-
-      if(g_left == 0)
-      {
-        next = std::make_pair(f_src, g_trg);
-        if (seen.find(next) == seen.end()) {
-          todo.push_back(next);
-        }
-        if (states_f_g_gf.find(next) == states_f_g_gf.end()) {
-          states_f_g_gf.insert({next, gf.newState()});
-        }
-        int gf_trg = states_f_g_gf[next];
-        int32_t gf_label = composeLabel(f_a, g_a, 0, g_right, f_inverted);
-        gf.linkStates(gf_src,
-                      gf_trg,
-                      gf_label,
-                      g_wt);
+    for(const auto &g_trans_it : g_arcs) {
+      JoinedLabel const &g_label = g_labels[g_trans_it.first];
+      if(g_label.left == 0)
+      {
+        link(gf_src, std::make_pair(f_src, g_trans_it.second.first),
+             join(0, g_label), g_trans_it.second.second);
       }
     }
 
     // Loop through arcs from f_src; when the right-side of our arc
     // matches left-side of an arc from g states, add that to todo:
-    for(auto& trans_it : transitions[f_src])
+    auto f_arcs = transitions.find(f_src);
+    if(f_arcs == transitions.end()) {
+      continue;
+    }
+    for(auto& trans_it : f_arcs->second)
     {
       int f_label = trans_it.first,
           f_trg   = trans_it.second.first;
@@ -1488,63 +3041,26 @@ Transducer::compose(Transducer const &g,
       }
 
       // Loop through non-epsilon arcs from the live state of g
-      for (auto &g_trans_it : g.transitions.at(g_src)) {
-        int g_label = g_trans_it.first,
-            g_trg = g_trans_it.second.first;
-        double g_wt = g_trans_it.second.second;
-        std::pair<int32_t, int32_t> g_leftright = g_a.decode(g_label);
-        const int32_t g_left = g_leftright.first,
-                      g_right = g_leftright.second;
+      for (auto &g_trans_it : g_arcs) {
+        JoinedLabel const &g_label = g_labels[g_trans_it.first];
 
         // output of f same as input of g?
         // label becomes input of f and output of g
-        if (g_left != 0 && // we've already dealt with g epsilons
-            f_a.sameSymbol(f_output, g_a, g_left, true)) {
-          next = std::make_pair(f_trg, g_trg);
-          if (seen.find(next) == seen.end()) {
-            todo.push_back(next);
-          }
-          if (states_f_g_gf.find(next) == states_f_g_gf.end()) {
-            states_f_g_gf.insert({next, gf.newState()});
-          }
-          int gf_trg = states_f_g_gf[next];
-          int32_t gf_label = composeLabel(f_a, g_a, f_input, g_right, f_inverted);
-          gf.linkStates(gf_src,   // fromState
-                        gf_trg,   // toState
-                        gf_label, // symbol-pair, using f alphabet
-                        f_wt + g_wt); // weight of transduction – composition adds weights!
+        if (g_label.left != 0 && // we've already dealt with g epsilons
+            matches(f_output, g_label)) {
+          link(gf_src, std::make_pair(f_trg, g_trans_it.second.first),
+               join(f_input, g_label), // symbol-pair, using f alphabet
+               f_wt + g_trans_it.second.second); // weight of transduction – composition adds weights!
         }
       }
       if(g_anywhere && g_src == g.initial) {
         // If g_anywhere, all g entries are optional – we always add
         // the transitions that were already in f:
-        next = std::make_pair(f_trg, g_src);
-        if (seen.find(next) == seen.end()) {
-          todo.push_back(next);
-        }
-        if (states_f_g_gf.find(next) == states_f_g_gf.end()) {
-          states_f_g_gf.insert({next, gf.newState()});
-        }
-        int gf_trg = states_f_g_gf[next];
-        gf.linkStates(gf_src,  // fromState
-                      gf_trg,  // toState
-                      f_label, // symbol-pair, using f alphabet
-                      f_wt);   // weight of transduction
+        link(gf_src, std::make_pair(f_trg, g_src), f_label, f_wt);
       }
       // If f has an epsilon, also add a transition not to g.initial but g_src:
       if(f_output == 0) {      // will be the left if f_inverted
-        next = std::make_pair(f_trg, g_src);
-        if (seen.find(next) == seen.end()) {
-          todo.push_back(next);
-        }
-        if (states_f_g_gf.find(next) == states_f_g_gf.end()) {
-          states_f_g_gf.insert({next, gf.newState()});
-        }
-        int gf_trg = states_f_g_gf[next];
-        gf.linkStates(gf_src,  // fromState
-                      gf_trg,  // toState
-                      f_label, // symbol-pair, using f alphabet
-                      f_wt);   // weight of transduction
+        link(gf_src, std::make_pair(f_trg, g_src), f_label, f_wt);
       }
     } // end loop arcs from f_src
   } // end while todo
@@ -1558,8 +3074,8 @@ Transducer::compose(Transducer const &g,
                         // if we're in anywhere mode, every state will be paired with g.initial if it's not paired with something in the middle of g
                         || (g_anywhere && g.initial == s_g)))
     {
-      double wt_gf = finals[s_f] + (g.isFinal(s_g) ? g.finals.at(s_g)
-                                                   : default_weight);
+      double wt_gf = finals.at(s_f) + (g.isFinal(s_g) ? g.finals.at(s_g)
+                                                      : default_weight);
       gf.finals.insert({s_gf, wt_gf});
     }
   }
@@ -17,9 +17,11 @@
 #ifndef _TRANSDUCTOR_
 #define _TRANSDUCTOR_
 
+#include <cstdint>
 #include <cstdio>
 #include <map>
 #include <set>
+#include <vector>
 
 #include <lttoolbox/alphabet.h>
 #include <lttoolbox/sorted_vector.hpp>
@@ -32,6 +34,7 @@
 constexpr double default_weight = 0;
 
 class MatchExe;
+class TransExe;
 
 /**
  * Class to represent a letter transducer during the dictionary compilation
@@ -40,6 +43,8 @@ class Transducer
 {
 private:
   friend class MatchExe;
+  friend class MatchTable;
+  friend class TransExe;
 
   /**
    * Initial state
@@ -58,6 +63,97 @@ private:
    */
   std::map<int, std::multimap<int, std::pair<int, double> > > transitions;
 
+  /**
+   * Transition in Arcs
+   */
+  struct Arc
+  {
+    int tag;
+    int target;
+    double weight;
+  };
+
+  /**
+   * The transitions of all the states in two arrays, for the algorithms
+   * that rebuild the whole transducer: a tree node per transition costs
+   * them far more memory, allocations and cache misses.  Those of state
+   * s are arcs[first[s]] up to arcs[first[s + 1]], in the order of
+   * transitions[s].
+   */
+  struct Arcs
+  {
+    std::vector<uint32_t> first;
+    std::vector<Arc> arcs;
+  };
+
+  /**
+   * Move the transitions to flat; states missing from the maps, which
+   * they allow, get no transitions
+   */
+  void flatten(Arcs &flat);
+
+  /**
+   * Move the transitions back from flat
+   */
+  void unflatten(Arcs &flat);
+
+  /**
+   * reverse() on flat transitions
+   */
+  void reverse(Arcs &flat, int epsilon_tag);
+
+  /**
+   * determinize() on flat transitions
+   */
+  void determinize(Arcs &flat, int epsilon_tag);
+
+  /**
+   * Merge the equivalent states of the transducer in flat, if it is
+   * deterministic, and drop those no final state can be reached from,
+   * numbering the rest as determinize() would, which leaves it the same
+   * as reversing and determinizing it twice would.  Acyclic transducers
+   * are merged level by level from the end (Revuz), others by partition
+   * refinement (Hopcroft, as Valmari lays it out for partial automata).
+   * @return false, changing nothing, if there is an epsilon transition,
+   * two transitions of a state on the same tag and weight, or no final
+   * state can be reached
+   */
+  bool mergeEquivalent(Arcs &flat, int epsilon_tag);
+
+  /**
+   * Minimize the transducer in flat by reversing and determinizing it
+   * twice (Brzozowski)
+   */
+  void brzozowski(Arcs &flat, int epsilon_tag);
+
+  /**
+   * Minimize the transducer in flat by splitting it by the first symbol
+   * read, minimizing the parts on separate threads and merging their
+   * equivalent states under a shared initial state
+   * @param jobs most parts, and threads, to use
+   * @return false, changing nothing, if it has fewer than two first
+   * symbols
+   */
+  bool minimizeParts(Arcs &flat, int epsilon_tag, unsigned jobs);
+
+  /**
+   * If push, move the weights of the deterministic transducer in flat
+   * towards the initial state, so that the lightest way from each state
+   * to a final one weighs 0 and states whose suffixes only differ in
+   * where their weights lie become equivalent; the weight of every path
+   * stays the same.  Then round the weights to multiples of quantum, if
+   * above 0.  Weights are only pushed when none is negative and no final
+   * state has a weight, as minimizing drops those
+   * @return whether any weight changed
+   */
+  bool reweight(Arcs &flat, bool push, double quantum);
+
+  /**
+   * The states a final state can be reached from, indexed by state
+   * @param initial_too count the initial state as final
+   */
+  std::vector<bool> coaccessible(bool initial_too) const;
+
   /**
    * New state creator
    * @return the new state number
@@ -80,7 +176,7 @@ private:
    * @param symbol the string to be escaped
    * @param hfst if true, use HFST-compatible escape sequences
    */
-  void escapeSymbol(UString& symbol, bool hfst) const;
+  static void escapeSymbol(UString& symbol, bool hfst);
 
 public:
 
@@ -248,6 +344,15 @@ public:
    */
   void show(Alphabet const &a, UFILE *output, int epsilon_tag = 0, bool hfst = false) const;
 
+  /**
+   * Print the transducer at input as show() prints it after joinFinals(),
+   * state by state as it is decoded, so that only the transitions of one
+   * state are kept at a time; with no output it is just gone past
+   * @param input the stream, at a transducer not in the mapped format
+   */
+  static void show(FILE *input, Alphabet const &a, UFILE *output,
+                   int epsilon_tag = 0, bool hfst = false);
+
   /**
    * Determinize the transducer
    * @param epsilon_tag the tag to take as epsilon
@@ -255,10 +360,19 @@ public:
   void determinize(int epsilon_tag = 0);
 
   /**
-   * Minimize = reverse + determinize + reverse + determinize
+   * Minimize = reverse + determinize + reverse + determinize, or just
+   * merging the equivalent states if the transducer is deterministic,
+   * which gives the same in far less time
    * @param epsilon_tag the tag to take as epsilon
+   * @param jobs the most threads to minimize on; above 1, the paths
+   * starting with different symbols are minimized apart
+   * @param push_weights move the weights towards the initial state, so
+   * that states which only differ in where their weights lie merge
+   * @param weight_quantum if above 0, round the weights to multiples of
+   * it, which lets more states merge at the cost of exactness
    */
-  void minimize(int epsilon_tag = 0);
+  void minimize(int epsilon_tag = 0, unsigned jobs = 1,
+                bool push_weights = false, double weight_quantum = 0);
 
 
   /**
@@ -437,6 +551,8 @@ public:
    * @param g_a the alphabet of the transducer g
    * @param f_inverted run composition right-to-left on this transducer
    * @param g_anywhere don't require anchored matches, let g optionally compose at any sub-path
+   * @param prune don't make the states of gf that no final state can
+   * be reached from (minimization would drop them anyway)
    * @return the composition gf
    */
   Transducer compose(Transducer const &g,
@@ -444,7 +560,8 @@ public:
                      Alphabet const &g_a,
                      bool f_inverted = false,
                      bool g_anywhere = false,
-                     int epsilon_tag = 0);
+                     int epsilon_tag = 0,
+                     bool prune = false);
 
   /**
    * Helper for creating the arc label when composing g ∘ f, used by compose.
@@ -483,6 +600,18 @@ public:
    */
   void invert(Alphabet& alpha);
 
+  /**
+   * Number the states again so that the ones used together are near
+   * each other once loaded: the initial state first, then the others by
+   * decreasing number of visits and, among those with the same number,
+   * in breadth-first order from the initial state
+   * @param visits the visits to every state, by its position in the
+   *               order write() writes them in, as counted by
+   *               FSTProcessor::startProfile(); empty for breadth-first
+   *               order
+   */
+  void renumber(std::vector<uint64_t> const &visits);
+
   /**
    * Deletes all transitions with a symbol pair in syms
    */
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#include <lttoolbox/word_graph.h>
+
+#include <algorithm>
+#include <deque>
+
+size_t
+WordGraph::Hash::operator()(int state) const
+{
+  State const &s = graph->states[state];
+  size_t h = s.final ? 0x9e3779b97f4a7c15ull : 0;
+  for(auto const &t : s.transitions)
+  {
+    h ^= size_t(t.first) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    h ^= size_t(t.second) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+  }
+  return h;
+}
+
+bool
+WordGraph::Equal::operator()(int a, int b) const
+{
+  State const &sa = graph->states[a];
+  State const &sb = graph->states[b];
+  return sa.final == sb.final && sa.transitions == sb.transitions;
+}
+
+WordGraph::WordGraph() :
+registry(16, Hash{this}, Equal{this})
+{
+  newState();
+}
+
+int
+WordGraph::newState()
+{
+  if(!free_states.empty())
+  {
+    int state = free_states.back();
+    free_states.pop_back();
+    return state;
+  }
+  states.emplace_back();
+  return states.size() - 1;
+}
+
+void
+WordGraph::deleteState(int state)
+{
+  for(auto const &t : states[state].transitions)
+  {
+    states[t.second].incoming--;
+  }
+  states[state] = State();
+  free_states.push_back(state);
+}
+
+int
+WordGraph::target(int state, int symbol) const
+{
+  auto const &ts = states[state].transitions;
+  auto it = std::lower_bound(ts.begin(), ts.end(), std::make_pair(symbol, 0));
+  if(it == ts.end() || it->first != symbol)
+  {
+    return -1;
+  }
+  return it->second;
+}
+
+void
+WordGraph::retarget(int state, int symbol, int to)
+{
+  auto &ts = states[state].transitions;
+  auto it = std::lower_bound(ts.begin(), ts.end(), std::make_pair(symbol, 0));
+  if(it == ts.end() || it->first != symbol)
+  {
+    ts.insert(it, std::make_pair(symbol, to));
+  }
+  else
+  {
+    states[it->second].incoming--;
+    it->second = to;
+  }
+  states[to].incoming++;
+}
+
+int
+WordGraph::clone(int state)
+{
+  int copy = newState();
+  states[copy].transitions = states[state].transitions;
+  states[copy].final = states[state].final;
+  for(auto const &t : states[copy].transitions)
+  {
+    states[t.second].incoming++;
+  }
+  return copy;
+}
+
+int
+WordGraph::replaceOrRegister(int parent, int symbol, int state)
+{
+  auto it = registry.find(state);
+  if(it == registry.end())
+  {
+    registry.insert(state);
+    return state;
+  }
+  int equal = *it;
+  if(equal != state)
+  {
+    retarget(parent, symbol, equal);
+    deleteState(state);
+  }
+  return equal;
+}
+
+void
+WordGraph::add(std::vector<int> const &sequence)
+{
+  // the common prefix with the sequences already there
+  std::vector<int> path(1, 0);
+  size_t i = 0;
+  for(; i < sequence.size(); i++)
+  {
+    int next = target(path.back(), sequence[i]);
+    if(next < 0)
+    {
+      break;
+    }
+    path.push_back(next);
+  }
+  if(i == sequence.size() && states[path.back()].final)
+  {
+    return;
+  }
+  sequences++;
+
+  // the states of the prefix change, so they leave the registry until
+  // they are checked again; from the first confluence on they are
+  // shared with other paths, and this one gets copies of them
+  size_t confluence = 1;
+  while(confluence < path.size() && states[path[confluence]].incoming < 2)
+  {
+    registry.erase(path[confluence]);
+    confluence++;
+  }
+  for(size_t j = confluence; j < path.size(); j++)
+  {
+    int copy = clone(path[j]);
+    retarget(path[j-1], sequence[j-1], copy);
+    path[j] = copy;
+  }
+
+  for(; i < sequence.size(); i++)
+  {
+    int next = newState();
+    retarget(path.back(), sequence[i], next);
+    path.push_back(next);
+  }
+  states[path.back()].final = true;
+
+  for(size_t j = path.size() - 1; j > 0; j--)
+  {
+    path[j] = replaceOrRegister(path[j-1], sequence[j-1], path[j]);
+  }
+}
+
+size_t
+WordGraph::size() const
+{
+  return sequences;
+}
+
+void
+WordGraph::build(Transducer &t, double weight) const
+{
+  std::vector<int> number(states.size(), -1);
+  number[0] = t.getInitial();
+  std::deque<int> queue(1, 0);
+  while(!queue.empty())
+  {
+    int state = queue.front();
+    queue.pop_front();
+    if(states[state].final)
+    {
+      t.setFinal(number[state], weight);
+    }
+    for(auto const &tr : states[state].transitions)
+    {
+      if(number[tr.second] < 0)
+      {
+        number[tr.second] = t.insertNewSingleTransduction(tr.first,
+                                                           number[state],
+                                                           weight);
+        queue.push_back(tr.second);
+      }
+      else
+      {
+        t.linkStates(number[state], number[tr.second], tr.first, weight);
+      }
+    }
+  }
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _LT_WORD_GRAPH_H_
+#define _LT_WORD_GRAPH_H_
+
+#include <lttoolbox/transducer.h>
+
+#include <cstddef>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/**
+ * Minimal acyclic automaton of a set of symbol sequences, kept minimal
+ * as the sequences are added in any order, so that a large set never
+ * takes more memory than its minimal automaton needs (Daciuk, Mihov,
+ * Watson and Watson 2000, "Incremental construction of minimal acyclic
+ * finite-state automata", for unsorted data).  The states that fall
+ * out of use are recycled.
+ */
+class WordGraph
+{
+private:
+  struct State
+  {
+    /**
+     * Transitions sorted by symbol, to the target states
+     */
+    std::vector<std::pair<int, int>> transitions;
+
+    /**
+     * Transitions to this state; the confluences are those with more
+     * than one, which a new sequence can't go through unchanged
+     */
+    int incoming = 0;
+    bool final = false;
+  };
+
+  struct Hash
+  {
+    WordGraph const *graph;
+    size_t operator()(int state) const;
+  };
+
+  struct Equal
+  {
+    WordGraph const *graph;
+    bool operator()(int a, int b) const;
+  };
+
+  std::vector<State> states;
+  std::vector<int> free_states;
+
+  /**
+   * The states other than the initial one, by their finality and
+   * transitions: two states with the same ones are merged
+   */
+  std::unordered_set<int, Hash, Equal> registry;
+
+  size_t sequences = 0;
+
+  int newState();
+  void deleteState(int state);
+
+  /**
+   * Target of the transition of state with symbol, or -1 if none
+   */
+  int target(int state, int symbol) const;
+
+  /**
+   * Point the transition of state with symbol to state to
+   */
+  void retarget(int state, int symbol, int to);
+
+  /**
+   * Copy of state, with the same transitions
+   */
+  int clone(int state);
+
+  /**
+   * Merge state into an equal one if there is one, else register it
+   * @return the state that the transition from parent now goes to
+   */
+  int replaceOrRegister(int parent, int symbol, int state);
+
+public:
+  WordGraph();
+
+  /**
+   * Add a sequence of symbols; nothing changes if it is already there
+   */
+  void add(std::vector<int> const &sequence);
+
+  /**
+   * Number of sequences added that weren't there yet
+   */
+  size_t size() const;
+
+  /**
+   * Write the automaton out as a transducer of the symbols, states
+   * numbered breadth first; it is already minimal
+   */
+  void build(Transducer &t, double weight = 0.0000) const;
+};
+
+#endif
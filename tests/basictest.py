@@ -101,10 +101,12 @@ class PrintTest(BasicTest):
     printdir = "lr"
     expectedOutput = ""
     expectedRetCodeFail = False
+    compflags = []              # type: List[str]
     printflags = []
 
     def compileTest(self, tmpd):
         return self.compileDix(self.printdir, self.printdix,
+                               flags=self.compflags,
                                binName=tmpd+'/compiled.bin')
 
     def runTest(self):
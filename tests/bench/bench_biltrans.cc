@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Runs FSTProcessor::biltransWithQueue() on every line of the input, as
+// the transfer modules of Apertium do, for lt_bench.py to time.  Every
+// line is one lexical unit with its delimiters, ^lemma<tags>$.
+
+#include <lttoolbox/fst_processor.h>
+#include <lttoolbox/file_utils.h>
+#include <lttoolbox/lt_locale.h>
+
+#include <iostream>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+  LtLocale::tryToSetLocale();
+
+  if (argc != 2) {
+    std::cerr << "USAGE: " << argv[0] << " bidix_bin < lexical_units" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  FILE* in = openInBinFile(argv[1]);
+  FSTProcessor fstp;
+  fstp.load(in);
+  fclose(in);
+  fstp.initBiltrans();
+
+  std::vector<UString> words;
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    words.push_back(to_ustring(line.c_str()));
+  }
+
+  // the sizes are summed only so that the calls cannot be optimised out
+  size_t total = 0;
+  for (auto& word : words) {
+    auto result = fstp.biltransWithQueue(word);
+    total += result.first.size() + result.second;
+  }
+  std::cout << words.size() << " " << total << std::endl;
+  return EXIT_SUCCESS;
+}
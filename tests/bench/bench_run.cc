@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Runs a command and prints its wall time in seconds and its peak
+// resident set size in kilobytes on stderr, for lt_bench.py.  Linux counts the
+// memory of the parent at the fork in the peak of the child, so the
+// command is started from this small process rather than from Python.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    fprintf(stderr, "USAGE: %s command [arguments]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return EXIT_FAILURE;
+  }
+  if (pid == 0) {
+    execvp(argv[1], argv + 1);
+    perror(argv[1]);
+    _exit(127);
+  }
+
+  int status = 0;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0) {
+    perror("wait4");
+    return EXIT_FAILURE;
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  long rss = usage.ru_maxrss;
+#ifdef __APPLE__
+  rss /= 1024;
+#endif
+  fprintf(stderr, "%.6f %ld\n", elapsed.count(), rss);
+  return (WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE);
+}
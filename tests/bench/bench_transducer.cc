@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Times the operations of Transducer that lt-comp, lt-trim and
+// lt-compose spend their time in, and counts the allocations they make,
+// on a synthetic analyser and bidix built from a seed or on the largest
+// sections of compiled ones.  Writes JSON to stdout, for lt_bench.py.
+
+#include <lttoolbox/alphabet.h>
+#include <lttoolbox/file_utils.h>
+#include <lttoolbox/lt_locale.h>
+#include <lttoolbox/trans_exe.h>
+#include <lttoolbox/transducer.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <random>
+#include <string>
+
+// Every allocation goes through these, including those of the library
+static uint64_t allocations = 0;
+static uint64_t allocated_bytes = 0;
+
+void *operator new(std::size_t size)
+{
+  allocations++;
+  allocated_bytes += size;
+  if (void *p = malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+  free(p);
+}
+
+namespace {
+
+struct Input
+{
+  Alphabet mono_a;
+  Transducer mono;
+  Alphabet bi_a;
+  Transducer bi;
+};
+
+// An analyser as lt-comp builds it before minimising a section: every
+// entry is a path of its own from the initial state, some behind an
+// epsilon transition, so that it is as nondeterministic as it gets
+void synthesise(Input &in, int words, unsigned seed)
+{
+  std::mt19937 rng(seed);
+  std::string const letters = "abcdefghijklmnoprstuvyz";
+  UString const pos[] = {u"<n>", u"<vblex>", u"<adj>"};
+  for (auto &a : {&in.mono_a, &in.bi_a}) {
+    for (auto &p : pos) {
+      a->includeSymbol(p);
+    }
+    a->includeSymbol(u"<sg>");
+    a->includeSymbol(u"<pl>");
+  }
+  for (int i = 0; i < words; i++) {
+    std::u16string w;
+    for (int n = 3 + rng() % 8; n > 0; n--) {
+      w += letters[rng() % letters.size()];
+    }
+    UString const &p = pos[rng() % 3];
+    for (int number = 0; number < 2; number++) {
+      int state = in.mono.getInitial();
+      if (i % 8 == 0) {
+        state = in.mono.insertNewSingleTransduction(0, state);
+      }
+      for (auto c : w) {
+        state = in.mono.insertNewSingleTransduction(in.mono_a(c, c), state);
+      }
+      if (number == 1) {
+        state = in.mono.insertNewSingleTransduction(in.mono_a('s', 0), state);
+      }
+      state = in.mono.insertNewSingleTransduction(in.mono_a(0, in.mono_a(p)), state);
+      state = in.mono.insertNewSingleTransduction(
+        in.mono_a(0, in.mono_a(number ? u"<pl>" : u"<sg>")), state);
+      in.mono.setFinal(state);
+    }
+    if (i % 2 == 0) {
+      int state = in.bi.getInitial();
+      for (size_t j = 0; j < w.size(); j++) {
+        state = in.bi.insertNewSingleTransduction(in.bi_a(w[j], w[w.size() - 1 - j]), state);
+      }
+      int tag = in.bi_a(p);
+      state = in.bi.insertNewSingleTransduction(in.bi_a(tag, tag), state);
+      in.bi.setFinal(state);
+    }
+  }
+}
+
+// The largest section of a compiled transducer
+void sample(char const *file, Alphabet &alphabet, Transducer &t)
+{
+  FILE *input = openInBinFile(file);
+  std::set<UChar32> letters;
+  std::map<UString, Transducer> sections;
+  readTransducerSet(input, letters, alphabet, sections);
+  fclose(input);
+  for (auto &it : sections) {
+    if (it.second.size() > t.size()) {
+      t = it.second;
+    }
+  }
+}
+
+bool first_result = true;
+
+// Run op runs times, each after a fresh prepare, and report the best time
+// and the allocations of the first run
+void measure(char const *name, int runs, std::function<void()> const &prepare,
+             std::function<void()> const &op)
+{
+  double best = 0;
+  uint64_t count = 0, bytes = 0;
+  for (int i = 0; i < runs; i++) {
+    prepare();
+    uint64_t const a = allocations, b = allocated_bytes;
+    auto start = std::chrono::steady_clock::now();
+    op();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (i == 0 || elapsed.count() < best) {
+      best = elapsed.count();
+    }
+    if (i == 0) {
+      count = allocations - a;
+      bytes = allocated_bytes - b;
+    }
+  }
+  printf("%s    {\"operation\": \"%s\", \"seconds\": %.6f, \"allocations\": %llu, "
+         "\"allocated_bytes\": %llu}", first_result ? "" : ",\n", name, best,
+         static_cast<unsigned long long>(count), static_cast<unsigned long long>(bytes));
+  first_result = false;
+  fflush(stdout);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+  LtLocale::tryToSetLocale();
+
+  int words = 20000;
+  unsigned seed = 1;
+  int runs = 3;
+  int arg = 1;
+  for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+    std::string opt = argv[arg];
+    if (opt == "--words") {
+      words = atoi(argv[arg + 1]);
+    } else if (opt == "--seed") {
+      seed = atoi(argv[arg + 1]);
+    } else if (opt == "--runs") {
+      runs = atoi(argv[arg + 1]);
+    } else {
+      break;
+    }
+  }
+  if ((argc - arg != 0 && argc - arg != 2) || words < 1 || runs < 1) {
+    fprintf(stderr, "USAGE: %s [--words N] [--seed N] [--runs N] [analyser_bin bidix_bin]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Input in;
+  if (argc - arg == 2) {
+    sample(argv[arg], in.mono_a, in.mono);
+    sample(argv[arg + 1], in.bi_a, in.bi);
+  } else {
+    synthesise(in, words, seed);
+  }
+
+  printf("{\n  \"source\": \"%s\",\n  \"states\": %d,\n  \"transitions\": %d,\n  \"results\": [\n",
+         argc - arg == 2 ? "sampled" : "synthetic", in.mono.size(),
+         in.mono.numberOfTransitions());
+
+  Transducer t;
+  auto fresh = [&]() { t = in.mono; };
+  measure("closure_all", runs, fresh, [&]() { t.closure_all(0); });
+  measure("determinize", runs, fresh, [&]() { t.determinize(); });
+  measure("minimize", runs, fresh, [&]() { t.minimize(); });
+
+  // trim and compose take the analyser minimised and the bidix prepared
+  // the way lt-trim and lt-compose do it
+  Transducer analyser = in.mono;
+  analyser.minimize();
+  Transducer bi = in.bi;
+  bi.minimize();
+  Alphabet prefix_a = in.bi_a;
+  std::set<int> loopback;
+  prefix_a.createLoopbackSymbols(loopback, in.mono_a, Alphabet::right);
+  Transducer prefix = bi.appendDotStar(loopback).moveLemqsLast(prefix_a);
+  auto fresh_analyser = [&]() { t = analyser; };
+  measure("trim", runs, fresh_analyser, [&]() { t.trim(prefix, in.mono_a, prefix_a); });
+  Alphabet compose_a;
+  measure("compose", runs, [&]() { t = analyser; compose_a = in.mono_a; },
+          [&]() { t.compose(bi, compose_a, in.bi_a); });
+
+  // the files are written as lt-comp writes the sections, minimised
+  FILE *file = tmpfile();
+  auto rewind_file = [&]() { fflush(file); rewind(file); };
+  measure("write", runs, [&]() { rewind_file(); }, [&]() { analyser.write(file); });
+  measure("read", runs, rewind_file, [&]() { t.read(file); });
+  TransExe te;
+  measure("TransExe::read", runs, rewind_file, [&]() { te.read(file, in.mono_a); });
+  rewind_file();
+  te.write(file);
+  measure("TransExe::read mapped", runs, rewind_file, [&]() { te.read(file, in.mono_a); });
+  fclose(file);
+
+  printf("\n  ]\n}\n");
+  return EXIT_SUCCESS;
+}
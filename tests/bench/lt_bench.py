@@ -0,0 +1,334 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""Throughput benchmark of lt-proc.
+
+Generates a monolingual, a bilingual and a transliteration dictionary and
+a corpus from a seed, so that every run with the same arguments measures
+the same input, compiles them with lt-comp and times analysis, generation,
+lexical transfer (-b), transliteration (-t), decompounding (-e) and
+FSTProcessor::biltransWithQueue().  The results are written as JSON:
+for every mode the best time over the runs, the time to load the
+dictionary, characters and tokens per second once loaded, and the peak
+resident set size.  bench-transducer adds the time and allocations of
+the Transducer operations of the compilers (determinize, minimize, trim,
+compose, reading and writing) on a synthetic unminimised analyser and on
+the compiled dictionaries.
+
+    python3 tests/bench/lt_bench.py BINDIR [--words N] [--ambiguity N] ...
+
+BINDIR holds lt-comp, lt-proc and the bench-run, bench-biltrans and
+bench-transducer helpers built by the lt-bench target; the measures of a
+missing bench-biltrans or bench-transducer are skipped.  Needs a Unix.
+
+With --baseline, the modes are compared with those of an earlier report
+made with the same parameters, and the exit status is 1 if any of them
+lost more than --tolerance of its throughput, or took that much more load
+time or memory (--warn-only just prints them).  --history appends every
+report as a line of JSON, to follow the measures from run to run.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+LETTERS = "abcdefghijklmnoprstuvyz"
+TAGS = ["n", "vblex", "adj", "sg", "pl", "inf", "pri", "past", "p3",
+        "compound-only-L", "compound-R", "sent", "cm"]
+# surface suffixes and tags of every paradigm; they share "" and "s" so
+# that the readings of a stem are ambiguous with each other
+PARADIGMS = {
+    "n": [("", "<n><sg>"), ("s", "<n><pl>")],
+    "vblex": [("", "<vblex><pri><p3>"), ("s", "<vblex><pri><p3><pl>"),
+              ("ar", "<vblex><inf>"), ("ó", "<vblex><past><p3>")],
+    "adj": [("", "<adj><sg>"), ("s", "<adj><pl>")],
+}
+TRANSLIT = [("a", "а"), ("b", "б"), ("v", "в"), ("g", "г"), ("d", "д"),
+            ("e", "е"), ("zh", "ж"), ("z", "з"), ("i", "и"), ("k", "к"),
+            ("l", "л"), ("m", "м"), ("n", "н"), ("o", "о"), ("p", "п"),
+            ("r", "р"), ("s", "с"), ("t", "т"), ("u", "у"), ("f", "ф"),
+            ("kh", "х"), ("ts", "ц"), ("ch", "ч"), ("sh", "ш"), ("y", "ы")]
+# load times differing by less than this many seconds are noise, however
+# large a part of a short load time they are
+LOAD_SLACK = 0.005
+
+
+def tags(s):
+    return "".join('<s n="%s"/>' % t for t in s.strip("<>").split("><"))
+
+
+def word(rng, lo=3, hi=10):
+    return "".join(rng.choice(LETTERS) for _ in range(rng.randint(lo, hi)))
+
+
+def header(alphabet):
+    out = ['<?xml version="1.0" encoding="UTF-8"?>', '<dictionary>',
+           '<alphabet>%s</alphabet>' % alphabet, '<sdefs>']
+    out += ['<sdef n="%s"/>' % t for t in TAGS + ["x%d" % i for i in range(16)]]
+    out.append('</sdefs>')
+    return out
+
+
+def readings(args):
+    """The pos and extra sense tag of each of the --ambiguity readings"""
+    pos = list(PARADIGMS)
+    return [(pos[i % len(pos)], "" if i < len(pos) else "<x%d>" % (i // len(pos)))
+            for i in range(args.ambiguity)]
+
+
+def make_data(args, d):
+    rng = random.Random(args.seed)
+    stems = set()
+    while len(stems) < args.words:
+        stems.add(word(rng))
+    stems = sorted(stems)
+
+    mono = header(LETTERS + LETTERS.upper() + "Ó")
+    mono.append('<pardefs>')
+    for name, forms in PARADIGMS.items():
+        mono.append('<pardef n="%s">' % name)
+        for suffix, t in forms:
+            mono.append('<e><p><l>%s</l><r>%s</r></p></e>' % (suffix, tags(t)))
+        mono.append('</pardef>')
+    mono.append('<pardef n="cmp"><e><p><l></l><r><s n="n"/><s n="compound-only-L"/></r></p></e>'
+                '<e><p><l>o</l><r><s n="n"/><s n="compound-R"/></r></p></e></pardef>')
+    mono.append('</pardefs>')
+    mono.append('<section id="main" type="standard">')
+    bi = header("")
+    bi.append('<section id="main" type="standard">')
+    lexical = []
+    for i, s in enumerate(stems):
+        for pos, sense in readings(args):
+            if sense:
+                mono.append('<e lm="%s"><i>%s</i><par n="%s"/><p><l></l><r>%s</r></p></e>'
+                            % (s, s, pos, tags(sense)))
+            else:
+                mono.append('<e lm="%s"><i>%s</i><par n="%s"/></e>' % (s, s, pos))
+            lexical += ["%s%s%s" % (s, t, sense) for _, t in PARADIGMS[pos]]
+            if not sense:
+                bi.append('<e><p><l>%s<s n="%s"/></l><r>%s<s n="%s"/></r></p></e>'
+                          % (s, pos, s[::-1], pos))
+        if i % 4 == 0:
+            mono.append('<e lm="%s"><i>%s</i><par n="cmp"/></e>' % (s, s))
+    mono.append('</section>')
+    mono.append('<section id="punct" type="inconditional">')
+    mono.append('<e><p><l>.</l><r>.<s n="sent"/></r></p></e>')
+    mono.append('<e><p><l>,</l><r>,<s n="cm"/></r></p></e>')
+    mono.append('</section>')
+    mono.append('</dictionary>')
+    bi.append('</section>')
+    bi.append('</dictionary>')
+
+    tr = header("")
+    tr.append('<section id="main" type="standard">')
+    for a, b in TRANSLIT:
+        tr.append('<e><p><l>%s</l><r>%s</r></p></e>' % (a, b))
+    tr.append('</section>')
+    tr.append('</dictionary>')
+
+    forms = [s + suffix for s in stems for suffix in ("", "s", "ar", "ó")]
+    compounds = [s for i, s in enumerate(stems) if i % 4 == 0]
+    text = []
+    for i in range(args.tokens):
+        r = rng.random()
+        if r < 0.8:
+            w = rng.choice(forms)
+        elif r < 0.9:
+            w = word(rng)
+        elif r < 0.95:
+            w = rng.choice(compounds) + rng.choice(compounds) + "o"
+        else:
+            w = rng.choice(forms) + rng.choice(".,")
+        text.append(w + ("\n" if i % 15 == 14 else " "))
+    units = [rng.choice(lexical) for _ in range(args.tokens)]
+
+    files = {
+        "mono.dix": "\n".join(mono) + "\n",
+        "bi.dix": "\n".join(bi) + "\n",
+        "translit.dix": "\n".join(tr) + "\n",
+        "corpus.txt": "".join(text),
+        "lexical.txt": "".join("^%s$\n" % u for u in units),
+    }
+    for name, content in files.items():
+        with open(os.path.join(d, name), "w", encoding="utf-8") as f:
+            f.write(content)
+
+
+def run(runner, cmd, stdin):
+    """Run cmd through bench-run with stdin from the file stdin, returning
+    the wall time in seconds and the peak resident set size in kilobytes"""
+    with open(stdin, "rb") as f:
+        proc = subprocess.run([runner] + cmd, stdin=f, stdout=subprocess.DEVNULL,
+                              stderr=subprocess.PIPE)
+    if proc.returncode != 0:
+        sys.exit("Error: %s failed" % " ".join(cmd))
+    # the measure is the last line, after any messages of cmd
+    elapsed, rss = proc.stderr.split()[-2:]
+    return float(elapsed), int(rss)
+
+
+def measure(runner, name, cmd, stdin, chars, tokens, runs):
+    best, rss = None, 0
+    for _ in range(runs):
+        t, r = run(runner, cmd, stdin)
+        best = t if best is None else min(best, t)
+        rss = max(rss, r)
+    load = min(run(runner, cmd, os.devnull)[0] for _ in range(runs))
+    work = max(best - load, 1e-9)
+    return {
+        "mode": name,
+        "seconds": round(best, 6),
+        "load_seconds": round(load, 6),
+        "chars_per_second": round(chars / work),
+        "tokens_per_second": round(tokens / work),
+        "peak_rss_kb": rss,
+    }
+
+
+def compare(report, baseline, tolerance):
+    """The measures of report worse than those of baseline by more than
+    tolerance, a fraction, as a list of dicts"""
+    before = {r["mode"]: r for r in baseline["results"]}
+    regressions = []
+    for result in report["results"]:
+        old = before.get(result["mode"])
+        if old is None:
+            continue
+        # (measure, whether higher is better, the least change that counts)
+        for measure, higher, slack in [("chars_per_second", True, 0),
+                                       ("load_seconds", False, LOAD_SLACK),
+                                       ("peak_rss_kb", False, 0)]:
+            was, now = old[measure], result[measure]
+            worse = was - now if higher else now - was
+            if worse > tolerance * was and worse > slack:
+                regressions.append({"mode": result["mode"], "measure": measure,
+                                    "baseline": was, "value": now})
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark lt-proc on generated dictionaries")
+    parser.add_argument("bindir", help="directory with lt-comp, lt-proc, bench-run and bench-biltrans")
+    parser.add_argument("--words", type=int, default=20000, help="stems in the dictionary")
+    parser.add_argument("--ambiguity", type=int, default=3,
+                        help="readings of every stem, at most 48")
+    parser.add_argument("--tokens", type=int, default=300000, help="tokens in the corpus")
+    parser.add_argument("--seed", type=int, default=1, help="seed of the generated data")
+    parser.add_argument("--runs", type=int, default=3, help="runs of every mode, the best is kept")
+    parser.add_argument("--output", help="write the JSON to this file instead of stdout")
+    parser.add_argument("--baseline", help="report of an earlier run to compare the modes with")
+    parser.add_argument("--tolerance", type=float, default=0.15,
+                        help="fraction by which a measure may be worse than in the baseline")
+    parser.add_argument("--warn-only", action="store_true",
+                        help="exit with 0 even if the baseline was better")
+    parser.add_argument("--history", help="append the report to this file as a line of JSON")
+    args = parser.parse_args()
+    if not 1 <= args.ambiguity <= 48:
+        parser.error("--ambiguity must be between 1 and 48")
+    parameters = {"words": args.words, "ambiguity": args.ambiguity,
+                  "tokens": args.tokens, "seed": args.seed, "runs": args.runs}
+    baseline = None
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if baseline.get("parameters") != parameters:
+            parser.error("the baseline was measured with %s, not %s"
+                         % (baseline.get("parameters"), parameters))
+
+    def tool(name):
+        return os.path.join(args.bindir, name)
+
+    with tempfile.TemporaryDirectory() as d:
+        def path(name):
+            return os.path.join(d, name)
+
+        make_data(args, d)
+        compile_seconds = {}
+        for direction, dix, out in [("lr", "mono.dix", "analyser.bin"),
+                                    ("rl", "mono.dix", "generator.bin"),
+                                    ("lr", "bi.dix", "bilingual.bin"),
+                                    ("lr", "translit.dix", "translit.bin")]:
+            start = time.perf_counter()
+            subprocess.run([tool("lt-comp"), direction, path(dix), path(out)],
+                           stdout=subprocess.DEVNULL, check=True)
+            compile_seconds[out] = round(time.perf_counter() - start, 6)
+
+        with open(path("corpus.txt"), encoding="utf-8") as f:
+            corpus_chars = len(f.read())
+        with open(path("lexical.txt"), encoding="utf-8") as f:
+            lexical_chars = len(f.read())
+        proc = tool("lt-proc")
+        modes = [
+            ("analysis", [proc, "-a", path("analyser.bin")], "corpus.txt", corpus_chars),
+            ("generation", [proc, "-g", path("generator.bin")], "lexical.txt", lexical_chars),
+            ("bilingual", [proc, "-b", path("bilingual.bin")], "lexical.txt", lexical_chars),
+            ("transliteration", [proc, "-t", path("translit.bin")], "corpus.txt", corpus_chars),
+            ("decomposition", [proc, "-e", path("analyser.bin")], "corpus.txt", corpus_chars),
+        ]
+        if os.path.exists(tool("bench-biltrans")):
+            modes.append(("biltransWithQueue", [tool("bench-biltrans"), path("bilingual.bin")],
+                          "lexical.txt", lexical_chars))
+        else:
+            print("Warning: no bench-biltrans in %s, skipping biltransWithQueue" % args.bindir,
+                  file=sys.stderr)
+
+        results = []
+        for name, cmd, stdin, chars in modes:
+            results.append(measure(tool("bench-run"), name, cmd, path(stdin), chars, args.tokens, args.runs))
+            print("%-18s %10d chars/s %9d tokens/s %8d kB" %
+                  (name, results[-1]["chars_per_second"], results[-1]["tokens_per_second"],
+                   results[-1]["peak_rss_kb"]), file=sys.stderr)
+
+        transducer = []
+        if os.path.exists(tool("bench-transducer")):
+            common = [tool("bench-transducer"), "--words", str(args.words),
+                      "--seed", str(args.seed), "--runs", str(args.runs)]
+            for cmd in [common, common + [path("analyser.bin"), path("bilingual.bin")]]:
+                proc = subprocess.run(cmd, stdout=subprocess.PIPE, check=True)
+                transducer.append(json.loads(proc.stdout))
+                for op in transducer[-1]["results"]:
+                    print("%-9s %-22s %10.6f s %9d allocations" %
+                          (transducer[-1]["source"], op["operation"], op["seconds"],
+                           op["allocations"]), file=sys.stderr)
+        else:
+            print("Warning: no bench-transducer in %s, skipping the transducer operations"
+                  % args.bindir, file=sys.stderr)
+
+    report = {
+        "date": datetime.datetime.now(datetime.timezone.utc).isoformat(timespec="seconds"),
+        "parameters": parameters,
+        "compile_seconds": compile_seconds,
+        "results": results,
+        "transducer": transducer,
+    }
+    regressions = []
+    if baseline is not None:
+        regressions = compare(report, baseline, args.tolerance)
+        report["baseline"] = {"file": os.path.abspath(args.baseline),
+                              "date": baseline.get("date"),
+                              "tolerance": args.tolerance,
+                              "regressions": regressions}
+        for r in regressions:
+            print("%s: %s %s went from %s to %s" %
+                  ("Warning" if args.warn_only else "Error", r["mode"], r["measure"],
+                   r["baseline"], r["value"]), file=sys.stderr)
+    text = json.dumps(report, indent=2) + "\n"
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text)
+    if args.history:
+        with open(args.history, "a") as f:
+            f.write(json.dumps(report) + "\n")
+    if regressions and not args.warn_only:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
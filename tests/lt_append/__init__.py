@@ -8,11 +8,12 @@ class AppendProcTest(unittest.TestCase, ProcTest):
     dir1 = "lr"
     dir2 = "lr"
     procflags = ["-z"]
+    appendflags = []
 
     def compileTest(self, tmpd):
         self.compileDix(self.dir1, self.dix1, binName=tmpd+'/dix1.bin')
         self.compileDix(self.dir2, self.dix2, binName=tmpd+'/dix2.bin')
-        self.callProc('lt-append', [tmpd+"/dix1.bin",
+        self.callProc('lt-append', self.appendflags+[tmpd+"/dix1.bin",
                                     tmpd+"/dix2.bin",
                                     tmpd+"/compiled.bin"])
         return True
@@ -21,3 +22,15 @@ class SimpleAppend(AppendProcTest):
     inputs = ["a", "b"]
     expectedOutputs = ["^a/a<n>$",
 					   "^b/b<v>$"]
+
+class UnionAppend(AppendProcTest):
+    dix2 = "data/append3.dix"
+    appendflags = ["-u"]
+    inputs = ["a", "c"]
+    expectedOutputs = ["^a/a<n>/a<adj>$",
+                       "^c/c<adj>$"]
+
+class UnionKeepAppend(UnionAppend):
+    appendflags = ["-u", "-k"]
+    expectedOutputs = ["^a/a<n>$",
+                       "^c/*c$"]
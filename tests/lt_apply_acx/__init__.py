@@ -17,3 +17,23 @@ class AcxTest(unittest.TestCase, ProcTest):
         self.callProc('lt-apply-acx',
                       [tmpd+'/plain.bin', self.acx, tmpd+'/compiled.bin'])
         return True
+
+class RuntimeAcxTest(unittest.TestCase, ProcTest):
+    dix = 'data/minimal-mono.dix'
+    acx = 'data/basic.acx'
+    procdir = 'lr'
+    inputs = ['abc', 'ábc', 'äbc', 'Ábc', 'ÄBC', 'xbc']
+    expectedOutputs = ['^abc/ab<n><def>$',
+                       '^ábc/ab<n><def>$',
+                       '^äbc/ab<n><def>$',
+                       '^Ábc/Ab<n><def>$',
+                       '^ÄBC/AB<n><def>$',
+                       '^xbc/*xbc$']
+
+    def compileTest(self, tmpd):
+        ret = self.compileDix(self.procdir, self.dix,
+                              binName=tmpd+'/plain.bin')
+        if not ret: return ret
+        self.callProc('lt-apply-acx',
+                      ['-r', tmpd+'/plain.bin', self.acx, tmpd+'/compiled.bin'])
+        return True
@@ -1,7 +1,16 @@
 # -*- coding: utf-8 -*-
 
 from basictest import ProcTest, PrintTest
+import filecmp
+import json
+import os
+import random
+from subprocess import run
 import unittest
+try:
+    import resource
+except ImportError:
+    resource = None
 
 class CompNormalAndJoin(unittest.TestCase, ProcTest):
     inputs = ["abc", "ab", "y", "n", "jg", "jh", "kg"]
@@ -14,6 +23,12 @@ class EmptyDixOk(unittest.TestCase, ProcTest):
 	expectedOutputs = ["^abc/*abc$"]
 
 
+class EmptyAttOk(unittest.TestCase, ProcTest):
+	procdix = "data/entirely-empty.att"
+	inputs = ["abc"]
+	expectedOutputs = ["^abc/*abc$"]
+
+
 class CompEmptyLhsShouldError(unittest.TestCase, ProcTest):
     procdix = "data/lhs-empty-mono.dix"
     expectedCompRetCodeFail = True
@@ -49,6 +64,9 @@ class CompSplitMultichar(unittest.TestCase, ProcTest):
     inputs = ["א"]
     expectedOutputs = ["^א/אַן<blah>$"]
 
+class CompAttJobs(CompSplitMultichar):
+    compflags = ["-j"]
+
 class CompLSX(unittest.TestCase, PrintTest):
     printdix = "data/basic.lsx"
     expectedOutput = '''0	1	<ANY_CHAR>	<ANY_CHAR>	0.000000\t
@@ -88,6 +106,15 @@ class VariantHoTest(unittest.TestCase, ProcTest):
     expectedOutputs = ['^y/y<n><ind>$']
 
 
+class VariantNoIncrementalTest(VariantNoTest):
+    # the entries of other variants are not counted into the parts
+    compflags = ['-I', '2']
+
+
+class VariantHoIncrementalTest(VariantHoTest):
+    compflags = ['--var-right=ho', '-I', '1']
+
+
 class RestrictTest(unittest.TestCase, ProcTest):
     procdix = 'data/variants.dix'
     procdir = 'lr'
@@ -113,3 +140,153 @@ class RestrictRL2(RestrictTest):
     restrictflags = ['-v', 'oci']
     inputs = ['abc', 'ab']
     expectedOutputs = ['^abc/*abc$', '^ab/abbb<n><ind>$']
+
+class CompIncremental(unittest.TestCase, ProcTest):
+    procdix = 'data/minimal-mono.dix'
+    compflags = ['-I', '1']
+    inputs = ['abc', 'ab', 'y', 'n', 'jg', 'kg']
+    expectedOutputs = ['^abc/ab<n><def>$', '^ab/ab<n><ind>$', '^y/y<n><ind>$',
+                       '^n/n<n><ind>$', '^jg/j<pr>+g<n>$', '^kg/k<pr>+g<n>$']
+
+class CompCacheDir(unittest.TestCase, ProcTest):
+    procdix = 'data/minimal-mono.dix'
+    inputs = ['abc', 'ab', 'y', 'n', 'jg', 'kg']
+    expectedOutputs = ['^abc/ab<n><def>$', '^ab/ab<n><ind>$', '^y/y<n><ind>$',
+                       '^n/n<n><ind>$', '^jg/j<pr>+g<n>$', '^kg/k<pr>+g<n>$']
+
+    def compileTest(self, tmpd):
+        # the second time, every part comes from the cache
+        flags = ['-C', tmpd+'/cache', '-I', '1']
+        for _ in range(2):
+            if not self.compileDix(self.procdir, self.procdix, flags=flags,
+                                   binName=tmpd+'/compiled.bin'):
+                return False
+        return len(os.listdir(tmpd+'/cache')) == 7
+
+class CompCacheDirBothDirections(unittest.TestCase, ProcTest):
+    procdix = 'data/minimal-mono.dix'
+    procdir = 'rl'
+    procflags = ['-z', '-g']
+    inputs = ['^ab<n><ind>$', '^ab<n><def>$', '^j<pr>+g<n>$']
+    expectedOutputs = ['ab', 'abc', 'jg']
+
+    def compileTest(self, tmpd):
+        # the lr parts have the same entries, but must not be reused
+        for d in ['lr', 'rl']:
+            if not self.compileDix(d, self.procdix,
+                                   flags=['-C', tmpd+'/cache', '-I', '1'],
+                                   binName=tmpd+'/compiled.bin'):
+                return False
+        self.assertEqual(len(os.listdir(tmpd+'/cache')), 14)
+        return True
+
+class CompPartsOnThreads(CompIncremental):
+    compflags = ['-j', '-I', '1']
+
+class CompBatch(CompIncremental):
+    def compileTest(self, tmpd):
+        with open(tmpd+'/manifest', 'w') as manifest:
+            manifest.write('# the generator too, which nothing reads\n\n')
+            manifest.write('-I 1 %s %s %s\n' % (self.procdir, self.procdix,
+                                                tmpd+'/compiled.bin'))
+            manifest.write('-j rl %s %s  # generator\n' % (self.procdix,
+                                                           tmpd+'/gen.bin'))
+        if not self.callProc('lt-comp', [], ['--batch', tmpd+'/manifest']):
+            return False
+        self.assertTrue(os.path.exists(tmpd+'/gen.bin'))
+        return True
+
+class CompPushWeights(unittest.TestCase, ProcTest):
+    procdix = 'data/entry-weights.dix'
+    compflags = ['-W']
+    procflags = ['-W']
+    inputs = ['nanow']
+    expectedOutputs = ['^nanow/nan<n><ma><du><gen><W:32.120000>/nan<n><ma><du><acc><W:34.120000>/nan<n><ma><pl><gen><W:39.120000>/nan<n><ma><pl><acc><W:41.120000>$']
+
+class CompReport(CompPushWeights):
+    def compileTest(self, tmpd):
+        flags = self.compflags + ['-R', tmpd+'/report.json']
+        if not self.compileDix(self.procdir, self.procdix, flags=flags,
+                               binName=tmpd+'/compiled.bin'):
+            return False
+        with open(tmpd+'/report.json') as f:
+            report = json.load(f)
+        self.assertEqual([(p['name'], p['entries'], p['references'])
+                          for p in report['paradigms']],
+                         [('nan__n_ma', 21, 1)])
+        self.assertEqual([(s['name'], s['entries'], s['references'])
+                          for s in report['sections']],
+                         [('main@standard', 1, 0)])
+        self.assertGreaterEqual(report['sections'][0]['states_before'],
+                                report['sections'][0]['states'])
+        # - is text on stderr, and the transducer is written as ever
+        res = run([os.environ['LTTOOLBOX_PATH']+'/lt-comp', '-R', '-']
+                  + self.compflags + [self.procdir, self.procdix,
+                                      tmpd+'/compiled.bin'],
+                  capture_output=True)
+        self.assertEqual(res.returncode, 0)
+        self.assertIn(b'nan__n_ma: 21 entries, used 1 times', res.stderr)
+        self.assertIn(b'main@standard: 1 entries', res.stderr)
+        return True
+
+class CompReportUnwritable(unittest.TestCase, ProcTest):
+    compflags = ['-R', '/nonexistent/report.json']
+    expectedCompRetCodeFail = True
+
+class CompMemoryLimit(unittest.TestCase, ProcTest):
+    inputs = ['cats', 'dog', 'xq']
+    expectedOutputs = ['^cats/cat<n><pl>$', '^dog/dog<n><sg>$', '^xq/*xq$']
+
+    def writeDix(self, tmpd):
+        # big enough that its parts take more than the 1 MB of -L 1
+        rand = random.Random(1)
+        words = {'cat', 'dog'}
+        while len(words) < 5000:
+            words.add(''.join(rand.choice('abcdefghijklmnopqrstuvwxyz')
+                              for _ in range(rand.randint(4, 12))))
+        with open(tmpd+'/big.dix', 'w') as f:
+            f.write('<dictionary><sdefs><sdef n="n"/><sdef n="sg"/>'
+                    '<sdef n="pl"/></sdefs><pardefs><pardef n="n">'
+                    '<e><p><l></l><r><s n="n"/><s n="sg"/></r></p></e>'
+                    '<e><p><l>s</l><r><s n="n"/><s n="pl"/></r></p></e>'
+                    '</pardef></pardefs><section id="main" type="standard">\n')
+            for w in sorted(words):
+                f.write('<e lm="%s"><i>%s</i><par n="n"/></e>\n' % (w, w))
+            f.write('</section></dictionary>\n')
+        return tmpd+'/big.dix'
+
+    def compileTest(self, tmpd):
+        dix = self.writeDix(tmpd)
+        if not (self.compileDix(self.procdir, dix, binName=tmpd+'/plain.bin') and
+                self.compileDix(self.procdir, dix, flags=['-I', '100', '-L', '1'],
+                                binName=tmpd+'/compiled.bin')):
+            return False
+        # the parts read back make the same transducer
+        self.assertTrue(filecmp.cmp(tmpd+'/plain.bin', tmpd+'/compiled.bin',
+                                    shallow=False))
+        return True
+
+@unittest.skipUnless(resource, 'needs setrlimit')
+class CompMemoryLimitNoTempFile(CompMemoryLimit):
+    def compileTest(self, tmpd):
+        dix = self.writeDix(tmpd)
+        def compile(flags):
+            # stdin, stdout, stderr and the dictionary, which leaves no
+            # file descriptor for the parts
+            return run([os.environ['LTTOOLBOX_PATH']+'/lt-comp'] + flags
+                       + [self.procdir, dix, tmpd+'/compiled.bin'],
+                       capture_output=True,
+                       preexec_fn=lambda: resource.setrlimit(resource.RLIMIT_NOFILE, (4, 4)))
+        res = compile(['-I', '100', '-L', '1'])
+        self.assertEqual(res.returncode, 1)
+        self.assertIn(b'Cannot create a temporary file', res.stderr)
+        # and so it is the parts that could not be written
+        self.assertEqual(compile(['-I', '100']).returncode, 0)
+        return True
+
+class CompMemoryLimitInvalid(unittest.TestCase, ProcTest):
+    compflags = ['-L', 'lots']
+    expectedCompRetCodeFail = True
+
+class CompMemoryLimitZero(CompMemoryLimitInvalid):
+    compflags = ['-L', '0']
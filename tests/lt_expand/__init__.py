@@ -28,3 +28,6 @@ y:y<n><ind>
 n:n<n><ind>
 __REGEXP__xyz\\:abc[qxj]\\+:__REGEXP__xyz\\:abc[qxj]\\+<vblex>
 '''
+
+class ExpandJobs(ExpandTest):
+    expandflags = ['-j']
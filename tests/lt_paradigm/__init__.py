@@ -38,6 +38,17 @@ class SortTest(ParadigmTest):
     expectedOutputs = ['ab<n><def>:abc\nab<n><ind>:ab\nn<n><ind>:n\ny<n><ind>:y']
     sortoutput = False
 
+class JobsSortTest(SortTest):
+    procflags = ['-s', '-j']
+
+class LimitTest(ParadigmTest):
+    procflags = ['-n', '2']
+    inputs = ['*<n><*>', 'y<*>']
+    expectedOutputs = ['ab<n><def>:abc\nab<n><ind>:ab', 'y<n><ind>:y']
+
+class JobsLimitTest(LimitTest):
+    procflags = ['-n', '2', '-j']
+
 class ExcludeSingleTest(ParadigmTest):
     procdix = 'data/unbalanced-epsilons-mono.dix'
     inputs = ['*<vblex><*>', '*<vblex><*-pres>', '*<vblex><*-inf-pret>']
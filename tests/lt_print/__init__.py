@@ -40,6 +40,31 @@ class SectionsFst(unittest.TestCase, PrintTest):
 """
 
 
+class SectionsDirectoryFst(SectionsFst):
+    compflags = ["-D"]
+
+
+class SectionsJobs(SectionsFst):
+    printflags = ["-j"]
+
+
+class SectionsDirectoryJobs(SectionsFst):
+    compflags = ["-D"]
+    printflags = ["-j"]
+
+
+class OneSection(SectionsFst):
+    printflags = ["-s", "main@standard"]
+    expectedOutput = """0\t1\tX\tX\t0.000000\t
+1\t2\tε\t<np>\t0.000000\t
+2\t0.000000
+"""
+
+
+class OneSectionDirectory(OneSection):
+    compflags = ["-D", "--mmap"]
+
+
 class Alphabet(unittest.TestCase, PrintTest):
     printdix = "data/alphabet.att"
     printdir = "lr"
@@ -1,5 +1,10 @@
 # -*- coding: utf-8 -*-
-from basictest import ProcTest as _ProcTest
+from basictest import BasicTest, ProcTest as _ProcTest, TempDir
+import json
+import os
+import signal
+import socket
+import time
 import unittest
 
 class ProcTest(unittest.TestCase, _ProcTest):
@@ -13,6 +18,20 @@ class ValidInput(ProcTest):
                        "^ABC/AB<n><def>$ ^jg/j<pr>+g<n>$",
                        "^y/y<n><ind>$ ^n/n<n><ind>$"]
 
+class LiteralTagsInInput(ProcTest):
+    # tags of the dictionary in raw input are dropped, not written as the
+    # characters of their negative symbols
+    inputs = ["xyz<n> abc<def> q"]
+    expectedOutputs = ["^xyz/*xyz$ ^abc/ab<n><def>$ ^q/*q$"]
+
+class LiteralTagsInInputNoFlush(LiteralTagsInInput):
+    procflags = []
+    flushing = False
+
+class LiteralTagsInInputWeights(LiteralTagsInInput):
+    procflags = ["-z", "-W", "-N", "1"]
+    expectedOutputs = ["^xyz/*xyz$ ^abc/ab<n><def><W:0.000000>$ ^q/*q$"]
+
 class BiprocSkipTags(ProcTest):
     procdix = "data/biproc-skips-tags-mono.dix"
     procflags = ["-b", "-z"]
@@ -74,6 +93,18 @@ class PrintNAnalyses(ProcTest):
     inputs = ["cat"]
     expectedOutputs = ["^cat/cat+n$"]
 
+class PrintNAnalysesConverging(ProcTest):
+    procdix = "data/converging-weights.att"
+    procflags = ["-N 2", "-W"]
+    inputs = ["ab"]
+    expectedOutputs = ["^ab/ab<W:1.000000>/aB<W:1.500000>$"]
+
+class PrintWeightClassesConverging(ProcTest):
+    procdix = "data/converging-weights.att"
+    procflags = ["-L 1"]
+    inputs = ["ab"]
+    expectedOutputs = ["^ab/ab$"]
+
 class LemmaEntryWeights(ProcTest):
     procdix = "data/lemma-entry-weights.dix"
     procflags = ["-W"]
@@ -294,6 +325,27 @@ class SpaceCompound(ProcTest):
         ]
 
 
+class LongCompound(ProcTest):
+    procdix = "data/compound-long.dix"
+    inputs = ["aaaaaaaaaaaaaaaaaaaaaaaa",
+              "aaaaaaaaaa",
+              "Aaaaaa",
+              ]
+    procflags = ['-z', '-e', '-M', '6']
+    expectedOutputs = [
+        "^aaaaaaaaaaaaaaaaaaaaaaaa/aaaa<n>+aaaa<n>+aaaa<n>+aaaa<n>+aaaa<n>+aaaa<n>$",
+        "^aaaaaaaaaa/aa<n>+aaaa<n>+aaaa<n>/aaa<n>+aaa<n>+aaaa<n>/aaaa<n>+aa<n>+aaaa<n>/aaa<n>+aaaa<n>+aaa<n>/aaaa<n>+aaa<n>+aaa<n>/aaaa<n>+aaaa<n>+aa<n>$",
+        "^Aaaaaa/Aa<n>+aaaa<n>/Aaa<n>+aaa<n>/Aaaa<n>+aa<n>$",
+        ]
+
+
+class MaxActivePaths(ProcTest):
+    procdix = "data/max-active-paths.dix"
+    inputs = ["abc", "ab"]
+    procflags = ['-z', '-W', '-P', '2']
+    expectedOutputs = ["^abc/y<n><W:1.000000>/x<n><W:2.000000>$", "^ab/*ab$"]
+
+
 class ShyCmp(ProcTest):
     procdix = "data/spcmp.dix"
     # These examples include soft hyphens (visible in editors like Emacs):
@@ -320,6 +372,13 @@ class ApostropheTransliteration(ProcTest):
     expectedOutputs = ["kaʼaguy", "kaʼaguy"]
 
 
+class DeterministicTransliteration(ProcTest):
+    procdix = "data/deterministic-translit.dix"
+    inputs = ["abc", "ABC xaBcx", "de De DE dx"]
+    procflags = ['-z', '-t']
+    expectedOutputs = ["bbd", "BcD xbcdx", "f F F dx"]
+
+
 class DebugGen(ProcTest):
     inputs = ["^ab<n><ind>$",
               "^ab<n><indic>$"]
@@ -496,5 +555,281 @@ class SlashesInTags(ProcTest):
                        '^\\*lobwana1.1<n><1/2><a/b>/*lopwana1.1<n><1/2><a/b>$',
                        '^\\*lobwana1.1<n><3/4><a/b>/@\\*lobwana1.1<n><3/4><a/b>$']
 
+class MmapValidInput(ValidInput):
+    compflags = ["--mmap"]
+
+class MmapWeightedCatTransducer(WeightedCatTransducer):
+    compflags = ["--mmap"]
+    procflags = ["-W", "-z"]
+    expectedOutputs = ["^cat/cat+n<W:11.528235>/cat+v<W:12.559967>$"]
+
+class DirectoryValidInput(ValidInput):
+    compflags = ["-D"]
+
+class ThreadsNullFlush(ValidInput):
+    procflags = ["-z", "-T", "2"]
+    # whole streams, some ending right after a NUL, which serial mode
+    # flushes what follows of as well
+    streams = [b"", b"\0", b"ab\0", b"ab\0\0", b"ab", b"ab\0ABC jg\0y n\0"]
+
+    def runTest(self):
+        super().runTest()
+        with TempDir() as tmpd:
+            self.assertTrue(self.compileTest(tmpd))
+            for stream in self.streams:
+                outputs = []
+                for flags in [["-z"], self.procflags]:
+                    proc = self.openPipe('lt-proc', flags+[tmpd+'/compiled.bin'])
+                    outputs.append(proc.communicate(stream)[0])
+                    self.assertEqual(proc.returncode, 0)
+                self.assertEqual(outputs[1], outputs[0], stream)
+
+class ThreadsNoFlush(ProcTest):
+    procflags = ["-T", "2"]
+    flushing = False
+    inputs = ["ab.\nABC jg.\n\ny n"]
+    expectedOutputs = ["^ab/ab<n><ind>$.\n^ABC/AB<n><def>$ ^jg/j<pr>+g<n>$.\n\n^y/y<n><ind>$ ^n/n<n><ind>$"]
+
+class IoThreadsNullFlush(ThreadsNullFlush):
+    procflags = ["-z", "-j"]
+
+class IoThreadsNoFlush(ThreadsNoFlush):
+    procflags = ["-j"]
+
+class AnalysisCache(ProcTest):
+    procflags = ["-z", "-A", "2"]
+    inputs = ["ab ab.", "ABC ab ABC", "y n jg y ab n", "ab"]
+    expectedOutputs = ["^ab/ab<n><ind>$ ^ab/ab<n><ind>$.",
+                       "^ABC/AB<n><def>$ ^ab/ab<n><ind>$ ^ABC/AB<n><def>$",
+                       "^y/y<n><ind>$ ^n/n<n><ind>$ ^jg/j<pr>+g<n>$ ^y/y<n><ind>$ ^ab/ab<n><ind>$ ^n/n<n><ind>$",
+                       "^ab/ab<n><ind>$"]
+
+class AnalysisCacheGardenPathMwe(GardenPathMwe):
+    procflags = ["-z", "-A", "1M"]
+    inputs = GardenPathMwe.inputs * 2
+    expectedOutputs = GardenPathMwe.expectedOutputs * 2
+
+class AnalysisCacheWordboundBlank(WordboundBlankAnalysisTest):
+    procflags = ["-z", "-A", "100"]
+    inputs = WordboundBlankAnalysisTest.inputs * 2
+    expectedOutputs = WordboundBlankAnalysisTest.expectedOutputs * 2
+
+class GenerationCache(ProcTest):
+    procdir = "rl"
+    procflags = ["-z", "-g", "-A", "2"]
+    inputs = ["^ab<n><def>$ ^ab<n><ind>$ ^ab<n><def>$ ^Ab<n><ind>$ ^x<n>$ ^x<n>$",
+              "^ab<n><indic>$ ^ab<n><def>$"]
+    expectedOutputs = ["abc ab abc Ab #x #x",
+                       "#ab abc"]
+
+class BilingualCache(ProcTest):
+    procdir = "rl"
+    procflags = ["-z", "-b", "-A", "100"]
+    inputs = ["^ab<n><def>$ ^#ab<n><def>$ ^ab<n><def>$ ^x<n>$ ^x<n>$"]
+    expectedOutputs = ["^ab<n><def>/abc$ ^#ab<n><def>/@#ab<n><def>$ ^ab<n><def>/abc$ ^x<n>/@x<n>$ ^x<n>/@x<n>$"]
+
+class RestoreChars(ProcTest):
+    procdix = "data/restore-chars.dix"
+    procflags = ["-z", "-r", "data/restore-chars.rcx"]
+    inputs = ["cafe", "elan", "Elan", "ELAN", "café"]
+    expectedOutputs = ["^cafe/café<n>$",
+                       "^elan/elan<n>/élan<n>$",
+                       "^Elan/Elan<n>/Élan<n>$",
+                       "^ELAN/ELAN<n>/ÉLAN<n>$",
+                       "^café/café<n>$"]
+
+class Stages(ProcTest):
+    procdir = "rl"
+    procflags = ["-z", "-g"]
+    inputs = ["^ab<n><ind>$ ^ab<n><def>$ ^y<n><ind>$.", "^n<n><ind>$"]
+    expectedOutputs = ["^ab/ab<n><ind>$ ^abc/ab<n><def>$ ^y/y<n><ind>$.",
+                       "^n/n<n><ind>$"]
+
+    def compileTest(self, tmpd):
+        return (super().compileTest(tmpd) and
+                self.compileDix("lr", self.procdix, binName=tmpd+'/analyser.bin'))
+
+    def openProc(self, tmpd):
+        return self.openPipe('lt-proc', self.procflags + ["-y", "a:"+tmpd+"/analyser.bin",
+                                                          tmpd+'/compiled.bin'])
+
+class ComposeAtLookup(ProcTest):
+    procflags = ["-z", "-a"]
+    inputs = ["ab ABC Ab", "y n jg"]
+    expectedOutputs = ["^ab/xy<n>$ ^ABC/XY<n><def>$ ^Ab/Xy<n>$",
+                       "^y/z<n>$ ^n/*n$ ^jg/jg<pr>$"]
+
+    def compileTest(self, tmpd):
+        return (super().compileTest(tmpd) and
+                self.compileDix("lr", "data/compose-runtime.dix", binName=tmpd+'/composed.bin'))
+
+    def openProc(self, tmpd):
+        return self.openPipe('lt-proc', self.procflags + ["-f", tmpd+"/composed.bin",
+                                                          tmpd+'/compiled.bin'])
+
+class LongRewind(ProcTest):
+    # the match ends after "a" but the regex keeps going through
+    # more punctuation than the buffer used to hold before giving up
+    procdix = "data/long-rewind.dix"
+    procflags = ["-z"]
+    inputs = ["a" + ".,"*1500 + "x"]
+    expectedOutputs = ["^a/a<n>$" + ".,"*1500 + "^x/*x$"]
+
 # These fail on some systems:
 #from null_flush_invalid_stream_format import *
+
+
+class SAO(ProcTest):
+    procflags = ["-s"]
+    flushing = False
+    # the last word, words after unknown ones and a blank for each space
+    inputs = ["ab",
+              "xyz!! ab",
+              "<![CDATA[x]]><![CDATA[y]]> ab ab",
+              "ab<![CDATA[x]]> <![CDATA[y]]> ab"]
+    expectedOutputs = ["ab&n;&ind;",
+                       "<d>xyz</d>!! ab&n;&ind;",
+                       "<![CDATA[x]]><![CDATA[y]]> ab&n;&ind; ab&n;&ind;",
+                       "ab&n;&ind;<![CDATA[x]]> <![CDATA[y]]> ab&n;&ind;"]
+
+class SAOPreblank(ProcTest):
+    procdix = "data/preblank-mono.dix"
+    procflags = ["-s"]
+    flushing = False
+    inputs = ["ab 'ab", "ab 'xy ab"]
+    expectedOutputs = ["ab&n;  '&apos;ab&n;", "ab&n;  '&apos;<d>xy</d> ab&n;"]
+
+
+class MemReport(unittest.TestCase, BasicTest):
+    def analyse(self, tmpd, report):
+        self.compileDix('lr', 'data/minimal-mono.dix', binName=tmpd+'/compiled.bin')
+        proc = self.openPipe('lt-proc', ['-R', report, tmpd+'/compiled.bin'])
+        out, err = proc.communicate(b'ab abc')
+        self.assertEqual(proc.returncode, 0)
+        self.assertEqual(out, b'^ab/ab<n><ind>$ ^abc/ab<n><def>$')
+        return err
+
+    def runTest(self):
+        with TempDir() as tmpd:
+            self.analyse(tmpd, tmpd+'/report.json')
+            with open(tmpd+'/report.json') as f:
+                report = json.load(f)
+            self.assertEqual([s['name'] for s in report['sections']],
+                             ['j@standard', 'main@standard'])
+            self.assertGreater(report['sections'][0]['nodes'], 0)
+            self.assertGreater(report['dictionary_bytes'], 0)
+            self.assertGreater(report['session_bytes'], 0)
+            # - is text on stderr, and stdout stays the analyses
+            err = self.analyse(tmpd, '-')
+            self.assertIn(b'dictionary:', err)
+            self.assertIn(b'main@standard: 7 nodes', err)
+            self.assertIn(b'session:', err)
+
+
+class MemReportUnwritable(ProcTest):
+    procflags = ["-R", "/nonexistent/report.json"]
+    inputs = ["ab"]
+    expectedOutputs = [""]
+    expectedRetCodeFail = True
+    flushing = False
+
+
+@unittest.skipUnless(hasattr(socket, 'AF_UNIX'), 'no Unix sockets')
+class Serve(unittest.TestCase, BasicTest):
+    procdix = "data/minimal-mono.dix"
+
+    def connect(self, path):
+        # the server takes a moment to start listening
+        for _ in range(100):
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            try:
+                sock.connect(path)
+                sock.settimeout(5)
+                return sock
+            except (FileNotFoundError, ConnectionRefusedError):
+                sock.close()
+                time.sleep(0.05)
+        self.fail("server did not listen on " + path)
+
+    def request(self, path, text):
+        with self.connect(path) as sock:
+            sock.sendall(text.encode('utf-8') + b'\0')
+            reply = b''
+            while not reply.endswith(b'\0'):
+                chunk = sock.recv(4096)
+                if not chunk:
+                    break
+                reply += chunk
+            return reply.rstrip(b'\0').decode('utf-8')
+
+    def serve(self, tmpd):
+        self.compileDix('lr', self.procdix, binName=tmpd+'/compiled.bin')
+        return self.openPipe('lt-proc', ['-S', tmpd+'/socket',
+                                         tmpd+'/compiled.bin'])
+
+    def runTest(self):
+        with TempDir() as tmpd:
+            server = self.serve(tmpd)
+            try:
+                self.assertEqual(self.request(tmpd+'/socket', 'ab y'),
+                                 '^ab/ab<n><ind>$ ^y/y<n><ind>$')
+                # each connection is a session of its own
+                self.assertEqual(self.request(tmpd+'/socket', 'jg'),
+                                 '^jg/j<pr>+g<n>$')
+            finally:
+                server.kill()
+                self.closePipe(server, expectFail=True)
+
+
+class ServeOnlyReplacesSockets(Serve):
+    def runTest(self):
+        with TempDir() as tmpd:
+            with open(tmpd+'/socket', 'w') as f:
+                f.write('not a socket')
+            server = self.serve(tmpd)
+            try:
+                server.wait(timeout=10)
+            finally:
+                server.kill()
+                self.closePipe(server, expectFail=True)
+            with open(tmpd+'/socket') as f:
+                self.assertEqual(f.read(), 'not a socket')
+
+
+class ServeReload(Serve):
+    def answerChanges(self, path, text, old):
+        # the dictionary is read again on a thread of its own
+        for _ in range(100):
+            reply = self.request(path, text)
+            if reply != old:
+                return reply
+            time.sleep(0.05)
+        return old
+
+    def runTest(self):
+        with TempDir() as tmpd:
+            server = self.serve(tmpd)
+            try:
+                path = tmpd+'/socket'
+                self.assertEqual(self.request(path, 'nanow'), '^nanow/*nanow$')
+                self.compileDix('lr', 'data/entry-weights.dix',
+                                binName=tmpd+'/other.bin')
+                os.replace(tmpd+'/other.bin', tmpd+'/compiled.bin')
+                server.send_signal(signal.SIGHUP)
+                self.assertEqual(self.answerChanges(path, 'nanow', '^nanow/*nanow$'),
+                                 '^nanow/nan<n><ma><du><gen>/nan<n><ma><du><acc>'
+                                 '/nan<n><ma><pl><gen>/nan<n><ma><pl><acc>$')
+                # a dictionary that cannot be read keeps the one before
+                with open(tmpd+'/compiled.bin', 'wb') as f:
+                    f.write(b'not a dictionary')
+                server.send_signal(signal.SIGHUP)
+                time.sleep(0.5)
+                self.assertIsNone(server.poll())
+                self.assertEqual(self.request(path, 'nanow ab'),
+                                 '^nanow/nan<n><ma><du><gen>/nan<n><ma><du><acc>'
+                                 '/nan<n><ma><pl><gen>/nan<n><ma><pl><acc>$ ^ab/*ab$')
+            finally:
+                server.kill()
+                err = server.communicate()[1]
+                self.closePipe(server, expectFail=True)
+            self.assertIn(b'keeping the current dictionary', err)
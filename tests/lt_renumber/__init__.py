@@ -0,0 +1,35 @@
+# -*- coding: utf-8 -*-
+
+from basictest import ProcTest
+import unittest
+
+
+class RenumberProcTest(unittest.TestCase, ProcTest):
+    procdix = "data/minimal-mono.dix"
+    inputs = ["abc", "ab", "y", "n", "jg", "jh", "kg"]
+    expectedOutputs = ["^abc/ab<n><def>$", "^ab/ab<n><ind>$", "^y/y<n><ind>$", "^n/n<n><ind>$", "^jg/j<pr>+g<n>$", "^jh/j<pr>+h<n>$", "^kg/k<pr>+g<n>$"]
+    profileflags = []
+    renumberflags = []
+
+    def compileTest(self, tmpd):
+        self.compileDix(self.procdir, self.procdix, binName=tmpd+'/plain.bin')
+        proc = self.openPipe('lt-proc', ['-z', '-F', tmpd+'/profile.txt']
+                                  + self.profileflags
+                                  + [tmpd+'/plain.bin'])
+        for inp in self.inputs:
+            self.communicateFlush(inp+"[][\n]", proc)
+        self.closePipe(proc)
+        self.callProc('lt-renumber', ['-p', tmpd+'/profile.txt',
+                                      tmpd+'/plain.bin',
+                                      tmpd+'/compiled.bin'],
+                      self.renumberflags)
+        return True
+
+
+class RenumberMmap(RenumberProcTest):
+    renumberflags = ["-M"]
+
+
+
+class RenumberSampled(RenumberProcTest):
+    profileflags = ["-G", "3"]
@@ -1,5 +1,6 @@
 # -*- coding: utf-8 -*-
-from basictest import ProcTest as _ProcTest
+from basictest import ProcTest as _ProcTest, TempDir
+import filecmp
 import unittest
 
 class TmxProcTest(unittest.TestCase, _ProcTest):
@@ -28,6 +29,10 @@ class Simple(TmxProcTest):
     expectedOutputs = ['[Ikkje så merkeleg].\nJa, ja.']
 
 
+class SimpleJobs(Simple):
+    compflags = ['-j']
+
+
 class SimpleSpaceSep(TmxProcTest):
     procflags = ['-s']
     inputs = ['Ikke så merkelig at det skjer.',]
@@ -58,6 +63,35 @@ class Numbers(TmxProcTest):
         '1 og [3 på halv] fire',
     ]
 
+class NumbersJobs(Numbers):
+    compflags = ['-j']
+
+
+class ManyUnitsJobs(TmxProcTest):
+    """Enough units for several rounds on every core, which must give the
+    same transducer as a compilation without -j."""
+
+    def writeTmx(self, path):
+        with open(path, 'w') as tmx:
+            tmx.write('<?xml version="1.0" encoding="UTF-8"?>\n'
+                      '<tmx version="1.4"><header srclang="nb-NO"/><body>\n')
+            for i in range(5000):
+                tmx.write('<tu><tuv xml:lang="nob"><seg>ord %d og kake %d</seg></tuv>'
+                          '<tuv xml:lang="nno"><seg>ord %d og kake %d</seg></tuv></tu>\n'
+                          % (i * 7, i % 10, i * 7 + 1, i % 10))
+            tmx.write('</body></tmx>\n')
+
+    def runTest(self):
+        with TempDir() as tmpd:
+            self.writeTmx(tmpd+'/many.tmx')
+            self.compileDix(self.procdir, tmpd+'/many.tmx',
+                            binName=tmpd+'/serial.bin')
+            self.compileDix(self.procdir, tmpd+'/many.tmx', flags=['-j'],
+                            binName=tmpd+'/jobs.bin')
+            self.assertTrue(filecmp.cmp(tmpd+'/serial.bin', tmpd+'/jobs.bin',
+                                        shallow=False))
+
+
 @unittest.expectedFailure
 class NumbersTwice(TmxProcTest):
     procdix = 'data/numbers.tmx'
@@ -75,3 +109,17 @@ class NumbersTwice(TmxProcTest):
         '1 [3 på halv] fire',
     ]
 
+
+class NumbersPrefix(TmxProcTest):
+    procdix = 'data/numbers-prefix.tmx'
+    procflags = ['-s']
+    inputs = [
+        'kake 2 og 3',
+        'kake 2 og te',
+        'kaffe 4 og 5 kjeks',
+    ]
+    expectedOutputs = [
+        '[kake 2] og 3',
+        '[kake 2 og te]',
+        '[kaffi 4 og 5 kjeks]',
+    ]
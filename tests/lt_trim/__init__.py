@@ -16,11 +16,12 @@ class TrimProcTest(unittest.TestCase, ProcTest):
     bidix = "data/minimal-bi.dix"
     bidir = "lr"
     procflags = ["-z"]
+    trimflags = []
 
     def compileTest(self, tmpd):
         self.compileDix(self.monodir, self.monodix, binName=tmpd+'/mono.bin')
         self.compileDix(self.bidir, self.bidix, binName=tmpd+'/bi.bin')
-        self.callProc('lt-trim', [tmpd+"/mono.bin",
+        self.callProc('lt-trim', self.trimflags+[tmpd+"/mono.bin",
                                   tmpd+"/bi.bin",
                                   tmpd+"/compiled.bin"])
         # The above already asserts retcode, so if we got this far we know it
@@ -32,6 +33,12 @@ class TrimNormalAndJoin(TrimProcTest):
     inputs = ["abc", "ab", "y", "n", "jg", "jh", "kg"]
     expectedOutputs = ["^abc/ab<n><def>$", "^ab/ab<n><ind>$", "^y/y<n><ind>$", "^n/*n$", "^jg/j<pr>+g<n>$", "^jh/*jh$", "^kg/*kg$"]
 
+class TrimJobs(TrimNormalAndJoin):
+    trimflags = ["-j"]
+
+class TrimDirectory(TrimNormalAndJoin):
+    trimflags = ["-D"]
+
 class TrimCmp(TrimProcTest):
     inputs = ["a", "b", "c", "d", "aa", "ab", "ac", "ad", "ba", "bb", "bc", "bd", "ca", "cb", "cc", "cd", "da", "db", "dc", "dd", ]
     expectedOutputs = ["^a/*a$", "^b/b<n>$", "^c/*c$", "^d/d<n>$", "^aa/*aa$", "^ab/a<n>+b<n>$", "^ac/*ac$", "^ad/a<n>+d<n>$", "^ba/*ba$", "^bb/*bb$", "^bc/*bc$", "^bd/*bd$", "^ca/*ca$", "^cb/d<n>+b<n>$", "^cc/*cc$", "^cd/d<n>+d<n>$", "^da/*da$", "^db/*db$", "^dc/*dc$", "^dd/*dd$"]
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Analyses tokens of dictionaries in tests/data, whose directory is the
+// argument, with FSTProcessor::analyseBatch and checks the analyses and
+// weights against those lt-proc -W gives.  Exits with 1 and says which
+// token if they differ.
+
+#include <lttoolbox/compiler.h>
+#include <lttoolbox/fst_processor.h>
+#include <lttoolbox/lt_locale.h>
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void load(FSTProcessor &fstp, std::string const &dix)
+{
+  Compiler c;
+  c.parse(dix, Compiler::COMPILER_RESTRICTION_LR_VAL);
+  FILE *bin = tmpfile();
+  c.write(bin);
+  rewind(bin);
+  fstp.load(bin);
+  fclose(bin);
+  fstp.initAnalysis();
+}
+
+static void check(FSTProcessor &fstp, std::vector<UString> const &tokens,
+                  std::vector<std::vector<UString>> const &expected,
+                  std::vector<std::vector<double>> const &expected_weights)
+{
+  std::vector<UStringView> views(tokens.begin(), tokens.end());
+  std::vector<std::vector<UString>> analyses(tokens.size());
+  std::vector<std::vector<double>> weights(tokens.size());
+  fstp.analyseBatch(views.data(), views.size(), analyses.data(), weights.data());
+  for(size_t i = 0; i < tokens.size(); i++)
+  {
+    bool ok = (analyses[i] == expected[i] &&
+               weights[i].size() == expected_weights[i].size());
+    for(size_t j = 0; ok && j < weights[i].size(); j++)
+    {
+      ok = (weights[i][j] > expected_weights[i][j] - 1e-6 &&
+            weights[i][j] < expected_weights[i][j] + 1e-6);
+    }
+    if(!ok)
+    {
+      std::cerr << "FAILED: " << tokens[i] << " gave";
+      for(auto &it : analyses[i])
+      {
+        std::cerr << ' ' << it;
+      }
+      std::cerr << std::endl;
+      failures++;
+    }
+  }
+
+  // without weights, and reusing the vectors of the last call
+  fstp.analyseBatch(views.data(), views.size(), analyses.data());
+  for(size_t i = 0; i < tokens.size(); i++)
+  {
+    if(analyses[i] != expected[i])
+    {
+      std::cerr << "FAILED: " << tokens[i] << " without weights" << std::endl;
+      failures++;
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  LtLocale::tryToSetLocale();
+  if(argc != 2)
+  {
+    std::cerr << "USAGE: " << argv[0] << " tests/data" << std::endl;
+    return 2;
+  }
+  std::string const data = argv[1];
+
+  FSTProcessor minimal;
+  load(minimal, data + "/minimal-mono.dix");
+  // the case of the token as analysis() gives it, unknown tokens and
+  // those only a prefix of which is known with no analyses
+  check(minimal,
+        {u"ab", u"Ab", u"ABC", u"abc", u"xyz", u"abcd", u""},
+        {{u"ab<n><ind>"}, {u"Ab<n><ind>"}, {u"AB<n><def>"}, {u"ab<n><def>"},
+         {}, {}, {}},
+        {{0}, {0}, {0}, {0}, {}, {}, {}});
+
+  FSTProcessor weighted;
+  load(weighted, data + "/entry-weights.dix");
+  check(weighted, {u"nanow", u"NANOW"},
+        {{u"nan<n><ma><du><gen>", u"nan<n><ma><du><acc>",
+          u"nan<n><ma><pl><gen>", u"nan<n><ma><pl><acc>"},
+         {u"NAN<n><ma><du><gen>", u"NAN<n><ma><du><acc>",
+          u"NAN<n><ma><pl><gen>", u"NAN<n><ma><pl><acc>"}},
+        {{32.12, 34.12, 39.12, 41.12}, {32.12, 34.12, 39.12, 41.12}});
+
+  return failures == 0 ? 0 : 1;
+}
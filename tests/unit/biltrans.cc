@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Looks lexical units up in minimal-bi.dix, from the directory of
+// tests/data given as the argument, with the biltrans functions writing
+// into a buffer and checks that they give what the ones returning a
+// string do, with and without the cache of lookups.  Exits with 1 and
+// says which unit if not.
+
+#include <lttoolbox/compiler.h>
+#include <lttoolbox/fst_processor.h>
+#include <lttoolbox/lt_locale.h>
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, char const *what, UStringView input)
+{
+  if(!ok)
+  {
+    std::cerr << "FAILED: " << what << " of " << input << std::endl;
+    failures++;
+  }
+}
+
+static void compare(FSTProcessor &fstp, UString const &input, bool with_delim)
+{
+  // the buffer keeps what the call before wrote, which must not show
+  UString out = u"left over";
+  fstp.biltrans(input, out, with_delim);
+  check(out == fstp.biltrans(input, with_delim), "biltrans", input);
+  fstp.biltransfull(input, out, with_delim);
+  check(out == fstp.biltransfull(input, with_delim), "biltransfull", input);
+  int const queue = fstp.biltransWithQueue(input, out, with_delim);
+  auto const with_queue = fstp.biltransWithQueue(input, with_delim);
+  check(out == with_queue.first && queue == with_queue.second,
+        "biltransWithQueue", input);
+  fstp.biltransWithoutQueue(input, out, with_delim);
+  check(out == fstp.biltransWithoutQueue(input, with_delim),
+        "biltransWithoutQueue", input);
+}
+
+int main(int argc, char *argv[])
+{
+  LtLocale::tryToSetLocale();
+  if(argc != 2)
+  {
+    std::cerr << "USAGE: " << argv[0] << " tests/data" << std::endl;
+    return 2;
+  }
+
+  Compiler c;
+  c.parse(std::string(argv[1]) + "/minimal-bi.dix", Compiler::COMPILER_RESTRICTION_LR_VAL);
+  FILE *bin = tmpfile();
+  c.write(bin);
+  rewind(bin);
+  FSTProcessor fstp;
+  fstp.load(bin);
+  fclose(bin);
+  fstp.initBiltrans();
+
+  std::vector<UString> const units = {
+    u"ab<n><def>", u"ab<n>", u"Ab<n><def>", u"AB<n><def>", u"y<n><pl><x>",
+    u"xyz<n>", u"ab", u"j<pr>+g<n><sg>", u"j<pr>+xyz<n>", u"*ab<n><def>",
+    u"\\*ab<n><def>", u"ab<n><def>#c", u""};
+  for(int cached = 0; cached < 2; cached++)
+  {
+    if(cached)
+    {
+      fstp.setBiltransCacheSize(100, 0);
+    }
+    // twice, the second time from the cache if there is one
+    for(int pass = 0; pass < 2; pass++)
+    {
+      for(auto const &unit : units)
+      {
+        compare(fstp, unit, false);
+        compare(fstp, u"^" + unit + u"$", true);
+      }
+    }
+  }
+
+  UString out;
+  fstp.biltrans(u"^xyz<n>$", out);
+  check(out == u"^@xyz<n>$", "unknown", u"^xyz<n>$");
+  fstp.biltransWithoutQueue(u"xyz<n>", out, false);
+  check(out == u"@xyz<n>", "unknown", u"xyz<n>");
+  check(fstp.biltransWithQueue(u"^ab<n><def>$", out) == 4 &&
+        out.compare(0, 7, u"^xy<n><") == 0, "queue", u"^ab<n><def>$");
+
+  return failures == 0 ? 0 : 1;
+}
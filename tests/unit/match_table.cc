@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Steps a MatchTable and a MatchState through the same symbols of a
+// PatternList, among them symbols the patterns never use, and checks that
+// they agree at every step.  Exits with 1 and says where if they don't.
+
+#include <lttoolbox/match_exe.h>
+#include <lttoolbox/match_state.h>
+#include <lttoolbox/match_table.h>
+#include <lttoolbox/pattern_list.h>
+
+#include <iostream>
+#include <memory>
+#include <random>
+#include <set>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, char const *what, int step)
+{
+  if(!ok)
+  {
+    std::cerr << "FAILED: " << what << " at step " << step << std::endl;
+    failures++;
+  }
+}
+
+int main()
+{
+  PatternList pl;
+  pl.insert(1, u"ab", u"n.sg");
+  pl.insert(2, u"ab", u"n.*");
+  pl.insert(3, u"", u"vblex.*");
+  pl.insert(4, u"a*", u"adj");
+  pl.insert(5, u"cab", u"");
+  pl.beginSequence();
+  pl.insert(6, u"ab", u"n.*");
+  pl.insert(6, u"", u"adj");
+  pl.endSequence();
+  pl.buildTransducer();
+
+  Alphabet &alphabet = pl.getAlphabet();
+  int const any_char = alphabet(PatternList::ANY_CHAR);
+  int const any_tag = alphabet(PatternList::ANY_TAG);
+  std::vector<int> const tags = {alphabet(u"<n>"), alphabet(u"<sg>"),
+                                 alphabet(u"<vblex>"), alphabet(u"<adj>")};
+
+  std::unique_ptr<MatchExe> me(pl.newMatchExe());
+  std::unique_ptr<MatchTable> mt(pl.newMatchTable());
+
+  // what is not in the table leads to the dead state, which stays dead
+  int const initial = mt->getInitial();
+  check(mt->step(initial, 'z') == MatchTable::dead, "missing character", 0);
+  check(mt->step(initial, 0x10000) == MatchTable::dead, "character past the table", 0);
+  check(mt->step(initial, -10000) == MatchTable::dead, "missing tag", 0);
+  check(mt->step(initial, 'z', -10000) == MatchTable::dead, "missing alternatives", 0);
+  check(mt->step(MatchTable::dead, 'a', any_char) == MatchTable::dead, "step from dead", 0);
+  check(mt->size(MatchTable::dead) == 0, "size of dead", 0);
+  check(mt->classifyFinals(MatchTable::dead) == -1, "class of dead", 0);
+  check(mt->step(initial, 'z', 'a') == mt->step(initial, 'a'), "missing input, known alt", 0);
+
+  // lexical units, of a lemma, tags and the end of the unit, some of
+  // them joined as a sequence, so that the patterns match now and then
+  // z and U+10000 are in no pattern, U+10000 past every character in one
+  std::vector<std::vector<int>> const lemmas = {{'a', 'b'}, {'c', 'a', 'b'},
+                                                {'a'}, {'a', 'z'}, {'z'},
+                                                {0x10000}, {}};
+  std::set<int> const banned = {1, 6};
+  std::mt19937 random(1);
+  std::set<int> matched;
+  for(int unit = 0, step = 0; unit < 20000 && failures <= 10; unit++)
+  {
+    std::vector<std::pair<int, bool>> input;
+    for(int joined = 0; joined == 0 || random() % 3 == 0; joined++)
+    {
+      if(joined > 0)
+      {
+        input.push_back({'+', false});
+      }
+      for(int c : lemmas[random() % lemmas.size()])
+      {
+        input.push_back({c, false});
+      }
+      for(int i = random() % 4; i > 0; i--)
+      {
+        input.push_back({tags[random() % tags.size()], true});
+      }
+      if(random() % 8 == 0)
+      {
+        // a tag not in the alphabet
+        input.push_back({-10000, true});
+      }
+      input.push_back({alphabet(PatternList::QUEUE), true});
+    }
+
+    int state = initial;
+    MatchState ms;
+    ms.init(me->getInitial());
+    for(auto const &it : input)
+    {
+      step++;
+      if(random() % 4 == 0)
+      {
+        state = mt->step(state, it.first);
+        ms.step(it.first);
+      }
+      else
+      {
+        int const alt = (it.second ? any_tag : any_char);
+        state = mt->step(state, it.first, alt);
+        ms.step(it.first, alt);
+      }
+      check(mt->size(state) == ms.size(), "size", step);
+      check(mt->classifyFinals(state) == ms.classifyFinals(me->getFinals()),
+            "final class", step);
+      check(mt->classifyFinals(state, banned) == ms.classifyFinals(me->getFinals(), banned),
+            "final class with banned rules", step);
+      matched.insert(mt->classifyFinals(state));
+    }
+  }
+  // a test that never reaches the final classes shows nothing
+  check(matched.size() == 7, "every pattern matched", 0);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2026 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Checks the Simd functions of the instruction set named as the argument,
+// which LT_SIMD must choose, against plain loops, from every offset of an
+// aligned buffer and for lengths up to several vectors, so that the
+// unaligned heads and partial tails are covered.  Exits with 77 if the
+// machine does not have that instruction set, and with 1 and says where
+// if the results differ.
+
+#include <lttoolbox/simd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, char const *what, size_t offset, size_t n)
+{
+  if(!ok && failures++ < 10)
+  {
+    std::cerr << "FAILED: " << what << " from offset " << offset
+              << " of length " << n << std::endl;
+  }
+}
+
+static size_t findByte(char const *data, size_t n, char const *stops, size_t count)
+{
+  for(size_t i = 0; i < n; i++)
+  {
+    if(memchr(stops, data[i], count) != nullptr)
+    {
+      return i;
+    }
+  }
+  return n;
+}
+
+static size_t findUnit(UChar const *s, size_t n, UChar const *units, size_t count)
+{
+  for(size_t i = 0; i < n; i++)
+  {
+    for(size_t j = 0; j < count; j++)
+    {
+      if(s[i] == units[j])
+      {
+        return i;
+      }
+    }
+  }
+  return n;
+}
+
+// longer than two vectors of the widest instruction set, and the offsets
+// from an alignment to the widest vector
+static size_t const max_length = 200;
+static size_t const max_offset = 64;
+
+int main(int argc, char *argv[])
+{
+  if(argc != 2)
+  {
+    std::cerr << "USAGE: " << argv[0] << " avx512bw|avx2|sse2|neon|scalar" << std::endl;
+    return 2;
+  }
+  if(strcmp(Simd::level(), argv[1]) != 0)
+  {
+    std::cerr << argv[1] << " is not available, " << Simd::level()
+              << " was chosen" << std::endl;
+    return 77;
+  }
+
+  std::mt19937 random(1);
+  alignas(64) char bytes[max_offset + max_length + max_offset];
+  alignas(64) UChar units[max_offset + max_length + max_offset];
+  // the bytes and units past 0x7f and 0x7fff catch signed comparisons
+  char const byte_values[] = {'a', 'b', ' ', '^', '$', '\0', '\x7f',
+                              '\x80', '\xc3', '\xff'};
+  UChar const unit_values[] = {u'a', u'b', u' ', u'^', 0, 0x7f, 0x80, 0xff,
+                               0x100, 0x7fff, 0x8000, 0xd800, 0xffff};
+
+  for(size_t offset = 0; offset <= max_offset; offset++)
+  {
+    for(size_t n = 0; n <= max_length; n++)
+    {
+      char *data = bytes + offset;
+      UChar *s = units + offset;
+
+      // mostly what is not looked for, so that the first hit is
+      // anywhere in the buffer or not in it at all
+      char stops[Simd::max_stops];
+      size_t const stop_count = 1 + random() % Simd::max_stops;
+      for(size_t j = 0; j < stop_count; j++)
+      {
+        stops[j] = byte_values[random() % sizeof(byte_values)];
+      }
+      size_t const byte_density = 1 + random() % (2 * max_length);
+      for(size_t i = 0; i < n; i++)
+      {
+        data[i] = (random() % byte_density == 0
+                   ? stops[random() % stop_count] : 'x');
+      }
+      // what is looked for past the end must not be found, nor give n
+      // by being right at the end
+      data[n] = 'x';
+      memset(data + n + 1, stops[0], max_offset - 1);
+      check(Simd::findByte(data, n, stops, stop_count) ==
+            findByte(data, n, stops, stop_count), "findByte", offset, n);
+
+      // ASCII up to one byte that is not, if any
+      size_t const ascii = random() % (n + 1);
+      for(size_t i = 0; i < n; i++)
+      {
+        data[i] = (i == ascii ? byte_values[7 + random() % 3]
+                   : static_cast<char>(random() % 0x80));
+      }
+      std::vector<UChar> out(n + 1, 0xfffe);
+      size_t const widened = Simd::widenAscii(data, n, out.data());
+      check(widened == ascii, "widenAscii length", offset, n);
+      for(size_t i = 0; i < widened && i < n; i++)
+      {
+        check(out[i] == static_cast<UChar>(data[i]), "widenAscii unit", offset, n);
+      }
+      check(out[n] == 0xfffe, "widenAscii past the end", offset, n);
+
+      UChar wanted[Simd::max_units];
+      size_t const unit_count = 1 + random() % Simd::max_units;
+      for(size_t j = 0; j < unit_count; j++)
+      {
+        wanted[j] = unit_values[random() % (sizeof(unit_values) / sizeof(UChar))];
+      }
+      size_t const unit_density = 1 + random() % (2 * max_length);
+      for(size_t i = 0; i < n; i++)
+      {
+        s[i] = (random() % unit_density == 0
+                ? wanted[random() % unit_count] : u'x');
+      }
+      s[n] = u'x';
+      std::fill(s + n + 1, s + n + max_offset, wanted[0]);
+      check(Simd::findUnit(s, n, wanted, unit_count) ==
+            findUnit(s, n, wanted, unit_count), "findUnit", offset, n);
+    }
+  }
+
+  return failures == 0 ? 0 : 1;
+}